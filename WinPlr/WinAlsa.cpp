@@ -0,0 +1,440 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio ALSA sink
+**********************************************************
+* WinAlsa.cpp
+* ALSA output for Linux builds (link with -lasound)
+*********************************************************/
+#include "WinEngine.h"
+
+#ifdef __linux__
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*************************************************
+* GetAlsaFormat():
+* Convert WAVEFORMATEX to ALSA sample format
+*************************************************/
+static snd_pcm_format_t
+GetAlsaFormat(
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	if (lpFormat->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+	{
+		switch (lpFormat->wBitsPerSample)
+		{
+		case 32:	return SND_PCM_FORMAT_FLOAT_LE;
+		case 64:	return SND_PCM_FORMAT_FLOAT64_LE;
+		default:	return SND_PCM_FORMAT_UNKNOWN;
+		}
+	}
+
+	switch (lpFormat->wBitsPerSample)
+	{
+	case 8:		return SND_PCM_FORMAT_U8;
+	case 16:	return SND_PCM_FORMAT_S16_LE;
+	case 24:	return SND_PCM_FORMAT_S24_3LE;
+	case 32:	return SND_PCM_FORMAT_S32_LE;
+	default:	return SND_PCM_FORMAT_UNKNOWN;
+	}
+}
+
+/*************************************************
+* AlsaSink():
+* Constructor. Device name is ALSA PCM name,
+* like "default", "hw:0,0" or "null"
+*************************************************/
+Player::AlsaSink::AlsaSink(
+	_In_ LPCSTR lpDeviceName
+) : lpPcm(NULL), lpPollFds(NULL), dwPollCount(0), lpSource(NULL), dwPeriodFrames(0), dwBufferFrames(0),
+	bCanPause(FALSE), bPaused(FALSE), bEndOfData(FALSE), dwPeriodsWritten(0),
+	bStopRequested(FALSE), bFinished(FALSE), dwXruns(0), uFramesWritten(0), llDelayFrames(0)
+{
+	iWakePipe[0] = iWakePipe[1] = -1;
+	memset(&waveFormat, 0, sizeof(WAVEFORMATEX));
+	snprintf(szDevice, sizeof(szDevice), "%s", (lpDeviceName && *lpDeviceName) ? lpDeviceName : "default");
+}
+
+/*************************************************
+* ~AlsaSink():
+* Destructor
+*************************************************/
+Player::AlsaSink::~AlsaSink()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Open PCM in mmap mode with period-sized
+* transfers and ring of ALSA_PERIOD_COUNT periods.
+* Sink which is open is closed first
+*************************************************/
+BOOL
+Player::AlsaSink::Open(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpNewSource
+)
+{
+	Close();
+
+	snd_pcm_format_t pcmFormat = GetAlsaFormat(lpFormat);
+	if (!lpFormat->nBlockAlign || !lpFormat->nSamplesPerSec || !lpNewSource || pcmFormat == SND_PCM_FORMAT_UNKNOWN)
+	{
+		return FALSE;
+	}
+
+	waveFormat = *lpFormat;
+	int iErr = snd_pcm_open(&lpPcm, szDevice, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+	if (iErr < 0)
+	{
+		DEBUG_MESSAGE("Sink error! Can't open ALSA device");
+		lpPcm = NULL;
+		return FALSE;
+	}
+
+	snd_pcm_hw_params_t* lpHwParams = NULL;
+	snd_pcm_hw_params_alloca(&lpHwParams);
+	snd_pcm_hw_params_any(lpPcm, lpHwParams);
+
+	unsigned int uRate = lpFormat->nSamplesPerSec;
+	snd_pcm_uframes_t uPeriod = max(uRate * SINK_PERIOD_MS / 1000, 1u);
+	snd_pcm_uframes_t uBuffer = uPeriod * ALSA_PERIOD_COUNT;
+
+	if (snd_pcm_hw_params_set_access(lpPcm, lpHwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0 ||
+		snd_pcm_hw_params_set_format(lpPcm, lpHwParams, pcmFormat) < 0 ||
+		snd_pcm_hw_params_set_channels(lpPcm, lpHwParams, lpFormat->nChannels) < 0 ||
+		snd_pcm_hw_params_set_rate_near(lpPcm, lpHwParams, &uRate, NULL) < 0 ||
+		snd_pcm_hw_params_set_period_size_near(lpPcm, lpHwParams, &uPeriod, NULL) < 0 ||
+		snd_pcm_hw_params_set_buffer_size_near(lpPcm, lpHwParams, &uBuffer) < 0 ||
+		snd_pcm_hw_params(lpPcm, lpHwParams) < 0)
+	{
+		DEBUG_MESSAGE("Sink error! ALSA device doesn't support mmap stream with this format");
+		Close();
+		return FALSE;
+	}
+
+	// rate is negotiated before, resampler is upstream
+	if (uRate != lpFormat->nSamplesPerSec)
+	{
+		DEBUG_MESSAGE("Sink error! ALSA device doesn't support sample rate");
+		Close();
+		return FALSE;
+	}
+
+	snd_pcm_hw_params_get_period_size(lpHwParams, &uPeriod, NULL);
+	snd_pcm_hw_params_get_buffer_size(lpHwParams, &uBuffer);
+	bCanPause = snd_pcm_hw_params_can_pause(lpHwParams);
+	dwPeriodFrames = (DWORD)uPeriod;
+	dwBufferFrames = (DWORD)uBuffer;
+
+	// wake up every period, start when ring is full
+	snd_pcm_sw_params_t* lpSwParams = NULL;
+	snd_pcm_sw_params_alloca(&lpSwParams);
+	snd_pcm_sw_params_current(lpPcm, lpSwParams);
+	snd_pcm_sw_params_set_avail_min(lpPcm, lpSwParams, uPeriod);
+	snd_pcm_sw_params_set_start_threshold(lpPcm, lpSwParams, uBuffer - (uBuffer % uPeriod));
+	if (snd_pcm_sw_params(lpPcm, lpSwParams) < 0)
+	{
+		DEBUG_MESSAGE("Sink error! Can't set ALSA software params");
+		Close();
+		return FALSE;
+	}
+
+	// last descriptor is our wake pipe
+	int iCount = snd_pcm_poll_descriptors_count(lpPcm);
+	if (iCount <= 0 || pipe(iWakePipe) < 0)
+	{
+		DEBUG_MESSAGE("Sink error! Can't get ALSA poll descriptors");
+		Close();
+		return FALSE;
+	}
+
+	dwPollCount = (DWORD)iCount;
+	lpPollFds = new struct pollfd[dwPollCount + 1];
+	snd_pcm_poll_descriptors(lpPcm, lpPollFds, dwPollCount);
+	lpPollFds[dwPollCount].fd = iWakePipe[0];
+	lpPollFds[dwPollCount].events = POLLIN;
+	lpPollFds[dwPollCount].revents = 0;
+
+	lpSource = lpNewSource;
+	bEndOfData = FALSE;
+	bPaused = FALSE;
+	bFinished = FALSE;
+	dwXruns = 0;
+	dwPeriodsWritten = 0;
+	uFramesWritten = 0;
+	llDelayFrames = 0;
+	deadlineMonitor.Reset();
+
+	CHAR szLatency[64] = {};
+	snprintf(szLatency, sizeof(szLatency), "ALSA stream latency: %u ms", GetLatency());
+	DEBUG_MESSAGE(szLatency);
+	return TRUE;
+}
+
+/*************************************************
+* Start():
+* Resume device and begin render thread
+*************************************************/
+BOOL
+Player::AlsaSink::Start()
+{
+	if (!lpPcm || renderThread.joinable())
+	{
+		return FALSE;
+	}
+
+	if (bPaused)
+	{
+		snd_pcm_pause(lpPcm, 0);
+		bPaused = FALSE;
+	}
+
+	bStopRequested = FALSE;
+	renderThread = std::thread(&Player::AlsaSink::RenderLoop, this);
+	return TRUE;
+}
+
+/*************************************************
+* Stop():
+* Stop render thread and pause device.
+* If device can't pause - queued frames is dropped
+*************************************************/
+VOID
+Player::AlsaSink::Stop()
+{
+	bStopRequested = TRUE;
+	if (renderThread.joinable())
+	{
+		BYTE bWake = 0;
+		if (write(iWakePipe[1], &bWake, 1) < 0) { DEBUG_MESSAGE("Sink error! Can't wake ALSA thread"); }
+		renderThread.join();
+
+		// drain wake byte for next start
+		if (read(iWakePipe[0], &bWake, 1) < 0) { DEBUG_MESSAGE("Sink error! Can't read ALSA wake pipe"); }
+	}
+
+	if (lpPcm && !bFinished && snd_pcm_state(lpPcm) == SND_PCM_STATE_RUNNING)
+	{
+		if (bCanPause && snd_pcm_pause(lpPcm, 1) == 0)
+		{
+			bPaused = TRUE;
+		}
+		else
+		{
+			snd_pcm_drop(lpPcm);
+			snd_pcm_prepare(lpPcm);
+			llDelayFrames = 0;
+		}
+	}
+}
+
+/*************************************************
+* Close():
+* Stop and close device
+*************************************************/
+VOID
+Player::AlsaSink::Close()
+{
+	Stop();
+
+	if (lpPcm)
+	{
+		snd_pcm_close(lpPcm);
+		lpPcm = NULL;
+	}
+	for (DWORD i = 0; i < 2; i++)
+	{
+		if (iWakePipe[i] >= 0) { close(iWakePipe[i]); iWakePipe[i] = -1; }
+	}
+
+	delete[] lpPollFds;
+	lpPollFds = NULL;
+	dwPollCount = 0;
+	lpSource = NULL;
+}
+
+/*************************************************
+* RecoverStream():
+* Prepare device after xrun or suspend and
+* continue playing. Returns FALSE on fatal error
+*************************************************/
+BOOL
+Player::AlsaSink::RecoverStream(
+	_In_ long lError
+)
+{
+	if (lError == -EPIPE || lError == -ESTRPIPE)
+	{
+		dwXruns++;
+		deadlineMonitor.telemetry.AddUnderrun();
+	}
+
+	// render thread can't wait for console, UI takes error later
+	int iErr = snd_pcm_recover(lpPcm, (int)lError, 1);
+	if (iErr < 0)
+	{
+		errorRing.Post((DWORD)-iErr, "Sink error! Can't recover ALSA stream");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*************************************************
+* WritePeriod():
+* Pull one period from source directly to
+* mmap area. Returns count of committed frames
+*************************************************/
+DWORD
+Player::AlsaSink::WritePeriod()
+{
+	const snd_pcm_channel_area_t* lpAreas = NULL;
+	snd_pcm_uframes_t uOffset = 0;
+	snd_pcm_uframes_t uFrames = dwPeriodFrames;
+
+	int iErr = snd_pcm_mmap_begin(lpPcm, &lpAreas, &uOffset, &uFrames);
+	if (iErr < 0)
+	{
+		return RecoverStream(iErr) ? 0 : (DWORD)-1;
+	}
+
+	// interleaved area, all channels share one pointer
+	BYTE* lpDest = (BYTE*)lpAreas[0].addr + (lpAreas[0].first + uOffset * lpAreas[0].step) / 8;
+	DWORD dwRead = bEndOfData ? 0 : lpSource->ReadFrames(lpDest, (DWORD)uFrames);
+	if (dwRead < uFrames)
+	{
+		snd_pcm_format_set_silence(GetAlsaFormat(&waveFormat), lpDest + dwRead * waveFormat.nBlockAlign, (unsigned int)((uFrames - dwRead) * waveFormat.nChannels));
+		bEndOfData = TRUE;
+	}
+
+	snd_pcm_sframes_t lCommitted = snd_pcm_mmap_commit(lpPcm, uOffset, uFrames);
+	if (lCommitted < 0 || (snd_pcm_uframes_t)lCommitted != uFrames)
+	{
+		return RecoverStream(lCommitted < 0 ? lCommitted : -EPIPE) ? 0 : (DWORD)-1;
+	}
+
+	uFramesWritten += dwRead;
+	dwPeriodsWritten++;
+	return (DWORD)uFrames;
+}
+
+/*************************************************
+* RenderLoop():
+* Sleep in poll till device has free period,
+* then fill it from source
+*************************************************/
+VOID
+Player::AlsaSink::RenderLoop()
+{
+	SetRealtimeThreadPriority();
+
+	while (!bStopRequested && !bEndOfData)
+	{
+		snd_pcm_sframes_t lAvail = snd_pcm_avail_update(lpPcm);
+		if (lAvail < 0)
+		{
+			if (!RecoverStream(lAvail)) { break; }
+			continue;
+		}
+
+		if ((snd_pcm_uframes_t)lAvail < dwPeriodFrames)
+		{
+			// ring is full - device must be started by threshold
+			if (snd_pcm_state(lpPcm) == SND_PCM_STATE_PREPARED)
+			{
+				snd_pcm_start(lpPcm);
+			}
+
+			if (poll(lpPollFds, dwPollCount + 1, -1) < 0 && errno != EINTR) { break; }
+			if (lpPollFds[dwPollCount].revents & POLLIN) { break; }
+
+			unsigned short uRevents = 0;
+			snd_pcm_poll_descriptors_revents(lpPcm, lpPollFds, dwPollCount, &uRevents);
+			if ((uRevents & POLLERR) && !RecoverStream(-EPIPE)) { break; }
+			continue;
+		}
+
+		// device starves when all queued frames are played
+		UINT64 uStartNs = deadlineMonitor.BeginCallback();
+		UINT64 uQueued = dwBufferFrames - min((DWORD)lAvail, dwBufferFrames);
+		deadlineMonitor.telemetry.AddQueued((DWORD)(uQueued / dwPeriodFrames));
+		DWORD dwWritten = WritePeriod();
+		deadlineMonitor.EndCallback(uStartNs, uQueued * 1000000000 / waveFormat.nSamplesPerSec);
+
+		if (dwWritten == (DWORD)-1) { break; }
+
+		snd_pcm_sframes_t lDelay = 0;
+		if (snd_pcm_delay(lpPcm, &lDelay) == 0)
+		{
+			llDelayFrames = lDelay;
+		}
+	}
+
+	// play all queued frames before finish
+	if (bEndOfData && !bStopRequested)
+	{
+		snd_pcm_nonblock(lpPcm, 0);
+		snd_pcm_drain(lpPcm);
+		snd_pcm_nonblock(lpPcm, 1);
+		llDelayFrames = 0;
+		bFinished = TRUE;
+	}
+
+#ifdef DEBUG
+	CHAR szStats[128] = {};
+	snprintf(szStats, sizeof(szStats), "ALSA stream: %u periods written, %u xruns", dwPeriodsWritten, (DWORD)dwXruns);
+	DEBUG_MESSAGE(szStats);
+#endif
+}
+
+/*************************************************
+* GetPosition():
+* Written frames minus frames queued in device
+*************************************************/
+UINT64
+Player::AlsaSink::GetPosition()
+{
+	UINT64 uWritten = uFramesWritten;
+	UINT64 uDelay = (UINT64)max(llDelayFrames.load(), (LONG64)0);
+	return (uDelay < uWritten) ? uWritten - uDelay : 0;
+}
+
+DWORD Player::AlsaSink::GetLatency() { return waveFormat.nSamplesPerSec ? (DWORD)((UINT64)dwBufferFrames * 1000 / waveFormat.nSamplesPerSec) : 0; }
+DWORD Player::AlsaSink::GetUnderruns() { return dwXruns; }
+BOOL Player::AlsaSink::IsFinished() { return bFinished; }
+Player::DeadlineMonitor* Player::AlsaSink::GetDeadlineMonitor() { return &deadlineMonitor; }
+
+/*************************************************
+* IsFormatSupported():
+* Ask device for format, channels and rate.
+* "hw:" devices take only own rates, if device
+* can't be opened now, Open reports error
+*************************************************/
+BOOL
+Player::AlsaSink::IsFormatSupported(
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	snd_pcm_format_t pcmFormat = GetAlsaFormat(lpFormat);
+	if (pcmFormat == SND_PCM_FORMAT_UNKNOWN) { return FALSE; }
+
+	snd_pcm_t* lpTestPcm = NULL;
+	if (lpPcm || snd_pcm_open(&lpTestPcm, szDevice, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) < 0) { return TRUE; }
+
+	snd_pcm_hw_params_t* lpHwParams = NULL;
+	snd_pcm_hw_params_alloca(&lpHwParams);
+	BOOL isSupported = snd_pcm_hw_params_any(lpTestPcm, lpHwParams) >= 0 &&
+		snd_pcm_hw_params_test_format(lpTestPcm, lpHwParams, pcmFormat) == 0 &&
+		snd_pcm_hw_params_test_channels(lpTestPcm, lpHwParams, lpFormat->nChannels) == 0 &&
+		snd_pcm_hw_params_test_rate(lpTestPcm, lpHwParams, lpFormat->nSamplesPerSec, 0) == 0;
+	snd_pcm_close(lpTestPcm);
+	return isSupported;
+}
+#endif
@@ -11,63 +11,171 @@
 #include "WinAudio.h"
 
 HANDLE hAudioFile;
-#define NOTIFIATINS_POSES 2
+MME_STREAM_CONFIG mmeStreamConfig = { MME_BUFFER_SIZE, MME_BUFFER_COUNT };
+
+/*************************************************
+* FillWaveOutBuffer():
+* Copy next part of PCM data to waveOut 
+* buffer and write it to device
+*************************************************/
+BOOL
+FillWaveOutBuffer(
+	_In_ MME_FEEDER_P lpFeeder,
+	_In_ WAVEHDR* lpHeader
+)
+{
+	if (lpFeeder->bStopping || lpFeeder->bEndOfData)
+	{
+		return FALSE;
+	}
+
+	DWORD dwFrames = lpFeeder->dwBufferSize / lpFeeder->dwBlockAlign;
+	DWORD dwRead = lpFeeder->lpSource->ReadFrames((BYTE*)lpHeader->lpData, dwFrames);
+	if (dwRead < dwFrames)
+	{
+		lpFeeder->bEndOfData = TRUE;
+	}
+	if (!dwRead)
+	{
+		return FALSE;
+	}
+
+	// last buffer can be smaller than others
+	lpHeader->dwBufferLength = dwRead * lpFeeder->dwBlockAlign;
+
+	MMRESULT uWave = waveOutWrite(lpFeeder->hWaveOut, lpHeader, sizeof(WAVEHDR));
+	if (uWave != MMSYSERR_NOERROR)
+	{
+		// device is gone, play queued buffers and finish stream
+		PostAudioError(uWave, "Stream error! Can't write buffer (MME)");
+		lpFeeder->bEndOfData = TRUE;
+		return FALSE;
+	}
+
+	lpFeeder->dwQueued++;
+	return TRUE;
+}
+
+/*************************************************
+* WaveOutFeederThread():
+* Refill waveOut buffers on WOM_DONE
+*************************************************/
+DWORD
+WINAPI
+WaveOutFeederThread(
+	_In_ LPVOID lpParam
+)
+{
+	MME_FEEDER_P lpFeeder = (MME_FEEDER_P)lpParam;
+	Player::ThreadSystem feederThread;
+	MSG threadMsg = {};
+
+	feederThread.ThSetNewThreadName("WINPLR MME FEEDER");
+
+	// create message queue before waveOutOpen sends WOM_OPEN
+	PeekMessageA(&threadMsg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+	SetEvent(lpFeeder->hReadyEvent);
+
+	while (GetMessageA(&threadMsg, NULL, 0, 0) > FALSE)
+	{
+		if (threadMsg.message != MM_WOM_DONE) { continue; }
+
+		WAVEHDR* lpHeader = (WAVEHDR*)threadMsg.lParam;
+		Player::DeadlineMonitor* lpMonitor = lpFeeder->lpMonitor;
+		UINT64 uStartNs = lpMonitor ? lpMonitor->BeginCallback() : 0;
+		BOOL isRefill = !lpFeeder->bStopping && !lpFeeder->bEndOfData;
+		lpFeeder->dwQueued--;
+
+		// device has played everything before we had time to refill
+		DWORD dwQueued = lpFeeder->dwQueued;
+		if (!dwQueued && isRefill)
+		{
+			lpFeeder->dwUnderruns++;
+			if (lpMonitor) { lpMonitor->telemetry.AddUnderrun(); }
+		}
+
+		FillWaveOutBuffer(lpFeeder, lpHeader);
+
+		// device starves when all queued buffers are played
+		if (lpMonitor && isRefill)
+		{
+			lpMonitor->telemetry.AddQueued(dwQueued);
+			lpMonitor->EndCallback(uStartNs, (UINT64)dwQueued * lpFeeder->dwBufferSize * 1000000000 / max(lpFeeder->dwBytesPerSec, 1UL));
+		}
+	}
+
+	return NULL;
+}
 
 /*************************************************
 * CreateStreamFromBuffer():
-* Create stream from FILE_DATA
-* and PCM_DATA struct
+* Create waveOut stream which pulls
+* frames from source
 *************************************************/
 STREAM_DATA
 Player::Stream::CreateMMIOStream(
-	_In_ FILE_DATA dData,
-	_In_ PCM_DATA dPCM,
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpSource,
 	_In_ HWND hwnd
 )
 {
 	STREAM_DATA streamData;
 	ZeroMemory(&streamData, sizeof(STREAM_DATA));
-	streamData.dPCM = dPCM;
 
 	// create wave callback
 	WAVEFORMATEX waveFormat = {};
 	ZeroMemory(&waveFormat, sizeof(WAVEFORMATEX));
-	waveFormat.cbSize = sizeof(WAVEFORMATEX);
-	waveFormat.nAvgBytesPerSec = dPCM.waveFormat.nAvgBytesPerSec;
-	waveFormat.nBlockAlign = dPCM.waveFormat.nBlockAlign;
-	waveFormat.nChannels = dPCM.waveFormat.nChannels;
-	waveFormat.nSamplesPerSec = dPCM.waveFormat.nSamplesPerSec;
-	waveFormat.wBitsPerSample = dPCM.waveFormat.wBitsPerSample;
-	waveFormat.wFormatTag = dPCM.waveFormat.wFormatTag;
-
-	// check for current format
-	switch (dData.eType)
+	waveFormat.cbSize = NULL;
+	waveFormat.nBlockAlign = lpFormat->nBlockAlign;
+	waveFormat.nChannels = lpFormat->nChannels;
+	waveFormat.nSamplesPerSec = lpFormat->nSamplesPerSec;
+	waveFormat.wBitsPerSample = lpFormat->wBitsPerSample;
+	waveFormat.wFormatTag = lpFormat->wFormatTag;
+	waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+	streamData.waveFormat = waveFormat;
+
+	if (!lpSource || !waveFormat.nBlockAlign)
 	{
-	case WAV_FILE:
-		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
-		break;
-	case ALAC_FILE:
-	case FLAC_FILE:
-	case MPEG3_FILE:
-	case MPEG4_FILE:
-	case OGG_FILE:
-	case OPUS_FILE:
-	case MPEG2_FILE:
-	case AIF_FILE:
-	case UNKNOWN_FILE:
-	default:
-		waveFormat.wFormatTag = WAVE_FORMAT_UNKNOWN;
-		break;
+		return streamData;
 	}
-	
+
+	// create feeder for waveOut buffers
+	MME_FEEDER_P lpFeeder = (MME_FEEDER_P)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(MME_FEEDER));
+	DO_EXIT(lpFeeder, "Stream error! Can't allocate stream feeder (MME)");
+
+	// buffer size must be aligned to sample frame
+	DWORD dwBufferSize = max(mmeStreamConfig.dwBufferSize, (DWORD)waveFormat.nBlockAlign);
+	lpFeeder->dwBufferSize = dwBufferSize - (dwBufferSize % waveFormat.nBlockAlign);
+	lpFeeder->dwBufferCount = max(mmeStreamConfig.dwBufferCount, 2UL);
+	lpFeeder->lpSource = lpSource;
+	lpFeeder->dwBlockAlign = waveFormat.nBlockAlign;
+	lpFeeder->dwBytesPerSec = waveFormat.nAvgBytesPerSec;
+	lpFeeder->hReadyEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+	// preallocate all buffers and headers once
+	lpFeeder->lpBuffers = (BYTE*)HeapAlloc(GetProcessHeap(), NULL, lpFeeder->dwBufferSize * lpFeeder->dwBufferCount);
+	lpFeeder->lpHeaders = (WAVEHDR*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(WAVEHDR) * lpFeeder->dwBufferCount);
+	DO_EXIT(lpFeeder->lpBuffers && lpFeeder->lpHeaders, "Stream error! Can't allocate buffers (MME)");
+
+	// begin our feeder thread
+	lpFeeder->hThread = CreateThread(
+		NULL,
+		NULL,
+		WaveOutFeederThread,
+		(LPVOID)lpFeeder,
+		NULL,
+		&lpFeeder->dwThreadID
+	);
+	DO_EXIT(lpFeeder->hThread, "Stream error! Can't create feeder thread (MME)");
+	WaitForSingleObject(lpFeeder->hReadyEvent, INFINITE);
+
 	// open default wave out
 	MMRESULT uWave = waveOutOpen(
-		NULL,
+		&lpFeeder->hWaveOut,
 		WAVE_MAPPER,
 		&waveFormat,
-		NULL,
-		NULL,
+		lpFeeder->dwThreadID,
+		(DWORD_PTR)lpFeeder,
 		CALLBACK_THREAD
 	);
 	switch (uWave)
@@ -81,6 +189,38 @@ Player::Stream::CreateMMIOStream(
 	case MMSYSERR_NOERROR:		default:			break;
 	}
 
+	streamData.lpMMEFeeder = lpFeeder;
+	if (uWave != MMSYSERR_NOERROR)
+	{
+		return streamData;
+	}
+
+	// don't start device before PlayBufferSound
+	waveOutPause(lpFeeder->hWaveOut);
+
+	for (DWORD i = 0; i < lpFeeder->dwBufferCount; i++)
+	{
+		WAVEHDR* lpHeader = &lpFeeder->lpHeaders[i];
+		lpHeader->lpData = (LPSTR)(lpFeeder->lpBuffers + i * lpFeeder->dwBufferSize);
+		lpHeader->dwBufferLength = lpFeeder->dwBufferSize;
+
+		uWave = waveOutPrepareHeader(lpFeeder->hWaveOut, lpHeader, sizeof(WAVEHDR));
+		DO_EXIT(uWave == MMSYSERR_NOERROR, "Stream error! Can't prepare header (MME)");
+	}
+
+	// feeder thread doesn't touch ring before first WOM_DONE
+	for (DWORD i = 0; i < lpFeeder->dwBufferCount; i++)
+	{
+		if (!FillWaveOutBuffer(lpFeeder, &lpFeeder->lpHeaders[i])) { break; }
+	}
+
+	// all queued buffers is our output latency
+	streamData.dwLatency = (DWORD)(((UINT64)lpFeeder->dwBufferSize * lpFeeder->dwBufferCount * 1000) / max(waveFormat.nAvgBytesPerSec, 1UL));
+
+	CHAR szLatency[64] = {};
+	StringCchPrintfA(szLatency, 64, "MME stream latency: %u ms", streamData.dwLatency);
+	DEBUG_MESSAGE(szLatency);
+
 	streamData.bPlaying = TRUE;
 	streamData.lpDirectNotify = NULL;
 	streamData.lpDirectSound = NULL;
@@ -89,14 +229,168 @@ Player::Stream::CreateMMIOStream(
 	return streamData;
 }
 
+/*************************************************
+* FillDirectSoundSection():
+* Copy next part of PCM data to ring buffer.
+* If data is ended - fill with silence
+*************************************************/
+HRESULT
+FillDirectSoundSection(
+	_In_ STREAM_FEEDER_P lpFeeder,
+	_In_ DWORD dwOffset
+)
+{
+	HRESULT hr = NULL;
+	LPVOID pBuffer1 = NULL;
+	LPVOID pBuffer2 = NULL;
+	DWORD dwBufferSize1 = NULL;
+	DWORD dwBufferSize2 = NULL;
+
+	// lock only one section of ring
+	hr = lpFeeder->lpBuffer->Lock(
+		dwOffset,
+		lpFeeder->dwSectionBytes,
+		&pBuffer1,
+		&dwBufferSize1,
+		&pBuffer2,
+		&dwBufferSize2,
+		NULL
+	);
+
+	// if buffer is lost - restore it and try again
+	if (hr == DSERR_BUFFERLOST)
+	{
+		lpFeeder->lpBuffer->Restore();
+		hr = lpFeeder->lpBuffer->Lock(
+			dwOffset,
+			lpFeeder->dwSectionBytes,
+			&pBuffer1,
+			&dwBufferSize1,
+			&pBuffer2,
+			&dwBufferSize2,
+			NULL
+		);
+	}
+	if (!SUCCEEDED(hr)) { return hr; }
+
+	LPVOID pParts[2] = { pBuffer1, pBuffer2 };
+	DWORD dwParts[2] = { dwBufferSize1, dwBufferSize2 };
+
+	for (DWORD i = 0; i < 2; i++)
+	{
+		if (!pParts[i]) { continue; }
+
+		// pull all available frames, rest is silence
+		DWORD dwFrames = dwParts[i] / lpFeeder->dwBlockAlign;
+		DWORD dwRead = lpFeeder->bEndOfData ? 0 : lpFeeder->lpSource->ReadFrames((BYTE*)pParts[i], dwFrames);
+		DWORD dwCopy = dwRead * lpFeeder->dwBlockAlign;
+		memset((BYTE*)pParts[i] + dwCopy, lpFeeder->bSilence, dwParts[i] - dwCopy);
+		lpFeeder->uSourceFrames += dwRead;
+
+		if (dwRead < dwFrames)
+		{
+			lpFeeder->bEndOfData = TRUE;
+		}
+	}
+
+	return lpFeeder->lpBuffer->Unlock(pBuffer1, dwBufferSize1, pBuffer2, dwBufferSize2);
+}
+
+/*************************************************
+* DirectSoundFeederThread():
+* Refill played sections of ring buffer
+* when DirectSound signals notify position
+*************************************************/
+DWORD
+WINAPI
+DirectSoundFeederThread(
+	_In_ LPVOID lpParam
+)
+{
+	STREAM_FEEDER_P lpFeeder = (STREAM_FEEDER_P)lpParam;
+	HANDLE hEvents[NOTIFIATINS_POSES + 1] = {};
+	Player::ThreadSystem feederThread;
+
+	feederThread.ThSetNewThreadName("WINPLR DIRECTSOUND FEEDER");
+
+	// stop event must be first to have priority
+	hEvents[0] = lpFeeder->hStopEvent;
+	for (DWORD i = 0; i < NOTIFIATINS_POSES; i++)
+	{
+		hEvents[i + 1] = lpFeeder->hNotifyEvents[i];
+	}
+
+	while (TRUE)
+	{
+		DWORD dwWait = WaitForMultipleObjects(NOTIFIATINS_POSES + 1, hEvents, FALSE, INFINITE);
+		if (dwWait == WAIT_OBJECT_0 || dwWait == WAIT_FAILED)
+		{
+			break;
+		}
+
+		// section with this index is played now
+		DWORD dwSection = dwWait - WAIT_OBJECT_0 - 1;
+		if (dwSection >= NOTIFIATINS_POSES) { continue; }
+
+		InterlockedExchangeAdd64(&lpFeeder->llPlayedBytes, lpFeeder->dwSectionBytes);
+		lpFeeder->dwLastSection = dwSection;
+
+		// wait for last data section to be played before stop
+		if (lpFeeder->bEndOfData && ++lpFeeder->dwTailSections >= NOTIFIATINS_POSES)
+		{
+			lpFeeder->lpBuffer->Stop();
+			lpFeeder->bFinished = TRUE;
+			break;
+		}
+
+		Player::DeadlineMonitor* lpMonitor = lpFeeder->lpMonitor;
+		UINT64 uStartNs = lpMonitor ? lpMonitor->BeginCallback() : 0;
+		BOOL isRefill = !lpFeeder->bEndOfData;
+		DWORD dwSectionStart = dwSection * lpFeeder->dwSectionBytes;
+		DWORD dwQueuedBytes = 0;
+
+		// if play cursor is back in this section - we are too late
+		DWORD dwPlayCursor = NULL;
+		if (SUCCEEDED(lpFeeder->lpBuffer->GetCurrentPosition(&dwPlayCursor, NULL)))
+		{
+			if (dwPlayCursor / lpFeeder->dwSectionBytes == dwSection)
+			{
+				lpFeeder->dwUnderruns++;
+				if (lpMonitor) { lpMonitor->telemetry.AddUnderrun(); }
+			}
+			else
+			{
+				// data from play cursor to this section is still not played
+				dwQueuedBytes = (dwSectionStart + lpFeeder->dwBufferBytes - dwPlayCursor) % lpFeeder->dwBufferBytes;
+			}
+		}
+
+		HRESULT hr = FillDirectSoundSection(lpFeeder, dwSectionStart);
+
+		if (lpMonitor && isRefill)
+		{
+			lpMonitor->telemetry.AddQueued(dwQueuedBytes / lpFeeder->dwSectionBytes);
+			lpMonitor->EndCallback(uStartNs, (UINT64)dwQueuedBytes * 1000000000 / max(lpFeeder->dwBytesPerSec, 1UL));
+		}
+		// lost buffer is restored by fill, other errors finish stream on queued data
+		if (!SUCCEEDED(hr))
+		{
+			PostAudioError((DWORD)hr, "Stream error! Can't refill ring buffer (DirectSound)");
+			lpFeeder->bEndOfData = TRUE;
+		}
+	}
+
+	return NULL;
+}
+
 /*************************************************
 * CreateStreamFromBuffer():
 * Create DirectSound stream from user data
 *************************************************/
 STREAM_DATA
 Player::Stream::CreateDirectSoundStream(
-	_In_ FILE_DATA dData,
-	_In_ PCM_DATA dPCM,
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpSource,
 	_In_ HWND hwnd
 )
 {
@@ -105,31 +399,27 @@ Player::Stream::CreateDirectSoundStream(
 	WAVEFORMATEX waveFormat = {};
 	HRESULT hr = NULL;
 	LPDIRECTSOUNDBUFFER tempBuffer = {};
-	streamData.bPlaying = FALSE;	// make true before init
-	streamData.dPCM = dPCM;
 
 	ZeroMemory(&streamData, sizeof(STREAM_DATA));
 	ZeroMemory(&bufferDesc, sizeof(DSBUFFERDESC));
 	ZeroMemory(&waveFormat, sizeof(WAVEFORMATEX));
 	ZeroMemory(&tempBuffer, sizeof(LPDIRECTSOUNDBUFFER));
+	streamData.bPlaying = FALSE;	// make true before init
 
-	if (dData.dwSize)
+	if (lpSource && lpFormat->nBlockAlign)
 	{
-		// initialize the direct sound interface 
-		if (!SUCCEEDED(DirectSoundCreate(
-			NULL,
+		// direct sound interface and primary buffer are opened at startup
+		if (!deviceManager.AcquireDirectSound(
+			hwnd,
 			&streamData.lpDirectSound,
-			NULL)))
+			&streamData.lpPrimaryDirectBuffer))
 		{
 			CreateErrorText(
 				"Failed to create sound device (DirectSound). Check your audio drivers\nor restart with '-no_direct_sound' argument'."
 			);
+			return streamData;
 		}
 
-		// set the cooperative level
-		hr = streamData.lpDirectSound->SetCooperativeLevel(hwnd, DSSCL_PRIORITY);
-		R_ASSERT2(hr, "Failed to set cooperative level (DirectSound)");
-
 		{
 			// create device caps
 			DSCAPS dsCaps;
@@ -141,33 +431,26 @@ Player::Stream::CreateDirectSoundStream(
 			R_ASSERT2(hr, "Stream error! Can't get device caps (DirectSound)");
 		}
 
-		// set parameters for primary buffer
-		bufferDesc.dwSize = sizeof(DSBUFFERDESC);
-		bufferDesc.dwFlags = DSBCAPS_PRIMARYBUFFER | DSBCAPS_CTRLVOLUME;
-		bufferDesc.guid3DAlgorithm = GUID_NULL;
-
-		// create primary sound buffer with buffer descriptor
-		hr = streamData.lpDirectSound->CreateSoundBuffer(
-			&bufferDesc,
-			&streamData.lpPrimaryDirectBuffer,
-			NULL
-		);
-		R_ASSERT2(hr, "Stream error! Can't create primary sound buffer (DirectSound)");
-		waveFormat.nAvgBytesPerSec = dPCM.waveFormat.nAvgBytesPerSec;
-		waveFormat.nBlockAlign = dPCM.waveFormat.nBlockAlign;
-		waveFormat.nChannels = dPCM.waveFormat.nChannels;
-		waveFormat.nSamplesPerSec = dPCM.waveFormat.nSamplesPerSec;
-		waveFormat.wBitsPerSample = dPCM.waveFormat.wBitsPerSample;
-		waveFormat.wFormatTag = dPCM.waveFormat.wFormatTag;
+		waveFormat.nAvgBytesPerSec = lpFormat->nAvgBytesPerSec;
+		waveFormat.nBlockAlign = lpFormat->nBlockAlign;
+		waveFormat.nChannels = lpFormat->nChannels;
+		waveFormat.nSamplesPerSec = lpFormat->nSamplesPerSec;
+		waveFormat.wBitsPerSample = lpFormat->wBitsPerSample;
+		waveFormat.wFormatTag = lpFormat->wFormatTag;
+		streamData.waveFormat = waveFormat;
 
 		// set the primary buffer to be the wave format specified.
 		hr = streamData.lpPrimaryDirectBuffer->SetFormat(&waveFormat);
 		R_ASSERT2(hr, "Stream error! Can't set wave format for sound buffer (DirectSound)");
 
+		// ring size doesn't depend on file size, only on format
+		DWORD dwSectionBytes = (waveFormat.nSamplesPerSec * STREAM_BUFFER_MS / 1000 / NOTIFIATINS_POSES) * waveFormat.nBlockAlign;
+		dwSectionBytes = max(dwSectionBytes, (DWORD)waveFormat.nBlockAlign);
+
 		// set parameters for secondary buffer
 		bufferDesc.dwSize = sizeof(DSBUFFERDESC);
-		bufferDesc.dwFlags = DSBCAPS_CTRLVOLUME;
-		bufferDesc.dwBufferBytes = dData.dwSize;
+		bufferDesc.dwFlags = DSBCAPS_CTRLVOLUME | DSBCAPS_CTRLPOSITIONNOTIFY | DSBCAPS_GETCURRENTPOSITION2;
+		bufferDesc.dwBufferBytes = dwSectionBytes * NOTIFIATINS_POSES;
 		bufferDesc.lpwfxFormat = &waveFormat;
 		bufferDesc.guid3DAlgorithm = GUID_NULL;
 
@@ -189,89 +472,415 @@ Player::Stream::CreateDirectSoundStream(
 		// free temp buffer
 		_RELEASE(tempBuffer);
 
-		LPVOID pBuffer = NULL;
-		DWORD dwBufferSize = NULL;
+		// get notify interface for our ring
+		hr = streamData.lpSecondaryDirectBuffer->QueryInterface(
+			IID_IDirectSoundNotify,
+			(LPVOID*)&streamData.lpDirectNotify
+		);
+		R_ASSERT2(hr, "Stream error! Can't query notify interface (DirectSound)");
+
+		// create feeder for ring buffer
+		STREAM_FEEDER_P lpFeeder = (STREAM_FEEDER_P)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(STREAM_FEEDER));
+		DO_EXIT(lpFeeder, "Stream error! Can't allocate stream feeder (DirectSound)");
+		lpFeeder->lpBuffer = streamData.lpSecondaryDirectBuffer;
+		lpFeeder->lpSource = lpSource;
+		lpFeeder->dwBlockAlign = waveFormat.nBlockAlign;
+		lpFeeder->dwBytesPerSec = waveFormat.nAvgBytesPerSec;
+		lpFeeder->dwLastSection = NOTIFIATINS_POSES - 1;
+		lpFeeder->dwBufferBytes = bufferDesc.dwBufferBytes;
+		lpFeeder->dwSectionBytes = dwSectionBytes;
+		lpFeeder->bSilence = (waveFormat.wBitsPerSample == 8) ? 0x80 : 0x00;
+		lpFeeder->hStopEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+
+		// notify at the end of every section
+		DSBPOSITIONNOTIFY notifyPoses[NOTIFIATINS_POSES] = {};
+		for (DWORD i = 0; i < NOTIFIATINS_POSES; i++)
+		{
+			lpFeeder->hNotifyEvents[i] = CreateEventA(NULL, FALSE, FALSE, NULL);
+			notifyPoses[i].dwOffset = (i + 1) * dwSectionBytes - 1;
+			notifyPoses[i].hEventNotify = lpFeeder->hNotifyEvents[i];
+		}
 
-		// lock buffer
-		hr = streamData.lpSecondaryDirectBuffer->Lock(
+		hr = streamData.lpDirectNotify->SetNotificationPositions(NOTIFIATINS_POSES, notifyPoses);
+		R_ASSERT2(hr, "Stream error! Can't set notification positions (DirectSound)");
+
+		// fill all ring before start
+		for (DWORD i = 0; i < NOTIFIATINS_POSES; i++)
+		{
+			hr = FillDirectSoundSection(lpFeeder, i * dwSectionBytes);
+			R_ASSERT2(hr, "Stream error! Can't fill ring buffer (DirectSound)");
+		}
+
+		// begin our feeder thread
+		lpFeeder->hThread = CreateThread(
 			NULL,
-			dData.dwSize,
-			&pBuffer,
-			(LPDWORD)&dwBufferSize,
 			NULL,
+			DirectSoundFeederThread,
+			(LPVOID)lpFeeder,
 			NULL,
 			NULL
 		);
-		R_ASSERT2(hr, "Stream error! Can't lock buffer (DirectSound)");
+		DO_EXIT(lpFeeder->hThread, "Stream error! Can't create feeder thread (DirectSound)");
 
-		memcpy(pBuffer, dPCM.lpData, dData.dwSize);
-
-		// unlock buffer
-		hr = streamData.lpSecondaryDirectBuffer->Unlock(
-			pBuffer,
-			dwBufferSize,
-			NULL,
-			NULL
-		);
-		R_ASSERT2(hr, "Stream error! Can't unlock buffer (DirectSound)");		
+		streamData.lpFeeder = lpFeeder;
+		streamData.dwLatency = STREAM_BUFFER_MS;
 	}
 	return streamData;
 }
 
 /*************************************************
 * PlayBufferSound():
-* Play sound from buffer 
+* Play or resume sound from current position
 *************************************************/
 VOID
 Player::Stream::PlayBufferSound(
-	_In_ STREAM_DATA streamData
+	_Inout_ STREAM_DATA_P lpStreamData
 )
 {
 	HRESULT hr = NULL;
 
 	// if secondary buffer is not empty - use DirectSound
-	if (streamData.lpSecondaryDirectBuffer)
+	if (lpStreamData->lpSecondaryDirectBuffer)
 	{
-		// play sound
-		hr = streamData.lpSecondaryDirectBuffer->SetCurrentPosition(NULL);
-		hr = streamData.lpSecondaryDirectBuffer->SetVolume(-2000);
-		hr = streamData.lpSecondaryDirectBuffer->Play(NULL, NULL, NULL);
+		// ring is played from cursor where it was stopped, feeder keeps its sections
+		hr = lpStreamData->lpSecondaryDirectBuffer->Play(NULL, NULL, lpStreamData->lpFeeder ? DSBPLAY_LOOPING : NULL);
 		R_ASSERT3(hr, "Stream error! Can't start playing");
-		streamData.bPlaying = TRUE;
+		lpStreamData->bPlaying = TRUE;
+	}
+
+	// all waveOut buffers are queued on paused device
+	if (lpStreamData->lpMMEFeeder && lpStreamData->lpMMEFeeder->hWaveOut)
+	{
+		if (waveOutRestart(lpStreamData->lpMMEFeeder->hWaveOut) != MMSYSERR_NOERROR)
+		{
+			DEBUG_MESSAGE("Stream error! Can't start playing (MME)");
+		}
+		lpStreamData->bPlaying = TRUE;
 	}
 }
 
 /*************************************************
 * StopBufferSound():
-* Stop playing buffer
+* Pause playing buffer, device is kept
 *************************************************/
 VOID 
 Player::Stream::StopBufferSound(
-	_In_ STREAM_DATA streamData
+	_Inout_ STREAM_DATA_P lpStreamData
 )
 {
 	HRESULT hr = NULL;
 
 	// if secondary buffer is not empty - try to stop
-	if (streamData.lpSecondaryDirectBuffer)
+	if (lpStreamData->lpSecondaryDirectBuffer)
 	{
-		hr = SUCCEEDED(streamData.lpSecondaryDirectBuffer->Stop());
+		hr = lpStreamData->lpSecondaryDirectBuffer->Stop();
 		R_ASSERT3(hr, "Stream error! Can't stop playing");
 	}
-	streamData.bPlaying = FALSE;
+	if (lpStreamData->lpMMEFeeder && lpStreamData->lpMMEFeeder->hWaveOut)
+	{
+		waveOutPause(lpStreamData->lpMMEFeeder->hWaveOut);
+	}
+	lpStreamData->bPlaying = FALSE;
 }
 
 /*************************************************
 * ReleaseSoundBuffers():
 * Release all DirectSound pointers
+* and waveOut device
 *************************************************/
 VOID
 Player::Stream::ReleaseSoundBuffers(
 	_In_ STREAM_DATA streamData
 )
 {
+	STREAM_FEEDER_P lpFeeder = streamData.lpFeeder;
+
+	// stop feeder thread before releasing ring buffer
+	if (lpFeeder)
+	{
+		SetEvent(lpFeeder->hStopEvent);
+		if (lpFeeder->hThread)
+		{
+			WaitForSingleObject(lpFeeder->hThread, INFINITE);
+			CloseHandle(lpFeeder->hThread);
+		}
+		for (DWORD i = 0; i < NOTIFIATINS_POSES; i++)
+		{
+			if (lpFeeder->hNotifyEvents[i]) { CloseHandle(lpFeeder->hNotifyEvents[i]); }
+		}
+		CloseHandle(lpFeeder->hStopEvent);
+		HeapFree(GetProcessHeap(), NULL, lpFeeder);
+	}
+
+	MME_FEEDER_P lpMMEFeeder = streamData.lpMMEFeeder;
+
+	// return all buffers from device before freeing it
+	if (lpMMEFeeder)
+	{
+		lpMMEFeeder->bStopping = TRUE;
+		if (lpMMEFeeder->hWaveOut)
+		{
+			waveOutReset(lpMMEFeeder->hWaveOut);
+		}
+		if (lpMMEFeeder->hThread)
+		{
+			PostThreadMessageA(lpMMEFeeder->dwThreadID, WM_QUIT, NULL, NULL);
+			WaitForSingleObject(lpMMEFeeder->hThread, INFINITE);
+			CloseHandle(lpMMEFeeder->hThread);
+		}
+		if (lpMMEFeeder->hWaveOut)
+		{
+			for (DWORD i = 0; i < lpMMEFeeder->dwBufferCount; i++)
+			{
+				waveOutUnprepareHeader(lpMMEFeeder->hWaveOut, &lpMMEFeeder->lpHeaders[i], sizeof(WAVEHDR));
+			}
+			waveOutClose(lpMMEFeeder->hWaveOut);
+		}
+		if (lpMMEFeeder->lpHeaders) { HeapFree(GetProcessHeap(), NULL, lpMMEFeeder->lpHeaders); }
+		if (lpMMEFeeder->lpBuffers) { HeapFree(GetProcessHeap(), NULL, lpMMEFeeder->lpBuffers); }
+		CloseHandle(lpMMEFeeder->hReadyEvent);
+		HeapFree(GetProcessHeap(), NULL, lpMMEFeeder);
+	}
+
 	_RELEASE(streamData.lpDirectNotify);
 	_RELEASE(streamData.lpDirectSound);
 	_RELEASE(streamData.lpPrimaryDirectBuffer);
 	_RELEASE(streamData.lpSecondaryDirectBuffer);
 }
+
+/*************************************************
+* DirectSoundSink():
+* Constructor
+*************************************************/
+Player::DirectSoundSink::DirectSoundSink(
+	_In_ HWND hwnd
+) : hwndOwner(hwnd)
+{
+	ZeroMemory(&streamData, sizeof(STREAM_DATA));
+}
+
+/*************************************************
+* ~DirectSoundSink():
+* Destructor
+*************************************************/
+Player::DirectSoundSink::~DirectSoundSink()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Create ring buffer and pre-fill it from source
+*************************************************/
+BOOL
+Player::DirectSoundSink::Open(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpSource
+)
+{
+	streamData = audioStream.CreateDirectSoundStream(lpFormat, lpSource, hwndOwner);
+
+	// feeder doesn't take notifies before Start
+	deadlineMonitor.Reset();
+	if (streamData.lpFeeder) { streamData.lpFeeder->lpMonitor = &deadlineMonitor; }
+	return streamData.lpSecondaryDirectBuffer && streamData.lpFeeder;
+}
+
+/*************************************************
+* Start():
+* Play ring buffer
+*************************************************/
+BOOL
+Player::DirectSoundSink::Start()
+{
+	if (!streamData.lpSecondaryDirectBuffer) { return FALSE; }
+
+	audioStream.PlayBufferSound(&streamData);
+	return TRUE;
+}
+
+/*************************************************
+* Stop():
+* Stop ring buffer
+*************************************************/
+VOID
+Player::DirectSoundSink::Stop()
+{
+	if (streamData.lpSecondaryDirectBuffer)
+	{
+		audioStream.StopBufferSound(&streamData);
+	}
+}
+
+/*************************************************
+* Close():
+* Stop feeder and release DirectSound
+*************************************************/
+VOID
+Player::DirectSoundSink::Close()
+{
+	if (streamData.lpDirectSound || streamData.lpFeeder)
+	{
+		audioStream.ReleaseSoundBuffers(streamData);
+	}
+	ZeroMemory(&streamData, sizeof(STREAM_DATA));
+}
+
+/*************************************************
+* GetPosition():
+* Played sections + play cursor offset in
+* current section, in frames
+*************************************************/
+UINT64
+Player::DirectSoundSink::GetPosition()
+{
+	STREAM_FEEDER_P lpFeeder = streamData.lpFeeder;
+	if (!lpFeeder || !lpFeeder->dwBlockAlign) { return 0; }
+	if (lpFeeder->bFinished) { return lpFeeder->uSourceFrames; }
+
+	DWORD dwPlayCursor = NULL;
+	lpFeeder->lpBuffer->GetCurrentPosition(&dwPlayCursor, NULL);
+
+	// section after last notified one is played now
+	DWORD dwSectionStart = ((lpFeeder->dwLastSection + 1) % NOTIFIATINS_POSES) * lpFeeder->dwSectionBytes;
+	DWORD dwInSection = (dwPlayCursor + lpFeeder->dwBufferBytes - dwSectionStart) % lpFeeder->dwBufferBytes;
+	dwInSection = min(dwInSection, lpFeeder->dwSectionBytes);
+
+	UINT64 uFrames = ((UINT64)lpFeeder->llPlayedBytes + dwInSection) / lpFeeder->dwBlockAlign;
+	return min(uFrames, lpFeeder->uSourceFrames);
+}
+
+DWORD Player::DirectSoundSink::GetLatency() { return streamData.dwLatency; }
+DWORD Player::DirectSoundSink::GetUnderruns() { return streamData.lpFeeder ? streamData.lpFeeder->dwUnderruns : 0; }
+BOOL Player::DirectSoundSink::IsFinished() { return streamData.lpFeeder ? streamData.lpFeeder->bFinished : FALSE; }
+
+/*************************************************
+* IsFormatSupported():
+* Secondary buffer with WAVEFORMATEX takes
+* only 8-bit and 16-bit PCM, mono or stereo,
+* on every driver
+*************************************************/
+BOOL
+Player::DirectSoundSink::IsFormatSupported(
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	if (lpFormat->nSamplesPerSec < DSBFREQUENCY_MIN || lpFormat->nSamplesPerSec > DSBFREQUENCY_MAX) { return FALSE; }
+	if (lpFormat->nChannels < 1 || lpFormat->nChannels > 2) { return FALSE; }
+	return lpFormat->wFormatTag == WAVE_FORMAT_PCM && (lpFormat->wBitsPerSample == 8 || lpFormat->wBitsPerSample == 16);
+}
+Player::DeadlineMonitor* Player::DirectSoundSink::GetDeadlineMonitor() { return &deadlineMonitor; }
+
+/*************************************************
+* MMESink():
+* Constructor
+*************************************************/
+Player::MMESink::MMESink()
+{
+	ZeroMemory(&streamData, sizeof(STREAM_DATA));
+}
+
+/*************************************************
+* ~MMESink():
+* Destructor
+*************************************************/
+Player::MMESink::~MMESink()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Open waveOut device and queue buffers
+*************************************************/
+BOOL
+Player::MMESink::Open(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpSource
+)
+{
+	streamData = audioStream.CreateMMIOStream(lpFormat, lpSource, NULL);
+
+	// device is paused, so no WOM_DONE before Start
+	deadlineMonitor.Reset();
+	if (streamData.lpMMEFeeder) { streamData.lpMMEFeeder->lpMonitor = &deadlineMonitor; }
+	return streamData.lpMMEFeeder && streamData.lpMMEFeeder->hWaveOut;
+}
+
+/*************************************************
+* Start():
+* Restart paused device
+*************************************************/
+BOOL
+Player::MMESink::Start()
+{
+	if (!streamData.lpMMEFeeder) { return FALSE; }
+
+	audioStream.PlayBufferSound(&streamData);
+	return TRUE;
+}
+
+/*************************************************
+* Stop():
+* Pause device
+*************************************************/
+VOID
+Player::MMESink::Stop()
+{
+	if (streamData.lpMMEFeeder)
+	{
+		audioStream.StopBufferSound(&streamData);
+	}
+}
+
+/*************************************************
+* Close():
+* Reset and close device
+*************************************************/
+VOID
+Player::MMESink::Close()
+{
+	if (streamData.lpMMEFeeder)
+	{
+		audioStream.ReleaseSoundBuffers(streamData);
+	}
+	ZeroMemory(&streamData, sizeof(STREAM_DATA));
+}
+
+/*************************************************
+* GetPosition():
+* Device position in samples
+*************************************************/
+UINT64
+Player::MMESink::GetPosition()
+{
+	MME_FEEDER_P lpFeeder = streamData.lpMMEFeeder;
+	if (!lpFeeder || !lpFeeder->hWaveOut) { return 0; }
+
+	MMTIME mmTime = {};
+	mmTime.wType = TIME_SAMPLES;
+	if (waveOutGetPosition(lpFeeder->hWaveOut, &mmTime, sizeof(MMTIME)) != MMSYSERR_NOERROR) { return 0; }
+
+	// driver can return position in bytes
+	if (mmTime.wType == TIME_BYTES) { return mmTime.u.cb / lpFeeder->dwBlockAlign; }
+	return mmTime.u.sample;
+}
+
+DWORD Player::MMESink::GetLatency() { return streamData.dwLatency; }
+DWORD Player::MMESink::GetUnderruns() { return streamData.lpMMEFeeder ? streamData.lpMMEFeeder->dwUnderruns : 0; }
+BOOL Player::MMESink::IsFinished() { return streamData.lpMMEFeeder ? (streamData.lpMMEFeeder->bEndOfData && !streamData.lpMMEFeeder->dwQueued) : FALSE; }
+
+/*************************************************
+* IsFormatSupported():
+* Wave mapper can fail with other formats
+* in WAVEFORMATEX. Rate is asked from driver
+*************************************************/
+BOOL
+Player::MMESink::IsFormatSupported(
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	if (lpFormat->wFormatTag != WAVE_FORMAT_PCM || (lpFormat->wBitsPerSample != 8 && lpFormat->wBitsPerSample != 16)) { return FALSE; }
+	return waveOutOpen(NULL, WAVE_MAPPER, lpFormat, NULL, NULL, WAVE_FORMAT_QUERY) == MMSYSERR_NOERROR;
+}
+Player::DeadlineMonitor* Player::MMESink::GetDeadlineMonitor() { return &deadlineMonitor; }
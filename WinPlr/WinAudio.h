@@ -27,6 +27,7 @@
 #include <xaudio2.h>
 #include <stdio.h>
 #include <process.h>
+#include "WinEngine.h"
 
 #define DLL_EXPORTS
 #ifdef DLL_EXPORTS
@@ -44,21 +45,24 @@ VOID CreateErrorText(_In_ LPCSTR lpMsgText, _In_ HRESULT hr);
 VOID CreateInfoText(_In_ LPCSTR lpMsgText);
 VOID CreateWarningText(_In_ LPCSTR lpMsgText);
 VOID ContinueIfYes(_In_ LPCSTR lpMsgText, _In_ LPCSTR lpMsgTitle);
+VOID SetMessageWindow(_In_ HWND hwnd);
+VOID PostAudioError(_In_ DWORD dwCode, _In_ LPCSTR lpMsgText);
 
-#define DEBUG_MESSAGE(x)	OutputDebugStringA(x); OutputDebugStringA("\n");
 #define _RELEASE(x)			if (x)					{ x->Release(); x = NULL; }	// safety release pointers
 #define R_ASSERT2(x, y)		if (!SUCCEEDED(x))		{ CreateErrorText(y, x); }
 #define R_ASSERT(x)			if (!SUCCEEDED(x))		{ CreateErrorText("R_ASSERT"); }
-#ifndef DEBUG
-#define ASSERT(x, y)		if (!x)					{ DEBUG_MESSAGE(y); }
-#define R_ASSERT3(x, y)		if (!SUCCEEDED(x))		{ DEBUG_MESSAGE(y); }
-#else
-#define ASSERT(x, y)		if (!x)					{ DEBUG_MESSAGE(y); __debugbreak(); }
-#define R_ASSERT3(x, y)		if (!SUCCEEDED(x))		{ DEBUG_MESSAGE(y); __debugbreak(); }
-#endif
+#define R_ASSERT3(x, y)		if (!SUCCEEDED(x))		{ PostAudioError((DWORD)(x), y); }	// never blocks, for audio threads
 #define DO_EXIT(x, y)		if (!(x))				{ CreateErrorText(y); }
 #define PLAYER_VERSION		"#PLAYER_VERSION: 0.2.2#"
 
+// commands are applied when feeder pulls next section, which is played one ring later,
+// so ring length is control latency. Short sections keep it small without underruns
+#define NOTIFIATINS_POSES	6			// count of notify positions in DirectSound ring
+#define STREAM_BUFFER_MS	120			// length of DirectSound ring in milliseconds, 20 ms sections
+#define MME_BUFFER_SIZE		16384		// size of one waveOut buffer
+#define MME_BUFFER_COUNT	4			// count of waveOut buffers in ring
+#define UI_REFRESH_RATE		30			// UI frames per second while playing
+
 typedef enum
 {
 	WAV_FILE = 1,
@@ -73,14 +77,6 @@ typedef enum
 	UNKNOWN_FILE = 10
 } FILE_TYPE;
 
-typedef enum
-{
-	HANN_WINDOW = 1,
-	HAMMING_WINDOW = 2,
-	BLACKMAN_WINDOW = 3,
-	BLACKMANHARRIS_WINDOW = 4
-} WINDOW_TYPE;
-
 typedef struct {
 	DWORD	dwType;				// thread type
 	LPCSTR	lpName;				// thread name
@@ -88,19 +84,10 @@ typedef struct {
 	DWORD	dwFlags;			// flags to create thread
 } THREAD_NAME; 
 
-typedef struct
-{
-	WAVEFORMATEX waveFormat;		// wave format info
-	BYTE* lpData;					// pointer to allocated memory
-	LPCSTR lpPath;					// full path to file
-	uint32_t pLoopStart;			// start loop
-	uint32_t pLoopLength;			// length of loop
-} PCM_DATA, *PCM_DATA_P;
-
 typedef struct
 {
 	HANDLE hFile;				// handle of file
-	BYTE* lpFile;				// pointer to allocated memory
+	BYTE* lpFile;				// pointer to mapped file
 	DWORD dwSize;				// size of file
 	FILE_TYPE eType;			// type of file
 } FILE_DATA, *FILE_DATA_P;
@@ -113,100 +100,66 @@ typedef struct
 
 typedef struct
 {
-	PCM_DATA dPCM;										// all PCM data for DirectSound
-	LPDIRECTSOUND lpDirectSound;						// DirectSound main object
-	LPDIRECTSOUNDBUFFER lpPrimaryDirectBuffer;			// DirectSound buffer
-	LPDIRECTSOUNDBUFFER lpSecondaryDirectBuffer;		// DirectSound buffer
-	LPDIRECTSOUNDNOTIFY lpDirectNotify;					// DirectSound notify
-	BOOL bPlaying;										// display if audio now is playing
-} STREAM_DATA, *STREAM_DATA_P;
+	LPDIRECTSOUNDBUFFER lpBuffer;						// ring buffer to refill
+	HANDLE hNotifyEvents[NOTIFIATINS_POSES];			// events for every notify position
+	HANDLE hStopEvent;									// event to stop feeder thread
+	HANDLE hThread;										// feeder thread
+	Player::AudioSource* lpSource;						// source of PCM frames
+	DWORD dwBlockAlign;									// size of one sample frame
+	DWORD dwBufferBytes;								// size of ring buffer
+	DWORD dwSectionBytes;								// size of one ring section
+	DWORD dwTailSections;								// sections played after end of data
+	DWORD dwLastSection;								// last played section
+	DWORD dwUnderruns;									// sections refilled too late
+	DWORD dwBytesPerSec;								// to convert queued bytes to time
+	Player::DeadlineMonitor* lpMonitor;					// refills against starvation time
+	volatile LONG64 llPlayedBytes;						// bytes played before current section
+	UINT64 uSourceFrames;								// frames read from source
+	BOOL bEndOfData;									// all PCM data is copied to ring
+	volatile BOOL bFinished;							// last data section is played
+	BYTE bSilence;										// silence value for current format
+} STREAM_FEEDER, *STREAM_FEEDER_P;
 
 typedef struct
 {
-	FILE_DATA dData;			// file data struct
-	PCM_DATA dPCM;				// PCM data struct
-} AUDIO_FILE, *AUDIO_FILE_P;
-
-typedef struct 
-{
-	uint32_t tag;				// tag of RIFF chunk
-	uint32_t size;				// chunk size
-} RIFFChunk;
+	DWORD dwBufferSize;									// size of one waveOut buffer
+	DWORD dwBufferCount;								// count of waveOut buffers
+} MME_STREAM_CONFIG, *MME_STREAM_CONFIG_P;
 
 typedef struct
 {
-	uint32_t tag;				// tag of RIFF chunk header
-	uint32_t size;				// chunk header size
-	uint32_t riff;				// RIFF info
-} RIFFChunkHeader;
-
-typedef struct 
-{
-	static const uint32_t LOOP_TYPE_FORWARD = 0x00000000;
-	static const uint32_t LOOP_TYPE_RELEASE = 0x00000001;
-
-	uint32_t size;				// chunk size
-	uint32_t loopType;			// chunk loop type
-	uint32_t loopStart;			// chunk loop start
-	uint32_t loopLength;		// chunk length
-} DLSLoop;
+	HWAVEOUT hWaveOut;									// waveOut device
+	WAVEHDR* lpHeaders;									// prepared headers for every buffer
+	BYTE* lpBuffers;									// memory for all buffers
+	DWORD dwBufferSize;									// size of one buffer
+	DWORD dwBufferCount;								// count of buffers
+	DWORD dwQueued;										// buffers queued to device
+	Player::AudioSource* lpSource;						// source of PCM frames
+	DWORD dwBlockAlign;									// size of one sample frame
+	BOOL bEndOfData;									// source is drained
+	DWORD dwUnderruns;									// count of device starvations
+	DWORD dwBytesPerSec;								// to convert queued bytes to time
+	Player::DeadlineMonitor* lpMonitor;					// refills against starvation time
+	HANDLE hThread;										// thread for WOM_DONE messages
+	DWORD dwThreadID;									// id of WOM_DONE thread
+	HANDLE hReadyEvent;									// thread message queue is created
+	volatile BOOL bStopping;							// don't refill, device is resetting
+} MME_FEEDER, *MME_FEEDER_P;
 
 typedef struct
 {
-	static const uint32_t OPTIONS_NOTRUNCATION = 0x00000001;
-	static const uint32_t OPTIONS_NOCOMPRESSION = 0x00000002;
-
-	uint32_t    size;
-	uint16_t    unityNote;
-	int16_t     fineTune;
-	int32_t     gain;
-	uint32_t    options;
-	uint32_t    loopCount;
-} RIFFDLSSample;
-
-typedef struct 
-{
-	static const uint32_t LOOP_TYPE_FORWARD = 0x00000000;
-	static const uint32_t LOOP_TYPE_ALTERNATING = 0x00000001;
-	static const uint32_t LOOP_TYPE_BACKWARD = 0x00000002;
-
-	uint32_t cuePointId;
-	uint32_t type;
-	uint32_t start;
-	uint32_t end;
-	uint32_t fraction;
-	uint32_t playCount;
-} MIDILoop;
-
-typedef struct 
-{
-	uint32_t        manufacturerId;
-	uint32_t        productId;
-	uint32_t        samplePeriod;
-	uint32_t        unityNode;
-	uint32_t        pitchFraction;
-	uint32_t        SMPTEFormat;
-	uint32_t        SMPTEOffset;
-	uint32_t        loopCount;
-	uint32_t        samplerData;
-} RIFFMIDISample;
-
-static_assert(sizeof(RIFFChunk) == 8, "structure size mismatch");
-static_assert(sizeof(RIFFChunkHeader) == 12, "structure size mismatch");
-static_assert(sizeof(DLSLoop) == 16, "structure size mismatch");
-static_assert(sizeof(RIFFDLSSample) == 20, "structure size mismatch");
-static_assert(sizeof(MIDILoop) == 24, "structure size mismatch");
-static_assert(sizeof(RIFFMIDISample) == 36, "structure size mismatch");
-
-const uint32_t FOURCC_RIFF_TAG		= MAKEFOURCC('R', 'I', 'F', 'F');
-const uint32_t FOURCC_FORMAT_TAG	= MAKEFOURCC('f', 'm', 't', ' ');
-const uint32_t FOURCC_DATA_TAG		= MAKEFOURCC('d', 'a', 't', 'a');
-const uint32_t FOURCC_WAVE_FILE_TAG = MAKEFOURCC('W', 'A', 'V', 'E');
-const uint32_t FOURCC_XWMA_FILE_TAG = MAKEFOURCC('X', 'W', 'M', 'A');
-const uint32_t FOURCC_DLS_SAMPLE	= MAKEFOURCC('w', 's', 'm', 'p');
-const uint32_t FOURCC_MIDI_SAMPLE	= MAKEFOURCC('s', 'm', 'p', 'l');
-const uint32_t FOURCC_XWMA_DPDS		= MAKEFOURCC('d', 'p', 'd', 's');
-const uint32_t FOURCC_XMA_SEEK		= MAKEFOURCC('s', 'e', 'e', 'k');
+	WAVEFORMATEX waveFormat;							// format of stream
+	LPDIRECTSOUND lpDirectSound;						// DirectSound main object
+	LPDIRECTSOUNDBUFFER lpPrimaryDirectBuffer;			// DirectSound buffer
+	LPDIRECTSOUNDBUFFER lpSecondaryDirectBuffer;		// DirectSound buffer
+	LPDIRECTSOUNDNOTIFY lpDirectNotify;					// DirectSound notify
+	STREAM_FEEDER_P lpFeeder;							// ring buffer feeder
+	MME_FEEDER_P lpMMEFeeder;							// waveOut buffers feeder
+	DWORD dwLatency;									// output latency in milliseconds
+	BOOL bPlaying;										// display if audio now is playing
+} STREAM_DATA, *STREAM_DATA_P;
+
+extern MME_STREAM_CONFIG mmeStreamConfig;
 
 namespace Player
 {
@@ -218,17 +171,103 @@ namespace Player
 		HANDLE_DATA LoadFileToBuffer(_In_ FILE_DATA dFile, _In_ PCM_DATA dPCM);
 		BOOL CheckBufferFile(_In_ HANDLE_DATA hdData);
 
-		HANDLE hHeap;
+		MappedFile mappedFile;
 	};
 	class Stream
 	{
 	public:
-		STREAM_DATA CreateMMIOStream(_In_ FILE_DATA dData, _In_ PCM_DATA dPCM, _In_ HWND hwnd);
-		STREAM_DATA CreateDirectSoundStream(_In_ FILE_DATA dData, _In_ PCM_DATA dPCM, _In_ HWND hwnd);
-		VOID PlayBufferSound(_In_ STREAM_DATA streamData);
-		VOID StopBufferSound(_In_ STREAM_DATA streamData);
+		STREAM_DATA CreateMMIOStream(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource, _In_ HWND hwnd);
+		STREAM_DATA CreateDirectSoundStream(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource, _In_ HWND hwnd);
+		VOID PlayBufferSound(_Inout_ STREAM_DATA_P lpStreamData);
+		VOID StopBufferSound(_Inout_ STREAM_DATA_P lpStreamData);
 		VOID ReleaseSoundBuffers(_In_ STREAM_DATA streamData);
 	};
+	class DirectSoundSink : public AudioSink
+	{
+	public:
+		DirectSoundSink(_In_ HWND hwnd);
+		~DirectSoundSink();
+		BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) override;
+		BOOL Start() override;
+		VOID Stop() override;
+		VOID Close() override;
+		UINT64 GetPosition() override;
+		DWORD GetLatency() override;
+		DWORD GetUnderruns() override;
+		BOOL IsFinished() override;
+		DeadlineMonitor* GetDeadlineMonitor() override;
+		BOOL IsFormatSupported(_In_ const WAVEFORMATEX* lpFormat) override;
+
+		HWND hwndOwner;
+		Stream audioStream;
+		STREAM_DATA streamData;
+		DeadlineMonitor deadlineMonitor;
+	};
+	class MMESink : public AudioSink
+	{
+	public:
+		MMESink();
+		~MMESink();
+		BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) override;
+		BOOL Start() override;
+		VOID Stop() override;
+		VOID Close() override;
+		UINT64 GetPosition() override;
+		DWORD GetLatency() override;
+		DWORD GetUnderruns() override;
+		BOOL IsFinished() override;
+		DeadlineMonitor* GetDeadlineMonitor() override;
+		BOOL IsFormatSupported(_In_ const WAVEFORMATEX* lpFormat) override;
+
+		Stream audioStream;
+		STREAM_DATA streamData;
+		DeadlineMonitor deadlineMonitor;
+	};
+
+	/*************************************************
+	* DeviceManager:
+	* Opens output device on background thread at
+	* startup and keeps it between tracks. Source
+	* voice is created again only for new format.
+	* Only one stream can use it at the same time
+	*************************************************/
+	class DeviceManager
+	{
+	public:
+		DeviceManager();
+		VOID StartWarmup(_In_ HWND hwnd, _In_ BOOL isXAudio);
+		BOOL WaitReady();
+		IXAudio2SourceVoice* AcquireSourceVoice(_In_ const WAVEFORMATEX* lpFormat, _In_ IXAudio2VoiceCallback* lpCallback);
+		BOOL AcquireDirectSound(_In_ HWND hwnd, _Out_ LPDIRECTSOUND* lppDirectSound, _Out_ LPDIRECTSOUNDBUFFER* lppPrimaryBuffer);
+		VOID Shutdown();
+
+		// UI thread: time from Play to first sample played by sink
+		VOID BeginPlayRequest();
+		VOID CheckFirstSample(_In_opt_ AudioSink* lpSink);
+		BOOL IsWaitingFirstSample();
+
+		IXAudio2* lpXAudio;
+		IXAudio2MasteringVoice* lpMasterVoice;
+		LPDIRECTSOUND lpDirectSound;
+		LPDIRECTSOUNDBUFFER lpPrimaryBuffer;
+		DWORD dwWarmupMs;						// time to open device on background thread
+		DWORD dwFirstSampleMs;					// last time from Play to first played sample
+
+	private:
+		static DWORD WINAPI WarmupThread(_In_ LPVOID lpParam);
+		BOOL OpenXAudio();
+		BOOL OpenDirectSound();
+
+		HANDLE hThread;
+		HWND hwndOwner;
+		BOOL isXAudioDevice;
+		IXAudio2SourceVoice* lpCachedVoice;		// voice of last stream
+		IXAudio2VoiceCallback* lpCachedCallback;
+		WAVEFORMATEX cachedFormat;
+		std::chrono::steady_clock::time_point playTime;
+		BOOL isWaitingFirstSample;
+	};
+
 	class ThreadSystem
 	{
 	public:
@@ -239,3 +278,5 @@ namespace Player
 	public:
 	};
 }
+
+extern Player::DeviceManager deviceManager;
@@ -0,0 +1,72 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio benchmarks
+**********************************************************
+* WinBenchmark.cpp
+* Launch params of benchmarks and their
+* shared input
+*********************************************************/
+#include "WinEngine.h"
+
+const BENCHMARK benchmarks[BENCHMARK_COUNT] =
+{
+	{ "-convert_benchmark", RunConvertBenchmark },
+	{ "-resample_benchmark", RunResampleBenchmark },
+	{ "-voice_benchmark", RunVoiceBenchmark },
+	{ "-eq_benchmark", RunEqBenchmark },
+	{ "-limiter_benchmark", RunLimiterBenchmark },
+	{ "-dither_benchmark", RunDitherBenchmark }
+};
+
+/*************************************************
+* FillBenchmarkNoise():
+* Same white noise on every run, from LCG
+* with seed 1, fPeak is its amplitude
+*************************************************/
+VOID
+FillBenchmarkNoise(
+	_Out_writes_(uSamples) FLOAT* lpDest,
+	_In_ size_t uSamples,
+	_In_ FLOAT fPeak
+)
+{
+	DWORD dwSeed = 1;
+	for (size_t i = 0; i < uSamples; i++)
+	{
+		dwSeed = dwSeed * 1664525u + 1013904223u;
+		lpDest[i] = (FLOAT)(int)dwSeed / 2147483648.0f * fPeak;
+	}
+}
+
+/*************************************************
+* MemorySource():
+* Constructor
+*************************************************/
+Player::MemorySource::MemorySource(
+	_In_reads_(dwNewFrames * dwNewChannels) const FLOAT* lpNewData,
+	_In_ DWORD dwNewFrames,
+	_In_ DWORD dwNewChannels
+) : lpData(lpNewData), dwFrames(dwNewFrames), dwChannels(dwNewChannels), dwPosition(0)
+{
+}
+
+/*************************************************
+* ReadFrames():
+* Copy frames till end of memory
+*************************************************/
+DWORD
+Player::MemorySource::ReadFrames(
+	_Out_writes_bytes_(dwCount * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwCount
+)
+{
+	dwCount = min(dwCount, dwFrames - dwPosition);
+	memcpy(lpDest, lpData + (size_t)dwPosition * dwChannels, (size_t)dwCount * dwChannels * sizeof(FLOAT));
+	dwPosition += dwCount;
+	return dwCount;
+}
+
+BOOL Player::MemorySource::SeekFrame(_In_ UINT64 uFrame) { dwPosition = (DWORD)min(uFrame, (UINT64)dwFrames); return TRUE; }
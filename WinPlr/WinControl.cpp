@@ -0,0 +1,431 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio transport control
+**********************************************************
+* WinControl.cpp
+* Lock-free commands from UI to audio thread
+* and sample-accurate transport
+*********************************************************/
+#include "WinEngine.h"
+
+/*************************************************
+* FillSilence():
+* Write silence in sample format
+*************************************************/
+static VOID
+FillSilence(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	// 8-bit PCM is unsigned, zero level is 0x80
+	memset(lpDest, lpFormat->wBitsPerSample == 8 ? 0x80 : 0x00, dwFrames * lpFormat->nBlockAlign);
+}
+
+/*************************************************
+* ControlSource():
+* Constructor
+*************************************************/
+Player::ControlSource::ControlSource()
+	: uPosition(0), dwDroppedEvents(0), lpSource(NULL), uOutputFrames(0), bPaused(FALSE), bEnded(FALSE)
+{
+	memset(&waveFormat, 0, sizeof(WAVEFORMATEX));
+}
+
+/*************************************************
+* SetSource():
+* Attach new upstream and clear queues.
+* Upstream gives frames of bus format, see
+* GetBusFormat(). Call it only when no sink
+* is pulling frames
+*************************************************/
+VOID
+Player::ControlSource::SetSource(
+	_In_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpBusFormat,
+	_In_ const WAVEFORMATEX* lpSinkFormat
+)
+{
+	eqSource.SetSource(lpUpstream, lpBusFormat);
+	gainSource.SetSource(lpUpstream ? &eqSource : NULL, lpBusFormat);
+	limiterSource.SetSource(lpUpstream ? &gainSource : NULL, lpBusFormat);
+	lpSource = lpUpstream && outputConvert.SetSource(&limiterSource, lpBusFormat, lpSinkFormat) ? &outputConvert : NULL;
+	waveFormat = *lpSinkFormat;
+	commandQueue.Reset();
+	eventQueue.Reset();
+	markQueue.Reset();
+	uPosition = 0;
+	uOutputFrames = 0;
+	dwDroppedEvents = 0;
+	bPaused = FALSE;
+	bEnded = FALSE;
+}
+
+/*************************************************
+* SetLimiter():
+* Limiter settings for next SetSource
+*************************************************/
+VOID
+Player::ControlSource::SetLimiter(
+	_In_ BOOL bEnable,
+	_In_ DWORD dwLookaheadMs,
+	_In_ FLOAT fCeilingDb
+)
+{
+	limiterSource.SetParams(bEnable, dwLookaheadMs, fCeilingDb);
+}
+
+/*************************************************
+* SetDither():
+* Dither of output converter for next SetSource
+*************************************************/
+VOID
+Player::ControlSource::SetDither(
+	_In_ DITHER_MODE eMode,
+	_In_ DWORD dwSeed
+)
+{
+	outputConvert.SetDither(eMode, dwSeed);
+}
+
+/*************************************************
+* PostCommand():
+* Queue command from UI thread. Returns FALSE
+* if audio thread didn't take previous commands
+*************************************************/
+BOOL
+Player::ControlSource::PostCommand(
+	_In_ const PLAYER_COMMAND& playerCommand
+)
+{
+	return commandQueue.Push(playerCommand);
+}
+
+/*************************************************
+* GetEvent():
+* Take next event on UI thread
+*************************************************/
+BOOL
+Player::ControlSource::GetEvent(
+	_Out_ PLAYER_EVENT* lpEvent
+)
+{
+	return eventQueue.Pop(lpEvent);
+}
+
+/*************************************************
+* GetMark():
+* Take next position mark on UI thread
+*************************************************/
+BOOL
+Player::ControlSource::GetMark(
+	_Out_ POSITION_MARK* lpMark
+)
+{
+	return markQueue.Pop(lpMark);
+}
+
+/*************************************************
+* PostMark():
+* Save track position at current sink frame.
+* Called on every jump or stop of position
+*************************************************/
+VOID
+Player::ControlSource::PostMark()
+{
+	POSITION_MARK positionMark = {};
+	positionMark.uOutputFrame = uOutputFrames;
+	positionMark.uSourceFrame = uPosition.load(std::memory_order_relaxed);
+	positionMark.bPaused = bPaused;
+
+	if (!markQueue.Push(positionMark))
+	{
+		dwDroppedEvents.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/*************************************************
+* PostEvent():
+* Queue event from audio thread. If UI is not
+* reading events, event is dropped and counted
+*************************************************/
+VOID
+Player::ControlSource::PostEvent(
+	_In_ PLAYER_EVENT_TYPE eType
+)
+{
+	PLAYER_EVENT playerEvent = {};
+	playerEvent.eType = eType;
+	playerEvent.uFrame = uPosition.load(std::memory_order_relaxed);
+
+	if (!eventQueue.Push(playerEvent))
+	{
+		dwDroppedEvents.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/*************************************************
+* ProcessCommands():
+* Apply all queued commands on audio thread
+*************************************************/
+VOID
+Player::ControlSource::ProcessCommands()
+{
+	PLAYER_COMMAND playerCommand = {};
+
+	while (commandQueue.Pop(&playerCommand))
+	{
+		switch (playerCommand.eType)
+		{
+		case PLAYER_COMMAND_PLAY:
+			bPaused = FALSE;
+			PostMark();
+			PostEvent(PLAYER_EVENT_PLAYING);
+			break;
+		case PLAYER_COMMAND_PAUSE:
+			bPaused = TRUE;
+			PostMark();
+			PostEvent(PLAYER_EVENT_PAUSED);
+			break;
+		case PLAYER_COMMAND_STOP:
+			// stop is pause at start of track
+			bPaused = TRUE;
+			SeekFrame(0);
+			PostMark();
+			PostEvent(PLAYER_EVENT_STOPPED);
+			break;
+		case PLAYER_COMMAND_SEEK:
+			if (SeekFrame(playerCommand.uFrame))
+			{
+				PostMark();
+				PostEvent(PLAYER_EVENT_SEEKED);
+			}
+			break;
+		case PLAYER_COMMAND_VOLUME:
+			gainSource.SetGain(playerCommand.fVolume);
+			PostEvent(PLAYER_EVENT_VOLUME);
+			break;
+		case PLAYER_COMMAND_MUTE:
+			gainSource.SetMute(playerCommand.bMute);
+			PostEvent(PLAYER_EVENT_VOLUME);
+			break;
+		case PLAYER_COMMAND_EQ:
+			eqSource.SetBand(playerCommand.dwBand, playerCommand.eqBand);
+			PostEvent(PLAYER_EVENT_EQ);
+			break;
+		case PLAYER_COMMAND_NEXT:
+			// sink drains and finishes, UI opens next track
+			bEnded = TRUE;
+			PostEvent(PLAYER_EVENT_NEXT);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*************************************************
+* ReadFrames():
+* Take commands, then pull frames from upstream
+*************************************************/
+DWORD
+Player::ControlSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	ProcessCommands();
+
+	if (bEnded || !lpSource)
+	{
+		return 0;
+	}
+
+	// paused sink still runs, so resume doesn't reopen device
+	if (bPaused)
+	{
+		FillSilence(&waveFormat, lpDest, dwFrames);
+		uOutputFrames += dwFrames;
+		return dwFrames;
+	}
+
+	DWORD dwRead = lpSource->ReadFrames(lpDest, dwFrames);
+	uPosition.fetch_add(dwRead, std::memory_order_relaxed);
+	uOutputFrames += dwRead;
+
+	if (dwRead < dwFrames)
+	{
+		bEnded = TRUE;
+		PostEvent(PLAYER_EVENT_END_OF_STREAM);
+	}
+	return dwRead;
+}
+
+/*************************************************
+* SeekFrame():
+* Move upstream cursor, audio thread only
+*************************************************/
+BOOL
+Player::ControlSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	if (!lpSource || !lpSource->SeekFrame(uFrame))
+	{
+		return FALSE;
+	}
+
+	uPosition.store(uFrame, std::memory_order_relaxed);
+	bEnded = FALSE;
+	return TRUE;
+}
+
+/*************************************************
+* Transport():
+* Constructor
+*************************************************/
+Player::Transport::Transport() : lpControlSource(NULL), lpSink(NULL), isNextMark(FALSE)
+{
+	memset(&currentMark, 0, sizeof(POSITION_MARK));
+	memset(&nextMark, 0, sizeof(POSITION_MARK));
+}
+
+/*************************************************
+* Attach():
+* Control new sink. Sink must be opened with
+* control source and it starts from frame 0
+*************************************************/
+VOID
+Player::Transport::Attach(
+	_In_opt_ ControlSource* lpControl,
+	_In_opt_ AudioSink* lpOutputSink
+)
+{
+	lpControlSource = lpControl;
+	lpSink = lpOutputSink;
+	isNextMark = FALSE;
+	memset(&currentMark, 0, sizeof(POSITION_MARK));
+}
+
+/*************************************************
+* PostCommand():
+* Send command to audio thread. Finished sink
+* doesn't pull frames, so command is refused
+*************************************************/
+BOOL
+Player::Transport::PostCommand(
+	_In_ const PLAYER_COMMAND& playerCommand
+)
+{
+	if (!lpControlSource || !lpSink || lpSink->IsFinished())
+	{
+		return FALSE;
+	}
+
+	return lpControlSource->PostCommand(playerCommand);
+}
+
+BOOL
+Player::Transport::PostCommand(
+	_In_ PLAYER_COMMAND_TYPE eType,
+	_In_ UINT64 uFrame,
+	_In_ FLOAT fVolume,
+	_In_ BOOL bMute
+)
+{
+	PLAYER_COMMAND playerCommand = {};
+	playerCommand.eType = eType;
+	playerCommand.uFrame = uFrame;
+	playerCommand.fVolume = fVolume;
+	playerCommand.bMute = bMute;
+	return PostCommand(playerCommand);
+}
+
+BOOL Player::Transport::Play() { return PostCommand(PLAYER_COMMAND_PLAY, 0, 0.0f, FALSE); }
+BOOL Player::Transport::Pause() { return PostCommand(PLAYER_COMMAND_PAUSE, 0, 0.0f, FALSE); }
+BOOL Player::Transport::Stop() { return PostCommand(PLAYER_COMMAND_STOP, 0, 0.0f, FALSE); }
+BOOL Player::Transport::Seek(_In_ UINT64 uFrame) { return PostCommand(PLAYER_COMMAND_SEEK, uFrame, 0.0f, FALSE); }
+BOOL Player::Transport::SetVolume(_In_ FLOAT fVolume) { return PostCommand(PLAYER_COMMAND_VOLUME, 0, fVolume, FALSE); }
+BOOL Player::Transport::SetMute(_In_ BOOL bMute) { return PostCommand(PLAYER_COMMAND_MUTE, 0, 0.0f, bMute); }
+BOOL Player::Transport::Next() { return PostCommand(PLAYER_COMMAND_NEXT, 0, 0.0f, FALSE); }
+
+/*************************************************
+* SetEqBand():
+* Send band settings, audio thread ramps
+* filter to them
+*************************************************/
+BOOL
+Player::Transport::SetEqBand(
+	_In_ DWORD dwBand,
+	_In_ const EQ_BAND& eqBand
+)
+{
+	PLAYER_COMMAND playerCommand = {};
+	playerCommand.eType = PLAYER_COMMAND_EQ;
+	playerCommand.dwBand = dwBand;
+	playerCommand.eqBand = eqBand;
+	return PostCommand(playerCommand);
+}
+
+/*************************************************
+* UpdateMarks():
+* Take marks which sink has already reached
+*************************************************/
+VOID
+Player::Transport::UpdateMarks(
+	_In_ UINT64 uSinkFrame
+)
+{
+	while (TRUE)
+	{
+		if (!isNextMark)
+		{
+			isNextMark = lpControlSource->GetMark(&nextMark);
+			if (!isNextMark) { break; }
+		}
+
+		// mark is still in device queue
+		if (nextMark.uOutputFrame > uSinkFrame) { break; }
+
+		currentMark = nextMark;
+		isNextMark = FALSE;
+	}
+}
+
+/*************************************************
+* GetPosition():
+* Track frame which is heard now. Sink clock is
+* backend clock, so position is sample-accurate
+*************************************************/
+UINT64
+Player::Transport::GetPosition()
+{
+	if (!lpControlSource || !lpSink)
+	{
+		return 0;
+	}
+
+	UINT64 uSinkFrame = lpSink->GetPosition();
+	UpdateMarks(uSinkFrame);
+
+	if (currentMark.bPaused || uSinkFrame < currentMark.uOutputFrame)
+	{
+		return currentMark.uSourceFrame;
+	}
+	return currentMark.uSourceFrame + (uSinkFrame - currentMark.uOutputFrame);
+}
+
+/*************************************************
+* IsPaused():
+* Pause or stop is heard now
+*************************************************/
+BOOL
+Player::Transport::IsPaused()
+{
+	GetPosition();
+	return currentMark.bPaused;
+}
@@ -0,0 +1,1159 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio sample format conversion
+**********************************************************
+* WinConvert.cpp
+* Scalar, SSE2 and AVX2 conversion kernels
+* with runtime CPU dispatch
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+#endif
+
+/*************************************************
+* Scalar kernels. Every SIMD kernel gives the same
+* bits: float is clamped to [-1; 1] like maxps/minps
+* do it, scaled and rounded to nearest even
+*************************************************/
+static inline FLOAT
+ClampSample(
+	_In_ FLOAT fValue
+)
+{
+	fValue = fValue > -1.0f ? fValue : -1.0f;
+	return fValue < 1.0f ? fValue : 1.0f;
+}
+
+static VOID
+ToFloatU8(
+	_In_reads_bytes_(dwSamples) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	for (DWORD i = 0; i < dwSamples; i++) { lpDest[i] = (FLOAT)((INT)lpSrc[i] - 128) * (1.0f / 128.0f); }
+}
+
+static VOID
+ToFloatS16(
+	_In_reads_bytes_(dwSamples * 2) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const SHORT* lpSamples = (const SHORT*)lpSrc;
+	for (DWORD i = 0; i < dwSamples; i++) { lpDest[i] = (FLOAT)lpSamples[i] * (1.0f / 32768.0f); }
+}
+
+static VOID
+ToFloatS24(
+	_In_reads_bytes_(dwSamples * 3) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	for (DWORD i = 0; i < dwSamples; i++, lpSrc += 3)
+	{
+		INT iValue = (INT)((UINT)lpSrc[0] << 8 | (UINT)lpSrc[1] << 16 | (UINT)lpSrc[2] << 24);
+		lpDest[i] = (FLOAT)iValue * (1.0f / 2147483648.0f);
+	}
+}
+
+static VOID
+ToFloatS32(
+	_In_reads_bytes_(dwSamples * 4) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const INT* lpSamples = (const INT*)lpSrc;
+	for (DWORD i = 0; i < dwSamples; i++) { lpDest[i] = (FLOAT)lpSamples[i] * (1.0f / 2147483648.0f); }
+}
+
+static VOID
+ToFloatF32(
+	_In_reads_bytes_(dwSamples * 4) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	memcpy(lpDest, lpSrc, dwSamples * sizeof(FLOAT));
+}
+
+static VOID
+ToFloatF64(
+	_In_reads_bytes_(dwSamples * 8) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const double* lpSamples = (const double*)lpSrc;
+	for (DWORD i = 0; i < dwSamples; i++) { lpDest[i] = (FLOAT)lpSamples[i]; }
+}
+
+static VOID
+FromFloatU8(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	for (DWORD i = 0; i < dwSamples; i++)
+	{
+		FLOAT fValue = ClampSample(lpSrc[i]) * 128.0f;
+		lpDest[i] = (BYTE)(lrintf(fValue < 127.0f ? fValue : 127.0f) + 128);
+	}
+}
+
+static VOID
+FromFloatS16(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 2) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	SHORT* lpSamples = (SHORT*)lpDest;
+	for (DWORD i = 0; i < dwSamples; i++)
+	{
+		FLOAT fValue = ClampSample(lpSrc[i]) * 32768.0f;
+		lpSamples[i] = (SHORT)lrintf(fValue < 32767.0f ? fValue : 32767.0f);
+	}
+}
+
+static VOID
+FromFloatS24(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 3) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	for (DWORD i = 0; i < dwSamples; i++, lpDest += 3)
+	{
+		FLOAT fValue = ClampSample(lpSrc[i]) * 8388608.0f;
+		INT iValue = (INT)lrintf(fValue < 8388607.0f ? fValue : 8388607.0f);
+		lpDest[0] = (BYTE)iValue;
+		lpDest[1] = (BYTE)(iValue >> 8);
+		lpDest[2] = (BYTE)(iValue >> 16);
+	}
+}
+
+static VOID
+FromFloatS32(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 4) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	// float has no 2^31 - 1, so scale is done in double
+	INT* lpSamples = (INT*)lpDest;
+	for (DWORD i = 0; i < dwSamples; i++)
+	{
+		double dValue = (double)ClampSample(lpSrc[i]) * 2147483648.0;
+		lpSamples[i] = (INT)lrint(dValue < 2147483647.0 ? dValue : 2147483647.0);
+	}
+}
+
+static VOID
+FromFloatF32(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 4) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	memcpy(lpDest, lpSrc, dwSamples * sizeof(FLOAT));
+}
+
+static VOID
+FromFloatF64(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 8) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	double* lpSamples = (double*)lpDest;
+	for (DWORD i = 0; i < dwSamples; i++) { lpSamples[i] = (double)lpSrc[i]; }
+}
+
+#ifdef CONVERT_X86
+/*************************************************
+* SSE2 kernels. Tail is done by scalar kernel
+*************************************************/
+static VOID
+ToFloatU8Sse2(
+	_In_reads_bytes_(dwSamples) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 bias = _mm_set1_ps(128.0f);
+	const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+	DWORD i = 0;
+	for (; i + 16 <= dwSamples; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(lpSrc + i));
+		__m128i words[2] = { _mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero) };
+		for (DWORD j = 0; j < 2; j++)
+		{
+			__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words[j], zero));
+			__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words[j], zero));
+			_mm_storeu_ps(lpDest + i + j * 8, _mm_mul_ps(_mm_sub_ps(lo, bias), scale));
+			_mm_storeu_ps(lpDest + i + j * 8 + 4, _mm_mul_ps(_mm_sub_ps(hi, bias), scale));
+		}
+	}
+	ToFloatU8(lpSrc + i, lpDest + i, dwSamples - i);
+}
+
+static VOID
+ToFloatS16Sse2(
+	_In_reads_bytes_(dwSamples * 2) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m128i words = _mm_loadu_si128((const __m128i*)(lpSrc + i * 2));
+
+		// sign extension: sample to high word, then arithmetic shift
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16);
+		_mm_storeu_ps(lpDest + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(lpDest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	ToFloatS16(lpSrc + i * 2, lpDest + i, dwSamples - i);
+}
+
+static VOID
+ToFloatS24Sse2(
+	_In_reads_bytes_(dwSamples * 3) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	// SSE2 has no byte shuffle, only conversion is vectorized
+	const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		const BYTE* lpBytes = lpSrc + i * 3;
+		__m128i values = _mm_setr_epi32(
+			(INT)((UINT)lpBytes[0] << 8 | (UINT)lpBytes[1] << 16 | (UINT)lpBytes[2] << 24),
+			(INT)((UINT)lpBytes[3] << 8 | (UINT)lpBytes[4] << 16 | (UINT)lpBytes[5] << 24),
+			(INT)((UINT)lpBytes[6] << 8 | (UINT)lpBytes[7] << 16 | (UINT)lpBytes[8] << 24),
+			(INT)((UINT)lpBytes[9] << 8 | (UINT)lpBytes[10] << 16 | (UINT)lpBytes[11] << 24)
+		);
+		_mm_storeu_ps(lpDest + i, _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+	}
+	ToFloatS24(lpSrc + i * 3, lpDest + i, dwSamples - i);
+}
+
+static VOID
+ToFloatS32Sse2(
+	_In_reads_bytes_(dwSamples * 4) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128i values = _mm_loadu_si128((const __m128i*)(lpSrc + i * 4));
+		_mm_storeu_ps(lpDest + i, _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+	}
+	ToFloatS32(lpSrc + i * 4, lpDest + i, dwSamples - i);
+}
+
+static VOID
+ToFloatF64Sse2(
+	_In_reads_bytes_(dwSamples * 8) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const double* lpSamples = (const double*)lpSrc;
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(lpSamples + i));
+		__m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(lpSamples + i + 2));
+		_mm_storeu_ps(lpDest + i, _mm_movelh_ps(lo, hi));
+	}
+	ToFloatF64(lpSrc + i * 8, lpDest + i, dwSamples - i);
+}
+
+static inline __m128
+ClampSampleSse2(
+	_In_ __m128 values
+)
+{
+	return _mm_min_ps(_mm_max_ps(values, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+}
+
+static VOID
+FromFloatU8Sse2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128 scale = _mm_set1_ps(128.0f);
+	const __m128 limit = _mm_set1_ps(127.0f);
+	const __m128i bias = _mm_set1_epi32(128);
+	DWORD i = 0;
+	for (; i + 16 <= dwSamples; i += 16)
+	{
+		__m128i values[4];
+		for (DWORD j = 0; j < 4; j++)
+		{
+			__m128 scaled = _mm_min_ps(_mm_mul_ps(ClampSampleSse2(_mm_loadu_ps(lpSrc + i + j * 4)), scale), limit);
+			values[j] = _mm_add_epi32(_mm_cvtps_epi32(scaled), bias);
+		}
+		__m128i words = _mm_packus_epi16(_mm_packs_epi32(values[0], values[1]), _mm_packs_epi32(values[2], values[3]));
+		_mm_storeu_si128((__m128i*)(lpDest + i), words);
+	}
+	FromFloatU8(lpSrc + i, lpDest + i, dwSamples - i);
+}
+
+static VOID
+FromFloatS16Sse2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 2) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 limit = _mm_set1_ps(32767.0f);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m128 lo = _mm_min_ps(_mm_mul_ps(ClampSampleSse2(_mm_loadu_ps(lpSrc + i)), scale), limit);
+		__m128 hi = _mm_min_ps(_mm_mul_ps(ClampSampleSse2(_mm_loadu_ps(lpSrc + i + 4)), scale), limit);
+		_mm_storeu_si128((__m128i*)(lpDest + i * 2), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+	}
+	FromFloatS16(lpSrc + i, lpDest + i * 2, dwSamples - i);
+}
+
+static VOID
+FromFloatS24Sse2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 3) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128 scale = _mm_set1_ps(8388608.0f);
+	const __m128 limit = _mm_set1_ps(8388607.0f);
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128 scaled = _mm_min_ps(_mm_mul_ps(ClampSampleSse2(_mm_loadu_ps(lpSrc + i)), scale), limit);
+		INT values[4];
+		_mm_storeu_si128((__m128i*)values, _mm_cvtps_epi32(scaled));
+
+		BYTE* lpBytes = lpDest + i * 3;
+		for (DWORD j = 0; j < 4; j++, lpBytes += 3)
+		{
+			lpBytes[0] = (BYTE)values[j];
+			lpBytes[1] = (BYTE)(values[j] >> 8);
+			lpBytes[2] = (BYTE)(values[j] >> 16);
+		}
+	}
+	FromFloatS24(lpSrc + i, lpDest + i * 3, dwSamples - i);
+}
+
+static VOID
+FromFloatS32Sse2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 4) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m128d scale = _mm_set1_pd(2147483648.0);
+	const __m128d limit = _mm_set1_pd(2147483647.0);
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128 values = ClampSampleSse2(_mm_loadu_ps(lpSrc + i));
+		__m128d lo = _mm_min_pd(_mm_mul_pd(_mm_cvtps_pd(values), scale), limit);
+		__m128d hi = _mm_min_pd(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(values, values)), scale), limit);
+		_mm_storeu_si128((__m128i*)(lpDest + i * 4), _mm_unpacklo_epi64(_mm_cvtpd_epi32(lo), _mm_cvtpd_epi32(hi)));
+	}
+	FromFloatS32(lpSrc + i, lpDest + i * 4, dwSamples - i);
+}
+
+static VOID
+FromFloatF64Sse2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 8) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	double* lpSamples = (double*)lpDest;
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128 values = _mm_loadu_ps(lpSrc + i);
+		_mm_storeu_pd(lpSamples + i, _mm_cvtps_pd(values));
+		_mm_storeu_pd(lpSamples + i + 2, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+	}
+	FromFloatF64(lpSrc + i, lpDest + i * 8, dwSamples - i);
+}
+
+/*************************************************
+* AVX2 kernels. Packed 24-bit data is moved by
+* byte shuffle inside 128-bit lanes
+*************************************************/
+CONVERT_TARGET_AVX2 static VOID
+ToFloatU8Avx2(
+	_In_reads_bytes_(dwSamples) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m256 bias = _mm256_set1_ps(128.0f);
+	const __m256 scale = _mm256_set1_ps(1.0f / 128.0f);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(lpSrc + i)));
+		_mm256_storeu_ps(lpDest + i, _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(values), bias), scale));
+	}
+	ToFloatU8(lpSrc + i, lpDest + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+ToFloatS16Avx2(
+	_In_reads_bytes_(dwSamples * 2) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256i values = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lpSrc + i * 2)));
+		_mm256_storeu_ps(lpDest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale));
+	}
+	ToFloatS16(lpSrc + i * 2, lpDest + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+ToFloatS24Avx2(
+	_In_reads_bytes_(dwSamples * 3) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	// every sample goes to high 3 bytes of int
+	const __m256i shuffle = _mm256_setr_epi8(
+		-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+		-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+	);
+	const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	DWORD i = 0;
+
+	// second lane load reads 4 bytes after 8 samples
+	for (; i + 10 <= dwSamples; i += 8)
+	{
+		const BYTE* lpBytes = lpSrc + i * 3;
+		__m256i bytes = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lpBytes)),
+			_mm_loadu_si128((const __m128i*)(lpBytes + 12)),
+			1
+		);
+		__m256i values = _mm256_shuffle_epi8(bytes, shuffle);
+		_mm256_storeu_ps(lpDest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale));
+	}
+	ToFloatS24(lpSrc + i * 3, lpDest + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+ToFloatS32Avx2(
+	_In_reads_bytes_(dwSamples * 4) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256i values = _mm256_loadu_si256((const __m256i*)(lpSrc + i * 4));
+		_mm256_storeu_ps(lpDest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale));
+	}
+	ToFloatS32(lpSrc + i * 4, lpDest + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+ToFloatF64Avx2(
+	_In_reads_bytes_(dwSamples * 8) const BYTE* lpSrc,
+	_Out_writes_(dwSamples) FLOAT* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const double* lpSamples = (const double*)lpSrc;
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		_mm_storeu_ps(lpDest + i, _mm256_cvtpd_ps(_mm256_loadu_pd(lpSamples + i)));
+		_mm_storeu_ps(lpDest + i + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(lpSamples + i + 4)));
+	}
+	ToFloatF64(lpSrc + i * 8, lpDest + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static inline __m256
+ClampSampleAvx2(
+	_In_ __m256 values
+)
+{
+	return _mm256_min_ps(_mm256_max_ps(values, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+}
+
+CONVERT_TARGET_AVX2 static VOID
+FromFloatU8Avx2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m256 scale = _mm256_set1_ps(128.0f);
+	const __m256 limit = _mm256_set1_ps(127.0f);
+	const __m256i bias = _mm256_set1_epi32(128);
+	const __m256i lanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256 scaled = _mm256_min_ps(_mm256_mul_ps(ClampSampleAvx2(_mm256_loadu_ps(lpSrc + i)), scale), limit);
+		__m256i values = _mm256_add_epi32(_mm256_cvtps_epi32(scaled), bias);
+
+		// packs work inside lanes, low dword of every lane has 4 samples
+		__m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(values, values), _mm256_setzero_si256());
+		bytes = _mm256_permutevar8x32_epi32(bytes, lanes);
+		_mm_storel_epi64((__m128i*)(lpDest + i), _mm256_castsi256_si128(bytes));
+	}
+	FromFloatU8(lpSrc + i, lpDest + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+FromFloatS16Avx2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 2) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 limit = _mm256_set1_ps(32767.0f);
+	DWORD i = 0;
+	for (; i + 16 <= dwSamples; i += 16)
+	{
+		__m256 lo = _mm256_min_ps(_mm256_mul_ps(ClampSampleAvx2(_mm256_loadu_ps(lpSrc + i)), scale), limit);
+		__m256 hi = _mm256_min_ps(_mm256_mul_ps(ClampSampleAvx2(_mm256_loadu_ps(lpSrc + i + 8)), scale), limit);
+
+		// packs interleaves lanes: lo0 hi0 lo1 hi1
+		__m256i words = _mm256_packs_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+		_mm256_storeu_si256((__m256i*)(lpDest + i * 2), _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	FromFloatS16(lpSrc + i, lpDest + i * 2, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+FromFloatS24Avx2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 3) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	// low 3 bytes of every int to first 12 bytes of lane
+	const __m256i shuffle = _mm256_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+	);
+	const __m256 scale = _mm256_set1_ps(8388608.0f);
+	const __m256 limit = _mm256_set1_ps(8388607.0f);
+	DWORD i = 0;
+
+	// every lane store writes 4 bytes more, next store or tail overwrites them
+	for (; i + 10 <= dwSamples; i += 8)
+	{
+		__m256 scaled = _mm256_min_ps(_mm256_mul_ps(ClampSampleAvx2(_mm256_loadu_ps(lpSrc + i)), scale), limit);
+		__m256i bytes = _mm256_shuffle_epi8(_mm256_cvtps_epi32(scaled), shuffle);
+		_mm_storeu_si128((__m128i*)(lpDest + i * 3), _mm256_castsi256_si128(bytes));
+		_mm_storeu_si128((__m128i*)(lpDest + i * 3 + 12), _mm256_extracti128_si256(bytes, 1));
+	}
+	FromFloatS24(lpSrc + i, lpDest + i * 3, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+FromFloatS32Avx2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 4) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	const __m256d scale = _mm256_set1_pd(2147483648.0);
+	const __m256d limit = _mm256_set1_pd(2147483647.0);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256 values = ClampSampleAvx2(_mm256_loadu_ps(lpSrc + i));
+		__m256d lo = _mm256_min_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(values)), scale), limit);
+		__m256d hi = _mm256_min_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(values, 1)), scale), limit);
+		_mm_storeu_si128((__m128i*)(lpDest + i * 4), _mm256_cvtpd_epi32(lo));
+		_mm_storeu_si128((__m128i*)(lpDest + i * 4 + 16), _mm256_cvtpd_epi32(hi));
+	}
+	FromFloatS32(lpSrc + i, lpDest + i * 4, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2 static VOID
+FromFloatF64Avx2(
+	_In_reads_(dwSamples) const FLOAT* lpSrc,
+	_Out_writes_bytes_(dwSamples * 8) BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	double* lpSamples = (double*)lpDest;
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		_mm256_storeu_pd(lpSamples + i, _mm256_cvtps_pd(_mm_loadu_ps(lpSrc + i)));
+		_mm256_storeu_pd(lpSamples + i + 4, _mm256_cvtps_pd(_mm_loadu_ps(lpSrc + i + 4)));
+	}
+	FromFloatF64(lpSrc + i, lpDest + i * 8, dwSamples - i);
+}
+#endif
+
+/*************************************************
+* Kernel tables by CPU and sample format.
+* Float copy is memcpy on all CPUs
+*************************************************/
+static const CONVERT_TO_FLOAT toFloatKernels[CONVERT_ISA_COUNT][SAMPLE_FORMAT_COUNT] =
+{
+	{ NULL, ToFloatU8, ToFloatS16, ToFloatS24, ToFloatS32, ToFloatF32, ToFloatF64 },
+#ifdef CONVERT_X86
+	{ NULL, ToFloatU8Sse2, ToFloatS16Sse2, ToFloatS24Sse2, ToFloatS32Sse2, ToFloatF32, ToFloatF64Sse2 },
+	{ NULL, ToFloatU8Avx2, ToFloatS16Avx2, ToFloatS24Avx2, ToFloatS32Avx2, ToFloatF32, ToFloatF64Avx2 }
+#else
+	{ NULL, ToFloatU8, ToFloatS16, ToFloatS24, ToFloatS32, ToFloatF32, ToFloatF64 },
+	{ NULL, ToFloatU8, ToFloatS16, ToFloatS24, ToFloatS32, ToFloatF32, ToFloatF64 }
+#endif
+};
+
+static const CONVERT_FROM_FLOAT fromFloatKernels[CONVERT_ISA_COUNT][SAMPLE_FORMAT_COUNT] =
+{
+	{ NULL, FromFloatU8, FromFloatS16, FromFloatS24, FromFloatS32, FromFloatF32, FromFloatF64 },
+#ifdef CONVERT_X86
+	{ NULL, FromFloatU8Sse2, FromFloatS16Sse2, FromFloatS24Sse2, FromFloatS32Sse2, FromFloatF32, FromFloatF64Sse2 },
+	{ NULL, FromFloatU8Avx2, FromFloatS16Avx2, FromFloatS24Avx2, FromFloatS32Avx2, FromFloatF32, FromFloatF64Avx2 }
+#else
+	{ NULL, FromFloatU8, FromFloatS16, FromFloatS24, FromFloatS32, FromFloatF32, FromFloatF64 },
+	{ NULL, FromFloatU8, FromFloatS16, FromFloatS24, FromFloatS32, FromFloatF32, FromFloatF64 }
+#endif
+};
+
+static CONVERT_ISA eSelectedIsa = CONVERT_ISA_SCALAR;
+
+/*************************************************
+* GetCpuIsa():
+* Best instruction set of CPU and OS
+*************************************************/
+static CONVERT_ISA
+GetCpuIsa()
+{
+#if defined(CONVERT_X86) && defined(_WIN32)
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) { return CONVERT_ISA_SCALAR; }
+
+	// AVX2 needs OS to save YMM registers (OSXSAVE and XCR0 bits 1, 2)
+	int iInfo[4] = {};
+	__cpuid(iInfo, 1);
+	if (!(iInfo[2] & (1 << 27)) || !(iInfo[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6) { return CONVERT_ISA_SSE2; }
+	__cpuidex(iInfo, 7, 0);
+	return (iInfo[1] & (1 << 5)) ? CONVERT_ISA_AVX2 : CONVERT_ISA_SSE2;
+#elif defined(CONVERT_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) { return CONVERT_ISA_AVX2; }
+	return __builtin_cpu_supports("sse2") ? CONVERT_ISA_SSE2 : CONVERT_ISA_SCALAR;
+#else
+	return CONVERT_ISA_SCALAR;
+#endif
+}
+
+/*************************************************
+* InitConvertKernels():
+* Choose kernels by CPU once at startup.
+* eMaxIsa can limit them for testing
+*************************************************/
+CONVERT_ISA
+InitConvertKernels(
+	_In_ CONVERT_ISA eMaxIsa
+)
+{
+	eSelectedIsa = min(GetCpuIsa(), eMaxIsa);
+	return eSelectedIsa;
+}
+
+CONVERT_ISA GetConvertIsa() { return eSelectedIsa; }
+
+/*************************************************
+* GetConvertIsaByName():
+* Instruction set from launch param value,
+* unknown name doesn't limit kernels
+*************************************************/
+CONVERT_ISA
+GetConvertIsaByName(
+	_In_opt_ LPCSTR lpName
+)
+{
+	if (lpName && !strncmp(lpName, "scalar", 6)) { return CONVERT_ISA_SCALAR; }
+	if (lpName && !strncmp(lpName, "sse2", 4)) { return CONVERT_ISA_SSE2; }
+	return CONVERT_ISA_AVX2;
+}
+
+/*************************************************
+* GetConvertIsaName():
+* Name of instruction set for logs
+*************************************************/
+LPCSTR
+GetConvertIsaName(
+	_In_ CONVERT_ISA eIsa
+)
+{
+	switch (eIsa)
+	{
+	case CONVERT_ISA_SSE2:	return "sse2";
+	case CONVERT_ISA_AVX2:	return "avx2";
+	default:				return "scalar";
+	}
+}
+
+CONVERT_TO_FLOAT
+GetToFloatKernel(
+	_In_ CONVERT_ISA eIsa,
+	_In_ SAMPLE_FORMAT eFormat
+)
+{
+	return (eIsa < CONVERT_ISA_COUNT && eFormat < SAMPLE_FORMAT_COUNT) ? toFloatKernels[eIsa][eFormat] : NULL;
+}
+
+CONVERT_FROM_FLOAT
+GetFromFloatKernel(
+	_In_ CONVERT_ISA eIsa,
+	_In_ SAMPLE_FORMAT eFormat
+)
+{
+	return (eIsa < CONVERT_ISA_COUNT && eFormat < SAMPLE_FORMAT_COUNT) ? fromFloatKernels[eIsa][eFormat] : NULL;
+}
+
+/*************************************************
+* GetSampleFormat():
+* Sample format of wave format, extensible
+* format is taken by SubFormat
+*************************************************/
+SAMPLE_FORMAT
+GetSampleFormat(
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	WORD wFormatTag = lpFormat->wFormatTag;
+	if (wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+	{
+		if (lpFormat->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) { return SAMPLE_FORMAT_UNKNOWN; }
+		wFormatTag = (WORD)((const WAVEFORMATEXTENSIBLE*)lpFormat)->SubFormat.Data1;
+	}
+
+	// 24-bit data in 32-bit container is not packed
+	if (lpFormat->nChannels && lpFormat->nBlockAlign != lpFormat->nChannels * ((lpFormat->wBitsPerSample + 7) / 8))
+	{
+		return SAMPLE_FORMAT_UNKNOWN;
+	}
+
+	if (wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+	{
+		switch (lpFormat->wBitsPerSample)
+		{
+		case 32:	return SAMPLE_FORMAT_F32;
+		case 64:	return SAMPLE_FORMAT_F64;
+		default:	return SAMPLE_FORMAT_UNKNOWN;
+		}
+	}
+	if (wFormatTag != WAVE_FORMAT_PCM) { return SAMPLE_FORMAT_UNKNOWN; }
+
+	switch (lpFormat->wBitsPerSample)
+	{
+	case 8:		return SAMPLE_FORMAT_U8;
+	case 16:	return SAMPLE_FORMAT_S16;
+	case 24:	return SAMPLE_FORMAT_S24;
+	case 32:	return SAMPLE_FORMAT_S32;
+	default:	return SAMPLE_FORMAT_UNKNOWN;
+	}
+}
+
+DWORD
+GetSampleBytes(
+	_In_ SAMPLE_FORMAT eFormat
+)
+{
+	static const DWORD dwBytes[SAMPLE_FORMAT_COUNT] = { 0, 1, 2, 3, 4, 4, 8 };
+	return eFormat < SAMPLE_FORMAT_COUNT ? dwBytes[eFormat] : 0;
+}
+
+LPCSTR
+GetSampleFormatName(
+	_In_ SAMPLE_FORMAT eFormat
+)
+{
+	static const LPCSTR lpNames[SAMPLE_FORMAT_COUNT] = { "unknown", "u8", "s16", "s24", "s32", "f32", "f64" };
+	return eFormat < SAMPLE_FORMAT_COUNT ? lpNames[eFormat] : lpNames[0];
+}
+
+/*************************************************
+* SetSampleFormat():
+* Change sample format of wave format,
+* channels and sample rate are kept
+*************************************************/
+VOID
+SetSampleFormat(
+	_Inout_ WAVEFORMATEX* lpFormat,
+	_In_ SAMPLE_FORMAT eFormat
+)
+{
+	lpFormat->wFormatTag = (eFormat == SAMPLE_FORMAT_F32 || eFormat == SAMPLE_FORMAT_F64) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+	lpFormat->wBitsPerSample = (WORD)(GetSampleBytes(eFormat) * 8);
+	lpFormat->nBlockAlign = (WORD)(GetSampleBytes(eFormat) * lpFormat->nChannels);
+	lpFormat->nAvgBytesPerSec = lpFormat->nSamplesPerSec * lpFormat->nBlockAlign;
+	lpFormat->cbSize = 0;
+}
+
+/*************************************************
+* ConvertSamples():
+* Any format to any other through float.
+* Float side is one chunk on stack
+*************************************************/
+VOID
+ConvertSamples(
+	_In_ SAMPLE_FORMAT eSrcFormat,
+	_In_ const BYTE* lpSrc,
+	_In_ SAMPLE_FORMAT eDestFormat,
+	_Out_ BYTE* lpDest,
+	_In_ DWORD dwSamples
+)
+{
+	if (eSrcFormat == eDestFormat)
+	{
+		memcpy(lpDest, lpSrc, dwSamples * GetSampleBytes(eSrcFormat));
+		return;
+	}
+
+	CONVERT_TO_FLOAT lpToFloat = toFloatKernels[eSelectedIsa][eSrcFormat];
+	CONVERT_FROM_FLOAT lpFromFloat = fromFloatKernels[eSelectedIsa][eDestFormat];
+	if (eSrcFormat == SAMPLE_FORMAT_F32)
+	{
+		lpFromFloat((const FLOAT*)lpSrc, lpDest, dwSamples);
+		return;
+	}
+	if (eDestFormat == SAMPLE_FORMAT_F32)
+	{
+		lpToFloat(lpSrc, (FLOAT*)lpDest, dwSamples);
+		return;
+	}
+
+	FLOAT fChunk[CONVERT_CHUNK_SAMPLES];
+	DWORD dwSrcBytes = GetSampleBytes(eSrcFormat);
+	DWORD dwDestBytes = GetSampleBytes(eDestFormat);
+	for (DWORD i = 0; i < dwSamples; i += CONVERT_CHUNK_SAMPLES)
+	{
+		DWORD dwCount = min(dwSamples - i, (DWORD)CONVERT_CHUNK_SAMPLES);
+		lpToFloat(lpSrc + i * dwSrcBytes, fChunk, dwCount);
+		lpFromFloat(fChunk, lpDest + i * dwDestBytes, dwCount);
+	}
+}
+
+/*************************************************
+* RunConvertBenchmark():
+* Speed of every kernel on every instruction
+* set of this CPU, in GB/s of integer side
+*************************************************/
+VOID
+RunConvertBenchmark(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	const DWORD dwSamples = 1 << 20;
+	FLOAT* lpFloats = new FLOAT[dwSamples];
+	BYTE* lpBytes = new BYTE[dwSamples * sizeof(double)];
+	for (DWORD i = 0; i < dwSamples; i++)
+	{
+		lpFloats[i] = (FLOAT)((i * 2654435761u) >> 8) / 8388608.0f - 1.0f;
+	}
+
+	int iWritten = snprintf(lpText, dwSize, "Kernel, GB/s (selected: %s)\n", GetConvertIsaName(eSelectedIsa));
+	DWORD dwOffset = iWritten > 0 ? min((DWORD)iWritten, dwSize) : 0;
+
+	CONVERT_ISA eCpuIsa = GetCpuIsa();
+	for (DWORD dwIsa = 0; dwIsa <= (DWORD)eCpuIsa; dwIsa++)
+	{
+		for (DWORD dwFormat = SAMPLE_FORMAT_U8; dwFormat < SAMPLE_FORMAT_COUNT; dwFormat++)
+		{
+			if (dwFormat == SAMPLE_FORMAT_F32) { continue; }
+
+			double dSeconds[2] = {};
+			DWORD dwRuns = 0;
+			auto startTime = std::chrono::steady_clock::now();
+
+			// repeat until time is measurable
+			while (dSeconds[0] + dSeconds[1] < 0.1)
+			{
+				auto runTime = std::chrono::steady_clock::now();
+				fromFloatKernels[dwIsa][dwFormat](lpFloats, lpBytes, dwSamples);
+				auto midTime = std::chrono::steady_clock::now();
+				toFloatKernels[dwIsa][dwFormat](lpBytes, lpFloats, dwSamples);
+				dSeconds[0] += std::chrono::duration<double>(midTime - runTime).count();
+				dSeconds[1] += std::chrono::duration<double>(std::chrono::steady_clock::now() - midTime).count();
+				dwRuns++;
+				if (std::chrono::steady_clock::now() - startTime > std::chrono::seconds(2)) { break; }
+			}
+
+			double dBytes = (double)dwSamples * GetSampleBytes((SAMPLE_FORMAT)dwFormat) * dwRuns;
+			iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%s->f32 %s: %.2f, f32->%s %s: %.2f\n",
+				GetSampleFormatName((SAMPLE_FORMAT)dwFormat), GetConvertIsaName((CONVERT_ISA)dwIsa), dBytes / max(dSeconds[1], 1e-9) / 1e9,
+				GetSampleFormatName((SAMPLE_FORMAT)dwFormat), GetConvertIsaName((CONVERT_ISA)dwIsa), dBytes / max(dSeconds[0], 1e-9) / 1e9);
+			if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+		}
+	}
+
+	// kernels of specialized table, stereo stream
+	for (DWORD dwFormat = SAMPLE_FORMAT_U8; dwFormat < SAMPLE_FORMAT_COUNT; dwFormat++)
+	{
+		if (dwFormat == SAMPLE_FORMAT_F32) { continue; }
+
+		CONVERT_FRAMES lpFromFloat = GetConvertFramesKernel(SAMPLE_FORMAT_F32, (SAMPLE_FORMAT)dwFormat, 2);
+		CONVERT_FRAMES lpToFloat = GetConvertFramesKernel((SAMPLE_FORMAT)dwFormat, SAMPLE_FORMAT_F32, 2);
+		double dSeconds[2] = {};
+		DWORD dwRuns = 0;
+		auto startTime = std::chrono::steady_clock::now();
+
+		while (dSeconds[0] + dSeconds[1] < 0.1)
+		{
+			auto runTime = std::chrono::steady_clock::now();
+			lpFromFloat((const BYTE*)lpFloats, lpBytes, dwSamples / 2, 2);
+			auto midTime = std::chrono::steady_clock::now();
+			lpToFloat(lpBytes, (BYTE*)lpFloats, dwSamples / 2, 2);
+			dSeconds[0] += std::chrono::duration<double>(midTime - runTime).count();
+			dSeconds[1] += std::chrono::duration<double>(std::chrono::steady_clock::now() - midTime).count();
+			dwRuns++;
+			if (std::chrono::steady_clock::now() - startTime > std::chrono::seconds(2)) { break; }
+		}
+
+		double dBytes = (double)dwSamples * GetSampleBytes((SAMPLE_FORMAT)dwFormat) * dwRuns;
+		iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%s->f32 stereo table: %.2f, f32->%s stereo table: %.2f\n",
+			GetSampleFormatName((SAMPLE_FORMAT)dwFormat), dBytes / max(dSeconds[1], 1e-9) / 1e9,
+			GetSampleFormatName((SAMPLE_FORMAT)dwFormat), dBytes / max(dSeconds[0], 1e-9) / 1e9);
+		if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+	}
+
+	delete[] lpFloats;
+	delete[] lpBytes;
+}
+
+/*************************************************
+* NegotiateFormat():
+* Format for sink: source format if sink takes
+* it, else float, else 16-bit PCM. Rate is the
+* source or forced one, else common device rates.
+* Channels are forced or source ones, else stereo
+*************************************************/
+BOOL
+Player::NegotiateFormat(
+	_In_ AudioSink* lpSink,
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ DWORD dwRate,
+	_In_ DWORD dwChannels,
+	_Out_ WAVEFORMATEX* lpSinkFormat
+)
+{
+	*lpSinkFormat = *lpFormat;
+	if (GetSampleFormat(lpFormat) == SAMPLE_FORMAT_UNKNOWN) { return FALSE; }
+
+	const DWORD dwChannelCounts[] = { (dwChannels && dwChannels <= MIX_MAX_CHANNELS) ? dwChannels : lpFormat->nChannels, 2 };
+	const DWORD dwRates[] = { dwRate ? dwRate : lpFormat->nSamplesPerSec, 48000, 44100, 96000 };
+	for (DWORD c = 0; c < sizeof(dwChannelCounts) / sizeof(DWORD); c++)
+	{
+		if (c && dwChannelCounts[c] == dwChannelCounts[0]) { continue; }
+
+		for (DWORD i = 0; i < sizeof(dwRates) / sizeof(DWORD); i++)
+		{
+			if (i && dwRates[i] == dwRates[0]) { continue; }
+
+			*lpSinkFormat = *lpFormat;
+			lpSinkFormat->nSamplesPerSec = dwRates[i];
+			lpSinkFormat->nAvgBytesPerSec = dwRates[i] * lpSinkFormat->nBlockAlign;
+			if (lpFormat->wFormatTag != WAVE_FORMAT_EXTENSIBLE && dwChannelCounts[c] == lpFormat->nChannels &&
+				lpSink->IsFormatSupported(lpSinkFormat))
+			{
+				return TRUE;
+			}
+
+			lpSinkFormat->nChannels = (WORD)dwChannelCounts[c];
+			SetSampleFormat(lpSinkFormat, SAMPLE_FORMAT_F32);
+			if (lpSink->IsFormatSupported(lpSinkFormat)) { return TRUE; }
+
+			SetSampleFormat(lpSinkFormat, SAMPLE_FORMAT_S16);
+			if (lpSink->IsFormatSupported(lpSinkFormat)) { return TRUE; }
+		}
+	}
+	return FALSE;
+}
+
+/*************************************************
+* ConvertSource():
+* Constructor
+*************************************************/
+Player::ConvertSource::ConvertSource() :
+	lpSource(NULL),
+	eSourceFormat(SAMPLE_FORMAT_UNKNOWN),
+	eDestFormat(SAMPLE_FORMAT_UNKNOWN),
+	dwChannels(0),
+	lpConvertFrames(NULL),
+	lpScratch(NULL),
+	dwScratchFrames(0),
+	eDither(DITHER_NONE),
+	dwDitherSeed(DITHER_SEED),
+	isDithered(FALSE)
+{
+	ResetDither(&ditherState, dwDitherSeed);
+}
+
+Player::ConvertSource::~ConvertSource()
+{
+	delete[] lpScratch;
+}
+
+/*************************************************
+* SetDither():
+* Dither of next SetSource, used only from
+* float to formats of GetDitherLsb
+*************************************************/
+VOID
+Player::ConvertSource::SetDither(
+	_In_ DITHER_MODE eMode,
+	_In_ DWORD dwSeed
+)
+{
+	eDither = eMode;
+	dwDitherSeed = dwSeed;
+}
+
+/*************************************************
+* SetSource():
+* Attach upstream, scratch buffer is allocated
+* here and never on audio thread
+*************************************************/
+BOOL
+Player::ConvertSource::SetSource(
+	_In_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpSourceFormat,
+	_In_ const WAVEFORMATEX* lpDestFormat
+)
+{
+	lpSource = lpUpstream;
+	eSourceFormat = GetSampleFormat(lpSourceFormat);
+	eDestFormat = GetSampleFormat(lpDestFormat);
+	dwChannels = lpSourceFormat->nChannels;
+
+	delete[] lpScratch;
+	lpScratch = NULL;
+	dwScratchFrames = 0;
+
+	if (eSourceFormat == SAMPLE_FORMAT_UNKNOWN || eDestFormat == SAMPLE_FORMAT_UNKNOWN ||
+		!dwChannels || dwChannels != lpDestFormat->nChannels)
+	{
+		lpSource = NULL;
+		return FALSE;
+	}
+
+	// kernel is taken once per stream. SIMD kernels are faster
+	// if one side is float, other pairs are converted without float pivot
+	BOOL isFloatPair = eSourceFormat == SAMPLE_FORMAT_F32 || eDestFormat == SAMPLE_FORMAT_F32;
+	lpConvertFrames = isFloatPair && GetConvertIsa() != CONVERT_ISA_SCALAR ? NULL :
+		GetConvertFramesKernel(eSourceFormat, eDestFormat, dwChannels);
+
+	// dither goes between float and from-float kernel
+	isDithered = eDither != DITHER_NONE && eSourceFormat == SAMPLE_FORMAT_F32 && GetDitherLsb(eDestFormat) &&
+		dwChannels <= MIX_MAX_CHANNELS;
+	if (isDithered) { lpConvertFrames = NULL; }
+	ResetDither(&ditherState, dwDitherSeed);
+
+	if (eSourceFormat != eDestFormat)
+	{
+		dwScratchFrames = max(CONVERT_CHUNK_SAMPLES / dwChannels, 1UL);
+		lpScratch = new BYTE[dwScratchFrames * dwChannels * GetSampleBytes(eSourceFormat)];
+	}
+	return TRUE;
+}
+
+/*************************************************
+* ReadFrames():
+* Read upstream by chunks and convert it
+*************************************************/
+DWORD
+Player::ConvertSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpSource) { return 0; }
+	if (!lpScratch) { return lpSource->ReadFrames(lpDest, dwFrames); }
+
+	DWORD dwDestFrameBytes = dwChannels * GetSampleBytes(eDestFormat);
+	DWORD dwWritten = 0;
+	while (dwWritten < dwFrames)
+	{
+		DWORD dwChunk = min(dwFrames - dwWritten, dwScratchFrames);
+		DWORD dwRead = lpSource->ReadFrames(lpScratch, dwChunk);
+		BYTE* lpChunkDest = lpDest + dwWritten * dwDestFrameBytes;
+		if (isDithered)
+		{
+			DitherSamples(&ditherState, eDither, GetConvertIsa(), eDestFormat, (FLOAT*)lpScratch, dwRead, dwChannels);
+			ConvertSamples(eSourceFormat, lpScratch, eDestFormat, lpChunkDest, dwRead * dwChannels);
+		}
+		else if (lpConvertFrames)
+		{
+			lpConvertFrames(lpScratch, lpChunkDest, dwRead, dwChannels);
+		}
+		else
+		{
+			ConvertSamples(eSourceFormat, lpScratch, eDestFormat, lpChunkDest, dwRead * dwChannels);
+		}
+		dwWritten += dwRead;
+		if (dwRead < dwChunk) { break; }
+	}
+	return dwWritten;
+}
+
+/*************************************************
+* SeekFrame():
+* Dither starts again from seed, so frames
+* after seek are same on every run
+*************************************************/
+BOOL
+Player::ConvertSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	if (!lpSource || !lpSource->SeekFrame(uFrame)) { return FALSE; }
+	ResetDither(&ditherState, dwDitherSeed);
+	return TRUE;
+}
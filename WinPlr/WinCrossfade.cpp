@@ -0,0 +1,402 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio track crossfade
+**********************************************************
+* WinCrossfade.cpp
+* Sample-accurate crossfades between queued tracks
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+static const LPCSTR lpCurveNames[] = { "linear", "equal_power", "s_curve" };
+
+/*************************************************
+* GetCrossfadeCurveByName():
+* Curve from launch param value, equal power
+* if name is unknown
+*************************************************/
+CROSSFADE_CURVE
+GetCrossfadeCurveByName(
+	_In_opt_ LPCSTR lpName
+)
+{
+	for (DWORD i = 0; lpName && i < sizeof(lpCurveNames) / sizeof(LPCSTR); i++)
+	{
+		if (!strncmp(lpName, lpCurveNames[i], strlen(lpCurveNames[i]))) { return (CROSSFADE_CURVE)i; }
+	}
+	return CROSSFADE_EQUAL_POWER;
+}
+
+LPCSTR
+GetCrossfadeCurveName(
+	_In_ CROSSFADE_CURVE eCurve
+)
+{
+	return (DWORD)eCurve < sizeof(lpCurveNames) / sizeof(LPCSTR) ? lpCurveNames[eCurve] : "unknown";
+}
+
+/*************************************************
+* CrossfadeSource():
+* Constructor
+*************************************************/
+Player::CrossfadeSource::CrossfadeSource() :
+	dwChannels(0),
+	dwFadeFrames(0),
+	dwCapacity(0),
+	eCurve(CROSSFADE_EQUAL_POWER),
+	lpApplyGain(NULL),
+	lpMixPlane(NULL),
+	dwCurrentDeck(CROSSFADE_DECK_COUNT),
+	isFading(FALSE),
+	dwFadeLength(0),
+	dwFadePosition(0),
+	lpScratch(NULL)
+{
+	for (DWORD i = 0; i < CROSSFADE_DECK_COUNT; i++)
+	{
+		lpDeckSources[i] = NULL;
+		lpDeckRings[i] = NULL;
+		dwDeckHeads[i] = 0;
+		dwDeckFrames[i] = 0;
+		bDeckEnded[i] = FALSE;
+		dwDeckStates[i] = CROSSFADE_DECK_FREE;
+	}
+}
+
+Player::CrossfadeSource::~CrossfadeSource()
+{
+	FreeBuffers();
+}
+
+VOID
+Player::CrossfadeSource::FreeBuffers()
+{
+	for (DWORD i = 0; i < CROSSFADE_DECK_COUNT; i++)
+	{
+		delete[] lpDeckRings[i];
+		lpDeckRings[i] = NULL;
+	}
+	delete[] lpScratch;
+	lpScratch = NULL;
+}
+
+/*************************************************
+* SetFormat():
+* Float format of every deck. Rings are
+* allocated here and never on audio thread.
+* Call it only when no sink is pulling frames
+*************************************************/
+BOOL
+Player::CrossfadeSource::SetFormat(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ DWORD dwNewFadeFrames,
+	_In_ CROSSFADE_CURVE eNewCurve
+)
+{
+	FreeBuffers();
+	dwChannels = 0;
+	if (GetSampleFormat(lpFormat) != SAMPLE_FORMAT_F32 || !lpFormat->nChannels) { return FALSE; }
+
+	dwChannels = lpFormat->nChannels;
+	dwFadeFrames = dwNewFadeFrames;
+	dwCapacity = dwFadeFrames + CROSSFADE_BLOCK_FRAMES;
+	eCurve = eNewCurve;
+	lpApplyGain = GetApplyGainKernel();
+	lpMixPlane = GetMixPlaneKernel();
+
+	for (DWORD i = 0; i < CROSSFADE_DECK_COUNT; i++)
+	{
+		lpDeckRings[i] = new FLOAT[(size_t)dwCapacity * dwChannels];
+		lpDeckSources[i] = NULL;
+		dwDeckHeads[i] = 0;
+		dwDeckFrames[i] = 0;
+		bDeckEnded[i] = FALSE;
+		dwDeckStates[i].store(CROSSFADE_DECK_FREE, std::memory_order_relaxed);
+	}
+	lpScratch = new FLOAT[CROSSFADE_SEGMENT_FRAMES * dwChannels];
+
+	dwCurrentDeck = CROSSFADE_DECK_COUNT;
+	isFading = FALSE;
+	return TRUE;
+}
+
+/*************************************************
+* IsDeckFree():
+* Deck isn't used by audio thread, so its
+* upstream can be changed
+*************************************************/
+BOOL
+Player::CrossfadeSource::IsDeckFree(
+	_In_ DWORD dwDeck
+)
+{
+	return dwDeck < CROSSFADE_DECK_COUNT && dwDeckStates[dwDeck].load(std::memory_order_acquire) == CROSSFADE_DECK_FREE;
+}
+
+/*************************************************
+* ReadAhead():
+* Read upstream frames to ring of deck
+*************************************************/
+static DWORD
+ReadAhead(
+	_In_ Player::AudioSource* lpSource,
+	_Inout_ FLOAT* lpRing,
+	_In_ DWORD dwCapacity,
+	_In_ DWORD dwChannels,
+	_In_ DWORD dwHead,
+	_Inout_ DWORD* lpFrames,
+	_Inout_ BOOL* lpEnded,
+	_In_ DWORD dwWanted
+)
+{
+	DWORD dwTotal = 0;
+	while (dwWanted && !*lpEnded)
+	{
+		DWORD dwTail = (dwHead + *lpFrames) % dwCapacity;
+		DWORD dwChunk = min(dwWanted, dwCapacity - dwTail);
+		DWORD dwRead = lpSource->ReadFrames((BYTE*)(lpRing + (size_t)dwTail * dwChannels), dwChunk);
+
+		*lpFrames += dwRead;
+		dwWanted -= dwRead;
+		dwTotal += dwRead;
+		if (dwRead < dwChunk) { *lpEnded = TRUE; }
+	}
+	return dwTotal;
+}
+
+/*************************************************
+* QueueTrack():
+* Prime free deck with fade length of track on
+* control thread, then give it to audio thread.
+* Overlap never waits for upstream of new track
+*************************************************/
+BOOL
+Player::CrossfadeSource::QueueTrack(
+	_In_ DWORD dwDeck,
+	_In_ AudioSource* lpTrack
+)
+{
+	if (!dwChannels || !IsDeckFree(dwDeck)) { return FALSE; }
+
+	lpDeckSources[dwDeck] = lpTrack;
+	dwDeckHeads[dwDeck] = 0;
+	dwDeckFrames[dwDeck] = 0;
+	bDeckEnded[dwDeck] = FALSE;
+	ReadAhead(lpTrack, lpDeckRings[dwDeck], dwCapacity, dwChannels, 0, &dwDeckFrames[dwDeck], &bDeckEnded[dwDeck], dwFadeFrames);
+
+	dwDeckStates[dwDeck].store(CROSSFADE_DECK_READY, std::memory_order_release);
+	return TRUE;
+}
+
+/*************************************************
+* FillDeck():
+* Keep fade length read ahead after next
+* frames. Read is limited to twice of taken
+* frames, so refill after seek is spread
+*************************************************/
+VOID
+Player::CrossfadeSource::FillDeck(
+	_In_ DWORD dwDeck,
+	_In_ DWORD dwFrames
+)
+{
+	DWORD dwTarget = min(dwFadeFrames + dwFrames, dwCapacity);
+	if (bDeckEnded[dwDeck] || dwDeckFrames[dwDeck] >= dwTarget) { return; }
+
+	DWORD dwWanted = min(dwTarget - dwDeckFrames[dwDeck], dwFrames * 2);
+	ReadAhead(lpDeckSources[dwDeck], lpDeckRings[dwDeck], dwCapacity, dwChannels, dwDeckHeads[dwDeck],
+		&dwDeckFrames[dwDeck], &bDeckEnded[dwDeck], dwWanted);
+}
+
+/*************************************************
+* PopFrames():
+* Take oldest frames of deck ring
+*************************************************/
+DWORD
+Player::CrossfadeSource::PopFrames(
+	_In_ DWORD dwDeck,
+	_Out_writes_(dwFrames * dwChannels) FLOAT* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	dwFrames = min(dwFrames, dwDeckFrames[dwDeck]);
+	DWORD dwFirst = min(dwFrames, dwCapacity - dwDeckHeads[dwDeck]);
+	const FLOAT* lpRing = lpDeckRings[dwDeck];
+
+	memcpy(lpDest, lpRing + (size_t)dwDeckHeads[dwDeck] * dwChannels, (size_t)dwFirst * dwChannels * sizeof(FLOAT));
+	memcpy(lpDest + (size_t)dwFirst * dwChannels, lpRing, (size_t)(dwFrames - dwFirst) * dwChannels * sizeof(FLOAT));
+
+	dwDeckHeads[dwDeck] = (dwDeckHeads[dwDeck] + dwFrames) % dwCapacity;
+	dwDeckFrames[dwDeck] -= dwFrames;
+	return dwFrames;
+}
+
+/*************************************************
+* GetCurveGain():
+* Gain of outgoing or incoming track at frame
+* of fade
+*************************************************/
+FLOAT
+Player::CrossfadeSource::GetCurveGain(
+	_In_ DWORD dwPosition,
+	_In_ BOOL isIncoming
+)
+{
+	static const FLOAT fHalfPi = 1.57079632679f;
+	FLOAT x = (FLOAT)dwPosition / (FLOAT)dwFadeLength;
+
+	switch (eCurve)
+	{
+	case CROSSFADE_LINEAR:		return isIncoming ? x : 1.0f - x;
+	case CROSSFADE_S_CURVE:
+	{
+		FLOAT fIn = x * x * (3.0f - 2.0f * x);
+		return isIncoming ? fIn : 1.0f - fIn;
+	}
+	default:					return isIncoming ? sinf(x * fHalfPi) : cosf(x * fHalfPi);
+	}
+}
+
+/*************************************************
+* MixFade():
+* Outgoing frames to output, incoming frames
+* to scratch, both scaled by curve segments and
+* summed. Returns frames of fade written
+*************************************************/
+DWORD
+Player::CrossfadeSource::MixFade(
+	_Out_writes_(dwFrames * dwChannels) FLOAT* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	DWORD dwIncomingDeck = (dwCurrentDeck + 1) % CROSSFADE_DECK_COUNT;
+	DWORD dwDone = 0;
+
+	while (dwDone < dwFrames && dwFadePosition < dwFadeLength)
+	{
+		DWORD dwSegment = min(min(dwFrames - dwDone, dwFadeLength - dwFadePosition), (DWORD)CROSSFADE_SEGMENT_FRAMES);
+		FLOAT* lpOutput = lpDest + (size_t)dwDone * dwChannels;
+
+		DWORD dwOutgoing = PopFrames(dwCurrentDeck, lpOutput, dwSegment);
+		memset(lpOutput + dwOutgoing * dwChannels, 0, (dwSegment - dwOutgoing) * dwChannels * sizeof(FLOAT));
+
+		// incoming track runs concurrently and keeps its read ahead
+		FillDeck(dwIncomingDeck, dwSegment);
+		DWORD dwIncoming = PopFrames(dwIncomingDeck, lpScratch, dwSegment);
+		memset(lpScratch + dwIncoming * dwChannels, 0, (dwSegment - dwIncoming) * dwChannels * sizeof(FLOAT));
+
+		FLOAT fOut = GetCurveGain(dwFadePosition, FALSE);
+		FLOAT fIn = GetCurveGain(dwFadePosition, TRUE);
+		FLOAT fOutStep = (GetCurveGain(dwFadePosition + dwSegment, FALSE) - fOut) / (FLOAT)dwSegment;
+		FLOAT fInStep = (GetCurveGain(dwFadePosition + dwSegment, TRUE) - fIn) / (FLOAT)dwSegment;
+		lpApplyGain(lpOutput, dwSegment, dwChannels, fOut, fOutStep);
+		lpApplyGain(lpScratch, dwSegment, dwChannels, fIn, fInStep);
+		lpMixPlane(lpOutput, lpScratch, 1.0f, dwSegment * dwChannels);
+
+		dwDone += dwSegment;
+		dwFadePosition += dwSegment;
+	}
+	return dwDone;
+}
+
+/*************************************************
+* ReadFrames():
+* Frames of current deck. When deck source is
+* ended and next track is ready, the rest of
+* read ahead is faded into next track
+*************************************************/
+DWORD
+Player::CrossfadeSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!dwChannels) { return 0; }
+
+	FLOAT* lpOutput = (FLOAT*)lpDest;
+	DWORD dwWritten = 0;
+	while (dwWritten < dwFrames)
+	{
+		// first track, or next track was queued after end of previous one
+		if (dwCurrentDeck == CROSSFADE_DECK_COUNT)
+		{
+			for (DWORD i = 0; i < CROSSFADE_DECK_COUNT && dwCurrentDeck == CROSSFADE_DECK_COUNT; i++)
+			{
+				if (dwDeckStates[i].load(std::memory_order_acquire) == CROSSFADE_DECK_READY) { dwCurrentDeck = i; }
+			}
+			if (dwCurrentDeck == CROSSFADE_DECK_COUNT) { break; }
+			dwDeckStates[dwCurrentDeck].store(CROSSFADE_DECK_PLAYING, std::memory_order_relaxed);
+		}
+
+		DWORD dwBlock = min(dwFrames - dwWritten, (DWORD)CROSSFADE_BLOCK_FRAMES);
+		DWORD dwNextDeck = (dwCurrentDeck + 1) % CROSSFADE_DECK_COUNT;
+		if (!isFading)
+		{
+			FillDeck(dwCurrentDeck, dwBlock);
+			BOOL isNextReady = dwDeckStates[dwNextDeck].load(std::memory_order_acquire) == CROSSFADE_DECK_READY;
+
+			// all frames left in deck are fade
+			if (bDeckEnded[dwCurrentDeck] && isNextReady && dwDeckFrames[dwCurrentDeck] <= dwFadeFrames)
+			{
+				dwDeckStates[dwNextDeck].store(CROSSFADE_DECK_PLAYING, std::memory_order_relaxed);
+				dwFadeLength = dwDeckFrames[dwCurrentDeck];
+				dwFadePosition = 0;
+				isFading = TRUE;
+			}
+			else
+			{
+				DWORD dwPlain = dwBlock;
+				if (bDeckEnded[dwCurrentDeck] && isNextReady) { dwPlain = min(dwPlain, dwDeckFrames[dwCurrentDeck] - dwFadeFrames); }
+
+				DWORD dwPopped = PopFrames(dwCurrentDeck, lpOutput + (size_t)dwWritten * dwChannels, dwPlain);
+				dwWritten += dwPopped;
+
+				// track is over and nothing is queued
+				if (dwPopped < dwPlain)
+				{
+					dwDeckStates[dwCurrentDeck].store(CROSSFADE_DECK_FREE, std::memory_order_release);
+					dwCurrentDeck = CROSSFADE_DECK_COUNT;
+				}
+				continue;
+			}
+		}
+
+		dwWritten += MixFade(lpOutput + (size_t)dwWritten * dwChannels, dwBlock);
+		if (dwFadePosition >= dwFadeLength)
+		{
+			dwDeckStates[dwCurrentDeck].store(CROSSFADE_DECK_FREE, std::memory_order_release);
+			dwCurrentDeck = dwNextDeck;
+			isFading = FALSE;
+		}
+	}
+	return dwWritten;
+}
+
+/*************************************************
+* SeekFrame():
+* Seek in current track, audio thread only.
+* Seek while fading goes to incoming track
+*************************************************/
+BOOL
+Player::CrossfadeSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	if (dwCurrentDeck == CROSSFADE_DECK_COUNT) { return FALSE; }
+
+	if (isFading)
+	{
+		dwDeckStates[dwCurrentDeck].store(CROSSFADE_DECK_FREE, std::memory_order_release);
+		dwCurrentDeck = (dwCurrentDeck + 1) % CROSSFADE_DECK_COUNT;
+		isFading = FALSE;
+	}
+
+	if (!lpDeckSources[dwCurrentDeck]->SeekFrame(uFrame)) { return FALSE; }
+	dwDeckHeads[dwCurrentDeck] = 0;
+	dwDeckFrames[dwCurrentDeck] = 0;
+	bDeckEnded[dwCurrentDeck] = FALSE;
+	return TRUE;
+}
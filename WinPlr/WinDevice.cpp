@@ -0,0 +1,326 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio output device manager
+**********************************************************
+* WinDevice.cpp
+* Background device opening and voice reuse
+*********************************************************/
+
+#include "WinAudio.h"
+
+Player::DeviceManager deviceManager;
+
+/*************************************************
+* DeviceManager():
+* Constructor
+*************************************************/
+Player::DeviceManager::DeviceManager() :
+	lpXAudio(NULL),
+	lpMasterVoice(NULL),
+	lpDirectSound(NULL),
+	lpPrimaryBuffer(NULL),
+	dwWarmupMs(0),
+	dwFirstSampleMs(0),
+	hThread(NULL),
+	hwndOwner(NULL),
+	isXAudioDevice(FALSE),
+	lpCachedVoice(NULL),
+	lpCachedCallback(NULL),
+	isWaitingFirstSample(FALSE)
+{
+	ZeroMemory(&cachedFormat, sizeof(WAVEFORMATEX));
+}
+
+/*************************************************
+* StartWarmup():
+* Open device on background thread, so
+* window is shown without waiting for driver
+*************************************************/
+VOID
+Player::DeviceManager::StartWarmup(
+	_In_ HWND hwnd,
+	_In_ BOOL isXAudio
+)
+{
+	if (hThread) { return; }
+
+	hwndOwner = hwnd;
+	isXAudioDevice = isXAudio;
+	hThread = CreateThread(NULL, NULL, WarmupThread, (LPVOID)this, NULL, NULL);
+}
+
+/*************************************************
+* WarmupThread():
+* Thread proc of device opening
+*************************************************/
+DWORD
+WINAPI
+Player::DeviceManager::WarmupThread(
+	_In_ LPVOID lpParam
+)
+{
+	DeviceManager* lpManager = (DeviceManager*)lpParam;
+	auto startTime = std::chrono::steady_clock::now();
+
+	// UI thread keeps multithreaded apartment alive
+	HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	BOOL isOpened = lpManager->isXAudioDevice ? lpManager->OpenXAudio() : lpManager->OpenDirectSound();
+	if (SUCCEEDED(hr)) { CoUninitialize(); }
+
+	lpManager->dwWarmupMs = (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - startTime).count();
+
+#ifdef DEBUG
+	CHAR szWarmup[64] = {};
+	StringCchPrintfA(szWarmup, 64, "Output device is %s in %u ms", isOpened ? "opened" : "not opened", lpManager->dwWarmupMs);
+	DEBUG_MESSAGE(szWarmup);
+#else
+	UNREFERENCED_PARAMETER(isOpened);
+#endif
+	return 0;
+}
+
+/*************************************************
+* WaitReady():
+* Wait for background opening. Returns
+* TRUE if any device is opened
+*************************************************/
+BOOL
+Player::DeviceManager::WaitReady()
+{
+	if (hThread)
+	{
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+		hThread = NULL;
+	}
+	return lpXAudio || lpDirectSound;
+}
+
+/*************************************************
+* OpenXAudio():
+* Create XAudio2 engine and mastering voice
+*************************************************/
+BOOL
+Player::DeviceManager::OpenXAudio()
+{
+	if (lpXAudio) { return TRUE; }
+
+	HRESULT hr = XAudio2Create(&lpXAudio);
+	if (!SUCCEEDED(hr))
+	{
+		lpXAudio = NULL;
+		return FALSE;
+	}
+
+	// mastering voice opens audio endpoint, it's the slowest part
+	hr = lpXAudio->CreateMasteringVoice(&lpMasterVoice);
+	if (!SUCCEEDED(hr))
+	{
+		lpMasterVoice = NULL;
+		_RELEASE(lpXAudio);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*************************************************
+* OpenDirectSound():
+* Create DirectSound object and primary buffer
+*************************************************/
+BOOL
+Player::DeviceManager::OpenDirectSound()
+{
+	if (lpDirectSound) { return TRUE; }
+
+	if (!SUCCEEDED(DirectSoundCreate(NULL, &lpDirectSound, NULL)))
+	{
+		lpDirectSound = NULL;
+		return FALSE;
+	}
+
+	// primary buffer can be created only with priority level
+	HRESULT hr = lpDirectSound->SetCooperativeLevel(hwndOwner, DSSCL_PRIORITY);
+	if (SUCCEEDED(hr))
+	{
+		DSBUFFERDESC bufferDesc = {};
+		ZeroMemory(&bufferDesc, sizeof(DSBUFFERDESC));
+		bufferDesc.dwSize = sizeof(DSBUFFERDESC);
+		bufferDesc.dwFlags = DSBCAPS_PRIMARYBUFFER | DSBCAPS_CTRLVOLUME;
+		bufferDesc.guid3DAlgorithm = GUID_NULL;
+
+		hr = lpDirectSound->CreateSoundBuffer(&bufferDesc, &lpPrimaryBuffer, NULL);
+	}
+
+	if (!SUCCEEDED(hr))
+	{
+		_RELEASE(lpPrimaryBuffer);
+		_RELEASE(lpDirectSound);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*************************************************
+* AcquireSourceVoice():
+* Returns source voice for stream. Cached voice
+* is used if format and callback are the same.
+* Voice must be stopped and flushed by owner
+*************************************************/
+IXAudio2SourceVoice*
+Player::DeviceManager::AcquireSourceVoice(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ IXAudio2VoiceCallback* lpCallback
+)
+{
+	// open device now if warm up wasn't started or was for other API
+	WaitReady();
+	if (!OpenXAudio())
+	{
+		CreateErrorText("Can't create XAudio device. Please, use DirectSound method.");
+		return NULL;
+	}
+
+	if (lpCachedVoice)
+	{
+		if (lpCachedCallback == lpCallback &&
+			cachedFormat.wFormatTag == lpFormat->wFormatTag &&
+			cachedFormat.nChannels == lpFormat->nChannels &&
+			cachedFormat.nSamplesPerSec == lpFormat->nSamplesPerSec &&
+			cachedFormat.wBitsPerSample == lpFormat->wBitsPerSample &&
+			cachedFormat.nBlockAlign == lpFormat->nBlockAlign)
+		{
+			return lpCachedVoice;
+		}
+
+		// format is changed
+		lpCachedVoice->DestroyVoice();
+		lpCachedVoice = NULL;
+	}
+
+	// create XAudio descriptor (pOutput is MasteringVoice)
+	XAUDIO2_SEND_DESCRIPTOR descAudio = {};
+	XAUDIO2_VOICE_SENDS voiceSends = {};
+	descAudio.Flags = NULL;
+	descAudio.pOutputVoice = lpMasterVoice;
+	voiceSends.SendCount = 1;
+	voiceSends.pSends = &descAudio;
+
+	HRESULT hr = lpXAudio->CreateSourceVoice(
+		&lpCachedVoice,
+		lpFormat,
+		NULL,
+		2.0f,
+		lpCallback,
+		&voiceSends,
+		NULL
+	);
+	if (!SUCCEEDED(hr))
+	{
+		CreateErrorText("Can't create XAudio Source voice.", hr);
+		lpCachedVoice = NULL;
+		return NULL;
+	}
+
+	lpCachedCallback = lpCallback;
+	cachedFormat = *lpFormat;
+	return lpCachedVoice;
+}
+
+/*************************************************
+* AcquireDirectSound():
+* Returns DirectSound object and primary buffer.
+* Pointers are referenced, caller must release it
+*************************************************/
+BOOL
+Player::DeviceManager::AcquireDirectSound(
+	_In_ HWND hwnd,
+	_Out_ LPDIRECTSOUND* lppDirectSound,
+	_Out_ LPDIRECTSOUNDBUFFER* lppPrimaryBuffer
+)
+{
+	*lppDirectSound = NULL;
+	*lppPrimaryBuffer = NULL;
+
+	WaitReady();
+	if (!lpDirectSound) { hwndOwner = hwnd; }
+	if (!OpenDirectSound()) { return FALSE; }
+
+	lpDirectSound->AddRef();
+	lpPrimaryBuffer->AddRef();
+	*lppDirectSound = lpDirectSound;
+	*lppPrimaryBuffer = lpPrimaryBuffer;
+	return TRUE;
+}
+
+/*************************************************
+* Shutdown():
+* Destroy voices and release devices.
+* All sinks must be closed before
+*************************************************/
+VOID
+Player::DeviceManager::Shutdown()
+{
+	WaitReady();
+
+	if (lpCachedVoice)
+	{
+		lpCachedVoice->DestroyVoice();
+		lpCachedVoice = NULL;
+	}
+	if (lpMasterVoice)
+	{
+		lpMasterVoice->DestroyVoice();
+		lpMasterVoice = NULL;
+	}
+	_RELEASE(lpXAudio);
+	_RELEASE(lpPrimaryBuffer);
+	_RELEASE(lpDirectSound);
+	lpCachedCallback = NULL;
+}
+
+/*************************************************
+* BeginPlayRequest():
+* Start time to first sample measuring
+*************************************************/
+VOID
+Player::DeviceManager::BeginPlayRequest()
+{
+	playTime = std::chrono::steady_clock::now();
+	isWaitingFirstSample = TRUE;
+}
+
+/*************************************************
+* CheckFirstSample():
+* Stop measuring when sink clock is moved
+*************************************************/
+VOID
+Player::DeviceManager::CheckFirstSample(
+	_In_opt_ AudioSink* lpSink
+)
+{
+	if (!isWaitingFirstSample) { return; }
+
+	// sink wasn't started or has nothing to play
+	if (!lpSink || lpSink->IsFinished())
+	{
+		isWaitingFirstSample = FALSE;
+		return;
+	}
+
+	if (lpSink->GetPosition())
+	{
+		dwFirstSampleMs = (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - playTime).count();
+		isWaitingFirstSample = FALSE;
+
+		CHAR szFirstSample[64] = {};
+		StringCchPrintfA(szFirstSample, 64, "Time to first sample: %u ms", dwFirstSampleMs);
+		DEBUG_MESSAGE(szFirstSample);
+	}
+}
+
+BOOL Player::DeviceManager::IsWaitingFirstSample() { return isWaitingFirstSample; }
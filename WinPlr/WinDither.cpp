@@ -0,0 +1,564 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio dither
+**********************************************************
+* WinDither.cpp
+* TPDF and noise shaped dither of float
+* to 8 and 16-bit conversion
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/*************************************************
+* Error feedback of noise shaping, 3-tap
+* E-weighted filter of Wannamaker. Noise is
+* 12 dB lower at DC and 11 dB higher at Nyquist
+*************************************************/
+static const FLOAT fShapeTaps[DITHER_SHAPE_TAPS] = { 1.623f, -0.982f, 0.109f };
+
+#define DITHER_NOISE_STEP		(1.0f / 65536.0f)	// TPDF value of 1 in LSB
+#define DITHER_ROUND_BIAS		12582912.0f			// 1.5 * 2^23, rounds to nearest even below 2^22
+
+/*************************************************
+* Noise kernels. Every lane is xorshift32, block
+* is next value of lanes 0 to 7, so every ISA
+* gives same sequence
+*************************************************/
+static VOID
+DitherNoiseScalar(
+	_Inout_updates_(DITHER_LANES) DWORD* lpLanes,
+	_Out_writes_(dwBlocks * DITHER_LANES) DWORD* lpNoise,
+	_In_ DWORD dwBlocks
+)
+{
+	for (DWORD b = 0; b < dwBlocks; b++)
+	{
+		for (DWORD l = 0; l < DITHER_LANES; l++)
+		{
+			DWORD dwValue = lpLanes[l];
+			dwValue ^= dwValue << 13;
+			dwValue ^= dwValue >> 17;
+			dwValue ^= dwValue << 5;
+			lpLanes[l] = dwValue;
+			lpNoise[b * DITHER_LANES + l] = dwValue;
+		}
+	}
+}
+
+/*************************************************
+* Triangular noise of random value: difference
+* of its 16-bit halves, -1 to 1 LSB. Integer
+* difference is exact in float on every ISA
+*************************************************/
+static inline FLOAT
+GetTriangularNoise(
+	_In_ DWORD dwNoise
+)
+{
+	return (FLOAT)((INT)(dwNoise & 0xFFFF) - (INT)(dwNoise >> 16));
+}
+
+static VOID
+AddTpdfScalar(
+	_Inout_updates_(dwSamples) FLOAT* lpSamples,
+	_In_reads_(dwSamples) const DWORD* lpNoise,
+	_In_ DWORD dwSamples,
+	_In_ FLOAT fStep
+)
+{
+	for (DWORD i = 0; i < dwSamples; i++) { lpSamples[i] += GetTriangularNoise(lpNoise[i]) * fStep; }
+}
+
+/*************************************************
+* Noise shaping kernels. Error feedback is serial
+* on every channel, so channels are lanes and
+* frame is one or two vectors. Only newest error
+* is on chain between frames, older taps and
+* noise are summed before it. Sample is left at
+* value which from-float kernel rounds to same
+* integer as here, error of clipping isn't fed
+* back and can't make filter unstable. Values
+* are below 2^16, bias rounds them like lrintf.
+* Chain is bound by latency, so AVX2 uses SSE2
+*************************************************/
+static VOID
+ShapeNoiseScalar(
+	_Inout_updates_(DITHER_SHAPE_TAPS * MIX_MAX_CHANNELS) FLOAT* lpErrors,
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_reads_(dwFrames * dwChannels) const FLOAT* lpNoise,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ FLOAT fLsb
+)
+{
+	FLOAT fScale = 1.0f / fLsb;
+	FLOAT* lpError0 = lpErrors;
+	FLOAT* lpError1 = lpErrors + MIX_MAX_CHANNELS;
+	FLOAT* lpError2 = lpErrors + 2 * MIX_MAX_CHANNELS;
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		for (DWORD c = 0; c < dwChannels; c++)
+		{
+			FLOAT fSample = lpSamples[i * dwChannels + c];
+			fSample = fSample > -1.0f ? fSample : -1.0f;
+			fSample = fSample < 1.0f ? fSample : 1.0f;
+
+			FLOAT fBase = fSample * fScale - (fShapeTaps[1] * lpError1[c] + fShapeTaps[2] * lpError2[c]);
+			FLOAT fNewest = fShapeTaps[0] * lpError0[c];
+			FLOAT fWanted = fBase - fNewest;
+			FLOAT fDithered = (fBase + lpNoise[i * dwChannels + c]) - fNewest;
+			lpError2[c] = lpError1[c];
+			lpError1[c] = lpError0[c];
+			lpError0[c] = ((fDithered + DITHER_ROUND_BIAS) - DITHER_ROUND_BIAS) - fWanted;
+			lpSamples[i * dwChannels + c] = fDithered * fLsb;
+		}
+	}
+}
+
+#ifdef CONVERT_X86
+static VOID
+DitherNoiseSse2(
+	_Inout_updates_(DITHER_LANES) DWORD* lpLanes,
+	_Out_writes_(dwBlocks * DITHER_LANES) DWORD* lpNoise,
+	_In_ DWORD dwBlocks
+)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i*)lpLanes);
+	__m128i hi = _mm_loadu_si128((const __m128i*)(lpLanes + 4));
+	for (DWORD b = 0; b < dwBlocks; b++)
+	{
+		lo = _mm_xor_si128(lo, _mm_slli_epi32(lo, 13));
+		hi = _mm_xor_si128(hi, _mm_slli_epi32(hi, 13));
+		lo = _mm_xor_si128(lo, _mm_srli_epi32(lo, 17));
+		hi = _mm_xor_si128(hi, _mm_srli_epi32(hi, 17));
+		lo = _mm_xor_si128(lo, _mm_slli_epi32(lo, 5));
+		hi = _mm_xor_si128(hi, _mm_slli_epi32(hi, 5));
+		_mm_storeu_si128((__m128i*)(lpNoise + b * DITHER_LANES), lo);
+		_mm_storeu_si128((__m128i*)(lpNoise + b * DITHER_LANES + 4), hi);
+	}
+	_mm_storeu_si128((__m128i*)lpLanes, lo);
+	_mm_storeu_si128((__m128i*)(lpLanes + 4), hi);
+}
+
+static VOID
+AddTpdfSse2(
+	_Inout_updates_(dwSamples) FLOAT* lpSamples,
+	_In_reads_(dwSamples) const DWORD* lpNoise,
+	_In_ DWORD dwSamples,
+	_In_ FLOAT fStep
+)
+{
+	const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+	const __m128 step = _mm_set1_ps(fStep);
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128i noise = _mm_loadu_si128((const __m128i*)(lpNoise + i));
+		__m128i tri = _mm_sub_epi32(_mm_and_si128(noise, lowMask), _mm_srli_epi32(noise, 16));
+		_mm_storeu_ps(lpSamples + i, _mm_add_ps(_mm_loadu_ps(lpSamples + i), _mm_mul_ps(_mm_cvtepi32_ps(tri), step)));
+	}
+	AddTpdfScalar(lpSamples + i, lpNoise + i, dwSamples - i, fStep);
+}
+
+/*************************************************
+* LoadChannelsSse2():
+* 1 to 4 channels of frame, other lanes are
+* zero. StoreChannelsSse2() writes them back
+*************************************************/
+static inline __m128
+LoadChannelsSse2(
+	_In_reads_(dwCount) const FLOAT* lpSrc,
+	_In_ DWORD dwCount
+)
+{
+	switch (dwCount)
+	{
+	case 1:		return _mm_load_ss(lpSrc);
+	case 2:		return _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)lpSrc);
+	case 3:		return _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)lpSrc), _mm_load_ss(lpSrc + 2));
+	default:	return _mm_loadu_ps(lpSrc);
+	}
+}
+
+static inline VOID
+StoreChannelsSse2(
+	_Out_writes_(dwCount) FLOAT* lpDest,
+	_In_ __m128 values,
+	_In_ DWORD dwCount
+)
+{
+	switch (dwCount)
+	{
+	case 1:		_mm_store_ss(lpDest, values); break;
+	case 2:		_mm_storel_pi((__m64*)lpDest, values); break;
+	case 3:		_mm_storel_pi((__m64*)lpDest, values); _mm_store_ss(lpDest + 2, _mm_movehl_ps(values, values)); break;
+	default:	_mm_storeu_ps(lpDest, values); break;
+	}
+}
+
+static VOID
+ShapeNoiseSse2(
+	_Inout_updates_(DITHER_SHAPE_TAPS * MIX_MAX_CHANNELS) FLOAT* lpErrors,
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_reads_(dwFrames * dwChannels) const FLOAT* lpNoise,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ FLOAT fLsb
+)
+{
+	const __m128 tap0 = _mm_set1_ps(fShapeTaps[0]);
+	const __m128 tap1 = _mm_set1_ps(fShapeTaps[1]);
+	const __m128 tap2 = _mm_set1_ps(fShapeTaps[2]);
+	const __m128 bias = _mm_set1_ps(DITHER_ROUND_BIAS);
+	const __m128 scale = _mm_set1_ps(1.0f / fLsb);
+	const __m128 lsb = _mm_set1_ps(fLsb);
+	const __m128 lowLimit = _mm_set1_ps(-1.0f);
+	const __m128 highLimit = _mm_set1_ps(1.0f);
+	DWORD dwCounts[2] = { dwChannels > 4 ? 4 : dwChannels, dwChannels > 4 ? dwChannels - 4 : 0 };
+	DWORD dwHalves = dwCounts[1] ? 2 : 1;
+
+	__m128 error0[2], error1[2], error2[2];
+	for (DWORD h = 0; h < 2; h++)
+	{
+		error0[h] = _mm_loadu_ps(lpErrors + h * 4);
+		error1[h] = _mm_loadu_ps(lpErrors + MIX_MAX_CHANNELS + h * 4);
+		error2[h] = _mm_loadu_ps(lpErrors + 2 * MIX_MAX_CHANNELS + h * 4);
+	}
+
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		for (DWORD h = 0; h < dwHalves; h++)
+		{
+			size_t uOffset = (size_t)i * dwChannels + h * 4;
+			__m128 sample = _mm_min_ps(_mm_max_ps(LoadChannelsSse2(lpSamples + uOffset, dwCounts[h]), lowLimit), highLimit);
+			__m128 base = _mm_sub_ps(_mm_mul_ps(sample, scale), _mm_add_ps(_mm_mul_ps(tap1, error1[h]), _mm_mul_ps(tap2, error2[h])));
+			__m128 newest = _mm_mul_ps(tap0, error0[h]);
+			__m128 wanted = _mm_sub_ps(base, newest);
+			__m128 dithered = _mm_sub_ps(_mm_add_ps(base, LoadChannelsSse2(lpNoise + uOffset, dwCounts[h])), newest);
+			error2[h] = error1[h];
+			error1[h] = error0[h];
+			error0[h] = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(dithered, bias), bias), wanted);
+			StoreChannelsSse2(lpSamples + uOffset, _mm_mul_ps(dithered, lsb), dwCounts[h]);
+		}
+	}
+
+	for (DWORD h = 0; h < 2; h++)
+	{
+		_mm_storeu_ps(lpErrors + h * 4, error0[h]);
+		_mm_storeu_ps(lpErrors + MIX_MAX_CHANNELS + h * 4, error1[h]);
+		_mm_storeu_ps(lpErrors + 2 * MIX_MAX_CHANNELS + h * 4, error2[h]);
+	}
+}
+
+CONVERT_TARGET_AVX2 static VOID
+DitherNoiseAvx2(
+	_Inout_updates_(DITHER_LANES) DWORD* lpLanes,
+	_Out_writes_(dwBlocks * DITHER_LANES) DWORD* lpNoise,
+	_In_ DWORD dwBlocks
+)
+{
+	__m256i lanes = _mm256_loadu_si256((const __m256i*)lpLanes);
+	for (DWORD b = 0; b < dwBlocks; b++)
+	{
+		lanes = _mm256_xor_si256(lanes, _mm256_slli_epi32(lanes, 13));
+		lanes = _mm256_xor_si256(lanes, _mm256_srli_epi32(lanes, 17));
+		lanes = _mm256_xor_si256(lanes, _mm256_slli_epi32(lanes, 5));
+		_mm256_storeu_si256((__m256i*)(lpNoise + b * DITHER_LANES), lanes);
+	}
+	_mm256_storeu_si256((__m256i*)lpLanes, lanes);
+	_mm256_zeroupper();
+}
+
+CONVERT_TARGET_AVX2 static VOID
+AddTpdfAvx2(
+	_Inout_updates_(dwSamples) FLOAT* lpSamples,
+	_In_reads_(dwSamples) const DWORD* lpNoise,
+	_In_ DWORD dwSamples,
+	_In_ FLOAT fStep
+)
+{
+	const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+	const __m256 step = _mm256_set1_ps(fStep);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256i noise = _mm256_loadu_si256((const __m256i*)(lpNoise + i));
+		__m256i tri = _mm256_sub_epi32(_mm256_and_si256(noise, lowMask), _mm256_srli_epi32(noise, 16));
+		_mm256_storeu_ps(lpSamples + i, _mm256_add_ps(_mm256_loadu_ps(lpSamples + i), _mm256_mul_ps(_mm256_cvtepi32_ps(tri), step)));
+	}
+	_mm256_zeroupper();
+	AddTpdfScalar(lpSamples + i, lpNoise + i, dwSamples - i, fStep);
+}
+#endif
+
+/*************************************************
+* Kernel tables by CPU
+*************************************************/
+static const DITHER_NOISE ditherNoiseKernels[CONVERT_ISA_COUNT] =
+{
+#ifdef CONVERT_X86
+	DitherNoiseScalar, DitherNoiseSse2, DitherNoiseAvx2
+#else
+	DitherNoiseScalar, DitherNoiseScalar, DitherNoiseScalar
+#endif
+};
+
+static const ADD_TPDF addTpdfKernels[CONVERT_ISA_COUNT] =
+{
+#ifdef CONVERT_X86
+	AddTpdfScalar, AddTpdfSse2, AddTpdfAvx2
+#else
+	AddTpdfScalar, AddTpdfScalar, AddTpdfScalar
+#endif
+};
+
+static const SHAPE_NOISE shapeNoiseKernels[CONVERT_ISA_COUNT] =
+{
+#ifdef CONVERT_X86
+	ShapeNoiseScalar, ShapeNoiseSse2, ShapeNoiseSse2
+#else
+	ShapeNoiseScalar, ShapeNoiseScalar, ShapeNoiseScalar
+#endif
+};
+
+/*************************************************
+* GetDitherModeByName():
+* Mode of launch param, none if unknown
+*************************************************/
+DITHER_MODE
+GetDitherModeByName(
+	_In_opt_ LPCSTR lpName
+)
+{
+	if (lpName && !strncmp(lpName, "tpdf", 4)) { return DITHER_TPDF; }
+	if (lpName && !strncmp(lpName, "shaped", 6)) { return DITHER_SHAPED; }
+	return DITHER_NONE;
+}
+
+LPCSTR
+GetDitherModeName(
+	_In_ DITHER_MODE eMode
+)
+{
+	switch (eMode)
+	{
+	case DITHER_TPDF:	return "tpdf";
+	case DITHER_SHAPED:	return "shaped";
+	default:			return "none";
+	}
+}
+
+/*************************************************
+* GetDitherLsb():
+* Float step of one integer value. Formats from
+* 24 bits are not dithered, float mantissa has
+* no more bits than them
+*************************************************/
+FLOAT
+GetDitherLsb(
+	_In_ SAMPLE_FORMAT eFormat
+)
+{
+	switch (eFormat)
+	{
+	case SAMPLE_FORMAT_U8:	return 1.0f / 128.0f;
+	case SAMPLE_FORMAT_S16:	return 1.0f / 32768.0f;
+	default:				return 0.0f;
+	}
+}
+
+/*************************************************
+* ResetDither():
+* Lanes are seeded by mixed seed and lane
+* index, xorshift can't start from zero
+*************************************************/
+VOID
+ResetDither(
+	_Out_ DITHER_STATE* lpState,
+	_In_ DWORD dwSeed
+)
+{
+	memset(lpState, 0, sizeof(DITHER_STATE));
+	for (DWORD l = 0; l < DITHER_LANES; l++)
+	{
+		DWORD dwValue = dwSeed + (l + 1) * 0x9E3779B9u;
+		dwValue = (dwValue ^ (dwValue >> 16)) * 0x85EBCA6Bu;
+		dwValue = (dwValue ^ (dwValue >> 13)) * 0xC2B2AE35u;
+		dwValue ^= dwValue >> 16;
+		lpState->dwLanes[l] = dwValue ? dwValue : 0x6D2B79F5u;
+	}
+	lpState->dwBlockPos = DITHER_LANES;
+}
+
+/*************************************************
+* GenerateNoise():
+* Next values of noise sequence. Rest of last
+* block is kept, so sequence doesn't depend on
+* sizes of calls
+*************************************************/
+static VOID
+GenerateNoise(
+	_Inout_ DITHER_STATE* lpState,
+	_In_ DITHER_NOISE lpNoiseKernel,
+	_Out_writes_(dwCount) DWORD* lpNoise,
+	_In_ DWORD dwCount
+)
+{
+	DWORD i = 0;
+	while (i < dwCount && lpState->dwBlockPos < DITHER_LANES) { lpNoise[i++] = lpState->dwBlock[lpState->dwBlockPos++]; }
+
+	DWORD dwBlocks = (dwCount - i) / DITHER_LANES;
+	if (dwBlocks)
+	{
+		lpNoiseKernel(lpState->dwLanes, lpNoise + i, dwBlocks);
+		i += dwBlocks * DITHER_LANES;
+	}
+
+	if (i < dwCount)
+	{
+		lpNoiseKernel(lpState->dwLanes, lpState->dwBlock, 1);
+		lpState->dwBlockPos = 0;
+		while (i < dwCount) { lpNoise[i++] = lpState->dwBlock[lpState->dwBlockPos++]; }
+	}
+}
+
+/*************************************************
+* DitherSamples():
+* Add dither to float frames before from-float
+* kernel of eFormat. Noise is taken by chunks
+* of whole frames on stack
+*************************************************/
+VOID
+DitherSamples(
+	_Inout_ DITHER_STATE* lpState,
+	_In_ DITHER_MODE eMode,
+	_In_ CONVERT_ISA eIsa,
+	_In_ SAMPLE_FORMAT eFormat,
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels
+)
+{
+	FLOAT fLsb = GetDitherLsb(eFormat);
+	if (eMode == DITHER_NONE || eIsa >= CONVERT_ISA_COUNT || !fLsb || !dwChannels || dwChannels > MIX_MAX_CHANNELS) { return; }
+
+	DWORD dwNoise[DITHER_CHUNK_SAMPLES];
+	FLOAT fNoise[DITHER_CHUNK_SAMPLES];
+	DWORD dwChunkFrames = DITHER_CHUNK_SAMPLES / dwChannels;
+	while (dwFrames)
+	{
+		DWORD dwChunk = min(dwFrames, dwChunkFrames);
+		GenerateNoise(lpState, ditherNoiseKernels[eIsa], dwNoise, dwChunk * dwChannels);
+		if (eMode == DITHER_SHAPED)
+		{
+			// shaping takes noise in LSB, added to zero it's exact
+			memset(fNoise, 0, dwChunk * dwChannels * sizeof(FLOAT));
+			addTpdfKernels[eIsa](fNoise, dwNoise, dwChunk * dwChannels, DITHER_NOISE_STEP);
+			shapeNoiseKernels[eIsa](lpState->fErrors[0], lpSamples, fNoise, dwChunk, dwChannels, fLsb);
+		}
+		else
+		{
+			addTpdfKernels[eIsa](lpSamples, dwNoise, dwChunk * dwChannels, fLsb * DITHER_NOISE_STEP);
+		}
+
+		lpSamples += (size_t)dwChunk * dwChannels;
+		dwFrames -= dwChunk;
+	}
+}
+
+/*************************************************
+* GetBusFormat():
+* Format of stages before sink. Dithered or
+* processed stream stays float up to output
+* converter, so boosts aren't clipped before
+* limiter and stream is rounded only once
+*************************************************/
+BOOL
+Player::GetBusFormat(
+	_In_ const WAVEFORMATEX* lpSinkFormat,
+	_In_ DITHER_MODE eMode,
+	_In_ BOOL isFloatDsp,
+	_Out_ WAVEFORMATEX* lpBusFormat
+)
+{
+	*lpBusFormat = *lpSinkFormat;
+	SAMPLE_FORMAT eFormat = GetSampleFormat(lpSinkFormat);
+	BOOL isIntegerSink = eFormat >= SAMPLE_FORMAT_U8 && eFormat <= SAMPLE_FORMAT_S32;
+	if ((eMode != DITHER_NONE && GetDitherLsb(eFormat)) || (isFloatDsp && isIntegerSink))
+	{
+		SetSampleFormat(lpBusFormat, SAMPLE_FORMAT_F32);
+	}
+	return eFormat != SAMPLE_FORMAT_UNKNOWN;
+}
+
+/*************************************************
+* RunDitherBenchmark():
+* Time of stereo dither to 16-bit on every
+* instruction set up to selected one. Hash of
+* output must be same on all of them, periods
+* aren't multiple of lanes to check it too
+*************************************************/
+VOID
+RunDitherBenchmark(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	const DWORD dwChannels = 2;
+	const DWORD dwFrames = 1 << 19;
+	const DWORD dwPeriodFrames = 441;
+	const DWORD dwSamples = dwFrames * dwChannels;
+	FLOAT* lpSource = new FLOAT[dwSamples];
+	FLOAT* lpFloats = new FLOAT[dwSamples];
+	SHORT* lpOutput = new SHORT[dwSamples];
+	FillBenchmarkNoise(lpSource, dwSamples, 0.5f);
+
+	int iWritten = snprintf(lpText, dwSize, "Dither to s16 stereo, seed %u, ns per sample (selected: %s)\n",
+		(DWORD)DITHER_SEED, GetConvertIsaName(GetConvertIsa()));
+	DWORD dwOffset = iWritten > 0 ? min((DWORD)iWritten, dwSize) : 0;
+
+	for (DWORD dwMode = DITHER_TPDF; dwMode < DITHER_MODE_COUNT; dwMode++)
+	{
+		for (DWORD dwIsa = 0; dwIsa <= (DWORD)GetConvertIsa(); dwIsa++)
+		{
+			DITHER_STATE ditherState;
+			ResetDither(&ditherState, DITHER_SEED);
+			memcpy(lpFloats, lpSource, dwSamples * sizeof(FLOAT));
+			CONVERT_FROM_FLOAT lpFromFloat = GetFromFloatKernel((CONVERT_ISA)dwIsa, SAMPLE_FORMAT_S16);
+
+			auto startTime = std::chrono::steady_clock::now();
+			for (DWORD i = 0; i < dwFrames; i += dwPeriodFrames)
+			{
+				DWORD dwPeriod = min(dwPeriodFrames, dwFrames - i);
+				DitherSamples(&ditherState, (DITHER_MODE)dwMode, (CONVERT_ISA)dwIsa, SAMPLE_FORMAT_S16, lpFloats + i * dwChannels, dwPeriod, dwChannels);
+				lpFromFloat(lpFloats + i * dwChannels, (BYTE*)(lpOutput + i * dwChannels), dwPeriod * dwChannels);
+			}
+			double dTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+			// FNV-1a of output and its error against source
+			DWORD dwHash = 2166136261u;
+			double dError = 0.0;
+			for (DWORD i = 0; i < dwSamples; i++)
+			{
+				dwHash = (dwHash ^ (WORD)lpOutput[i]) * 16777619u;
+				double dDiff = (double)lpOutput[i] - (double)lpSource[i] * 32768.0;
+				dError += dDiff * dDiff;
+			}
+
+			iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%s %s: %.2f ns, hash %08x, error %.3f LSB rms\n",
+				GetDitherModeName((DITHER_MODE)dwMode), GetConvertIsaName((CONVERT_ISA)dwIsa), dTime * 1e9 / dwSamples, dwHash, sqrt(dError / dwSamples));
+			if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+		}
+	}
+
+	delete[] lpSource;
+	delete[] lpFloats;
+	delete[] lpOutput;
+}
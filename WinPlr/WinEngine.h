@@ -0,0 +1,1460 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio engine header
+**********************************************************
+* WinEngine.h
+* Portable include file for engine modules
+*********************************************************/
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmreg.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// types and macros from WINAPI for non-Windows builds
+#define VOID				void
+#define TRUE				1
+#define FALSE				0
+#define CALLBACK
+#define WINAPI
+
+typedef uint8_t				BYTE;
+typedef uint16_t			WORD;
+typedef uint32_t			DWORD;
+typedef int16_t				SHORT;
+typedef int32_t				INT;
+typedef int32_t				LONG;
+typedef int32_t				HRESULT;
+typedef int					BOOL;
+typedef unsigned int		UINT;
+typedef uint64_t			UINT64;
+typedef int64_t				LONG64;
+typedef float				FLOAT;
+typedef char				CHAR;
+typedef const char*			LPCSTR;
+typedef char*				LPSTR;
+typedef void*				LPVOID;
+
+#define S_OK				((HRESULT)0)
+#define E_FAIL				((HRESULT)0x80004005L)
+#define SUCCEEDED(hr)		(((HRESULT)(hr)) >= 0)
+#define MAKEFOURCC(ch0, ch1, ch2, ch3) \
+	((DWORD)(BYTE)(ch0) | ((DWORD)(BYTE)(ch1) << 8) | ((DWORD)(BYTE)(ch2) << 16) | ((DWORD)(BYTE)(ch3) << 24))
+
+// windows.h min/max are macros, here they are functions to keep STL headers working
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return (a < b) ? a : b; }
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return (a > b) ? a : b; }
+
+#define __debugbreak()		__builtin_trap()
+
+// SAL annotations
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _In_reads_(x)
+#define _In_reads_opt_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Inout_updates_(x)
+#define _Inout_updates_bytes_(x)
+
+#define WAVE_FORMAT_UNKNOWN		0x0000
+#define WAVE_FORMAT_PCM			0x0001
+#define WAVE_FORMAT_ADPCM		0x0002
+#define WAVE_FORMAT_IEEE_FLOAT	0x0003
+#define WAVE_FORMAT_WMAUDIO2	0x0161
+#define WAVE_FORMAT_WMAUDIO3	0x0162
+#define WAVE_FORMAT_EXTENSIBLE	0xFFFE
+
+typedef struct
+{
+	DWORD Data1;
+	WORD Data2;
+	WORD Data3;
+	BYTE Data4[8];
+} GUID;
+
+#pragma pack(push, 1)
+typedef struct
+{
+	WORD wFormatTag;			// format type
+	WORD nChannels;				// number of channels
+	DWORD nSamplesPerSec;		// sample rate
+	DWORD nAvgBytesPerSec;		// for buffer estimation
+	WORD nBlockAlign;			// block size of data
+} WAVEFORMAT;
+
+typedef struct
+{
+	WAVEFORMAT wf;
+	WORD wBitsPerSample;
+} PCMWAVEFORMAT;
+
+typedef struct
+{
+	WORD wFormatTag;			// format type
+	WORD nChannels;				// number of channels
+	DWORD nSamplesPerSec;		// sample rate
+	DWORD nAvgBytesPerSec;		// for buffer estimation
+	WORD nBlockAlign;			// block size of data
+	WORD wBitsPerSample;		// number of bits per sample of mono data
+	WORD cbSize;				// count in bytes of the size of extra information
+} WAVEFORMATEX;
+
+typedef struct
+{
+	WAVEFORMATEX Format;
+	union
+	{
+		WORD wValidBitsPerSample;
+		WORD wSamplesPerBlock;
+		WORD wReserved;
+	} Samples;
+	DWORD dwChannelMask;
+	GUID SubFormat;
+} WAVEFORMATEXTENSIBLE;
+#pragma pack(pop)
+#endif
+
+#ifndef _SPEAKER_POSITIONS_
+#define _SPEAKER_POSITIONS_
+#define SPEAKER_FRONT_LEFT				0x1
+#define SPEAKER_FRONT_RIGHT				0x2
+#define SPEAKER_FRONT_CENTER			0x4
+#define SPEAKER_LOW_FREQUENCY			0x8
+#define SPEAKER_BACK_LEFT				0x10
+#define SPEAKER_BACK_RIGHT				0x20
+#define SPEAKER_FRONT_LEFT_OF_CENTER	0x40
+#define SPEAKER_FRONT_RIGHT_OF_CENTER	0x80
+#define SPEAKER_BACK_CENTER				0x100
+#define SPEAKER_SIDE_LEFT				0x200
+#define SPEAKER_SIDE_RIGHT				0x400
+#define SPEAKER_TOP_CENTER				0x800
+#define SPEAKER_TOP_FRONT_LEFT			0x1000
+#define SPEAKER_TOP_FRONT_CENTER		0x2000
+#define SPEAKER_TOP_FRONT_RIGHT			0x4000
+#define SPEAKER_TOP_BACK_LEFT			0x8000
+#define SPEAKER_TOP_BACK_CENTER			0x10000
+#define SPEAKER_TOP_BACK_RIGHT			0x20000
+#endif
+
+#ifdef _WIN32
+#define DEBUG_MESSAGE(x)	OutputDebugStringA(x); OutputDebugStringA("\n");
+#else
+#define DEBUG_MESSAGE(x)	fputs(x, stderr); fputs("\n", stderr);
+#endif
+#ifndef DEBUG
+#define ASSERT(x, y)		if (!x)					{ DEBUG_MESSAGE(y); }
+#else
+#define ASSERT(x, y)		if (!x)					{ DEBUG_MESSAGE(y); __debugbreak(); }
+#endif
+
+#define SINK_PERIOD_MS		10			// period of portable sinks in milliseconds
+#define ALSA_PERIOD_COUNT	4			// count of periods in ALSA ring
+#define LOOP_INFINITE		0xFFFFFFFF	// loop region is played until stop
+
+#ifdef __linux__
+typedef struct _snd_pcm snd_pcm_t;
+struct pollfd;
+#endif
+
+typedef struct
+{
+	WAVEFORMATEX waveFormat;		// wave format info
+	BYTE* lpData;					// pointer to 'data' chunk
+	DWORD dwDataSize;				// size of 'data' chunk
+	LPCSTR lpPath;					// full path to file
+	uint32_t pLoopStart;			// start loop
+	uint32_t pLoopLength;			// length of loop
+	DWORD dwChannelMask;			// speaker positions of extensible format, 0 if not set
+} PCM_DATA, *PCM_DATA_P;
+
+typedef struct
+{
+	uint32_t tag;				// tag of RIFF chunk
+	uint32_t size;				// chunk size
+} RIFFChunk;
+
+typedef struct
+{
+	uint32_t tag;				// tag of RIFF chunk header
+	uint32_t size;				// chunk header size
+	uint32_t riff;				// RIFF info
+} RIFFChunkHeader;
+
+typedef struct DLSLoop
+{
+	static const uint32_t LOOP_TYPE_FORWARD = 0x00000000;
+	static const uint32_t LOOP_TYPE_RELEASE = 0x00000001;
+
+	uint32_t size;				// chunk size
+	uint32_t loopType;			// chunk loop type
+	uint32_t loopStart;			// chunk loop start
+	uint32_t loopLength;		// chunk length
+} DLSLoop;
+
+typedef struct RIFFDLSSample
+{
+	static const uint32_t OPTIONS_NOTRUNCATION = 0x00000001;
+	static const uint32_t OPTIONS_NOCOMPRESSION = 0x00000002;
+
+	uint32_t    size;
+	uint16_t    unityNote;
+	int16_t     fineTune;
+	int32_t     gain;
+	uint32_t    options;
+	uint32_t    loopCount;
+} RIFFDLSSample;
+
+typedef struct MIDILoop
+{
+	static const uint32_t LOOP_TYPE_FORWARD = 0x00000000;
+	static const uint32_t LOOP_TYPE_ALTERNATING = 0x00000001;
+	static const uint32_t LOOP_TYPE_BACKWARD = 0x00000002;
+
+	uint32_t cuePointId;
+	uint32_t type;
+	uint32_t start;
+	uint32_t end;
+	uint32_t fraction;
+	uint32_t playCount;
+} MIDILoop;
+
+typedef struct
+{
+	uint32_t        manufacturerId;
+	uint32_t        productId;
+	uint32_t        samplePeriod;
+	uint32_t        unityNode;
+	uint32_t        pitchFraction;
+	uint32_t        SMPTEFormat;
+	uint32_t        SMPTEOffset;
+	uint32_t        loopCount;
+	uint32_t        samplerData;
+} RIFFMIDISample;
+
+static_assert(sizeof(RIFFChunk) == 8, "structure size mismatch");
+static_assert(sizeof(RIFFChunkHeader) == 12, "structure size mismatch");
+static_assert(sizeof(DLSLoop) == 16, "structure size mismatch");
+static_assert(sizeof(RIFFDLSSample) == 20, "structure size mismatch");
+static_assert(sizeof(MIDILoop) == 24, "structure size mismatch");
+static_assert(sizeof(RIFFMIDISample) == 36, "structure size mismatch");
+
+const uint32_t FOURCC_RIFF_TAG		= MAKEFOURCC('R', 'I', 'F', 'F');
+const uint32_t FOURCC_FORMAT_TAG	= MAKEFOURCC('f', 'm', 't', ' ');
+const uint32_t FOURCC_DATA_TAG		= MAKEFOURCC('d', 'a', 't', 'a');
+const uint32_t FOURCC_WAVE_FILE_TAG = MAKEFOURCC('W', 'A', 'V', 'E');
+const uint32_t FOURCC_XWMA_FILE_TAG = MAKEFOURCC('X', 'W', 'M', 'A');
+const uint32_t FOURCC_DLS_SAMPLE	= MAKEFOURCC('w', 's', 'm', 'p');
+const uint32_t FOURCC_MIDI_SAMPLE	= MAKEFOURCC('s', 'm', 'p', 'l');
+const uint32_t FOURCC_XWMA_DPDS		= MAKEFOURCC('d', 'p', 'd', 's');
+const uint32_t FOURCC_XMA_SEEK		= MAKEFOURCC('s', 'e', 'e', 'k');
+
+BOOL ParseWaveData(_In_reads_bytes_(dwSize) BYTE* lpFile, _In_ DWORD dwSize, _Out_ PCM_DATA_P lpPCM);
+
+#define MAX_RENDER_STAGES	16
+#define DEADLINE_HISTORY	256			// count of last callbacks kept by monitor
+#define TELEMETRY_BUCKETS	24			// buckets in one telemetry histogram
+
+typedef struct
+{
+	UINT64 uStartNs;				// callback start from monitor reset
+	UINT64 uDurationNs;				// time spent in callback
+	UINT64 uDeadlineNs;				// time left before device starves
+} CALLBACK_RECORD, *CALLBACK_RECORD_P;
+
+VOID SetRealtimeThreadPriority();
+
+#define COMMAND_QUEUE_SIZE	64			// commands or events in flight, power of 2
+
+typedef enum
+{
+	EQ_BAND_OFF = 0,				// band passes signal
+	EQ_BAND_PEAKING = 1,			// bell around frequency
+	EQ_BAND_LOW_SHELF = 2,
+	EQ_BAND_HIGH_SHELF = 3,
+	EQ_BAND_HIGH_PASS = 4,			// 12 dB/oct, gain is ignored
+	EQ_BAND_LOW_PASS = 5,			// 12 dB/oct, gain is ignored
+	EQ_BAND_TYPE_COUNT = 6
+} EQ_BAND_TYPE;
+
+typedef struct
+{
+	EQ_BAND_TYPE eType;
+	FLOAT fFrequency;				// center or corner frequency in Hz
+	FLOAT fGainDb;					// gain of peaking and shelf bands
+	FLOAT fQ;						// bandwidth, or slope of shelf
+} EQ_BAND;
+
+typedef enum
+{
+	PLAYER_COMMAND_PLAY = 0,
+	PLAYER_COMMAND_PAUSE = 1,
+	PLAYER_COMMAND_STOP = 2,
+	PLAYER_COMMAND_SEEK = 3,
+	PLAYER_COMMAND_VOLUME = 4,
+	PLAYER_COMMAND_NEXT = 5,
+	PLAYER_COMMAND_MUTE = 6,
+	PLAYER_COMMAND_EQ = 7
+} PLAYER_COMMAND_TYPE;
+
+typedef struct
+{
+	PLAYER_COMMAND_TYPE eType;		// command to process
+	UINT64 uFrame;					// sample frame for PLAYER_COMMAND_SEEK
+	FLOAT fVolume;					// linear gain for PLAYER_COMMAND_VOLUME
+	BOOL bMute;						// mute state for PLAYER_COMMAND_MUTE
+	DWORD dwBand;					// band number for PLAYER_COMMAND_EQ
+	EQ_BAND eqBand;					// band settings for PLAYER_COMMAND_EQ
+} PLAYER_COMMAND;
+
+typedef enum
+{
+	PLAYER_EVENT_PLAYING = 0,
+	PLAYER_EVENT_PAUSED = 1,
+	PLAYER_EVENT_STOPPED = 2,
+	PLAYER_EVENT_SEEKED = 3,
+	PLAYER_EVENT_VOLUME = 4,
+	PLAYER_EVENT_NEXT = 5,
+	PLAYER_EVENT_END_OF_STREAM = 6,
+	PLAYER_EVENT_EQ = 7
+} PLAYER_EVENT_TYPE;
+
+typedef struct
+{
+	PLAYER_EVENT_TYPE eType;		// what is happened on audio thread
+	UINT64 uFrame;					// source position at this moment
+} PLAYER_EVENT;
+
+typedef struct
+{
+	UINT64 uOutputFrame;			// sink frame where mark begins
+	UINT64 uSourceFrame;			// track frame at this sink frame
+	BOOL bPaused;					// track position doesn't move after mark
+} POSITION_MARK;
+
+#define ERROR_RING_SIZE		32			// errors in flight, power of 2
+#define ERROR_CONTEXT_SIZE	96			// max length of error text
+
+typedef struct
+{
+	DWORD dwCode;					// HRESULT, system or driver error code
+	UINT64 uTimeNs;					// steady clock time of error
+	CHAR szContext[ERROR_CONTEXT_SIZE];	// what was failed
+} PLAYER_ERROR;
+
+typedef struct
+{
+	CHAR szName[32];				// name of pipeline stage
+	double dSeconds;				// time spent in this stage only
+} RENDER_STAGE;
+
+typedef struct
+{
+	UINT64 uFrames;					// rendered sample frames
+	double dAudioSeconds;			// duration of rendered audio
+	double dWallSeconds;			// time spent to render
+	double dRealtimeFactor;			// audio seconds per one wall second
+	double dDecodeSeconds;			// file load and decode before render, not in wall time
+	UINT64 uPeakMemoryKB;			// peak resident memory of process
+	DWORD dwStageCount;				// count of filled stages
+	RENDER_STAGE stages[MAX_RENDER_STAGES];
+} RENDER_STATS, *RENDER_STATS_P;
+
+VOID AddRenderStage(_Inout_ RENDER_STATS_P lpStats, _In_ LPCSTR lpName, _In_ double dSeconds);
+UINT64 GetPeakMemoryKB();
+VOID FormatRenderStats(_In_ const RENDER_STATS* lpStats, _Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define CONVERT_CHUNK_SAMPLES	1024		// samples converted at once through float
+
+typedef enum
+{
+	SAMPLE_FORMAT_UNKNOWN = 0,
+	SAMPLE_FORMAT_U8 = 1,
+	SAMPLE_FORMAT_S16 = 2,
+	SAMPLE_FORMAT_S24 = 3,			// packed, 3 bytes per sample
+	SAMPLE_FORMAT_S32 = 4,
+	SAMPLE_FORMAT_F32 = 5,
+	SAMPLE_FORMAT_F64 = 6,
+	SAMPLE_FORMAT_COUNT = 7
+} SAMPLE_FORMAT;
+
+typedef enum
+{
+	CONVERT_ISA_SCALAR = 0,
+	CONVERT_ISA_SSE2 = 1,
+	CONVERT_ISA_AVX2 = 2,
+	CONVERT_ISA_COUNT = 3
+} CONVERT_ISA;
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#endif
+
+// MSVC compiles AVX2 intrinsics without /arch, GCC needs target for every function
+#if defined(CONVERT_X86) && defined(__GNUC__)
+#define CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CONVERT_TARGET_AVX2
+#endif
+
+typedef VOID(*CONVERT_TO_FLOAT)(_In_reads_bytes_(dwSamples * size) const BYTE* lpSrc, _Out_writes_(dwSamples) FLOAT* lpDest, _In_ DWORD dwSamples);
+typedef VOID(*CONVERT_FROM_FLOAT)(_In_reads_(dwSamples) const FLOAT* lpSrc, _Out_writes_bytes_(dwSamples * size) BYTE* lpDest, _In_ DWORD dwSamples);
+typedef VOID(*CONVERT_FRAMES)(_In_ const BYTE* lpSrc, _Out_ BYTE* lpDest, _In_ DWORD dwFrames, _In_ DWORD dwChannels);
+typedef VOID(*DEINTERLEAVE_FRAMES)(_In_ const BYTE* lpSrc, _In_reads_(dwChannels) FLOAT* const* lpPlanes, _In_ DWORD dwFrames, _In_ DWORD dwChannels);
+typedef VOID(*INTERLEAVE_FRAMES)(_In_reads_(dwChannels) const FLOAT* const* lpPlanes, _Out_ BYTE* lpDest, _In_ DWORD dwFrames, _In_ DWORD dwChannels);
+
+SAMPLE_FORMAT GetSampleFormat(_In_ const WAVEFORMATEX* lpFormat);
+DWORD GetSampleBytes(_In_ SAMPLE_FORMAT eFormat);
+LPCSTR GetSampleFormatName(_In_ SAMPLE_FORMAT eFormat);
+VOID SetSampleFormat(_Inout_ WAVEFORMATEX* lpFormat, _In_ SAMPLE_FORMAT eFormat);
+CONVERT_ISA InitConvertKernels(_In_ CONVERT_ISA eMaxIsa);
+CONVERT_ISA GetConvertIsa();
+CONVERT_ISA GetConvertIsaByName(_In_opt_ LPCSTR lpName);
+LPCSTR GetConvertIsaName(_In_ CONVERT_ISA eIsa);
+CONVERT_TO_FLOAT GetToFloatKernel(_In_ CONVERT_ISA eIsa, _In_ SAMPLE_FORMAT eFormat);
+CONVERT_FROM_FLOAT GetFromFloatKernel(_In_ CONVERT_ISA eIsa, _In_ SAMPLE_FORMAT eFormat);
+VOID ConvertSamples(_In_ SAMPLE_FORMAT eSrcFormat, _In_ const BYTE* lpSrc, _In_ SAMPLE_FORMAT eDestFormat, _Out_ BYTE* lpDest, _In_ DWORD dwSamples);
+CONVERT_FRAMES GetConvertFramesKernel(_In_ SAMPLE_FORMAT eSrcFormat, _In_ SAMPLE_FORMAT eDestFormat, _In_ DWORD dwChannels);
+DEINTERLEAVE_FRAMES GetDeinterleaveKernel(_In_ SAMPLE_FORMAT eSrcFormat, _In_ DWORD dwChannels);
+INTERLEAVE_FRAMES GetInterleaveKernel(_In_ SAMPLE_FORMAT eDestFormat, _In_ DWORD dwChannels);
+VOID RunConvertBenchmark(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define RESAMPLE_CHUNK_FRAMES	1024		// input frames read from upstream at once
+#define RESAMPLE_MAX_PHASES		1024		// filter phases, finer positions are interpolated
+#define RESAMPLE_MAX_TAPS		1024		// taps of one phase for strong downsampling
+#define RESAMPLE_MAX_RATIO		16			// max ratio of input and output rates
+
+typedef enum
+{
+	HANN_WINDOW = 1,
+	HAMMING_WINDOW = 2,
+	BLACKMAN_WINDOW = 3,
+	BLACKMANHARRIS_WINDOW = 4
+} WINDOW_TYPE;
+
+typedef enum
+{
+	RESAMPLE_QUALITY_LOW = 0,		// 16 taps, Hann window
+	RESAMPLE_QUALITY_MEDIUM = 1,	// 32 taps, Hann window
+	RESAMPLE_QUALITY_HIGH = 2,		// 64 taps, Blackman window
+	RESAMPLE_QUALITY_BEST = 3,		// 128 taps, Blackman-Harris window
+	RESAMPLE_QUALITY_COUNT = 4
+} RESAMPLE_QUALITY;
+
+typedef FLOAT(*RESAMPLE_DOT)(_In_reads_(dwTaps) const FLOAT* lpSamples, _In_reads_(dwTaps) const FLOAT* lpCoefs, _In_ DWORD dwTaps);
+
+RESAMPLE_QUALITY GetResampleQualityByName(_In_opt_ LPCSTR lpName);
+LPCSTR GetResampleQualityName(_In_ RESAMPLE_QUALITY eQuality);
+WINDOW_TYPE GetWindowTypeByName(_In_opt_ LPCSTR lpName, _In_ RESAMPLE_QUALITY eQuality);
+LPCSTR GetWindowTypeName(_In_ WINDOW_TYPE eWindow);
+VOID RunResampleBenchmark(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define GAIN_RAMP_MS			20			// time of gain change, so there is no zipper noise
+#define GAIN_MIN_DB				-60.0f		// lowest volume level, below it is silence
+#define GAIN_CHUNK_SAMPLES		1024		// integer samples scaled in float at once
+
+typedef VOID(*APPLY_GAIN)(_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples, _In_ DWORD dwFrames, _In_ DWORD dwChannels,
+	_In_ FLOAT fGain, _In_ FLOAT fStep);
+
+FLOAT DecibelsToGain(_In_ FLOAT fDecibels);
+APPLY_GAIN GetApplyGainKernel();
+
+#define MIX_MAX_CHANNELS		8			// channels of mix matrix, up to 7.1
+#define MIX_BLOCK_FRAMES		256			// frames mixed at once
+#define MIX_CACHE_SIZE			8			// matrices kept by layout pair
+
+typedef enum
+{
+	CHANNEL_MIX_DOWNMIX = 0,		// ITU-R BS.775 downmix, missing speakers go to nearest ones, LFE is dropped
+	CHANNEL_MIX_UPMIX = 1,			// downmix, center and surrounds are made from front pair
+	CHANNEL_MIX_CUSTOM = 2			// matrix from launch param
+} CHANNEL_MIX_MODE;
+
+typedef struct
+{
+	BYTE bDest;						// output channel
+	BYTE bSource;					// input channel
+	FLOAT fGain;
+} MIX_TAP;
+
+typedef VOID(*MIX_PLANE)(_Inout_updates_(dwFrames) FLOAT* lpDest, _In_reads_(dwFrames) const FLOAT* lpSrc, _In_ FLOAT fGain, _In_ DWORD dwFrames);
+
+DWORD GetDefaultChannelMask(_In_ DWORD dwChannels);
+DWORD GetLayoutChannelMask(_In_ DWORD dwChannelMask, _In_ DWORD dwChannels);
+BOOL BuildMixMatrix(_In_ DWORD dwSourceMask, _In_ DWORD dwSourceChannels, _In_ DWORD dwDestMask, _In_ DWORD dwDestChannels,
+	_In_ CHANNEL_MIX_MODE eMode, _Out_writes_(dwDestChannels * dwSourceChannels) FLOAT* lpMatrix);
+DWORD ParseMixMatrix(_In_ LPCSTR lpText, _Out_writes_(MIX_MAX_CHANNELS * MIX_MAX_CHANNELS) FLOAT* lpMatrix);
+MIX_PLANE GetMixPlaneKernel();
+
+#define CROSSFADE_DECK_COUNT		2			// outgoing and incoming track
+#define CROSSFADE_BLOCK_FRAMES		512			// frames taken from deck at once
+#define CROSSFADE_SEGMENT_FRAMES	64			// curve is linear inside segment
+
+typedef enum
+{
+	CROSSFADE_LINEAR = 0,			// gains sum to 1, level dips in the middle
+	CROSSFADE_EQUAL_POWER = 1,		// sine/cosine, constant power of uncorrelated tracks
+	CROSSFADE_S_CURVE = 2			// smoothstep, short overlap in the middle
+} CROSSFADE_CURVE;
+
+typedef enum
+{
+	CROSSFADE_DECK_FREE = 0,		// control thread can set new track
+	CROSSFADE_DECK_READY = 1,		// track is primed, render thread takes it
+	CROSSFADE_DECK_PLAYING = 2		// render thread owns it
+} CROSSFADE_DECK_STATE;
+
+CROSSFADE_CURVE GetCrossfadeCurveByName(_In_opt_ LPCSTR lpName);
+LPCSTR GetCrossfadeCurveName(_In_ CROSSFADE_CURVE eCurve);
+
+#define VOICE_POOL_SIZE			256			// voices mixed at once, preallocated
+#define VOICE_BLOCK_FRAMES		256			// frames mixed at once, gain/pan ramp length
+#define VOICE_SOFT_CLIP_KNEE	0.8f		// bus level where soft clipping starts
+
+typedef enum
+{
+	VOICE_FREE = 0,					// control thread can start voice
+	VOICE_READY = 1,				// voice is set, render thread takes it
+	VOICE_PLAYING = 2				// render thread owns it
+} VOICE_STATE;
+
+typedef VOID(*ACCUMULATE_VOICE)(_Inout_updates_(dwFrames * dwBusChannels) FLOAT* lpBus, _In_ const FLOAT* lpVoice, _In_ DWORD dwFrames,
+	_In_ DWORD dwBusChannels, _In_ DWORD dwVoiceChannels, _In_reads_(dwBusChannels) const FLOAT* lpGains, _In_reads_(dwBusChannels) const FLOAT* lpSteps);
+typedef VOID(*SOFT_CLIP)(_Inout_updates_(dwSamples) FLOAT* lpSamples, _In_ DWORD dwSamples);
+
+ACCUMULATE_VOICE GetAccumulateVoiceKernel();
+SOFT_CLIP GetSoftClipKernel();
+VOID RunVoiceBenchmark(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define EQ_MAX_BANDS			10			// bands of cascade
+#define EQ_STEP_FRAMES			8			// ramped coefficients change every that many frames
+#define EQ_RAMP_MS				20			// time of coefficient change, so there is no click
+#define EQ_CHUNK_SAMPLES		1024		// integer samples filtered in float at once
+#define EQ_DENORMAL_LIMIT		1e-15f		// filter state below it is flushed to zero
+
+typedef struct
+{
+	FLOAT b0, b1, b2;				// feed-forward, normalized by a0
+	FLOAT a1, a2;					// feedback, normalized by a0
+} BIQUAD_COEFS;
+
+typedef VOID(*EQ_CASCADE)(_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples, _In_ DWORD dwFrames, _In_ DWORD dwChannels,
+	_In_ const BIQUAD_COEFS* lpCoefs, _Inout_updates_(4 * MIX_MAX_CHANNELS) FLOAT* lpState);
+
+EQ_BAND_TYPE GetEqBandTypeByName(_In_opt_ LPCSTR lpName);
+LPCSTR GetEqBandTypeName(_In_ EQ_BAND_TYPE eType);
+VOID DesignBiquad(_In_ const EQ_BAND* lpBand, _In_ DWORD dwSampleRate, _Out_ BIQUAD_COEFS* lpCoefs);
+DWORD ParseEqBands(_In_opt_ LPCSTR lpText, _Out_writes_(EQ_MAX_BANDS) EQ_BAND* lpBands);
+EQ_CASCADE GetEqCascadeKernel();
+VOID RunEqBenchmark(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define LIMITER_OVERSAMPLE		4			// points per sample checked for true peak
+#define LIMITER_PHASE_TAPS		16			// input frames of one interpolation phase
+#define LIMITER_LOOKAHEAD_MS	5			// default time of gain fall before peak
+#define LIMITER_MAX_LOOKAHEAD_MS	20		// longest lookahead of launch param
+#define LIMITER_CEILING_DB		-1.0f		// default true peak ceiling, dBTP
+#define LIMITER_RELEASE_MS		100			// time constant of gain recovery
+#define LIMITER_MIN_GAIN		1e-4f		// lowest gain, keeps sum of attack ramp exact
+#define LIMITER_CHUNK_FRAMES	256			// frames limited at once
+
+typedef VOID(*TRUE_PEAK)(_In_reads_((dwFrames + LIMITER_PHASE_TAPS - 1) * dwChannels) const FLOAT* lpFrames,
+	_Out_writes_(dwFrames) FLOAT* lpPeaks, _In_ DWORD dwFrames, _In_ DWORD dwChannels);
+
+TRUE_PEAK GetTruePeakKernel();
+VOID RunLimiterBenchmark(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define DITHER_LANES			8			// independent generators, one AVX2 vector
+#define DITHER_SHAPE_TAPS		3			// error feedback taps of noise shaping
+#define DITHER_SEED				1			// seed when launch params have none
+#define DITHER_CHUNK_SAMPLES	1024		// noise generated at once on stack
+
+typedef enum
+{
+	DITHER_NONE = 0,
+	DITHER_TPDF = 1,				// triangular noise, 2 LSB peak to peak
+	DITHER_SHAPED = 2,				// TPDF with error feedback, noise moved up in frequency
+	DITHER_MODE_COUNT = 3
+} DITHER_MODE;
+
+typedef struct
+{
+	DWORD dwLanes[DITHER_LANES];	// xorshift32 state of every generator
+	DWORD dwBlock[DITHER_LANES];	// last block of noise, values from dwBlockPos aren't used yet
+	DWORD dwBlockPos;
+	FLOAT fErrors[DITHER_SHAPE_TAPS][MIX_MAX_CHANNELS];	// last quantization errors in LSB, newest row first
+} DITHER_STATE;
+
+typedef VOID(*DITHER_NOISE)(_Inout_updates_(DITHER_LANES) DWORD* lpLanes, _Out_writes_(dwBlocks * DITHER_LANES) DWORD* lpNoise, _In_ DWORD dwBlocks);
+typedef VOID(*ADD_TPDF)(_Inout_updates_(dwSamples) FLOAT* lpSamples, _In_reads_(dwSamples) const DWORD* lpNoise, _In_ DWORD dwSamples, _In_ FLOAT fStep);
+typedef VOID(*SHAPE_NOISE)(_Inout_updates_(DITHER_SHAPE_TAPS * MIX_MAX_CHANNELS) FLOAT* lpErrors, _Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_reads_(dwFrames * dwChannels) const FLOAT* lpNoise, _In_ DWORD dwFrames, _In_ DWORD dwChannels, _In_ FLOAT fLsb);
+
+DITHER_MODE GetDitherModeByName(_In_opt_ LPCSTR lpName);
+LPCSTR GetDitherModeName(_In_ DITHER_MODE eMode);
+FLOAT GetDitherLsb(_In_ SAMPLE_FORMAT eFormat);
+VOID ResetDither(_Out_ DITHER_STATE* lpState, _In_ DWORD dwSeed);
+VOID DitherSamples(_Inout_ DITHER_STATE* lpState, _In_ DITHER_MODE eMode, _In_ CONVERT_ISA eIsa, _In_ SAMPLE_FORMAT eFormat,
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples, _In_ DWORD dwFrames, _In_ DWORD dwChannels);
+VOID RunDitherBenchmark(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+#define BENCHMARK_COUNT			6
+#define BENCHMARK_TEXT_SIZE		4096		// enough for longest report
+
+typedef VOID(*RUN_BENCHMARK)(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+
+typedef struct
+{
+	LPCSTR lpParam;				// launch param which runs it
+	RUN_BENCHMARK lpRun;
+} BENCHMARK;
+
+extern const BENCHMARK benchmarks[BENCHMARK_COUNT];
+
+VOID FillBenchmarkNoise(_Out_writes_(uSamples) FLOAT* lpDest, _In_ size_t uSamples, _In_ FLOAT fPeak);
+
+namespace Player
+{
+	/*************************************************
+	* Histogram:
+	* Wait-free counter of values by buckets.
+	* Linear histogram has one bucket per value,
+	* other one has power of 2 buckets: bucket N
+	* holds values from 2^(N-1) to 2^N - 1
+	*************************************************/
+	class Histogram
+	{
+	public:
+		Histogram(_In_ BOOL isLinearBuckets);
+		VOID Reset();
+		VOID Add(_In_ UINT64 uValue);
+		UINT64 GetBucketMin(_In_ DWORD dwBucket);
+		UINT64 GetBucketMax(_In_ DWORD dwBucket);
+		UINT64 GetPercentile(_In_ DWORD dwPercent);		// upper bound of bucket
+
+		BOOL isLinear;
+		std::atomic<UINT64> buckets[TELEMETRY_BUCKETS];
+		std::atomic<UINT64> uCount;
+		std::atomic<UINT64> uMax;
+	};
+
+	/*************************************************
+	* StreamTelemetry:
+	* Counters of one playback stream. Render thread
+	* writes them with relaxed atomics, UI can read
+	* them at any time
+	*************************************************/
+	class StreamTelemetry
+	{
+	public:
+		StreamTelemetry();
+		VOID Reset();
+		VOID AddCallback(_In_ UINT64 uStartNs, _In_ UINT64 uDurationNs);
+		VOID AddQueued(_In_ DWORD dwQueued);
+		VOID AddUnderrun();
+
+		Histogram intervalUs;			// time between callbacks
+		Histogram jitterUs;				// change of interval between two callbacks
+		Histogram refillUs;				// time spent in callback
+		Histogram queuedBuffers;		// buffers left in device when callback started
+		std::atomic<UINT64> uUnderruns;
+
+	private:
+		UINT64 uLastStartNs;			// render thread only
+		UINT64 uLastIntervalNs;
+	};
+
+	/*************************************************
+	* DeadlineMonitor:
+	* Records every render callback against its
+	* deadline. Writer is render thread only, it
+	* never allocates or locks. Readers can get
+	* torn record from history, counters are exact
+	*************************************************/
+	class DeadlineMonitor
+	{
+	public:
+		DeadlineMonitor();
+		VOID Reset();
+		UINT64 BeginCallback();
+		VOID EndCallback(_In_ UINT64 uStartNs, _In_ UINT64 uDeadlineNs);
+		DWORD CopyHistory(_Out_writes_(dwMaxRecords) CALLBACK_RECORD_P lpRecords, _In_ DWORD dwMaxRecords);
+		VOID FormatTelemetry(_Out_writes_(dwSize) LPSTR lpText, _In_ DWORD dwSize);
+		BOOL DumpTelemetry(_In_ LPCSTR lpPath);
+
+		std::chrono::steady_clock::time_point resetTime;
+		StreamTelemetry telemetry;
+		CALLBACK_RECORD history[DEADLINE_HISTORY];
+		std::atomic<UINT64> uCallbacks;
+		std::atomic<UINT64> uMisses;			// callbacks finished after deadline
+		std::atomic<UINT64> uMaxDurationNs;
+	};
+
+	/*************************************************
+	* AudioSource:
+	* Pull-model provider of frames in sink format
+	*************************************************/
+	class AudioSource
+	{
+	public:
+		virtual ~AudioSource() {}
+
+		// returns count of written frames, less than dwFrames at end of stream
+		virtual DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) = 0;
+		virtual BOOL SeekFrame(_In_ UINT64) { return FALSE; }
+	};
+
+	/*************************************************
+	* AudioSink:
+	* Output device which pulls frames from source
+	*************************************************/
+	class AudioSink
+	{
+	public:
+		virtual ~AudioSink() {}
+
+		virtual BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) = 0;
+		virtual BOOL Start() = 0;
+		virtual VOID Stop() = 0;
+		virtual VOID Close() = 0;
+		virtual UINT64 GetPosition() = 0;		// played frames
+		virtual DWORD GetLatency() = 0;			// output latency in milliseconds
+		virtual DWORD GetUnderruns() = 0;		// count of device starvations
+		virtual BOOL IsFinished() = 0;			// source is drained and played
+		virtual DeadlineMonitor* GetDeadlineMonitor() { return NULL; }
+		virtual BOOL IsFormatSupported(_In_ const WAVEFORMATEX*) { return TRUE; }
+	};
+
+	/*************************************************
+	* SpscQueue:
+	* Wait-free ring for one producer thread and
+	* one consumer thread. Push and Pop never block,
+	* they fail if queue is full or empty
+	*************************************************/
+	template <typename T, DWORD dwSize>
+	class SpscQueue
+	{
+		static_assert(dwSize && !(dwSize & (dwSize - 1)), "queue size must be power of 2");
+
+	public:
+		SpscQueue() : dwHead(0), dwTail(0) {}
+
+		// producer thread only
+		BOOL Push(_In_ const T& item)
+		{
+			DWORD dwCurrentTail = dwTail.load(std::memory_order_relaxed);
+			if (dwCurrentTail - dwHead.load(std::memory_order_acquire) == dwSize)
+			{
+				return FALSE;
+			}
+
+			items[dwCurrentTail & (dwSize - 1)] = item;
+			dwTail.store(dwCurrentTail + 1, std::memory_order_release);
+			return TRUE;
+		}
+
+		// consumer thread only
+		BOOL Pop(_Out_ T* lpItem)
+		{
+			DWORD dwCurrentHead = dwHead.load(std::memory_order_relaxed);
+			if (dwCurrentHead == dwTail.load(std::memory_order_acquire))
+			{
+				return FALSE;
+			}
+
+			*lpItem = items[dwCurrentHead & (dwSize - 1)];
+			dwHead.store(dwCurrentHead + 1, std::memory_order_release);
+			return TRUE;
+		}
+
+		// only when both threads are not using queue
+		VOID Reset()
+		{
+			dwHead = 0;
+			dwTail = 0;
+		}
+
+	private:
+		alignas(64) std::atomic<DWORD> dwHead;		// next item to pop
+		alignas(64) std::atomic<DWORD> dwTail;		// next item to push
+		T items[dwSize];
+	};
+
+	/*************************************************
+	* ErrorRing:
+	* Lock-free ring of errors from any thread to
+	* UI thread. Post never blocks or allocates,
+	* error is dropped if ring is full
+	*************************************************/
+	class ErrorRing
+	{
+		static_assert(ERROR_RING_SIZE && !(ERROR_RING_SIZE & (ERROR_RING_SIZE - 1)), "ring size must be power of 2");
+
+	public:
+		ErrorRing();
+		BOOL Post(_In_ DWORD dwCode, _In_ LPCSTR lpContext);	// any thread
+		BOOL Pop(_Out_ PLAYER_ERROR* lpError);					// one consumer thread only
+
+		std::atomic<DWORD> dwPosted;
+		std::atomic<DWORD> dwDropped;
+
+	private:
+		typedef struct
+		{
+			std::atomic<DWORD> dwSequence;	// slot is free for Post when equal to position
+			PLAYER_ERROR error;
+		} ERROR_SLOT;
+
+		alignas(64) std::atomic<DWORD> dwHead;		// next error to pop
+		alignas(64) std::atomic<DWORD> dwTail;		// next error to post
+		ERROR_SLOT slots[ERROR_RING_SIZE];
+	};
+
+	/*************************************************
+	* ConvertSource:
+	* Converts frames of upstream to sample format
+	* of sink. Channels and sample rate are the same,
+	* same format is read without conversion. Float
+	* to 8 or 16-bit can be dithered
+	*************************************************/
+	class ConvertSource : public AudioSource
+	{
+	public:
+		ConvertSource();
+		~ConvertSource();
+		VOID SetDither(_In_ DITHER_MODE eMode, _In_ DWORD dwSeed);
+		BOOL SetSource(_In_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpSourceFormat, _In_ const WAVEFORMATEX* lpDestFormat);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+	private:
+		AudioSource* lpSource;
+		SAMPLE_FORMAT eSourceFormat;
+		SAMPLE_FORMAT eDestFormat;
+		DWORD dwChannels;
+		CONVERT_FRAMES lpConvertFrames;		// specialized kernel, NULL if SIMD kernels are used
+		BYTE* lpScratch;					// upstream frames before conversion
+		DWORD dwScratchFrames;
+		DITHER_MODE eDither;				// mode of float to 8 or 16-bit conversion
+		DWORD dwDitherSeed;
+		BOOL isDithered;					// dither is used by this pair of formats
+		DITHER_STATE ditherState;
+	};
+
+	BOOL NegotiateFormat(_In_ AudioSink* lpSink, _In_ const WAVEFORMATEX* lpFormat, _In_ DWORD dwRate, _In_ DWORD dwChannels, _Out_ WAVEFORMATEX* lpSinkFormat);
+	BOOL GetBusFormat(_In_ const WAVEFORMATEX* lpSinkFormat, _In_ DITHER_MODE eMode, _In_ BOOL isFloatDsp, _Out_ WAVEFORMATEX* lpBusFormat);
+
+	/*************************************************
+	* ResampleSource:
+	* Polyphase windowed-sinc resampler. Converts
+	* sample format too, frames of SeekFrame are
+	* output frames
+	*************************************************/
+	class ResampleSource : public AudioSource
+	{
+	public:
+		ResampleSource();
+		~ResampleSource();
+		VOID SetQuality(_In_ RESAMPLE_QUALITY eNewQuality, _In_ WINDOW_TYPE eNewWindow);
+		BOOL SetSource(_In_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpSourceFormat, _In_ const WAVEFORMATEX* lpDestFormat);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+		DWORD GetTaps();
+
+	private:
+		VOID FreeBuffers();
+		VOID DesignFilter();
+		VOID ResetState(_In_ DWORD dwStartPhase);
+		BOOL FillInput();
+
+		AudioSource* lpSource;
+		RESAMPLE_QUALITY eQuality;
+		WINDOW_TYPE eWindow;
+		DWORD dwChannels;
+		DWORD dwUp;							// output rate / gcd
+		DWORD dwDown;						// input rate / gcd
+		DWORD dwPhases;						// rows of filter table
+		DWORD dwTaps;						// taps of one phase, multiple of 8
+		FLOAT* lpCoefs;						// (dwPhases + 1) rows of dwTaps
+		RESAMPLE_DOT lpDot;
+		DEINTERLEAVE_FRAMES lpDeinterleave;
+		INTERLEAVE_FRAMES lpInterleave;
+		BYTE* lpScratch;					// upstream frames before deinterleave
+		DWORD dwSourceFrameBytes;
+		DWORD dwDestFrameBytes;
+		FLOAT* lpInputData;					// planar input history
+		FLOAT* lpOutputData;				// planar output of one chunk
+		FLOAT** lpInputPlanes;
+		FLOAT** lpOutputPlanes;
+		FLOAT** lpFillPlanes;				// input planes at fill offset
+		DWORD dwInputCapacity;
+		DWORD dwInputValid;					// frames in input planes
+		DWORD dwInputPos;					// first frame of filter window
+		DWORD dwInputEnd;					// end of upstream data in input planes
+		DWORD dwPhase;						// output position between input frames, 0..dwUp-1
+		BOOL isEndOfSource;
+	};
+
+	/*************************************************
+	* MixSource:
+	* Maps channels of upstream to channels of sink
+	* by mix matrix. Output is float, so format
+	* stage goes after it
+	*************************************************/
+	class MixSource : public AudioSource
+	{
+	public:
+		MixSource();
+		VOID SetMode(_In_ CHANNEL_MIX_MODE eNewMode, _In_reads_opt_(dwCount) const FLOAT* lpCustomMatrix, _In_ DWORD dwCount);
+		BOOL IsNeeded(_In_ DWORD dwSourceChannels, _In_ DWORD dwDestChannels);
+		BOOL SetSource(_In_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpSourceFormat, _In_ DWORD dwSourceMask,
+			_In_ DWORD dwDestChannels, _Out_ WAVEFORMATEX* lpMixFormat);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+		const FLOAT* GetMatrix();
+
+	private:
+		AudioSource* lpSource;
+		CHANNEL_MIX_MODE eMode;
+		FLOAT customMatrix[MIX_MAX_CHANNELS * MIX_MAX_CHANNELS];
+		DWORD dwCustomCount;				// values in custom matrix, 0 if it isn't set
+		FLOAT mixMatrix[MIX_MAX_CHANNELS * MIX_MAX_CHANNELS];	// row per output channel
+		MIX_TAP mixTaps[MIX_MAX_CHANNELS * MIX_MAX_CHANNELS];	// non-zero gains of matrix
+		DWORD dwTapCount;
+		DWORD dwSourceChannels;
+		DWORD dwDestChannels;
+		DWORD dwSourceFrameBytes;
+		MIX_PLANE lpMixPlane;
+		DEINTERLEAVE_FRAMES lpDeinterleave;
+		INTERLEAVE_FRAMES lpInterleave;
+		FLOAT* lpSourcePlanes[MIX_MAX_CHANNELS];
+		FLOAT* lpDestPlanes[MIX_MAX_CHANNELS];
+		FLOAT planeData[MIX_MAX_CHANNELS * 2][MIX_BLOCK_FRAMES];	// input planes, then output planes
+		BYTE scratch[MIX_BLOCK_FRAMES * MIX_MAX_CHANNELS * sizeof(double)];	// upstream frames
+	};
+
+	AudioSource* SetFormatStage(_In_ MixSource* lpMix, _In_ ConvertSource* lpConvert, _In_ ResampleSource* lpResample,
+		_In_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpSourceFormat, _In_ DWORD dwSourceMask, _In_ const WAVEFORMATEX* lpDestFormat);
+
+	/*************************************************
+	* GainSource:
+	* Volume and mute in float. Every change is
+	* linear ramp over GAIN_RAMP_MS, other time
+	* gain is constant
+	*************************************************/
+	class GainSource : public AudioSource
+	{
+	public:
+		GainSource();
+		BOOL SetSource(_In_opt_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpFormat);
+		VOID SetGain(_In_ FLOAT fNewGain);
+		VOID SetMute(_In_ BOOL bNewMute);
+		VOID Process(_Inout_updates_bytes_(dwFrames * nBlockAlign) BYTE* lpData, _In_ DWORD dwFrames);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+	private:
+		VOID StartRamp();
+		VOID ApplyFloat(_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples, _In_ DWORD dwFrames);
+
+		AudioSource* lpSource;
+		SAMPLE_FORMAT eFormat;
+		DWORD dwChannels;
+		DWORD dwRampFrames;
+		APPLY_GAIN lpApplyGain;
+		CONVERT_TO_FLOAT lpToFloat;
+		CONVERT_FROM_FLOAT lpFromFloat;
+		FLOAT fGain;						// volume without mute
+		BOOL bMuted;
+		FLOAT fCurrent;						// gain of next frame
+		FLOAT fStep;						// gain change per frame while ramp goes
+		DWORD dwRampLeft;					// frames left to target
+		FLOAT scratch[GAIN_CHUNK_SAMPLES];
+	};
+
+	/*************************************************
+	* EqualizerSource:
+	* Parametric EQ as cascade of biquads in
+	* direct form I. Channels of frame are
+	* SIMD lanes. New band settings ramp
+	* coefficients over EQ_RAMP_MS
+	*************************************************/
+	class EqualizerSource : public AudioSource
+	{
+	public:
+		EqualizerSource();
+		BOOL SetSource(_In_opt_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpFormat);
+		VOID SetBand(_In_ DWORD dwBand, _In_ const EQ_BAND& eqBand);
+		VOID Process(_Inout_updates_bytes_(dwFrames * nBlockAlign) BYTE* lpData, _In_ DWORD dwFrames);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+	private:
+		VOID StartRamp(_In_ DWORD dwBand);
+		VOID ProcessFloat(_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples, _In_ DWORD dwFrames);
+
+		AudioSource* lpSource;
+		SAMPLE_FORMAT eFormat;
+		DWORD dwChannels;
+		DWORD dwSampleRate;
+		DWORD dwRampBlocks;
+		EQ_CASCADE lpCascade;
+		CONVERT_TO_FLOAT lpToFloat;
+		CONVERT_FROM_FLOAT lpFromFloat;
+		EQ_BAND eqBands[EQ_MAX_BANDS];				// settings, kept between tracks
+		BIQUAD_COEFS currentCoefs[EQ_MAX_BANDS];	// coefficients of next block
+		BIQUAD_COEFS stepCoefs[EQ_MAX_BANDS];		// change per block while ramp goes
+		BIQUAD_COEFS targetCoefs[EQ_MAX_BANDS];
+		DWORD dwRampLeft[EQ_MAX_BANDS];				// blocks left to target
+		BOOL isBandActive[EQ_MAX_BANDS];			// band is not bypassed
+		DWORD dwBlockFrames;						// frames since last ramp step
+		FLOAT bandStates[EQ_MAX_BANDS][4 * MIX_MAX_CHANNELS];	// x1, x2, y1, y2 of every channel
+		FLOAT scratch[EQ_CHUNK_SAMPLES];
+	};
+
+	/*************************************************
+	* LimiterSource:
+	* Lookahead brickwall limiter on output bus.
+	* Peaks between samples are found by 4x
+	* oversampling, gain falls over lookahead
+	* before them. Output frames are aligned with
+	* input, lookahead is read ahead from upstream
+	*************************************************/
+	class LimiterSource : public AudioSource
+	{
+	public:
+		LimiterSource();
+		~LimiterSource();
+		VOID SetParams(_In_ BOOL bEnable, _In_ DWORD dwNewLookaheadMs, _In_ FLOAT fNewCeilingDb);
+		BOOL SetSource(_In_opt_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpFormat);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+		DWORD GetLatency();
+
+	private:
+		VOID FreeBuffers();
+		VOID ResetState();
+		DWORD LimitChunk(_In_ DWORD dwFrames);
+
+		AudioSource* lpSource;
+		BOOL bEnabled;
+		DWORD dwLookaheadMs;
+		FLOAT fCeiling;						// linear sample and true peak ceiling
+		SAMPLE_FORMAT eFormat;
+		DWORD dwChannels;
+		DWORD dwWindow;						// frames of gain hold and attack ramp
+		DWORD dwLatency;					// frames between input and output
+		FLOAT fRelease;						// part of distance to target gain recovered per frame
+		TRUE_PEAK lpTruePeak;
+		CONVERT_TO_FLOAT lpToFloat;
+		CONVERT_FROM_FLOAT lpFromFloat;
+		FLOAT* lpInput;						// detector history, then new frames
+		FLOAT* lpOutput;					// limited frames of chunk
+		FLOAT* lpPeaks;						// true peak of every new frame
+		FLOAT* lpDelay;						// ring of dwLatency frames
+		FLOAT* lpHoldGains;					// monotonic deque of gains over window
+		UINT64* lpHoldFrames;				// detector frame of every deque gain
+		FLOAT* lpRampGains;					// ring of held gains, averaged to attack ramp
+		DWORD dwHoldFirst;
+		DWORD dwHoldCount;
+		DWORD dwRampPos;					// next slot of ramp ring
+		DWORD dwDelayPos;					// next slot of delay ring
+		double dRampSum;
+		FLOAT fRecovery;					// gain after release, before hold
+		UINT64 uFrame;						// frames pushed since reset
+		DWORD dwFlushLeft;					// silent frames to push after end of upstream
+		BOOL isEndOfSource;
+	};
+
+	/*************************************************
+	* MemorySource:
+	* Float frames from memory for benchmarks
+	*************************************************/
+	class MemorySource : public AudioSource
+	{
+	public:
+		MemorySource(_In_reads_(dwNewFrames * dwNewChannels) const FLOAT* lpNewData, _In_ DWORD dwNewFrames, _In_ DWORD dwNewChannels);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+	private:
+		const FLOAT* lpData;
+		DWORD dwFrames;
+		DWORD dwChannels;
+		DWORD dwPosition;
+	};
+
+	/*************************************************
+	* CrossfadeSource:
+	* Plays queued tracks one after another and
+	* mixes end of track with start of next one.
+	* Every deck reads fade length ahead, so end
+	* of track is known before it is heard
+	*************************************************/
+	class CrossfadeSource : public AudioSource
+	{
+	public:
+		CrossfadeSource();
+		~CrossfadeSource();
+		BOOL SetFormat(_In_ const WAVEFORMATEX* lpFormat, _In_ DWORD dwNewFadeFrames, _In_ CROSSFADE_CURVE eNewCurve);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+		// control thread side
+		BOOL IsDeckFree(_In_ DWORD dwDeck);
+		BOOL QueueTrack(_In_ DWORD dwDeck, _In_ AudioSource* lpTrack);
+
+	private:
+		VOID FreeBuffers();
+		VOID FillDeck(_In_ DWORD dwDeck, _In_ DWORD dwFrames);
+		DWORD PopFrames(_In_ DWORD dwDeck, _Out_writes_(dwFrames * dwChannels) FLOAT* lpDest, _In_ DWORD dwFrames);
+		FLOAT GetCurveGain(_In_ DWORD dwPosition, _In_ BOOL isIncoming);
+		DWORD MixFade(_Out_writes_(dwFrames * dwChannels) FLOAT* lpDest, _In_ DWORD dwFrames);
+
+		DWORD dwChannels;
+		DWORD dwFadeFrames;
+		DWORD dwCapacity;							// frames of deck ring
+		CROSSFADE_CURVE eCurve;
+		APPLY_GAIN lpApplyGain;
+		MIX_PLANE lpMixPlane;
+		AudioSource* lpDeckSources[CROSSFADE_DECK_COUNT];
+		FLOAT* lpDeckRings[CROSSFADE_DECK_COUNT];
+		DWORD dwDeckHeads[CROSSFADE_DECK_COUNT];	// oldest frame in ring
+		DWORD dwDeckFrames[CROSSFADE_DECK_COUNT];	// frames read ahead
+		BOOL bDeckEnded[CROSSFADE_DECK_COUNT];		// deck source returned last frame
+		std::atomic<DWORD> dwDeckStates[CROSSFADE_DECK_COUNT];
+		DWORD dwCurrentDeck;						// render thread only, CROSSFADE_DECK_COUNT if nothing plays
+		BOOL isFading;
+		DWORD dwFadeLength;							// frames of current fade, can be shorter for short track
+		DWORD dwFadePosition;
+		FLOAT* lpScratch;							// incoming frames of fade
+	};
+
+	/*************************************************
+	* VoiceMixer:
+	* Sums pool of voices to one float bus. Voice
+	* reads memory frames or stream upstream, its
+	* gain and pan are ramped over one block. Bus
+	* is soft clipped. Nothing is allocated after
+	* SetFormat, so voices start and stop on
+	* control thread while sink is pulling frames
+	*************************************************/
+	class VoiceMixer : public AudioSource
+	{
+	public:
+		VoiceMixer();
+		BOOL SetFormat(_In_ const WAVEFORMATEX* lpFormat, _In_ BOOL bNewEndWhenIdle);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+		// control thread side, voice number is VOICE_POOL_SIZE if pool is full
+		DWORD PlayMemory(_In_reads_(dwFrames * dwChannels) const FLOAT* lpData, _In_ DWORD dwFrames, _In_ DWORD dwChannels,
+			_In_ BOOL isLooping, _In_ FLOAT fGain, _In_ FLOAT fPan);
+		DWORD PlayStream(_In_ AudioSource* lpStream, _In_ DWORD dwChannels, _In_ FLOAT fGain, _In_ FLOAT fPan);
+		VOID SetVoiceGain(_In_ DWORD dwVoice, _In_ FLOAT fGain);
+		VOID SetVoicePan(_In_ DWORD dwVoice, _In_ FLOAT fPan);
+		VOID StopVoice(_In_ DWORD dwVoice);
+		BOOL IsVoicePlaying(_In_ DWORD dwVoice);
+		DWORD GetActiveVoices();
+
+	private:
+		typedef struct
+		{
+			AudioSource* lpStream;					// NULL for memory voice
+			const FLOAT* lpData;
+			DWORD dwFrames;
+			DWORD dwPosition;						// render thread only
+			DWORD dwChannels;						// 1 or channels of bus
+			BOOL isLooping;
+			std::atomic<FLOAT> fGain;
+			std::atomic<FLOAT> fPan;				// -1 left, 1 right
+			std::atomic<BOOL> bStopRequested;
+			std::atomic<DWORD> dwState;
+			FLOAT fCurrent[MIX_MAX_CHANNELS];		// gains of last block, render thread only
+		} VOICE;
+
+		DWORD StartVoice(_In_opt_ AudioSource* lpStream, _In_opt_ const FLOAT* lpData, _In_ DWORD dwFrames, _In_ DWORD dwChannels,
+			_In_ BOOL isLooping, _In_ FLOAT fGain, _In_ FLOAT fPan);
+		VOID GetTargetGains(_In_ VOICE* lpVoice, _Out_writes_(MIX_MAX_CHANNELS) FLOAT* lpGains);
+		DWORD FetchFrames(_In_ VOICE* lpVoice, _In_ DWORD dwFrames, _Out_ const FLOAT** lpFrames);
+		DWORD MixVoice(_In_ VOICE* lpVoice, _Inout_updates_(dwFrames * dwChannels) FLOAT* lpBus, _In_ DWORD dwFrames);
+
+		DWORD dwChannels;
+		BOOL bEndWhenIdle;							// short read when no voice plays
+		ACCUMULATE_VOICE lpAccumulate;
+		SOFT_CLIP lpSoftClip;
+		VOICE voicePool[VOICE_POOL_SIZE];
+		std::atomic<DWORD> dwActiveVoices;			// voices taken by render thread
+		FLOAT scratch[VOICE_BLOCK_FRAMES * MIX_MAX_CHANNELS];
+	};
+
+	/*************************************************
+	* ControlSource:
+	* Applies UI commands on audio thread. Commands
+	* are taken at start of every ReadFrames, so
+	* control latency is one sink period
+	*************************************************/
+	class ControlSource : public AudioSource
+	{
+	public:
+		ControlSource();
+		VOID SetSource(_In_ AudioSource* lpUpstream, _In_ const WAVEFORMATEX* lpBusFormat, _In_ const WAVEFORMATEX* lpSinkFormat);
+		VOID SetLimiter(_In_ BOOL bEnable, _In_ DWORD dwLookaheadMs, _In_ FLOAT fCeilingDb);
+		VOID SetDither(_In_ DITHER_MODE eMode, _In_ DWORD dwSeed);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+		// UI thread side
+		BOOL PostCommand(_In_ const PLAYER_COMMAND& playerCommand);
+		BOOL GetEvent(_Out_ PLAYER_EVENT* lpEvent);
+		BOOL GetMark(_Out_ POSITION_MARK* lpMark);
+
+		std::atomic<UINT64> uPosition;				// frames taken from upstream
+		std::atomic<DWORD> dwDroppedEvents;			// events lost because UI didn't read them
+
+	private:
+		VOID ProcessCommands();
+		VOID PostEvent(_In_ PLAYER_EVENT_TYPE eType);
+		VOID PostMark();
+
+		SpscQueue<PLAYER_COMMAND, COMMAND_QUEUE_SIZE> commandQueue;
+		SpscQueue<PLAYER_EVENT, COMMAND_QUEUE_SIZE> eventQueue;
+		SpscQueue<POSITION_MARK, COMMAND_QUEUE_SIZE> markQueue;
+		AudioSource* lpSource;
+		WAVEFORMATEX waveFormat;
+		UINT64 uOutputFrames;						// frames given to sink, with silence
+		BOOL bPaused;								// output silence, don't pull upstream
+		BOOL bEnded;								// stream is ended by NEXT or upstream
+		EqualizerSource eqSource;					// EQ after upstream, kept between tracks
+		GainSource gainSource;						// volume after EQ, kept between tracks
+		LimiterSource limiterSource;				// true peak limiter after volume
+		ConvertSource outputConvert;				// bus to sink format, dither is here
+	};
+
+	/*************************************************
+	* Transport:
+	* UI side of playback control. Commands take
+	* effect at next sink buffer, position is
+	* track frame heard now by sink clock
+	*************************************************/
+	class Transport
+	{
+	public:
+		Transport();
+		VOID Attach(_In_opt_ ControlSource* lpControl, _In_opt_ AudioSink* lpOutputSink);
+		BOOL Play();
+		BOOL Pause();
+		BOOL Stop();
+		BOOL Seek(_In_ UINT64 uFrame);
+		BOOL SetVolume(_In_ FLOAT fVolume);
+		BOOL SetMute(_In_ BOOL bMute);
+		BOOL SetEqBand(_In_ DWORD dwBand, _In_ const EQ_BAND& eqBand);
+		BOOL Next();
+		UINT64 GetPosition();
+		BOOL IsPaused();
+
+	private:
+		BOOL PostCommand(_In_ PLAYER_COMMAND_TYPE eType, _In_ UINT64 uFrame, _In_ FLOAT fVolume, _In_ BOOL bMute);
+		BOOL PostCommand(_In_ const PLAYER_COMMAND& playerCommand);
+		VOID UpdateMarks(_In_ UINT64 uSinkFrame);
+
+		ControlSource* lpControlSource;
+		AudioSink* lpSink;
+		POSITION_MARK currentMark;				// mark which sink is playing now
+		POSITION_MARK nextMark;					// taken from queue, not reached by sink
+		BOOL isNextMark;
+	};
+
+	/*************************************************
+	* TimedSource:
+	* Pass-through source which measures time of
+	* upstream chain. Time of stage is own time
+	* minus time of nearest timed upstream
+	*************************************************/
+	class TimedSource : public AudioSource
+	{
+	public:
+		TimedSource(_In_ LPCSTR lpStageName, _In_ AudioSource* lpUpstream, _In_opt_ TimedSource* lpTimedUpstream);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+		double GetStageSeconds();
+
+		CHAR szName[32];
+		AudioSource* lpSource;
+		TimedSource* lpTimedSource;
+		double dTotalSeconds;		// time of this stage and all upstream
+	};
+
+	/*************************************************
+	* MappedFile:
+	* Read-only view of file. OS reads pages when
+	* they are touched and can drop them again, so
+	* memory and start-up time don't grow with file
+	*************************************************/
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+		BOOL Open(_In_ LPCSTR lpPath);
+		VOID Close();
+		VOID Swap(_Inout_ MappedFile* lpOther);
+
+		BYTE* lpData;				// view of file, pages are read-only
+		DWORD dwSize;				// mapped bytes, RIFF can't address more than 4 GB
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+	};
+
+	class PcmSource : public AudioSource
+	{
+	public:
+		PcmSource();
+		VOID SetData(_In_ const PCM_DATA& dNewPCM);
+		VOID SetLoop(_In_ DWORD dwLoopCount, _In_ DWORD dwCrossfadeFrames);
+		DWORD ReadFrames(_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest, _In_ DWORD dwFrames) override;
+		BOOL SeekFrame(_In_ UINT64 uFrame) override;
+
+		PCM_DATA dPCM;
+		DWORD dwReadOffset;			// next byte to read from PCM data
+		DWORD dwLoopsLeft;			// count of loop repeats to play or LOOP_INFINITE
+		DWORD dwLoopStart;			// loop region in bytes
+		DWORD dwLoopEnd;
+		DWORD dwCrossfadeBytes;		// loop end is mixed with data before loop start
+
+	private:
+		VOID CrossfadeSeam(_Inout_updates_bytes_(dwBytes) BYTE* lpDest, _In_ DWORD dwOffset, _In_ DWORD dwBytes);
+	};
+
+	class NullSink : public AudioSink
+	{
+	public:
+		NullSink(_In_ BOOL bIsPaced);
+		~NullSink();
+		BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) override;
+		BOOL Start() override;
+		VOID Stop() override;
+		VOID Close() override;
+		UINT64 GetPosition() override;
+		DWORD GetLatency() override;
+		DWORD GetUnderruns() override;
+		BOOL IsFinished() override;
+
+		DeadlineMonitor* GetDeadlineMonitor() override;
+
+	private:
+		VOID RenderLoop();
+
+		DeadlineMonitor deadlineMonitor;
+		BOOL bPaced;						// sleep to virtual clock
+		WAVEFORMATEX waveFormat;
+		AudioSource* lpSource;
+		BYTE* lpPeriod;						// preallocated period buffer
+		DWORD dwPeriodFrames;
+		std::thread renderThread;
+		std::atomic<BOOL> bStopRequested;
+		std::atomic<BOOL> bFinished;
+		std::atomic<UINT64> uFramesPlayed;
+	};
+
+	class WaveFileSink : public AudioSink
+	{
+	public:
+		WaveFileSink(_In_ LPCSTR lpFilePath, _In_ BOOL bIsPaced = FALSE);
+		~WaveFileSink();
+		BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) override;
+		BOOL Start() override;
+		VOID Stop() override;
+		VOID Close() override;
+		UINT64 GetPosition() override;
+		DWORD GetLatency() override;
+		DWORD GetUnderruns() override;
+		BOOL IsFinished() override;
+
+	private:
+		VOID RenderLoop();
+
+		BOOL bPaced;						// write at wall clock rate
+		CHAR szPath[260];
+		FILE* lpFile;
+		WAVEFORMATEX waveFormat;
+		AudioSource* lpSource;
+		BYTE* lpPeriod;						// preallocated period buffer
+		DWORD dwPeriodFrames;
+		DWORD dwDataOffset;					// offset of 'data' chunk size in file
+		std::thread renderThread;
+		std::atomic<BOOL> bStopRequested;
+		std::atomic<BOOL> bFinished;
+		std::atomic<UINT64> uFramesWritten;
+	};
+
+	BOOL RenderOffline(_In_ const WAVEFORMATEX* lpFormat, _In_ TimedSource* lpChain, _In_ AudioSink* lpSink, _Inout_ RENDER_STATS_P lpStats);
+
+#ifdef __linux__
+	class AlsaSink : public AudioSink
+	{
+	public:
+		AlsaSink(_In_ LPCSTR lpDeviceName);
+		~AlsaSink();
+		BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) override;
+		BOOL Start() override;
+		VOID Stop() override;
+		VOID Close() override;
+		UINT64 GetPosition() override;
+		DWORD GetLatency() override;
+		DWORD GetUnderruns() override;
+		BOOL IsFinished() override;
+
+		DeadlineMonitor* GetDeadlineMonitor() override;
+		BOOL IsFormatSupported(_In_ const WAVEFORMATEX* lpFormat) override;
+
+	private:
+		VOID RenderLoop();
+		BOOL RecoverStream(_In_ long lError);
+		DWORD WritePeriod();
+
+		CHAR szDevice[128];
+		snd_pcm_t* lpPcm;
+		struct pollfd* lpPollFds;			// device descriptors + wake pipe
+		DWORD dwPollCount;					// count of device descriptors
+		int iWakePipe[2];					// pipe to break poll on stop
+		WAVEFORMATEX waveFormat;
+		AudioSource* lpSource;
+		DWORD dwPeriodFrames;
+		DWORD dwBufferFrames;
+		BOOL bCanPause;						// device supports snd_pcm_pause
+		BOOL bPaused;
+		BOOL bEndOfData;
+		DWORD dwPeriodsWritten;
+		DeadlineMonitor deadlineMonitor;
+		std::thread renderThread;
+		std::atomic<BOOL> bStopRequested;
+		std::atomic<BOOL> bFinished;
+		std::atomic<DWORD> dwXruns;
+		std::atomic<UINT64> uFramesWritten;
+		std::atomic<LONG64> llDelayFrames;	// frames queued in device after last write
+	};
+#endif
+}
+
+extern Player::ErrorRing errorRing;
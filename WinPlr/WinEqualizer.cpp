@@ -0,0 +1,653 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio parametric EQ
+**********************************************************
+* WinEqualizer.cpp
+* Biquad cascade with channels in SIMD lanes
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+static const LPCSTR lpBandNames[] = { "off", "peak", "low_shelf", "high_shelf", "high_pass", "low_pass" };
+static const BIQUAD_COEFS identityCoefs = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+/*************************************************
+* GetEqBandTypeByName():
+* Band type from launch param value, peaking
+* if name is unknown
+*************************************************/
+EQ_BAND_TYPE
+GetEqBandTypeByName(
+	_In_opt_ LPCSTR lpName
+)
+{
+	for (DWORD i = 0; lpName && i < sizeof(lpBandNames) / sizeof(LPCSTR); i++)
+	{
+		if (!strncmp(lpName, lpBandNames[i], strlen(lpBandNames[i]))) { return (EQ_BAND_TYPE)i; }
+	}
+	return EQ_BAND_PEAKING;
+}
+
+LPCSTR
+GetEqBandTypeName(
+	_In_ EQ_BAND_TYPE eType
+)
+{
+	return (DWORD)eType < sizeof(lpBandNames) / sizeof(LPCSTR) ? lpBandNames[eType] : "unknown";
+}
+
+/*************************************************
+* DesignBiquad():
+* Coefficients of band by RBJ Audio EQ Cookbook.
+* Frequency is kept below Nyquist, Q above 0.1
+*************************************************/
+VOID
+DesignBiquad(
+	_In_ const EQ_BAND* lpBand,
+	_In_ DWORD dwSampleRate,
+	_Out_ BIQUAD_COEFS* lpCoefs
+)
+{
+	*lpCoefs = identityCoefs;
+	if (lpBand->eType == EQ_BAND_OFF || lpBand->eType >= EQ_BAND_TYPE_COUNT || !dwSampleRate) { return; }
+
+	const double dPi = 3.14159265358979323846;
+	double dFrequency = min(max((double)lpBand->fFrequency, 1.0), dwSampleRate * 0.49);
+	double dQ = max((double)lpBand->fQ, 0.1);
+	double w0 = 2.0 * dPi * dFrequency / dwSampleRate;
+	double dCos = cos(w0);
+	double dAlpha = sin(w0) / (2.0 * dQ);
+	double A = pow(10.0, lpBand->fGainDb / 40.0);
+	double dShelf = 2.0 * sqrt(A) * dAlpha;
+	double b0 = 1.0, b1 = 0.0, b2 = 0.0, a0 = 1.0, a1 = 0.0, a2 = 0.0;
+
+	switch (lpBand->eType)
+	{
+	case EQ_BAND_PEAKING:
+		b0 = 1.0 + dAlpha * A;		b1 = -2.0 * dCos;	b2 = 1.0 - dAlpha * A;
+		a0 = 1.0 + dAlpha / A;		a1 = -2.0 * dCos;	a2 = 1.0 - dAlpha / A;
+		break;
+	case EQ_BAND_LOW_SHELF:
+		b0 = A * ((A + 1.0) - (A - 1.0) * dCos + dShelf);
+		b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * dCos);
+		b2 = A * ((A + 1.0) - (A - 1.0) * dCos - dShelf);
+		a0 = (A + 1.0) + (A - 1.0) * dCos + dShelf;
+		a1 = -2.0 * ((A - 1.0) + (A + 1.0) * dCos);
+		a2 = (A + 1.0) + (A - 1.0) * dCos - dShelf;
+		break;
+	case EQ_BAND_HIGH_SHELF:
+		b0 = A * ((A + 1.0) + (A - 1.0) * dCos + dShelf);
+		b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * dCos);
+		b2 = A * ((A + 1.0) + (A - 1.0) * dCos - dShelf);
+		a0 = (A + 1.0) - (A - 1.0) * dCos + dShelf;
+		a1 = 2.0 * ((A - 1.0) - (A + 1.0) * dCos);
+		a2 = (A + 1.0) - (A - 1.0) * dCos - dShelf;
+		break;
+	case EQ_BAND_HIGH_PASS:
+		b0 = (1.0 + dCos) / 2.0;	b1 = -(1.0 + dCos);	b2 = (1.0 + dCos) / 2.0;
+		a0 = 1.0 + dAlpha;			a1 = -2.0 * dCos;	a2 = 1.0 - dAlpha;
+		break;
+	case EQ_BAND_LOW_PASS:
+		b0 = (1.0 - dCos) / 2.0;	b1 = 1.0 - dCos;	b2 = (1.0 - dCos) / 2.0;
+		a0 = 1.0 + dAlpha;			a1 = -2.0 * dCos;	a2 = 1.0 - dAlpha;
+		break;
+	default:
+		break;
+	}
+
+	lpCoefs->b0 = (FLOAT)(b0 / a0);
+	lpCoefs->b1 = (FLOAT)(b1 / a0);
+	lpCoefs->b2 = (FLOAT)(b2 / a0);
+	lpCoefs->a1 = (FLOAT)(a1 / a0);
+	lpCoefs->a2 = (FLOAT)(a2 / a0);
+}
+
+/*************************************************
+* ParseEqBands():
+* Bands from "TYPE:FREQ:GAIN:Q,..." text, gain
+* and Q can be omitted. Returns count of bands
+*************************************************/
+DWORD
+ParseEqBands(
+	_In_opt_ LPCSTR lpText,
+	_Out_writes_(EQ_MAX_BANDS) EQ_BAND* lpBands
+)
+{
+	DWORD dwCount = 0;
+	while (lpText && *lpText && *lpText != ' ' && dwCount < EQ_MAX_BANDS)
+	{
+		EQ_BAND* lpBand = &lpBands[dwCount];
+		lpBand->eType = GetEqBandTypeByName(lpText);
+		lpBand->fFrequency = 1000.0f;
+		lpBand->fGainDb = 0.0f;
+		lpBand->fQ = 0.7071f;
+
+		// fields after type are optional
+		FLOAT* lpFields[] = { &lpBand->fFrequency, &lpBand->fGainDb, &lpBand->fQ };
+		while (*lpText && *lpText != ':' && *lpText != ',' && *lpText != ' ') { lpText++; }
+		for (DWORD i = 0; i < sizeof(lpFields) / sizeof(FLOAT*) && *lpText == ':'; i++)
+		{
+			*lpFields[i] = strtof(lpText + 1, (LPSTR*)&lpText);
+		}
+
+		dwCount++;
+		while (*lpText && *lpText != ',' && *lpText != ' ') { lpText++; }
+		if (*lpText == ',') { lpText++; }
+	}
+	return dwCount;
+}
+
+/*************************************************
+* EqCascadeScalar():
+* One band over interleaved frames in direct
+* form I: y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2,
+* summed left to right. SIMD kernels keep this
+* order, so every ISA gives the same bits.
+* State holds real signal history, so ramped
+* coefficients do not kick it. Layout is x1, x2,
+* y1, y2, each for every channel
+*************************************************/
+static VOID
+EqCascadeScalar(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ const BIQUAD_COEFS* lpCoefs,
+	_Inout_updates_(4 * MIX_MAX_CHANNELS) FLOAT* lpState
+)
+{
+	for (DWORD c = 0; c < dwChannels; c++)
+	{
+		FLOAT x1 = lpState[c];
+		FLOAT x2 = lpState[MIX_MAX_CHANNELS + c];
+		FLOAT y1 = lpState[2 * MIX_MAX_CHANNELS + c];
+		FLOAT y2 = lpState[3 * MIX_MAX_CHANNELS + c];
+		for (DWORD i = 0; i < dwFrames; i++)
+		{
+			FLOAT x = lpSamples[i * dwChannels + c];
+			FLOAT y = lpCoefs->b0 * x + lpCoefs->b1 * x1 + lpCoefs->b2 * x2 - lpCoefs->a1 * y1 - lpCoefs->a2 * y2;
+			x2 = x1;
+			x1 = x;
+			y2 = y1;
+			y1 = y;
+			lpSamples[i * dwChannels + c] = y;
+		}
+
+		// decaying output would become denormal and slow
+		lpState[c] = x1;
+		lpState[MIX_MAX_CHANNELS + c] = x2;
+		lpState[2 * MIX_MAX_CHANNELS + c] = fabsf(y1) < EQ_DENORMAL_LIMIT ? 0.0f : y1;
+		lpState[3 * MIX_MAX_CHANNELS + c] = fabsf(y2) < EQ_DENORMAL_LIMIT ? 0.0f : y2;
+	}
+}
+
+#ifdef CONVERT_X86
+/*************************************************
+* LoadLanes():
+* First dwLanes floats to vector, rest is zero
+*************************************************/
+static inline __m128
+LoadLanes(
+	_In_reads_(dwLanes) const FLOAT* lpData,
+	_In_ DWORD dwLanes
+)
+{
+	switch (dwLanes)
+	{
+	case 1:		return _mm_load_ss(lpData);
+	case 2:		return _mm_castpd_ps(_mm_load_sd((const double*)lpData));
+	case 3:		return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd((const double*)lpData)), _mm_load_ss(lpData + 2));
+	default:	return _mm_loadu_ps(lpData);
+	}
+}
+
+static inline VOID
+StoreLanes(
+	_Out_writes_(dwLanes) FLOAT* lpData,
+	_In_ __m128 value,
+	_In_ DWORD dwLanes
+)
+{
+	switch (dwLanes)
+	{
+	case 1:		_mm_store_ss(lpData, value); break;
+	case 2:		_mm_store_sd((double*)lpData, _mm_castps_pd(value)); break;
+	case 3:
+		_mm_store_sd((double*)lpData, _mm_castps_pd(value));
+		_mm_store_ss(lpData + 2, _mm_movehl_ps(value, value));
+		break;
+	default:	_mm_storeu_ps(lpData, value); break;
+	}
+}
+
+/*************************************************
+* FlushDenormals():
+* Zero lanes of state below EQ_DENORMAL_LIMIT
+*************************************************/
+static inline __m128
+FlushDenormals(
+	_In_ __m128 state
+)
+{
+	__m128 absState = _mm_andnot_ps(_mm_set1_ps(-0.0f), state);
+	return _mm_and_ps(state, _mm_cmpge_ps(absState, _mm_set1_ps(EQ_DENORMAL_LIMIT)));
+}
+
+/*************************************************
+* EqCascadeSse():
+* Frame is one vector of up to 4 channels, or
+* two vectors of up to 8 channels
+*************************************************/
+static VOID
+EqCascadeSse(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ const BIQUAD_COEFS* lpCoefs,
+	_Inout_updates_(4 * MIX_MAX_CHANNELS) FLOAT* lpState
+)
+{
+	if (!dwChannels || dwChannels > MIX_MAX_CHANNELS)
+	{
+		EqCascadeScalar(lpSamples, dwFrames, dwChannels, lpCoefs, lpState);
+		return;
+	}
+
+	__m128 b0 = _mm_set1_ps(lpCoefs->b0);
+	__m128 b1 = _mm_set1_ps(lpCoefs->b1);
+	__m128 b2 = _mm_set1_ps(lpCoefs->b2);
+	__m128 a1 = _mm_set1_ps(lpCoefs->a1);
+	__m128 a2 = _mm_set1_ps(lpCoefs->a2);
+	DWORD dwLanes[2] = { min(dwChannels, 4u), dwChannels - min(dwChannels, 4u) };
+
+	for (DWORD h = 0; h < 2 && dwLanes[h]; h++)
+	{
+		FLOAT* lpHalf = lpState + h * 4;
+		__m128 x1 = _mm_loadu_ps(lpHalf);
+		__m128 x2 = _mm_loadu_ps(lpHalf + MIX_MAX_CHANNELS);
+		__m128 y1 = _mm_loadu_ps(lpHalf + 2 * MIX_MAX_CHANNELS);
+		__m128 y2 = _mm_loadu_ps(lpHalf + 3 * MIX_MAX_CHANNELS);
+		for (DWORD i = 0; i < dwFrames; i++)
+		{
+			FLOAT* lpFrame = lpSamples + i * dwChannels + h * 4;
+			__m128 x = LoadLanes(lpFrame, dwLanes[h]);
+			__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, x), _mm_mul_ps(b1, x1)), _mm_mul_ps(b2, x2));
+			y = _mm_sub_ps(_mm_sub_ps(y, _mm_mul_ps(a1, y1)), _mm_mul_ps(a2, y2));
+			x2 = x1;
+			x1 = x;
+			y2 = y1;
+			y1 = y;
+			StoreLanes(lpFrame, y, dwLanes[h]);
+		}
+
+		_mm_storeu_ps(lpHalf, x1);
+		_mm_storeu_ps(lpHalf + MIX_MAX_CHANNELS, x2);
+		_mm_storeu_ps(lpHalf + 2 * MIX_MAX_CHANNELS, FlushDenormals(y1));
+		_mm_storeu_ps(lpHalf + 3 * MIX_MAX_CHANNELS, FlushDenormals(y2));
+	}
+}
+
+/*************************************************
+* EqCascadeAvx2():
+* Frame of 8 channels is one vector. Masked
+* access to smaller frames overlaps store of
+* previous frame and stalls, so they go to
+* SSE kernel
+*************************************************/
+CONVERT_TARGET_AVX2
+static VOID
+EqCascadeAvx2(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ const BIQUAD_COEFS* lpCoefs,
+	_Inout_updates_(4 * MIX_MAX_CHANNELS) FLOAT* lpState
+)
+{
+	if (dwChannels != 8)
+	{
+		EqCascadeSse(lpSamples, dwFrames, dwChannels, lpCoefs, lpState);
+		return;
+	}
+
+	__m256 b0 = _mm256_set1_ps(lpCoefs->b0);
+	__m256 b1 = _mm256_set1_ps(lpCoefs->b1);
+	__m256 b2 = _mm256_set1_ps(lpCoefs->b2);
+	__m256 a1 = _mm256_set1_ps(lpCoefs->a1);
+	__m256 a2 = _mm256_set1_ps(lpCoefs->a2);
+
+	__m256 x1 = _mm256_loadu_ps(lpState);
+	__m256 x2 = _mm256_loadu_ps(lpState + MIX_MAX_CHANNELS);
+	__m256 y1 = _mm256_loadu_ps(lpState + 2 * MIX_MAX_CHANNELS);
+	__m256 y2 = _mm256_loadu_ps(lpState + 3 * MIX_MAX_CHANNELS);
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		FLOAT* lpFrame = lpSamples + i * 8;
+		__m256 x = _mm256_loadu_ps(lpFrame);
+		__m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(b0, x), _mm256_mul_ps(b1, x1)), _mm256_mul_ps(b2, x2));
+		y = _mm256_sub_ps(_mm256_sub_ps(y, _mm256_mul_ps(a1, y1)), _mm256_mul_ps(a2, y2));
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		_mm256_storeu_ps(lpFrame, y);
+	}
+
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	__m256 limit = _mm256_set1_ps(EQ_DENORMAL_LIMIT);
+	_mm256_storeu_ps(lpState, x1);
+	_mm256_storeu_ps(lpState + MIX_MAX_CHANNELS, x2);
+	_mm256_storeu_ps(lpState + 2 * MIX_MAX_CHANNELS, _mm256_and_ps(y1, _mm256_cmp_ps(_mm256_andnot_ps(signMask, y1), limit, _CMP_GE_OQ)));
+	_mm256_storeu_ps(lpState + 3 * MIX_MAX_CHANNELS, _mm256_and_ps(y2, _mm256_cmp_ps(_mm256_andnot_ps(signMask, y2), limit, _CMP_GE_OQ)));
+	_mm256_zeroupper();
+}
+#endif
+
+/*************************************************
+* GetEqCascadeKernel():
+* Biquad kernel for selected ISA
+*************************************************/
+EQ_CASCADE
+GetEqCascadeKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return EqCascadeAvx2;
+	case CONVERT_ISA_SSE2:	return EqCascadeSse;
+	default:				break;
+	}
+#endif
+	return EqCascadeScalar;
+}
+
+/*************************************************
+* EqualizerSource():
+* Constructor
+*************************************************/
+Player::EqualizerSource::EqualizerSource() :
+	lpSource(NULL),
+	eFormat(SAMPLE_FORMAT_UNKNOWN),
+	dwChannels(0),
+	dwSampleRate(0),
+	dwRampBlocks(1),
+	lpCascade(NULL),
+	lpToFloat(NULL),
+	lpFromFloat(NULL),
+	dwBlockFrames(0)
+{
+	memset(eqBands, 0, sizeof(eqBands));
+	memset(bandStates, 0, sizeof(bandStates));
+	for (DWORD i = 0; i < EQ_MAX_BANDS; i++)
+	{
+		currentCoefs[i] = identityCoefs;
+		targetCoefs[i] = identityCoefs;
+		stepCoefs[i] = {};
+		dwRampLeft[i] = 0;
+		isBandActive[i] = FALSE;
+	}
+}
+
+/*************************************************
+* SetSource():
+* Attach upstream. Bands are kept and designed
+* for new rate, new stream starts at them
+* without ramp. Returns FALSE if sample format
+* is unknown
+*************************************************/
+BOOL
+Player::EqualizerSource::SetSource(
+	_In_opt_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	lpSource = lpUpstream;
+	eFormat = GetSampleFormat(lpFormat);
+	dwChannels = lpFormat->nChannels;
+	dwSampleRate = lpFormat->nSamplesPerSec;
+	dwRampBlocks = max(dwSampleRate * EQ_RAMP_MS / 1000 / EQ_STEP_FRAMES, 1u);
+	lpCascade = GetEqCascadeKernel();
+	lpToFloat = GetToFloatKernel(GetConvertIsa(), eFormat);
+	lpFromFloat = GetFromFloatKernel(GetConvertIsa(), eFormat);
+
+	for (DWORD i = 0; i < EQ_MAX_BANDS; i++)
+	{
+		DesignBiquad(&eqBands[i], dwSampleRate, &targetCoefs[i]);
+		currentCoefs[i] = targetCoefs[i];
+		dwRampLeft[i] = 0;
+		isBandActive[i] = eqBands[i].eType != EQ_BAND_OFF;
+	}
+	memset(bandStates, 0, sizeof(bandStates));
+	dwBlockFrames = 0;
+	return lpToFloat && lpFromFloat;
+}
+
+/*************************************************
+* SetBand():
+* New settings of band, audio thread only
+*************************************************/
+VOID
+Player::EqualizerSource::SetBand(
+	_In_ DWORD dwBand,
+	_In_ const EQ_BAND& eqBand
+)
+{
+	if (dwBand >= EQ_MAX_BANDS) { return; }
+
+	eqBands[dwBand] = eqBand;
+	if (eqBand.eType == EQ_BAND_OFF && !isBandActive[dwBand]) { return; }
+	StartRamp(dwBand);
+}
+
+/*************************************************
+* StartRamp():
+* Coefficients go linearly from current ones.
+* Stability region of biquad is convex, so
+* every coefficient set of ramp is stable.
+* Enabled band starts ramp from pass-through
+*************************************************/
+VOID
+Player::EqualizerSource::StartRamp(
+	_In_ DWORD dwBand
+)
+{
+	DesignBiquad(&eqBands[dwBand], dwSampleRate, &targetCoefs[dwBand]);
+	if (!isBandActive[dwBand])
+	{
+		currentCoefs[dwBand] = identityCoefs;
+		memset(bandStates[dwBand], 0, sizeof(bandStates[dwBand]));
+		isBandActive[dwBand] = TRUE;
+	}
+
+	const BIQUAD_COEFS& current = currentCoefs[dwBand];
+	const BIQUAD_COEFS& target = targetCoefs[dwBand];
+	FLOAT fBlocks = (FLOAT)dwRampBlocks;
+	stepCoefs[dwBand].b0 = (target.b0 - current.b0) / fBlocks;
+	stepCoefs[dwBand].b1 = (target.b1 - current.b1) / fBlocks;
+	stepCoefs[dwBand].b2 = (target.b2 - current.b2) / fBlocks;
+	stepCoefs[dwBand].a1 = (target.a1 - current.a1) / fBlocks;
+	stepCoefs[dwBand].a2 = (target.a2 - current.a2) / fBlocks;
+	dwRampLeft[dwBand] = dwRampBlocks;
+}
+
+/*************************************************
+* ProcessFloat():
+* Every active band over block with constant
+* coefficients. While ramp goes, block is
+* EQ_STEP_FRAMES and ramps step at its end,
+* coarser steps are audible as clicks on loud
+* bands. Band turned off is bypassed after ramp
+*************************************************/
+VOID
+Player::EqualizerSource::ProcessFloat(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames
+)
+{
+	while (dwFrames)
+	{
+		BOOL isRamping = FALSE;
+		for (DWORD i = 0; i < EQ_MAX_BANDS; i++) { isRamping |= dwRampLeft[i] != 0; }
+
+		DWORD dwBlock = isRamping ? min(dwFrames, EQ_STEP_FRAMES - dwBlockFrames) : dwFrames;
+		for (DWORD i = 0; i < EQ_MAX_BANDS; i++)
+		{
+			if (isBandActive[i]) { lpCascade(lpSamples, dwBlock, dwChannels, &currentCoefs[i], bandStates[i]); }
+		}
+
+		lpSamples += (size_t)dwBlock * dwChannels;
+		dwFrames -= dwBlock;
+		if (!isRamping) { continue; }
+
+		dwBlockFrames += dwBlock;
+		if (dwBlockFrames < EQ_STEP_FRAMES) { continue; }
+
+		dwBlockFrames = 0;
+		for (DWORD i = 0; i < EQ_MAX_BANDS; i++)
+		{
+			if (!dwRampLeft[i]) { continue; }
+
+			BIQUAD_COEFS& current = currentCoefs[i];
+			current.b0 += stepCoefs[i].b0;
+			current.b1 += stepCoefs[i].b1;
+			current.b2 += stepCoefs[i].b2;
+			current.a1 += stepCoefs[i].a1;
+			current.a2 += stepCoefs[i].a2;
+			if (--dwRampLeft[i]) { continue; }
+
+			current = targetCoefs[i];
+			isBandActive[i] = eqBands[i].eType != EQ_BAND_OFF;
+		}
+	}
+}
+
+/*************************************************
+* Process():
+* Filter frames in place. Integer samples go
+* through float by chunks on stage scratch
+*************************************************/
+VOID
+Player::EqualizerSource::Process(
+	_Inout_updates_bytes_(dwFrames * nBlockAlign) BYTE* lpData,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpToFloat || !lpFromFloat || !dwChannels || dwChannels > MIX_MAX_CHANNELS) { return; }
+
+	BOOL isActive = FALSE;
+	for (DWORD i = 0; i < EQ_MAX_BANDS; i++) { isActive |= isBandActive[i]; }
+	if (!isActive) { return; }
+
+	if (eFormat == SAMPLE_FORMAT_F32)
+	{
+		ProcessFloat((FLOAT*)lpData, dwFrames);
+		return;
+	}
+
+	DWORD dwFrameBytes = GetSampleBytes(eFormat) * dwChannels;
+	DWORD dwChunkFrames = EQ_CHUNK_SAMPLES / dwChannels;
+	while (dwFrames)
+	{
+		DWORD dwChunk = min(dwFrames, dwChunkFrames);
+		lpToFloat(lpData, scratch, dwChunk * dwChannels);
+		ProcessFloat(scratch, dwChunk);
+		lpFromFloat(scratch, lpData, dwChunk * dwChannels);
+
+		lpData += (size_t)dwChunk * dwFrameBytes;
+		dwFrames -= dwChunk;
+	}
+}
+
+/*************************************************
+* ReadFrames():
+* Pull upstream and filter it
+*************************************************/
+DWORD
+Player::EqualizerSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpSource) { return 0; }
+
+	DWORD dwRead = lpSource->ReadFrames(lpDest, dwFrames);
+	Process(lpDest, dwRead);
+	return dwRead;
+}
+
+BOOL
+Player::EqualizerSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	return lpSource ? lpSource->SeekFrame(uFrame) : FALSE;
+}
+
+/*************************************************
+* RunEqBenchmark():
+* Time of one band on one channel sample for
+* common channel counts, ten peaking bands at
+* 48 kHz over white noise
+*************************************************/
+VOID
+RunEqBenchmark(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	const DWORD dwChannelCounts[] = { 1, 2, 6, 8 };
+	const DWORD dwRate = 48000;
+	const DWORD dwSeconds = 10;
+	const DWORD dwPeriodFrames = dwRate / 100;
+
+	int iWritten = snprintf(lpText, dwSize, "Parametric EQ, %u bands at %u Hz, ns per band per channel sample (%s)\n",
+		EQ_MAX_BANDS, dwRate, GetConvertIsaName(GetConvertIsa()));
+	DWORD dwOffset = iWritten > 0 ? min((DWORD)iWritten, dwSize) : 0;
+
+	for (DWORD n = 0; n < sizeof(dwChannelCounts) / sizeof(DWORD); n++)
+	{
+		DWORD dwChannels = dwChannelCounts[n];
+		DWORD dwSamples = dwPeriodFrames * dwChannels;
+		FLOAT* lpNoise = new FLOAT[dwSamples];
+		FLOAT* lpPeriod = new FLOAT[dwSamples];
+		FillBenchmarkNoise(lpNoise, dwSamples, 0.5f);
+
+		WAVEFORMATEX floatFormat = {};
+		floatFormat.nChannels = (WORD)dwChannels;
+		floatFormat.nSamplesPerSec = dwRate;
+		SetSampleFormat(&floatFormat, SAMPLE_FORMAT_F32);
+		Player::EqualizerSource* lpEqualizer = new Player::EqualizerSource();
+		for (DWORD b = 0; b < EQ_MAX_BANDS; b++)
+		{
+			EQ_BAND eqBand = { EQ_BAND_PEAKING, 31.25f * (FLOAT)(1 << b), (b & 1) ? -6.0f : 6.0f, 1.4f };
+			lpEqualizer->SetBand(b, eqBand);
+		}
+		lpEqualizer->SetSource(NULL, &floatFormat);
+
+		// input is copied every period, so only filter is timed
+		double dTime = 0.0;
+		for (DWORD dwPeriod = 0; dwPeriod < dwSeconds * 100; dwPeriod++)
+		{
+			memcpy(lpPeriod, lpNoise, dwSamples * sizeof(FLOAT));
+			auto startTime = std::chrono::steady_clock::now();
+			lpEqualizer->Process((BYTE*)lpPeriod, dwPeriodFrames);
+			dTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		}
+
+		double dBandSamples = (double)dwRate * dwSeconds * dwChannels * EQ_MAX_BANDS;
+		iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%u ch: %.2f ns, %.0fx realtime\n",
+			dwChannels, dTime * 1e9 / dBandSamples, (double)dwSeconds / max(dTime, 1e-9));
+		if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+
+		delete lpEqualizer;
+		delete[] lpNoise;
+		delete[] lpPeriod;
+	}
+}
@@ -0,0 +1,351 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio gain stage
+**********************************************************
+* WinGain.cpp
+* Smoothed software volume and mute
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/*************************************************
+* ApplyGainScalar():
+* Gain of frame n is fGain + fStep * n
+*************************************************/
+static VOID
+ApplyGainScalar(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ FLOAT fGain,
+	_In_ FLOAT fStep
+)
+{
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		FLOAT fFrameGain = fGain + fStep * (FLOAT)i;
+		for (DWORD c = 0; c < dwChannels; c++)
+		{
+			lpSamples[i * dwChannels + c] *= fFrameGain;
+		}
+	}
+}
+
+#ifdef CONVERT_X86
+/*************************************************
+* GetGainPeriod():
+* Vectors after which frame pattern of lanes
+* repeats, it is lcm(channels, lanes) / lanes
+*************************************************/
+static DWORD
+GetGainPeriod(
+	_In_ DWORD dwChannels,
+	_In_ DWORD dwLanes
+)
+{
+	DWORD dwSamples = dwChannels;
+	while (dwSamples % dwLanes) { dwSamples += dwChannels; }
+	return dwSamples / dwLanes;
+}
+
+static VOID
+ApplyGainSse(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ FLOAT fGain,
+	_In_ FLOAT fStep
+)
+{
+	if (!dwChannels || dwChannels > MIX_MAX_CHANNELS)
+	{
+		ApplyGainScalar(lpSamples, dwFrames, dwChannels, fGain, fStep);
+		return;
+	}
+
+	// frame of every lane inside period
+	DWORD dwVectors = GetGainPeriod(dwChannels, 4);
+	DWORD dwPeriodFrames = dwVectors * 4 / dwChannels;
+	__m128 frameOffsets[MIX_MAX_CHANNELS];
+	for (DWORD v = 0; v < dwVectors; v++)
+	{
+		DWORD s = v * 4;
+		frameOffsets[v] = _mm_setr_ps((FLOAT)(s / dwChannels), (FLOAT)((s + 1) / dwChannels),
+			(FLOAT)((s + 2) / dwChannels), (FLOAT)((s + 3) / dwChannels));
+	}
+
+	__m128 gain = _mm_set1_ps(fGain);
+	__m128 step = _mm_set1_ps(fStep);
+	DWORD dwPeriods = dwFrames / dwPeriodFrames;
+	FLOAT* lpData = lpSamples;
+	for (DWORD n = 0; n < dwPeriods; n++)
+	{
+		__m128 frameBase = _mm_set1_ps((FLOAT)(n * dwPeriodFrames));
+		for (DWORD v = 0; v < dwVectors; v++, lpData += 4)
+		{
+			__m128 laneGain = _mm_add_ps(gain, _mm_mul_ps(step, _mm_add_ps(frameBase, frameOffsets[v])));
+			_mm_storeu_ps(lpData, _mm_mul_ps(_mm_loadu_ps(lpData), laneGain));
+		}
+	}
+
+	DWORD dwDone = dwPeriods * dwPeriodFrames;
+	ApplyGainScalar(lpData, dwFrames - dwDone, dwChannels, fGain + fStep * (FLOAT)dwDone, fStep);
+}
+
+CONVERT_TARGET_AVX2
+static VOID
+ApplyGainAvx2(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels,
+	_In_ FLOAT fGain,
+	_In_ FLOAT fStep
+)
+{
+	if (!dwChannels || dwChannels > MIX_MAX_CHANNELS)
+	{
+		ApplyGainScalar(lpSamples, dwFrames, dwChannels, fGain, fStep);
+		return;
+	}
+
+	DWORD dwVectors = GetGainPeriod(dwChannels, 8);
+	DWORD dwPeriodFrames = dwVectors * 8 / dwChannels;
+	__m256 frameOffsets[MIX_MAX_CHANNELS];
+	for (DWORD v = 0; v < dwVectors; v++)
+	{
+		DWORD s = v * 8;
+		frameOffsets[v] = _mm256_setr_ps((FLOAT)(s / dwChannels), (FLOAT)((s + 1) / dwChannels),
+			(FLOAT)((s + 2) / dwChannels), (FLOAT)((s + 3) / dwChannels), (FLOAT)((s + 4) / dwChannels),
+			(FLOAT)((s + 5) / dwChannels), (FLOAT)((s + 6) / dwChannels), (FLOAT)((s + 7) / dwChannels));
+	}
+
+	__m256 gain = _mm256_set1_ps(fGain);
+	__m256 step = _mm256_set1_ps(fStep);
+	DWORD dwPeriods = dwFrames / dwPeriodFrames;
+	FLOAT* lpData = lpSamples;
+	for (DWORD n = 0; n < dwPeriods; n++)
+	{
+		__m256 frameBase = _mm256_set1_ps((FLOAT)(n * dwPeriodFrames));
+		for (DWORD v = 0; v < dwVectors; v++, lpData += 8)
+		{
+			__m256 laneGain = _mm256_add_ps(gain, _mm256_mul_ps(step, _mm256_add_ps(frameBase, frameOffsets[v])));
+			_mm256_storeu_ps(lpData, _mm256_mul_ps(_mm256_loadu_ps(lpData), laneGain));
+		}
+	}
+
+	DWORD dwDone = dwPeriods * dwPeriodFrames;
+	ApplyGainScalar(lpData, dwFrames - dwDone, dwChannels, fGain + fStep * (FLOAT)dwDone, fStep);
+}
+#endif
+
+/*************************************************
+* GetApplyGainKernel():
+* Gain ramp kernel for selected ISA
+*************************************************/
+APPLY_GAIN
+GetApplyGainKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return ApplyGainAvx2;
+	case CONVERT_ISA_SSE2:	return ApplyGainSse;
+	default:				break;
+	}
+#endif
+	return ApplyGainScalar;
+}
+
+/*************************************************
+* DecibelsToGain():
+* Linear gain of level, silence at GAIN_MIN_DB
+*************************************************/
+FLOAT
+DecibelsToGain(
+	_In_ FLOAT fDecibels
+)
+{
+	return fDecibels <= GAIN_MIN_DB ? 0.0f : powf(10.0f, fDecibels / 20.0f);
+}
+
+/*************************************************
+* GainSource():
+* Constructor
+*************************************************/
+Player::GainSource::GainSource() :
+	lpSource(NULL),
+	eFormat(SAMPLE_FORMAT_UNKNOWN),
+	dwChannels(0),
+	dwRampFrames(0),
+	lpApplyGain(NULL),
+	lpToFloat(NULL),
+	lpFromFloat(NULL),
+	fGain(1.0f),
+	bMuted(FALSE),
+	fCurrent(1.0f),
+	fStep(0.0f),
+	dwRampLeft(0)
+{
+}
+
+/*************************************************
+* SetSource():
+* Attach upstream. Volume is kept, new stream
+* starts at target gain without ramp. Returns
+* FALSE if sample format is unknown
+*************************************************/
+BOOL
+Player::GainSource::SetSource(
+	_In_opt_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	lpSource = lpUpstream;
+	eFormat = GetSampleFormat(lpFormat);
+	dwChannels = lpFormat->nChannels;
+	dwRampFrames = lpFormat->nSamplesPerSec * GAIN_RAMP_MS / 1000;
+	lpApplyGain = GetApplyGainKernel();
+	lpToFloat = GetToFloatKernel(GetConvertIsa(), eFormat);
+	lpFromFloat = GetFromFloatKernel(GetConvertIsa(), eFormat);
+
+	fCurrent = bMuted ? 0.0f : fGain;
+	fStep = 0.0f;
+	dwRampLeft = 0;
+	return lpToFloat && lpFromFloat;
+}
+
+/*************************************************
+* SetGain():
+* New linear volume, audio thread only
+*************************************************/
+VOID
+Player::GainSource::SetGain(
+	_In_ FLOAT fNewGain
+)
+{
+	fGain = max(fNewGain, 0.0f);
+	StartRamp();
+}
+
+VOID
+Player::GainSource::SetMute(
+	_In_ BOOL bNewMute
+)
+{
+	bMuted = bNewMute;
+	StartRamp();
+}
+
+/*************************************************
+* StartRamp():
+* Ramp goes from current gain, so change in
+* the middle of other ramp has no step
+*************************************************/
+VOID
+Player::GainSource::StartRamp()
+{
+	FLOAT fTarget = bMuted ? 0.0f : fGain;
+	if (!dwRampFrames || fTarget == fCurrent)
+	{
+		fCurrent = fTarget;
+		dwRampLeft = 0;
+		return;
+	}
+
+	fStep = (fTarget - fCurrent) / (FLOAT)dwRampFrames;
+	dwRampLeft = dwRampFrames;
+}
+
+/*************************************************
+* ApplyFloat():
+* Ramp part, then constant part
+*************************************************/
+VOID
+Player::GainSource::ApplyFloat(
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpSamples,
+	_In_ DWORD dwFrames
+)
+{
+	if (dwRampLeft)
+	{
+		DWORD dwRamp = min(dwFrames, dwRampLeft);
+		lpApplyGain(lpSamples, dwRamp, dwChannels, fCurrent, fStep);
+		fCurrent += fStep * (FLOAT)dwRamp;
+		dwRampLeft -= dwRamp;
+		if (!dwRampLeft) { fCurrent = bMuted ? 0.0f : fGain; }
+
+		lpSamples += (size_t)dwRamp * dwChannels;
+		dwFrames -= dwRamp;
+	}
+
+	if (dwFrames && fCurrent != 1.0f)
+	{
+		lpApplyGain(lpSamples, dwFrames, dwChannels, fCurrent, 0.0f);
+	}
+}
+
+/*************************************************
+* Process():
+* Scale frames in place. Integer samples go
+* through float by chunks on stage scratch
+*************************************************/
+VOID
+Player::GainSource::Process(
+	_Inout_updates_bytes_(dwFrames * nBlockAlign) BYTE* lpData,
+	_In_ DWORD dwFrames
+)
+{
+	if (!dwRampLeft && fCurrent == 1.0f) { return; }
+	if (!lpToFloat || !lpFromFloat || !dwChannels || dwChannels > GAIN_CHUNK_SAMPLES) { return; }
+
+	if (eFormat == SAMPLE_FORMAT_F32)
+	{
+		ApplyFloat((FLOAT*)lpData, dwFrames);
+		return;
+	}
+
+	DWORD dwFrameBytes = GetSampleBytes(eFormat) * dwChannels;
+	DWORD dwChunkFrames = GAIN_CHUNK_SAMPLES / dwChannels;
+	while (dwFrames)
+	{
+		DWORD dwChunk = min(dwFrames, dwChunkFrames);
+		lpToFloat(lpData, scratch, dwChunk * dwChannels);
+		ApplyFloat(scratch, dwChunk);
+		lpFromFloat(scratch, lpData, dwChunk * dwChannels);
+
+		lpData += (size_t)dwChunk * dwFrameBytes;
+		dwFrames -= dwChunk;
+	}
+}
+
+/*************************************************
+* ReadFrames():
+* Pull upstream and scale it
+*************************************************/
+DWORD
+Player::GainSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpSource) { return 0; }
+
+	DWORD dwRead = lpSource->ReadFrames(lpDest, dwFrames);
+	Process(lpDest, dwRead);
+	return dwRead;
+}
+
+BOOL
+Player::GainSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	return lpSource ? lpSource->SeekFrame(uFrame) : FALSE;
+}
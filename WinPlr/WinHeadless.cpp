@@ -0,0 +1,504 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio headless entry-point
+**********************************************************
+* WinHeadless.cpp
+* Console entry-point for non-Windows builds
+*********************************************************/
+#include "WinEngine.h"
+
+#ifndef _WIN32
+#include <vector>
+
+/*************************************************
+* GetLaunchParam():
+* Find "-name" or "-name=value" in arguments.
+* Returns value or empty string, NULL if not found
+*************************************************/
+static LPCSTR
+GetLaunchParam(
+	_In_ int argc,
+	_In_ char** argv,
+	_In_ LPCSTR lpName
+)
+{
+	size_t uLength = strlen(lpName);
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strncmp(argv[i], lpName, uLength))
+		{
+			if (argv[i][uLength] == '=') { return argv[i] + uLength + 1; }
+			if (argv[i][uLength] == '\0') { return argv[i] + uLength; }
+		}
+	}
+	return NULL;
+}
+
+/*************************************************
+* PrintErrors():
+* Print errors posted by render thread
+*************************************************/
+static VOID
+PrintErrors()
+{
+	PLAYER_ERROR playerError = {};
+	while (errorRing.Pop(&playerError))
+	{
+		fprintf(stderr, "%s (code %u)\n", playerError.szContext, playerError.dwCode);
+	}
+}
+
+/*************************************************
+* CreateOutputSink():
+* Choose output sink by launch params. Playlist
+* loads tracks while playing, so WAV output of
+* it is paced like device
+*************************************************/
+static Player::AudioSink*
+CreateOutputSink(
+	_In_ int argc,
+	_In_ char** argv,
+	_In_ BOOL isOffline,
+	_In_ BOOL isPlaylist
+)
+{
+	LPCSTR lpParam = GetLaunchParam(argc, argv, "-wave_output");
+	if (lpParam && *lpParam)
+	{
+		return new Player::WaveFileSink(lpParam, isPlaylist);
+	}
+
+	// offline render can't be paced by device
+	if (isOffline || GetLaunchParam(argc, argv, "-null_output"))
+	{
+		return new Player::NullSink(!isOffline);
+	}
+
+#ifdef __linux__
+	lpParam = GetLaunchParam(argc, argv, "-alsa_device");
+	return new Player::AlsaSink(lpParam ? lpParam : "default");
+#else
+	return new Player::NullSink(TRUE);
+#endif
+}
+
+typedef struct
+{
+	Player::MappedFile fileData;				// mapped file, 'data' chunk is read from it
+	PCM_DATA dPCM;
+	Player::PcmSource pcmSource;
+	Player::MixSource mixSource;
+	Player::ConvertSource convertSource;
+	Player::ResampleSource resampleSource;
+} TRACK_DECK;
+
+typedef struct
+{
+	std::vector<LPCSTR> trackPaths;
+	DWORD dwNextTrack;						// next path to load
+	DWORD dwQueuedTracks;					// track goes to deck by its queue number
+	WAVEFORMATEX mixFormat;					// float format of every deck
+	TRACK_DECK trackDecks[CROSSFADE_DECK_COUNT];
+	Player::CrossfadeSource crossfadeSource;
+	Player::ConvertSource outputConvert;	// float of decks to sink format
+} PLAYLIST;
+
+typedef struct
+{
+	TRACK_DECK* lpTracks;					// decoder chain of every voice
+	WAVEFORMATEX busFormat;					// float format of every voice
+	Player::VoiceMixer voiceMixer;
+	Player::ConvertSource outputConvert;	// float of bus to sink format
+} VOICE_MIX;
+
+/*************************************************
+* LoadWaveFile():
+* Map file and parse its chunks
+*************************************************/
+static BOOL
+LoadWaveFile(
+	_In_ LPCSTR lpPath,
+	_Out_ Player::MappedFile* lpFileData,
+	_Out_ PCM_DATA* lpPCM
+)
+{
+	if (!lpFileData->Open(lpPath))
+	{
+		DEBUG_MESSAGE("Filesystem error! Can't find file!");
+		return FALSE;
+	}
+
+	memset(lpPCM, 0, sizeof(PCM_DATA));
+	if (!ParseWaveData(lpFileData->lpData, lpFileData->dwSize, lpPCM))
+	{
+		DEBUG_MESSAGE("Filesystem error! File is not a valid WAV file");
+		return FALSE;
+	}
+	lpPCM->lpPath = lpPath;
+	return TRUE;
+}
+
+/*************************************************
+* SetTrackParams():
+* Loop, resampler and mixer params of track
+*************************************************/
+static VOID
+SetTrackParams(
+	_In_ int argc,
+	_In_ char** argv,
+	_In_ BOOL isOffline,
+	_Inout_ Player::PcmSource* lpPcmSource,
+	_Inout_ Player::MixSource* lpMixSource,
+	_Inout_ Player::ResampleSource* lpResampleSource
+)
+{
+	// loop params override loop from file, endless loop never ends offline render
+	LPCSTR lpParam = GetLaunchParam(argc, argv, "-loop_count");
+	DWORD dwLoopCount = lpParam ? strtoul(lpParam, NULL, 10) : lpPcmSource->dwLoopsLeft;
+	if (GetLaunchParam(argc, argv, "-loop_infinite") && !isOffline)
+	{
+		dwLoopCount = LOOP_INFINITE;
+	}
+	lpParam = GetLaunchParam(argc, argv, "-loop_crossfade_ms");
+	DWORD dwCrossfadeMs = lpParam ? strtoul(lpParam, NULL, 10) : 0;
+	lpPcmSource->SetLoop(dwLoopCount, (DWORD)((UINT64)dwCrossfadeMs * lpPcmSource->dPCM.waveFormat.nSamplesPerSec / 1000));
+
+	RESAMPLE_QUALITY eQuality = GetResampleQualityByName(GetLaunchParam(argc, argv, "-resample_quality"));
+	lpResampleSource->SetQuality(eQuality, GetWindowTypeByName(GetLaunchParam(argc, argv, "-resample_window"), eQuality));
+
+	// matrix from launch param overrides layout mapping
+	FLOAT mixMatrix[MIX_MAX_CHANNELS * MIX_MAX_CHANNELS] = {};
+	DWORD dwMatrixCount = ParseMixMatrix(GetLaunchParam(argc, argv, "-mix_matrix"), mixMatrix);
+	if (dwMatrixCount)
+	{
+		lpMixSource->SetMode(CHANNEL_MIX_CUSTOM, mixMatrix, dwMatrixCount);
+	}
+	else
+	{
+		lpMixSource->SetMode(GetLaunchParam(argc, argv, "-upmix") ? CHANNEL_MIX_UPMIX : CHANNEL_MIX_DOWNMIX, NULL, 0);
+	}
+}
+
+/*************************************************
+* QueueTracks():
+* Load next tracks to free decks. Whole file
+* and fade length of frames are ready before
+* deck is given to crossfade
+*************************************************/
+static VOID
+QueueTracks(
+	_In_ int argc,
+	_In_ char** argv,
+	_Inout_ PLAYLIST* lpPlaylist
+)
+{
+	while (lpPlaylist->dwNextTrack < lpPlaylist->trackPaths.size())
+	{
+		DWORD dwDeck = lpPlaylist->dwQueuedTracks % CROSSFADE_DECK_COUNT;
+		if (!lpPlaylist->crossfadeSource.IsDeckFree(dwDeck)) { break; }
+
+		TRACK_DECK& trackDeck = lpPlaylist->trackDecks[dwDeck];
+		LPCSTR lpPath = lpPlaylist->trackPaths[lpPlaylist->dwNextTrack++];
+
+		// first track is loaded already to negotiate format
+		if (lpPlaylist->dwNextTrack > 1 && !LoadWaveFile(lpPath, &trackDeck.fileData, &trackDeck.dPCM)) { continue; }
+		trackDeck.pcmSource.SetData(trackDeck.dPCM);
+		SetTrackParams(argc, argv, FALSE, &trackDeck.pcmSource, &trackDeck.mixSource, &trackDeck.resampleSource);
+
+		Player::AudioSource* lpStage = Player::SetFormatStage(&trackDeck.mixSource, &trackDeck.convertSource, &trackDeck.resampleSource,
+			&trackDeck.pcmSource, &trackDeck.dPCM.waveFormat, trackDeck.dPCM.dwChannelMask, &lpPlaylist->mixFormat);
+		if (!lpStage || !lpPlaylist->crossfadeSource.QueueTrack(dwDeck, lpStage))
+		{
+			fprintf(stderr, "Can't play %s\n", lpPath);
+			continue;
+		}
+
+		lpPlaylist->dwQueuedTracks++;
+		printf("Queued %s\n", lpPath);
+	}
+}
+
+/*************************************************
+* StartPlaylist():
+* Crossfade stage for all tracks, first track
+* is loaded and sets sink format
+*************************************************/
+static Player::AudioSource*
+StartPlaylist(
+	_In_ int argc,
+	_In_ char** argv,
+	_Inout_ PLAYLIST* lpPlaylist,
+	_Inout_ Player::MappedFile* lpFirstData,
+	_In_ const PCM_DATA& dFirstPCM,
+	_In_ const WAVEFORMATEX* lpSinkFormat
+)
+{
+	lpPlaylist->mixFormat = *lpSinkFormat;
+	SetSampleFormat(&lpPlaylist->mixFormat, SAMPLE_FORMAT_F32);
+
+	LPCSTR lpParam = GetLaunchParam(argc, argv, "-crossfade_ms");
+	DWORD dwFadeFrames = (DWORD)((UINT64)(lpParam ? strtoul(lpParam, NULL, 10) : 0) * lpSinkFormat->nSamplesPerSec / 1000);
+	CROSSFADE_CURVE eCurve = GetCrossfadeCurveByName(GetLaunchParam(argc, argv, "-crossfade_curve"));
+	if (!lpPlaylist->crossfadeSource.SetFormat(&lpPlaylist->mixFormat, dwFadeFrames, eCurve)) { return NULL; }
+
+	lpPlaylist->trackDecks[0].fileData.Swap(lpFirstData);
+	lpPlaylist->trackDecks[0].dPCM = dFirstPCM;
+	QueueTracks(argc, argv, lpPlaylist);
+	if (!lpPlaylist->dwQueuedTracks) { return NULL; }
+
+	printf("Crossfade %u frames, %s curve\n", dwFadeFrames, GetCrossfadeCurveName(eCurve));
+	return lpPlaylist->outputConvert.SetSource(&lpPlaylist->crossfadeSource, &lpPlaylist->mixFormat, lpSinkFormat) ?
+		(Player::AudioSource*)&lpPlaylist->outputConvert : NULL;
+}
+
+/*************************************************
+* StartVoiceMix():
+* All tracks are started at once as stream
+* voices of mixer, first track sets sink format
+*************************************************/
+static Player::AudioSource*
+StartVoiceMix(
+	_In_ int argc,
+	_In_ char** argv,
+	_Inout_ VOICE_MIX* lpVoiceMix,
+	_In_ const std::vector<LPCSTR>& trackPaths,
+	_Inout_ Player::MappedFile* lpFirstData,
+	_In_ const PCM_DATA& dFirstPCM,
+	_In_ const WAVEFORMATEX* lpSinkFormat
+)
+{
+	lpVoiceMix->busFormat = *lpSinkFormat;
+	SetSampleFormat(&lpVoiceMix->busFormat, SAMPLE_FORMAT_F32);
+	if (!lpVoiceMix->voiceMixer.SetFormat(&lpVoiceMix->busFormat, TRUE)) { return NULL; }
+
+	lpVoiceMix->lpTracks = new TRACK_DECK[trackPaths.size()];
+	lpVoiceMix->lpTracks[0].fileData.Swap(lpFirstData);
+	lpVoiceMix->lpTracks[0].dPCM = dFirstPCM;
+
+	DWORD dwVoices = 0;
+	for (size_t i = 0; i < trackPaths.size(); i++)
+	{
+		TRACK_DECK& trackDeck = lpVoiceMix->lpTracks[i];
+		if (i && !LoadWaveFile(trackPaths[i], &trackDeck.fileData, &trackDeck.dPCM)) { continue; }
+		trackDeck.pcmSource.SetData(trackDeck.dPCM);
+		SetTrackParams(argc, argv, FALSE, &trackDeck.pcmSource, &trackDeck.mixSource, &trackDeck.resampleSource);
+
+		Player::AudioSource* lpStage = Player::SetFormatStage(&trackDeck.mixSource, &trackDeck.convertSource, &trackDeck.resampleSource,
+			&trackDeck.pcmSource, &trackDeck.dPCM.waveFormat, trackDeck.dPCM.dwChannelMask, &lpVoiceMix->busFormat);
+		DWORD dwVoice = lpStage ? lpVoiceMix->voiceMixer.PlayStream(lpStage, lpSinkFormat->nChannels, 1.0f, 0.0f) : VOICE_POOL_SIZE;
+		if (dwVoice == VOICE_POOL_SIZE)
+		{
+			fprintf(stderr, "Can't play %s\n", trackPaths[i]);
+			continue;
+		}
+
+		printf("Voice %u: %s\n", dwVoice, trackPaths[i]);
+		dwVoices++;
+	}
+	if (!dwVoices) { return NULL; }
+
+	return lpVoiceMix->outputConvert.SetSource(&lpVoiceMix->voiceMixer, &lpVoiceMix->busFormat, lpSinkFormat) ?
+		(Player::AudioSource*)&lpVoiceMix->outputConvert : NULL;
+}
+
+/*************************************************
+* main():
+* winplr FILE.wav [FILE.wav...] [launch params]
+*************************************************/
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	// choose conversion kernels by CPU, launch param can limit them
+	InitConvertKernels(GetConvertIsaByName(GetLaunchParam(argc, argv, "-convert_isa")));
+	for (DWORD i = 0; i < BENCHMARK_COUNT; i++)
+	{
+		if (GetLaunchParam(argc, argv, benchmarks[i].lpParam))
+		{
+			CHAR szBenchmark[BENCHMARK_TEXT_SIZE] = {};
+			benchmarks[i].lpRun(szBenchmark, sizeof(szBenchmark));
+			fputs(szBenchmark, stdout);
+			return 0;
+		}
+	}
+
+	// every argument which isn't launch param is track
+	std::vector<LPCSTR> trackPaths;
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-') { trackPaths.push_back(argv[i]); }
+	}
+
+	if (trackPaths.empty())
+	{
+		fputs("Usage: winplr FILE.wav [FILE.wav...] [-offline_render] [-null_output] [-wave_output=PATH] [-alsa_device=NAME]\n"
+			"       [-telemetry_dump=PATH] [-loop_count=N] [-loop_infinite] [-loop_crossfade_ms=N] [-convert_isa=scalar|sse2|avx2]\n"
+			"       [-resample_rate=N] [-resample_quality=low|medium|high|best] [-resample_window=NAME]\n"
+			"       [-output_channels=N] [-upmix] [-mix_matrix=G,G,...] [-volume_db=N] [-mute]\n"
+			"       [-crossfade_ms=N] [-crossfade_curve=linear|equal_power|s_curve] [-mix_voices]\n"
+			"       [-eq=TYPE:FREQ:GAIN:Q,...] [-limiter] [-limiter_lookahead_ms=N] [-limiter_ceiling_db=N]\n"
+			"       [-dither=tpdf|shaped] [-dither_seed=N]\n"
+			"       winplr -convert_benchmark | -resample_benchmark | -voice_benchmark | -eq_benchmark | -limiter_benchmark\n"
+			"              | -dither_benchmark\n", stderr);
+		return 1;
+	}
+
+	RENDER_STATS renderStats = {};
+	auto startTime = std::chrono::steady_clock::now();
+
+	Player::MappedFile fileData;
+	PCM_DATA dPCM = {};
+	if (!LoadWaveFile(trackPaths[0], &fileData, &dPCM))
+	{
+		return 1;
+	}
+	renderStats.dDecodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	BOOL isOffline = GetLaunchParam(argc, argv, "-offline_render") != NULL;
+	Player::PcmSource pcmSource;
+	Player::MixSource mixSource;
+	Player::ConvertSource convertSource;
+	Player::ResampleSource resampleSource;
+	pcmSource.SetData(dPCM);
+	SetTrackParams(argc, argv, isOffline, &pcmSource, &mixSource, &resampleSource);
+	Player::TimedSource sourceStage("source", &pcmSource, NULL);
+	BOOL isVoiceMix = GetLaunchParam(argc, argv, "-mix_voices") && !isOffline;
+	BOOL isPlaylist = trackPaths.size() > 1 && !isOffline && !isVoiceMix;
+	Player::AudioSink* lpSink = CreateOutputSink(argc, argv, isOffline, isPlaylist);
+
+	// device gets format, rate and channels which it can play
+	Player::GainSource gainSource;
+	Player::AudioSource* lpFormatStage = NULL;
+	WAVEFORMATEX sinkFormat = {};
+	LPCSTR lpParam = GetLaunchParam(argc, argv, "-resample_rate");
+	DWORD dwRate = lpParam ? strtoul(lpParam, NULL, 10) : 0;
+	lpParam = GetLaunchParam(argc, argv, "-output_channels");
+	DWORD dwChannels = lpParam ? strtoul(lpParam, NULL, 10) : 0;
+
+	// EQ, volume and limiter are last stages before sink
+	Player::EqualizerSource eqSource;
+	EQ_BAND eqBands[EQ_MAX_BANDS] = {};
+	DWORD dwEqBands = ParseEqBands(GetLaunchParam(argc, argv, "-eq"), eqBands);
+	for (DWORD i = 0; i < dwEqBands; i++)
+	{
+		eqSource.SetBand(i, eqBands[i]);
+	}
+	LPCSTR lpVolume = GetLaunchParam(argc, argv, "-volume_db");
+	gainSource.SetGain(lpVolume ? DecibelsToGain(strtof(lpVolume, NULL)) : 1.0f);
+	gainSource.SetMute(GetLaunchParam(argc, argv, "-mute") != NULL);
+
+	// limiter keeps EQ and volume boosts under ceiling, any of its params enables it
+	Player::LimiterSource limiterSource;
+	LPCSTR lpLookahead = GetLaunchParam(argc, argv, "-limiter_lookahead_ms");
+	LPCSTR lpCeiling = GetLaunchParam(argc, argv, "-limiter_ceiling_db");
+	BOOL isLimiter = GetLaunchParam(argc, argv, "-limiter") || lpLookahead || lpCeiling;
+	limiterSource.SetParams(isLimiter,
+		lpLookahead ? strtoul(lpLookahead, NULL, 10) : LIMITER_LOOKAHEAD_MS, lpCeiling ? strtof(lpCeiling, NULL) : LIMITER_CEILING_DB);
+
+	// integer sinks get float bus with EQ, volume or limiter, and 8 and 16-bit ones
+	// with dither too, output converter rounds it once
+	Player::ConvertSource outputConvert;
+	WAVEFORMATEX busFormat = {};
+	DITHER_MODE eDither = GetDitherModeByName(GetLaunchParam(argc, argv, "-dither"));
+	lpParam = GetLaunchParam(argc, argv, "-dither_seed");
+	outputConvert.SetDither(eDither, lpParam ? strtoul(lpParam, NULL, 10) : DITHER_SEED);
+
+	// several tracks are played through crossfade, its decks are loaded while playing
+	PLAYLIST* lpPlaylist = isPlaylist ? new PLAYLIST() : NULL;
+	if (lpPlaylist)
+	{
+		lpPlaylist->trackPaths = trackPaths;
+	}
+
+	// or all of them are played at once by voice mixer
+	VOICE_MIX* lpVoiceMix = isVoiceMix ? new VOICE_MIX() : NULL;
+
+	if (Player::NegotiateFormat(lpSink, &dPCM.waveFormat, dwRate, dwChannels, &sinkFormat) &&
+		Player::GetBusFormat(&sinkFormat, eDither, dwEqBands || lpVolume || isLimiter, &busFormat))
+	{
+		lpFormatStage = lpPlaylist ? StartPlaylist(argc, argv, lpPlaylist, &fileData, dPCM, &busFormat) :
+			lpVoiceMix ? StartVoiceMix(argc, argv, lpVoiceMix, trackPaths, &fileData, dPCM, &busFormat) :
+			Player::SetFormatStage(&mixSource, &convertSource, &resampleSource, &sourceStage,
+				&dPCM.waveFormat, dPCM.dwChannelMask, &busFormat);
+	}
+
+	// offline render and playing use same chain, every stage is timed
+	Player::TimedSource formatStage("format", lpFormatStage, &sourceStage);
+	Player::TimedSource eqStage("eq", &eqSource, &formatStage);
+	Player::TimedSource gainStage("gain", &gainSource, &eqStage);
+	Player::TimedSource limiterStage("limiter", &limiterSource, &gainStage);
+	Player::TimedSource outputStage("output", &outputConvert, &limiterStage);
+	BOOL isChainSet = lpFormatStage && eqSource.SetSource(&formatStage, &busFormat) && gainSource.SetSource(&eqStage, &busFormat) &&
+		limiterSource.SetSource(&gainStage, &busFormat) && outputConvert.SetSource(&limiterStage, &busFormat, &sinkFormat);
+
+	int iResult = 0;
+	if (isOffline)
+	{
+		if (isChainSet && Player::RenderOffline(&sinkFormat, &outputStage, lpSink, &renderStats))
+		{
+			CHAR szStats[1024] = {};
+			FormatRenderStats(&renderStats, szStats, sizeof(szStats));
+			puts(szStats);
+		}
+		else
+		{
+			DEBUG_MESSAGE("Can't start output sink");
+			iResult = 1;
+		}
+	}
+	else if (isChainSet && lpSink->Open(&sinkFormat, &outputStage) && lpSink->Start())
+	{
+		while (!lpSink->IsFinished())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(SINK_PERIOD_MS));
+			PrintErrors();
+			if (lpPlaylist)
+			{
+				QueueTracks(argc, argv, lpPlaylist);
+			}
+		}
+
+		printf("Played %llu frames, latency %u ms, %u underruns\n",
+			(unsigned long long)lpSink->GetPosition(), lpSink->GetLatency(), lpSink->GetUnderruns());
+
+		Player::DeadlineMonitor* lpMonitor = lpSink->GetDeadlineMonitor();
+		if (lpMonitor)
+		{
+			printf("Render callbacks: %llu, deadline misses: %llu, max callback time: %.3f ms\n",
+				(unsigned long long)lpMonitor->uCallbacks.load(), (unsigned long long)lpMonitor->uMisses.load(),
+				lpMonitor->uMaxDurationNs.load() / 1000000.0);
+
+			CHAR szTelemetry[512] = {};
+			lpMonitor->FormatTelemetry(szTelemetry, sizeof(szTelemetry));
+			puts(szTelemetry);
+
+			LPCSTR lpDumpPath = GetLaunchParam(argc, argv, "-telemetry_dump");
+			if (lpDumpPath && *lpDumpPath)
+			{
+				lpMonitor->DumpTelemetry(lpDumpPath);
+			}
+		}
+		lpSink->Close();
+	}
+	else
+	{
+		DEBUG_MESSAGE("Can't start output sink");
+		iResult = 1;
+	}
+
+	delete lpSink;
+	delete lpPlaylist;
+	if (lpVoiceMix)
+	{
+		delete[] lpVoiceMix->lpTracks;
+		delete lpVoiceMix;
+	}
+	PrintErrors();
+	return iResult;
+}
+#endif
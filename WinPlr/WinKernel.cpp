@@ -0,0 +1,361 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio specialized frame kernels
+**********************************************************
+* WinKernel.cpp
+* Conversion kernels generated for every format
+* pair, (de)interleave kernels for every format
+* and channel count
+*********************************************************/
+#include "WinEngine.h"
+
+typedef enum
+{
+	CHANNEL_KERNEL_MONO = 0,
+	CHANNEL_KERNEL_STEREO = 1,
+	CHANNEL_KERNEL_5_1 = 2,
+	CHANNEL_KERNEL_7_1 = 3,
+	CHANNEL_KERNEL_GENERIC = 4,		// channel count is taken at runtime
+	CHANNEL_KERNEL_COUNT = 5
+} CHANNEL_KERNEL;
+
+/*************************************************
+* RoundFloat():
+* Round to nearest even without library calls.
+* Gives the same bits as lrintf in scalar kernels
+*************************************************/
+static inline FLOAT
+RoundFloat(
+	_In_ FLOAT fValue
+)
+{
+	// exact while |value| <= 2^22, bigger values are clamped later
+	return (fValue + 12582912.0f) - 12582912.0f;
+}
+
+static inline double
+RoundFloat(
+	_In_ double dValue
+)
+{
+	return (dValue + 6755399441055744.0) - 6755399441055744.0;
+}
+
+/*************************************************
+* ClampToInt():
+* Clamp rounded value to integer range and
+* convert it. Compare is a select (maxps/minps)
+* only when it is the last float op before
+* conversion, any float math after it makes
+* compiler keep branches (-ftrapping-math), so
+* values are scaled and rounded first. NaN goes
+* to low bound
+*************************************************/
+template <typename T>
+static inline INT
+ClampToInt(
+	_In_ T fValue,
+	_In_ T fLow,
+	_In_ T fHigh
+)
+{
+	fValue = fValue > fLow ? fValue : fLow;
+	return (INT)(fValue < fHigh ? fValue : fHigh);
+}
+
+/*************************************************
+* SampleTraits:
+* Load and store of one sample by index. Index
+* is size_t, 32-bit one may wrap and compiler
+* can't prove that frames are contiguous then
+*************************************************/
+template <SAMPLE_FORMAT eFormat>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<SAMPLE_FORMAT_U8>
+{
+	static inline FLOAT Load(const BYTE* lpData, size_t uIndex)
+	{
+		return (FLOAT)((INT)lpData[uIndex] - 128) * (1.0f / 128.0f);
+	}
+
+	static inline VOID Store(BYTE* lpData, size_t uIndex, FLOAT fValue)
+	{
+		lpData[uIndex] = (BYTE)(ClampToInt(RoundFloat(fValue * 128.0f), -128.0f, 127.0f) + 128);
+	}
+};
+
+template <>
+struct SampleTraits<SAMPLE_FORMAT_S16>
+{
+	static inline FLOAT Load(const BYTE* lpData, size_t uIndex)
+	{
+		return (FLOAT)((const SHORT*)lpData)[uIndex] * (1.0f / 32768.0f);
+	}
+
+	static inline VOID Store(BYTE* lpData, size_t uIndex, FLOAT fValue)
+	{
+		((SHORT*)lpData)[uIndex] = (SHORT)ClampToInt(RoundFloat(fValue * 32768.0f), -32768.0f, 32767.0f);
+	}
+};
+
+template <>
+struct SampleTraits<SAMPLE_FORMAT_S24>
+{
+	static inline FLOAT Load(const BYTE* lpData, size_t uIndex)
+	{
+		lpData += uIndex * 3;
+		INT iValue = (INT)((UINT)lpData[0] << 8 | (UINT)lpData[1] << 16 | (UINT)lpData[2] << 24);
+		return (FLOAT)iValue * (1.0f / 2147483648.0f);
+	}
+
+	static inline VOID Store(BYTE* lpData, size_t uIndex, FLOAT fValue)
+	{
+		// 2^23 is out of float rounding trick, so it's done in double
+		INT iValue = ClampToInt(RoundFloat((double)fValue * 8388608.0), -8388608.0, 8388607.0);
+		// word and byte store, three byte stores are split to lane extracts by vectorizer
+		lpData += uIndex * 3;
+		WORD wLow = (WORD)iValue;
+		memcpy(lpData, &wLow, sizeof(WORD));
+		lpData[2] = (BYTE)(iValue >> 16);
+	}
+};
+
+template <>
+struct SampleTraits<SAMPLE_FORMAT_S32>
+{
+	static inline FLOAT Load(const BYTE* lpData, size_t uIndex)
+	{
+		return (FLOAT)((const INT*)lpData)[uIndex] * (1.0f / 2147483648.0f);
+	}
+
+	static inline VOID Store(BYTE* lpData, size_t uIndex, FLOAT fValue)
+	{
+		((INT*)lpData)[uIndex] = ClampToInt(RoundFloat((double)fValue * 2147483648.0), -2147483648.0, 2147483647.0);
+	}
+};
+
+template <>
+struct SampleTraits<SAMPLE_FORMAT_F32>
+{
+	static inline FLOAT Load(const BYTE* lpData, size_t uIndex)
+	{
+		return ((const FLOAT*)lpData)[uIndex];
+	}
+
+	static inline VOID Store(BYTE* lpData, size_t uIndex, FLOAT fValue)
+	{
+		((FLOAT*)lpData)[uIndex] = fValue;
+	}
+};
+
+template <>
+struct SampleTraits<SAMPLE_FORMAT_F64>
+{
+	static inline FLOAT Load(const BYTE* lpData, size_t uIndex)
+	{
+		return (FLOAT)((const double*)lpData)[uIndex];
+	}
+
+	static inline VOID Store(BYTE* lpData, size_t uIndex, FLOAT fValue)
+	{
+		((double*)lpData)[uIndex] = (double)fValue;
+	}
+};
+
+/*************************************************
+* FrameKernels:
+* Kernel for one format pair. Interleaved frames
+* are one run of samples, so channel count only
+* sets length and kernel isn't specialized on it
+*************************************************/
+template <SAMPLE_FORMAT eSrcFormat, SAMPLE_FORMAT eDestFormat>
+struct FrameKernels
+{
+	static VOID Convert(const BYTE* lpSrc, BYTE* lpDest, DWORD dwFrames, DWORD dwChannels)
+	{
+		const size_t uSamples = (size_t)dwFrames * dwChannels;
+		for (size_t i = 0; i < uSamples; i++)
+		{
+			SampleTraits<eDestFormat>::Store(lpDest, i, SampleTraits<eSrcFormat>::Load(lpSrc, i));
+		}
+	}
+};
+
+// the same format is copied, s32 can't pass through float without loss
+template <SAMPLE_FORMAT eFormat>
+struct FrameKernels<eFormat, eFormat>
+{
+	static VOID Convert(const BYTE* lpSrc, BYTE* lpDest, DWORD dwFrames, DWORD dwChannels)
+	{
+		memcpy(lpDest, lpSrc, (size_t)dwFrames * dwChannels * GetSampleBytes(eFormat));
+	}
+};
+
+/*************************************************
+* PlaneKernels:
+* (De)interleave for one format and channel
+* count. Plane pointers are held in registers and
+* frame body is unrolled on channel count
+*************************************************/
+template <SAMPLE_FORMAT eFormat, DWORD CHANNELS>
+struct PlaneKernels
+{
+	static VOID Deinterleave(const BYTE* lpSrc, FLOAT* const* lpPlanes, DWORD dwFrames, DWORD)
+	{
+		FLOAT* lpFramePlanes[CHANNELS];
+		for (DWORD c = 0; c < CHANNELS; c++) { lpFramePlanes[c] = lpPlanes[c]; }
+
+		for (size_t i = 0; i < dwFrames; i++)
+		{
+			for (DWORD c = 0; c < CHANNELS; c++)
+			{
+				lpFramePlanes[c][i] = SampleTraits<eFormat>::Load(lpSrc, i * CHANNELS + c);
+			}
+		}
+	}
+
+	static VOID Interleave(const FLOAT* const* lpPlanes, BYTE* lpDest, DWORD dwFrames, DWORD)
+	{
+		const FLOAT* lpFramePlanes[CHANNELS];
+		for (DWORD c = 0; c < CHANNELS; c++) { lpFramePlanes[c] = lpPlanes[c]; }
+
+		for (size_t i = 0; i < dwFrames; i++)
+		{
+			for (DWORD c = 0; c < CHANNELS; c++)
+			{
+				SampleTraits<eFormat>::Store(lpDest, i * CHANNELS + c, lpFramePlanes[c][i]);
+			}
+		}
+	}
+};
+
+// channel count is taken at runtime, planes are walked one by one
+template <SAMPLE_FORMAT eFormat>
+struct PlaneKernels<eFormat, 0>
+{
+	static VOID Deinterleave(const BYTE* lpSrc, FLOAT* const* lpPlanes, DWORD dwFrames, DWORD dwChannels)
+	{
+		for (DWORD c = 0; c < dwChannels; c++)
+		{
+			FLOAT* lpPlane = lpPlanes[c];
+			for (size_t i = 0; i < dwFrames; i++)
+			{
+				lpPlane[i] = SampleTraits<eFormat>::Load(lpSrc, i * dwChannels + c);
+			}
+		}
+	}
+
+	static VOID Interleave(const FLOAT* const* lpPlanes, BYTE* lpDest, DWORD dwFrames, DWORD dwChannels)
+	{
+		for (DWORD c = 0; c < dwChannels; c++)
+		{
+			const FLOAT* lpPlane = lpPlanes[c];
+			for (size_t i = 0; i < dwFrames; i++)
+			{
+				SampleTraits<eFormat>::Store(lpDest, i * dwChannels + c, lpPlane[i]);
+			}
+		}
+	}
+};
+
+/*************************************************
+* Dispatch tables. Built by compiler, row 0 is
+* unknown format and has no kernels
+*************************************************/
+#define FRAME_KERNELS(SRC, DEST) &FrameKernels<SRC, DEST>::Convert
+
+#define FRAME_KERNELS_ROW(SRC) { {}, FRAME_KERNELS(SRC, SAMPLE_FORMAT_U8), FRAME_KERNELS(SRC, SAMPLE_FORMAT_S16), \
+	FRAME_KERNELS(SRC, SAMPLE_FORMAT_S24), FRAME_KERNELS(SRC, SAMPLE_FORMAT_S32), FRAME_KERNELS(SRC, SAMPLE_FORMAT_F32), \
+	FRAME_KERNELS(SRC, SAMPLE_FORMAT_F64) }
+
+#define PLANE_KERNELS(FORMAT, NAME) { &PlaneKernels<FORMAT, 1>::NAME, &PlaneKernels<FORMAT, 2>::NAME, \
+	&PlaneKernels<FORMAT, 6>::NAME, &PlaneKernels<FORMAT, 8>::NAME, &PlaneKernels<FORMAT, 0>::NAME }
+
+static constexpr CONVERT_FRAMES convertFramesKernels[SAMPLE_FORMAT_COUNT][SAMPLE_FORMAT_COUNT] =
+{
+	{},
+	FRAME_KERNELS_ROW(SAMPLE_FORMAT_U8),
+	FRAME_KERNELS_ROW(SAMPLE_FORMAT_S16),
+	FRAME_KERNELS_ROW(SAMPLE_FORMAT_S24),
+	FRAME_KERNELS_ROW(SAMPLE_FORMAT_S32),
+	FRAME_KERNELS_ROW(SAMPLE_FORMAT_F32),
+	FRAME_KERNELS_ROW(SAMPLE_FORMAT_F64)
+};
+
+static constexpr DEINTERLEAVE_FRAMES deinterleaveKernels[SAMPLE_FORMAT_COUNT][CHANNEL_KERNEL_COUNT] =
+{
+	{},
+	PLANE_KERNELS(SAMPLE_FORMAT_U8, Deinterleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_S16, Deinterleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_S24, Deinterleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_S32, Deinterleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_F32, Deinterleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_F64, Deinterleave)
+};
+
+static constexpr INTERLEAVE_FRAMES interleaveKernels[SAMPLE_FORMAT_COUNT][CHANNEL_KERNEL_COUNT] =
+{
+	{},
+	PLANE_KERNELS(SAMPLE_FORMAT_U8, Interleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_S16, Interleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_S24, Interleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_S32, Interleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_F32, Interleave),
+	PLANE_KERNELS(SAMPLE_FORMAT_F64, Interleave)
+};
+
+static inline CHANNEL_KERNEL
+GetChannelKernel(
+	_In_ DWORD dwChannels
+)
+{
+	switch (dwChannels)
+	{
+	case 1:		return CHANNEL_KERNEL_MONO;
+	case 2:		return CHANNEL_KERNEL_STEREO;
+	case 6:		return CHANNEL_KERNEL_5_1;
+	case 8:		return CHANNEL_KERNEL_7_1;
+	default:	return CHANNEL_KERNEL_GENERIC;
+	}
+}
+
+/*************************************************
+* GetConvertFramesKernel():
+* Kernel for stream, must be taken once
+* when stream is opened. NULL if format is unknown
+*************************************************/
+CONVERT_FRAMES
+GetConvertFramesKernel(
+	_In_ SAMPLE_FORMAT eSrcFormat,
+	_In_ SAMPLE_FORMAT eDestFormat,
+	_In_ DWORD dwChannels
+)
+{
+	if (eSrcFormat >= SAMPLE_FORMAT_COUNT || eDestFormat >= SAMPLE_FORMAT_COUNT || !dwChannels) { return NULL; }
+	return convertFramesKernels[eSrcFormat][eDestFormat];
+}
+
+DEINTERLEAVE_FRAMES
+GetDeinterleaveKernel(
+	_In_ SAMPLE_FORMAT eSrcFormat,
+	_In_ DWORD dwChannels
+)
+{
+	if (eSrcFormat >= SAMPLE_FORMAT_COUNT || !dwChannels) { return NULL; }
+	return deinterleaveKernels[eSrcFormat][GetChannelKernel(dwChannels)];
+}
+
+INTERLEAVE_FRAMES
+GetInterleaveKernel(
+	_In_ SAMPLE_FORMAT eDestFormat,
+	_In_ DWORD dwChannels
+)
+{
+	if (eDestFormat >= SAMPLE_FORMAT_COUNT || !dwChannels) { return NULL; }
+	return interleaveKernels[eDestFormat][GetChannelKernel(dwChannels)];
+}
@@ -0,0 +1,597 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio limiter
+**********************************************************
+* WinLimiter.cpp
+* Lookahead true peak limiter of output bus
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/*************************************************
+* Interpolation phases at 1/4, 2/4 and 3/4 of
+* sample after center tap 7. Kaiser windowed
+* sinc, beta 5, cutoff 0.95 of Nyquist, every
+* phase has unity DC gain. Table is constant,
+* so every machine finds same peaks. Phase 0
+* is sample itself
+*************************************************/
+static const FLOAT truePeakTaps[LIMITER_OVERSAMPLE - 1][LIMITER_PHASE_TAPS] =
+{
+	{ 0.001377915f, -0.001964478f, 0.000812329f, 0.004482233f, -0.018124880f, 0.049472506f, -0.133906507f, 0.862255273f,
+	  0.326755671f, -0.142428751f, 0.082796296f, -0.049644274f, 0.028341489f, -0.014594954f, 0.006318472f, -0.001948341f },
+	{ -0.001140741f, 0.004281360f, -0.011374046f, 0.025069695f, -0.049607104f, 0.094150068f, -0.190699314f, 0.629320081f,
+	  0.629320081f, -0.190699314f, 0.094150068f, -0.049607104f, 0.025069695f, -0.011374046f, 0.004281360f, -0.001140741f },
+	{ -0.001948341f, 0.006318472f, -0.014594954f, 0.028341489f, -0.049644274f, 0.082796296f, -0.142428751f, 0.326755671f,
+	  0.862255273f, -0.133906507f, 0.049472506f, -0.018124880f, 0.004482233f, 0.000812329f, -0.001964478f, 0.001377915f }
+};
+
+#define TRUE_PEAK_CENTER		(LIMITER_PHASE_TAPS / 2 - 1)
+#define LIMITER_SLACK_SAMPLES	8			// vector loads of last frame may read past it
+
+/*************************************************
+* TruePeakScalar():
+* Peak of frame i is largest of its
+* samples and points after them on every
+* channel. Window of frame i starts at frame i
+* of lpFrames, center is TRUE_PEAK_CENTER.
+* Taps are summed in order, so SIMD kernels
+* give same bits
+*************************************************/
+static VOID
+TruePeakScalar(
+	_In_reads_((dwFrames + LIMITER_PHASE_TAPS - 1) * dwChannels) const FLOAT* lpFrames,
+	_Out_writes_(dwFrames) FLOAT* lpPeaks,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels
+)
+{
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		const FLOAT* lpWindow = lpFrames + i * dwChannels;
+		FLOAT fPeak = 0.0f;
+		for (DWORD c = 0; c < dwChannels; c++)
+		{
+			fPeak = max(fPeak, fabsf(lpWindow[TRUE_PEAK_CENTER * dwChannels + c]));
+			for (DWORD p = 0; p < LIMITER_OVERSAMPLE - 1; p++)
+			{
+				FLOAT fSum = 0.0f;
+				for (DWORD t = 0; t < LIMITER_PHASE_TAPS; t++)
+				{
+					fSum += truePeakTaps[p][t] * lpWindow[t * dwChannels + c];
+				}
+				fPeak = max(fPeak, fabsf(fSum));
+			}
+		}
+		lpPeaks[i] = fPeak;
+	}
+}
+
+#ifdef CONVERT_X86
+/*************************************************
+* TruePeakSse():
+* Channels are lanes, frame is one or two
+* vectors. Loads may take samples of next
+* frame, their lanes are masked out
+*************************************************/
+static VOID
+TruePeakSse(
+	_In_reads_((dwFrames + LIMITER_PHASE_TAPS - 1) * dwChannels) const FLOAT* lpFrames,
+	_Out_writes_(dwFrames) FLOAT* lpPeaks,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels
+)
+{
+	if (!dwChannels || dwChannels > MIX_MAX_CHANNELS)
+	{
+		TruePeakScalar(lpFrames, lpPeaks, dwFrames, dwChannels);
+		return;
+	}
+
+	__m128 taps[LIMITER_OVERSAMPLE - 1][LIMITER_PHASE_TAPS];
+	for (DWORD p = 0; p < LIMITER_OVERSAMPLE - 1; p++)
+	{
+		for (DWORD t = 0; t < LIMITER_PHASE_TAPS; t++) { taps[p][t] = _mm_set1_ps(truePeakTaps[p][t]); }
+	}
+
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+	__m128 lowMask = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32((int)dwChannels), laneIndex));
+	__m128 highMask = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32((int)dwChannels - 4), laneIndex));
+	DWORD dwHalves = dwChannels > 4 ? 2 : 1;
+
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		__m128 peak = _mm_setzero_ps();
+		for (DWORD h = 0; h < dwHalves; h++)
+		{
+			const FLOAT* lpWindow = lpFrames + i * dwChannels + h * 4;
+			__m128 sum0 = _mm_setzero_ps();
+			__m128 sum1 = _mm_setzero_ps();
+			__m128 sum2 = _mm_setzero_ps();
+			for (DWORD t = 0; t < LIMITER_PHASE_TAPS; t++)
+			{
+				__m128 x = _mm_loadu_ps(lpWindow + t * dwChannels);
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(taps[0][t], x));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(taps[1][t], x));
+				sum2 = _mm_add_ps(sum2, _mm_mul_ps(taps[2][t], x));
+			}
+
+			__m128 center = _mm_loadu_ps(lpWindow + TRUE_PEAK_CENTER * dwChannels);
+			__m128 halfPeak = _mm_max_ps(_mm_max_ps(_mm_andnot_ps(signMask, center), _mm_andnot_ps(signMask, sum0)),
+				_mm_max_ps(_mm_andnot_ps(signMask, sum1), _mm_andnot_ps(signMask, sum2)));
+			peak = _mm_max_ps(peak, _mm_and_ps(halfPeak, h ? highMask : lowMask));
+		}
+
+		peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+		peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+		lpPeaks[i] = _mm_cvtss_f32(peak);
+	}
+}
+
+/*************************************************
+* TruePeakAvx2():
+* Frame of 5 to 8 channels is one vector,
+* smaller frames go to SSE kernel
+*************************************************/
+CONVERT_TARGET_AVX2
+static VOID
+TruePeakAvx2(
+	_In_reads_((dwFrames + LIMITER_PHASE_TAPS - 1) * dwChannels) const FLOAT* lpFrames,
+	_Out_writes_(dwFrames) FLOAT* lpPeaks,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwChannels
+)
+{
+	if (dwChannels <= 4 || dwChannels > MIX_MAX_CHANNELS)
+	{
+		TruePeakSse(lpFrames, lpPeaks, dwFrames, dwChannels);
+		return;
+	}
+
+	__m256 taps[LIMITER_OVERSAMPLE - 1][LIMITER_PHASE_TAPS];
+	for (DWORD p = 0; p < LIMITER_OVERSAMPLE - 1; p++)
+	{
+		for (DWORD t = 0; t < LIMITER_PHASE_TAPS; t++) { taps[p][t] = _mm256_set1_ps(truePeakTaps[p][t]); }
+	}
+
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	__m256 laneMask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32((int)dwChannels), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		const FLOAT* lpWindow = lpFrames + i * dwChannels;
+		__m256 sum0 = _mm256_setzero_ps();
+		__m256 sum1 = _mm256_setzero_ps();
+		__m256 sum2 = _mm256_setzero_ps();
+		for (DWORD t = 0; t < LIMITER_PHASE_TAPS; t++)
+		{
+			__m256 x = _mm256_loadu_ps(lpWindow + t * dwChannels);
+			sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(taps[0][t], x));
+			sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(taps[1][t], x));
+			sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(taps[2][t], x));
+		}
+
+		__m256 center = _mm256_loadu_ps(lpWindow + TRUE_PEAK_CENTER * dwChannels);
+		__m256 peak = _mm256_max_ps(_mm256_max_ps(_mm256_andnot_ps(signMask, center), _mm256_andnot_ps(signMask, sum0)),
+			_mm256_max_ps(_mm256_andnot_ps(signMask, sum1), _mm256_andnot_ps(signMask, sum2)));
+		peak = _mm256_and_ps(peak, laneMask);
+
+		__m128 half = _mm_max_ps(_mm256_castps256_ps128(peak), _mm256_extractf128_ps(peak, 1));
+		half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_max_ss(half, _mm_shuffle_ps(half, half, 1));
+		lpPeaks[i] = _mm_cvtss_f32(half);
+	}
+	_mm256_zeroupper();
+}
+#endif
+
+/*************************************************
+* GetRingIndex():
+* Index below 2 * dwSize wrapped to ring
+*************************************************/
+static inline DWORD
+GetRingIndex(
+	_In_ DWORD dwIndex,
+	_In_ DWORD dwSize
+)
+{
+	return dwIndex >= dwSize ? dwIndex - dwSize : dwIndex;
+}
+
+/*************************************************
+* GetTruePeakKernel():
+* True peak detector for selected ISA
+*************************************************/
+TRUE_PEAK
+GetTruePeakKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return TruePeakAvx2;
+	case CONVERT_ISA_SSE2:	return TruePeakSse;
+	default:				break;
+	}
+#endif
+	return TruePeakScalar;
+}
+
+/*************************************************
+* LimiterSource():
+* Constructor
+*************************************************/
+Player::LimiterSource::LimiterSource() :
+	lpSource(NULL),
+	bEnabled(FALSE),
+	dwLookaheadMs(LIMITER_LOOKAHEAD_MS),
+	fCeiling(DecibelsToGain(LIMITER_CEILING_DB)),
+	eFormat(SAMPLE_FORMAT_UNKNOWN),
+	dwChannels(0),
+	dwWindow(0),
+	dwLatency(0),
+	fRelease(1.0f),
+	lpTruePeak(NULL),
+	lpToFloat(NULL),
+	lpFromFloat(NULL),
+	lpInput(NULL),
+	lpOutput(NULL),
+	lpPeaks(NULL),
+	lpDelay(NULL),
+	lpHoldGains(NULL),
+	lpHoldFrames(NULL),
+	lpRampGains(NULL),
+	dwHoldFirst(0),
+	dwHoldCount(0),
+	dwRampPos(0),
+	dwDelayPos(0),
+	dRampSum(0.0),
+	fRecovery(1.0f),
+	uFrame(0),
+	dwFlushLeft(0),
+	isEndOfSource(FALSE)
+{
+}
+
+Player::LimiterSource::~LimiterSource()
+{
+	FreeBuffers();
+}
+
+VOID
+Player::LimiterSource::FreeBuffers()
+{
+	delete[] lpInput;
+	delete[] lpOutput;
+	delete[] lpPeaks;
+	delete[] lpDelay;
+	delete[] lpHoldGains;
+	delete[] lpHoldFrames;
+	delete[] lpRampGains;
+	lpInput = NULL;
+	lpOutput = NULL;
+	lpPeaks = NULL;
+	lpDelay = NULL;
+	lpHoldGains = NULL;
+	lpHoldFrames = NULL;
+	lpRampGains = NULL;
+}
+
+/*************************************************
+* SetParams():
+* Settings for next SetSource. Ceiling is
+* not above full scale
+*************************************************/
+VOID
+Player::LimiterSource::SetParams(
+	_In_ BOOL bEnable,
+	_In_ DWORD dwNewLookaheadMs,
+	_In_ FLOAT fNewCeilingDb
+)
+{
+	bEnabled = bEnable;
+	dwLookaheadMs = min(max(dwNewLookaheadMs, 1UL), (DWORD)LIMITER_MAX_LOOKAHEAD_MS);
+	fCeiling = DecibelsToGain(min(fNewCeilingDb, 0.0f));
+}
+
+/*************************************************
+* SetSource():
+* Attach upstream. All buffers are allocated
+* here and never on audio thread. Disabled
+* limiter passes frames through. Returns FALSE
+* if sample format is unknown, then limiter
+* passes frames through too
+*************************************************/
+BOOL
+Player::LimiterSource::SetSource(
+	_In_opt_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	FreeBuffers();
+	lpSource = lpUpstream;
+	dwLatency = 0;
+	if (!bEnabled) { return TRUE; }
+
+	eFormat = GetSampleFormat(lpFormat);
+	dwChannels = lpFormat->nChannels;
+	lpTruePeak = GetTruePeakKernel();
+	lpToFloat = GetToFloatKernel(GetConvertIsa(), eFormat);
+	lpFromFloat = GetFromFloatKernel(GetConvertIsa(), eFormat);
+	if (!lpToFloat || !lpFromFloat || !dwChannels || dwChannels > MIX_MAX_CHANNELS || !lpFormat->nSamplesPerSec)
+	{
+		return FALSE;
+	}
+
+	// detector sees frame TRUE_PEAK_CENTER + 1 frames late, ramp reaches its gain dwWindow - 1 frames later
+	dwWindow = max(lpFormat->nSamplesPerSec * dwLookaheadMs / 1000, 1UL);
+	dwLatency = dwWindow + TRUE_PEAK_CENTER;
+	fRelease = (FLOAT)(1.0 - exp(-1000.0 / ((double)lpFormat->nSamplesPerSec * LIMITER_RELEASE_MS)));
+
+	lpInput = new FLOAT[(LIMITER_PHASE_TAPS - 1 + LIMITER_CHUNK_FRAMES) * dwChannels + LIMITER_SLACK_SAMPLES];
+	lpOutput = new FLOAT[LIMITER_CHUNK_FRAMES * dwChannels];
+	lpPeaks = new FLOAT[LIMITER_CHUNK_FRAMES];
+	lpDelay = new FLOAT[dwLatency * dwChannels];
+	lpHoldGains = new FLOAT[dwWindow];
+	lpHoldFrames = new UINT64[dwWindow];
+	lpRampGains = new FLOAT[dwWindow];
+	memset(lpInput, 0, ((LIMITER_PHASE_TAPS - 1 + LIMITER_CHUNK_FRAMES) * dwChannels + LIMITER_SLACK_SAMPLES) * sizeof(FLOAT));
+	ResetState();
+	return TRUE;
+}
+
+/*************************************************
+* ResetState():
+* Stream starts after silence, so gain is at
+* unity and nothing is held
+*************************************************/
+VOID
+Player::LimiterSource::ResetState()
+{
+	memset(lpInput, 0, (LIMITER_PHASE_TAPS - 1) * dwChannels * sizeof(FLOAT));
+	for (DWORD i = 0; i < dwWindow; i++)
+	{
+		lpRampGains[i] = 1.0f;
+	}
+
+	dwHoldFirst = 0;
+	dwHoldCount = 0;
+	dwRampPos = 0;
+	dwDelayPos = 0;
+	dRampSum = (double)dwWindow;
+	fRecovery = 1.0f;
+	uFrame = 0;
+	dwFlushLeft = dwLatency;
+	isEndOfSource = FALSE;
+}
+
+/*************************************************
+* LimitChunk():
+* Push new frames of lpInput. Target gain of
+* peak falls at once and recovers by release,
+* minimum over window holds it for lookahead,
+* average over window turns it to ramp which
+* reaches target right at peak. Output frame
+* is input frame dwLatency frames before.
+* Returns count of output frames
+*************************************************/
+DWORD
+Player::LimiterSource::LimitChunk(
+	_In_ DWORD dwFrames
+)
+{
+	lpTruePeak(lpInput, lpPeaks, dwFrames, dwChannels);
+
+	DWORD dwOutput = 0;
+	for (DWORD i = 0; i < dwFrames; i++, uFrame++)
+	{
+		FLOAT fTarget = lpPeaks[i] > fCeiling ? max(fCeiling / lpPeaks[i], LIMITER_MIN_GAIN) : 1.0f;
+		fRecovery = fTarget < fRecovery ? fTarget : fRecovery + (fTarget - fRecovery) * fRelease;
+
+		// monotonic deque, first gain is minimum of window
+		if (dwHoldCount && lpHoldFrames[dwHoldFirst] + dwWindow <= uFrame)
+		{
+			dwHoldFirst = dwHoldFirst + 1 == dwWindow ? 0 : dwHoldFirst + 1;
+			dwHoldCount--;
+		}
+		while (dwHoldCount && lpHoldGains[GetRingIndex(dwHoldFirst + dwHoldCount - 1, dwWindow)] >= fRecovery) { dwHoldCount--; }
+		DWORD dwLast = GetRingIndex(dwHoldFirst + dwHoldCount, dwWindow);
+		lpHoldGains[dwLast] = fRecovery;
+		lpHoldFrames[dwLast] = uFrame;
+		dwHoldCount++;
+
+		dRampSum += lpHoldGains[dwHoldFirst] - lpRampGains[dwRampPos];
+		lpRampGains[dwRampPos] = lpHoldGains[dwHoldFirst];
+		dwRampPos = dwRampPos + 1 == dwWindow ? 0 : dwRampPos + 1;
+		FLOAT fGain = (FLOAT)(dRampSum / dwWindow);
+
+		FLOAT* lpSlot = lpDelay + (size_t)dwDelayPos * dwChannels;
+		dwDelayPos = dwDelayPos + 1 == dwLatency ? 0 : dwDelayPos + 1;
+		const FLOAT* lpNew = lpInput + (size_t)(LIMITER_PHASE_TAPS - 1 + i) * dwChannels;
+		if (uFrame >= dwLatency)
+		{
+			// ramp keeps true peak under ceiling, clamp keeps rounding of it
+			FLOAT* lpOut = lpOutput + (size_t)dwOutput * dwChannels;
+			for (DWORD c = 0; c < dwChannels; c++)
+			{
+				lpOut[c] = min(max(lpSlot[c] * fGain, -fCeiling), fCeiling);
+			}
+			dwOutput++;
+		}
+		memcpy(lpSlot, lpNew, dwChannels * sizeof(FLOAT));
+	}
+
+	memmove(lpInput, lpInput + (size_t)dwFrames * dwChannels, (LIMITER_PHASE_TAPS - 1) * dwChannels * sizeof(FLOAT));
+	return dwOutput;
+}
+
+/*************************************************
+* ReadFrames():
+* Pull upstream by chunks. First call reads
+* lookahead more than it gives, after end of
+* upstream silence pushes lookahead out, so
+* count of frames is same as upstream
+*************************************************/
+DWORD
+Player::LimiterSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpSource) { return 0; }
+	if (!dwLatency) { return lpSource->ReadFrames(lpDest, dwFrames); }
+
+	DWORD dwFrameBytes = GetSampleBytes(eFormat) * dwChannels;
+	FLOAT* lpNew = lpInput + (LIMITER_PHASE_TAPS - 1) * dwChannels;
+	DWORD dwWritten = 0;
+	while (dwWritten < dwFrames && (!isEndOfSource || dwFlushLeft))
+	{
+		DWORD dwChunk = min(dwFrames - dwWritten, (DWORD)LIMITER_CHUNK_FRAMES);
+		DWORD dwRead = 0;
+		if (!isEndOfSource)
+		{
+			// integer frames are read to unwritten part of destination
+			BYTE* lpRead = eFormat == SAMPLE_FORMAT_F32 ? (BYTE*)lpNew : lpDest + (size_t)dwWritten * dwFrameBytes;
+			dwRead = lpSource->ReadFrames(lpRead, dwChunk);
+			if (eFormat != SAMPLE_FORMAT_F32) { lpToFloat(lpRead, lpNew, dwRead * dwChannels); }
+			isEndOfSource = dwRead < dwChunk;
+		}
+
+		if (isEndOfSource)
+		{
+			DWORD dwFlush = min(dwChunk - dwRead, dwFlushLeft);
+			memset(lpNew + (size_t)dwRead * dwChannels, 0, (size_t)dwFlush * dwChannels * sizeof(FLOAT));
+			dwRead += dwFlush;
+			dwFlushLeft -= dwFlush;
+		}
+
+		DWORD dwOutput = LimitChunk(dwRead);
+		lpFromFloat(lpOutput, lpDest + (size_t)dwWritten * dwFrameBytes, dwOutput * dwChannels);
+		dwWritten += dwOutput;
+	}
+	return dwWritten;
+}
+
+/*************************************************
+* SeekFrame():
+* Lookahead is read again from new position
+*************************************************/
+BOOL
+Player::LimiterSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	if (!lpSource || !lpSource->SeekFrame(uFrame)) { return FALSE; }
+	if (dwLatency) { ResetState(); }
+	return TRUE;
+}
+
+DWORD Player::LimiterSource::GetLatency() { return dwLatency; }
+
+/*************************************************
+* RunLimiterBenchmark():
+* Time of one frame for common channel counts
+* at 48 kHz over noise 6 dB above full scale,
+* and true peak of output against ceiling.
+* 16-bit bus shows noise clipped before limiter
+*************************************************/
+VOID
+RunLimiterBenchmark(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	const DWORD dwChannelCounts[] = { 1, 2, 6, 8 };
+	const SAMPLE_FORMAT eBusFormats[] = { SAMPLE_FORMAT_F32, SAMPLE_FORMAT_S16 };
+	const DWORD dwRate = 48000;
+	const DWORD dwSeconds = 10;
+	const DWORD dwPeriodFrames = dwRate / 100;
+	const DWORD dwFrames = dwRate * dwSeconds;
+
+	int iWritten = snprintf(lpText, dwSize, "Limiter, %u ms lookahead, ceiling %.1f dBTP at %u Hz, ns per frame (%s)\n",
+		(DWORD)LIMITER_LOOKAHEAD_MS, LIMITER_CEILING_DB, dwRate, GetConvertIsaName(GetConvertIsa()));
+	DWORD dwOffset = iWritten > 0 ? min((DWORD)iWritten, dwSize) : 0;
+
+	for (DWORD n = 0; n < sizeof(dwChannelCounts) / sizeof(DWORD); n++)
+	{
+		DWORD dwChannels = dwChannelCounts[n];
+		size_t uSamples = ((size_t)dwFrames + LIMITER_PHASE_TAPS) * dwChannels + LIMITER_SLACK_SAMPLES;
+		FLOAT* lpNoise = new FLOAT[(size_t)dwFrames * dwChannels];
+		FLOAT* lpLimited[2] = { new FLOAT[uSamples](), new FLOAT[uSamples]() };
+		FillBenchmarkNoise(lpNoise, (size_t)dwFrames * dwChannels, 2.0f);
+
+		WAVEFORMATEX floatFormat = {};
+		floatFormat.nChannels = (WORD)dwChannels;
+		floatFormat.nSamplesPerSec = dwRate;
+		SetSampleFormat(&floatFormat, SAMPLE_FORMAT_F32);
+
+		for (DWORD b = 0; b < sizeof(eBusFormats) / sizeof(SAMPLE_FORMAT); b++)
+		{
+			WAVEFORMATEX busFormat = floatFormat;
+			SetSampleFormat(&busFormat, eBusFormats[b]);
+			Player::MemorySource noiseSource(lpNoise, dwFrames, dwChannels);
+
+			// integer bus clips noise before limiter, like stages on it did
+			Player::ConvertSource toBus;
+			Player::ConvertSource fromBus;
+			Player::LimiterSource* lpLimiter = new Player::LimiterSource();
+			lpLimiter->SetParams(TRUE, LIMITER_LOOKAHEAD_MS, LIMITER_CEILING_DB);
+			Player::AudioSource* lpChain = lpLimiter;
+			if (eBusFormats[b] == SAMPLE_FORMAT_F32)
+			{
+				lpLimiter->SetSource(&noiseSource, &floatFormat);
+			}
+			else
+			{
+				toBus.SetSource(&noiseSource, &floatFormat, &busFormat);
+				lpLimiter->SetSource(&toBus, &busFormat);
+				fromBus.SetSource(lpLimiter, &busFormat, &floatFormat);
+				lpChain = &fromBus;
+			}
+
+			// output goes after silent history of detector
+			FLOAT* lpOutput = lpLimited[b] + (LIMITER_PHASE_TAPS - 1) * dwChannels;
+			DWORD dwTotal = 0;
+			auto startTime = std::chrono::steady_clock::now();
+			for (DWORD dwRead = 1; dwRead; dwTotal += dwRead)
+			{
+				dwRead = lpChain->ReadFrames((BYTE*)(lpOutput + (size_t)dwTotal * dwChannels), min(dwPeriodFrames, dwFrames - dwTotal));
+			}
+			double dTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+			FLOAT* lpPeaks = new FLOAT[dwTotal];
+			FLOAT fPeak = 0.0f;
+			GetTruePeakKernel()(lpLimited[b], lpPeaks, dwTotal, dwChannels);
+			for (DWORD i = 0; i < dwTotal; i++) { fPeak = max(fPeak, lpPeaks[i]); }
+
+			// difference from float bus is distortion of clipping
+			double dError = 0.0;
+			double dPower = 0.0;
+			for (size_t i = 0; i < (size_t)dwTotal * dwChannels; i++)
+			{
+				double dDelta = (double)lpOutput[i] - lpLimited[0][(LIMITER_PHASE_TAPS - 1) * dwChannels + i];
+				dError += dDelta * dDelta;
+				dPower += (double)lpOutput[i] * lpOutput[i];
+			}
+
+			iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%s bus, %u ch: %.2f ns, %.0fx realtime, %u of %u frames, output %.2f dBTP, error %.1f dB\n",
+				GetSampleFormatName(eBusFormats[b]), dwChannels, dTime * 1e9 / dwTotal, (double)dwSeconds / max(dTime, 1e-9), dwTotal, dwFrames,
+				20.0 * log10(max(fPeak, 1e-9f)), dError > 0.0 ? 10.0 * log10(dError / max(dPower, 1e-30)) : -INFINITY);
+			if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+
+			delete lpLimiter;
+			delete[] lpPeaks;
+		}
+
+		delete[] lpNoise;
+		delete[] lpLimited[0];
+		delete[] lpLimited[1];
+	}
+}
@@ -0,0 +1,587 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio channel mixer
+**********************************************************
+* WinMix.cpp
+* Channel layout mapping by downmix/upmix matrices
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+#define MIX_SPEAKER_COUNT		18			// speaker positions of WAVEFORMATEXTENSIBLE
+#define MIX_ROUTE_DEPTH			6			// max substitutions of missing speaker
+
+static const FLOAT fMinus3dB = 0.70710678f;
+
+typedef struct
+{
+	DWORD dwSourceMask;
+	DWORD dwSourceChannels;
+	DWORD dwDestMask;
+	DWORD dwDestChannels;
+	CHANNEL_MIX_MODE eMode;
+	FLOAT mixMatrix[MIX_MAX_CHANNELS * MIX_MAX_CHANNELS];
+} MIX_CACHE_ENTRY;
+
+// matrices are built on control thread only
+static MIX_CACHE_ENTRY mixCache[MIX_CACHE_SIZE] = {};
+static DWORD dwCacheCount = 0;
+static DWORD dwCacheNext = 0;
+
+static DWORD
+GetSpeakerIndex(
+	_In_ DWORD dwSpeaker
+)
+{
+	DWORD dwIndex = 0;
+	while (dwSpeaker > 1)
+	{
+		dwSpeaker >>= 1;
+		dwIndex++;
+	}
+	return dwIndex;
+}
+
+static DWORD
+GetMaskChannels(
+	_In_ DWORD dwMask
+)
+{
+	DWORD dwCount = 0;
+	for (; dwMask; dwMask &= dwMask - 1) { dwCount++; }
+	return dwCount;
+}
+
+/*************************************************
+* MixPlaneScalar():
+* Adds input plane with gain to output plane
+*************************************************/
+static VOID
+MixPlaneScalar(
+	_Inout_updates_(dwFrames) FLOAT* lpDest,
+	_In_reads_(dwFrames) const FLOAT* lpSrc,
+	_In_ FLOAT fGain,
+	_In_ DWORD dwFrames
+)
+{
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		lpDest[i] += lpSrc[i] * fGain;
+	}
+}
+
+#ifdef CONVERT_X86
+static VOID
+MixPlaneSse(
+	_Inout_updates_(dwFrames) FLOAT* lpDest,
+	_In_reads_(dwFrames) const FLOAT* lpSrc,
+	_In_ FLOAT fGain,
+	_In_ DWORD dwFrames
+)
+{
+	__m128 gain = _mm_set1_ps(fGain);
+	DWORD i = 0;
+	for (; i + 4 <= dwFrames; i += 4)
+	{
+		_mm_storeu_ps(lpDest + i, _mm_add_ps(_mm_loadu_ps(lpDest + i), _mm_mul_ps(_mm_loadu_ps(lpSrc + i), gain)));
+	}
+	MixPlaneScalar(lpDest + i, lpSrc + i, fGain, dwFrames - i);
+}
+
+CONVERT_TARGET_AVX2
+static VOID
+MixPlaneAvx2(
+	_Inout_updates_(dwFrames) FLOAT* lpDest,
+	_In_reads_(dwFrames) const FLOAT* lpSrc,
+	_In_ FLOAT fGain,
+	_In_ DWORD dwFrames
+)
+{
+	__m256 gain = _mm256_set1_ps(fGain);
+	DWORD i = 0;
+	for (; i + 8 <= dwFrames; i += 8)
+	{
+		_mm256_storeu_ps(lpDest + i, _mm256_add_ps(_mm256_loadu_ps(lpDest + i), _mm256_mul_ps(_mm256_loadu_ps(lpSrc + i), gain)));
+	}
+	MixPlaneScalar(lpDest + i, lpSrc + i, fGain, dwFrames - i);
+}
+#endif
+
+/*************************************************
+* GetMixPlaneKernel():
+* Accumulate kernel for selected ISA
+*************************************************/
+MIX_PLANE
+GetMixPlaneKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return MixPlaneAvx2;
+	case CONVERT_ISA_SSE2:	return MixPlaneSse;
+	default:				break;
+	}
+#endif
+	return MixPlaneScalar;
+}
+
+/*************************************************
+* RouteSpeaker():
+* Adds gains of speaker to output speakers.
+* Missing speaker goes to nearest ones: center
+* to front pair, back to side and back again,
+* surrounds to front, heights to base layer
+*************************************************/
+static VOID
+RouteSpeaker(
+	_In_ DWORD dwSpeaker,
+	_In_ FLOAT fGain,
+	_In_ DWORD dwDestMask,
+	_In_ DWORD dwDepth,
+	_Inout_updates_(MIX_SPEAKER_COUNT) FLOAT* lpGains
+)
+{
+	if (dwDestMask & dwSpeaker)
+	{
+		lpGains[GetSpeakerIndex(dwSpeaker)] += fGain;
+		return;
+	}
+	if (dwDepth >= MIX_ROUTE_DEPTH) { return; }
+	dwDepth++;
+
+	switch (dwSpeaker)
+	{
+	case SPEAKER_FRONT_CENTER:
+		if ((dwDestMask & (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT)) == (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT))
+		{
+			RouteSpeaker(SPEAKER_FRONT_LEFT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains);
+			RouteSpeaker(SPEAKER_FRONT_RIGHT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains);
+		}
+		break;
+	case SPEAKER_FRONT_LEFT:
+	case SPEAKER_FRONT_RIGHT:
+		RouteSpeaker(SPEAKER_FRONT_CENTER, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains);
+		break;
+	case SPEAKER_FRONT_LEFT_OF_CENTER:	RouteSpeaker(SPEAKER_FRONT_LEFT, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_FRONT_RIGHT_OF_CENTER:	RouteSpeaker(SPEAKER_FRONT_RIGHT, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_BACK_LEFT:
+		if (dwDestMask & SPEAKER_SIDE_LEFT) { RouteSpeaker(SPEAKER_SIDE_LEFT, fGain, dwDestMask, dwDepth, lpGains); }
+		else { RouteSpeaker(SPEAKER_FRONT_LEFT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains); }
+		break;
+	case SPEAKER_BACK_RIGHT:
+		if (dwDestMask & SPEAKER_SIDE_RIGHT) { RouteSpeaker(SPEAKER_SIDE_RIGHT, fGain, dwDestMask, dwDepth, lpGains); }
+		else { RouteSpeaker(SPEAKER_FRONT_RIGHT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains); }
+		break;
+	case SPEAKER_SIDE_LEFT:
+		if (dwDestMask & SPEAKER_BACK_LEFT) { RouteSpeaker(SPEAKER_BACK_LEFT, fGain, dwDestMask, dwDepth, lpGains); }
+		else { RouteSpeaker(SPEAKER_FRONT_LEFT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains); }
+		break;
+	case SPEAKER_SIDE_RIGHT:
+		if (dwDestMask & SPEAKER_BACK_RIGHT) { RouteSpeaker(SPEAKER_BACK_RIGHT, fGain, dwDestMask, dwDepth, lpGains); }
+		else { RouteSpeaker(SPEAKER_FRONT_RIGHT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains); }
+		break;
+	case SPEAKER_BACK_CENTER:
+		RouteSpeaker(SPEAKER_BACK_LEFT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains);
+		RouteSpeaker(SPEAKER_BACK_RIGHT, fGain * fMinus3dB, dwDestMask, dwDepth, lpGains);
+		break;
+	case SPEAKER_TOP_CENTER:
+	case SPEAKER_TOP_FRONT_CENTER:	RouteSpeaker(SPEAKER_FRONT_CENTER, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_TOP_FRONT_LEFT:	RouteSpeaker(SPEAKER_FRONT_LEFT, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_TOP_FRONT_RIGHT:	RouteSpeaker(SPEAKER_FRONT_RIGHT, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_TOP_BACK_LEFT:		RouteSpeaker(SPEAKER_BACK_LEFT, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_TOP_BACK_CENTER:	RouteSpeaker(SPEAKER_BACK_CENTER, fGain, dwDestMask, dwDepth, lpGains); break;
+	case SPEAKER_TOP_BACK_RIGHT:	RouteSpeaker(SPEAKER_BACK_RIGHT, fGain, dwDestMask, dwDepth, lpGains); break;
+	default:						break;		// LFE is dropped if sink hasn't it
+	}
+}
+
+/*************************************************
+* GetDefaultChannelMask():
+* Speakers of usual layout for channel count
+*************************************************/
+DWORD
+GetDefaultChannelMask(
+	_In_ DWORD dwChannels
+)
+{
+	const DWORD dwFront = SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+	const DWORD dwBack = SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+	const DWORD dwSide = SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+
+	switch (dwChannels)
+	{
+	case 1:		return SPEAKER_FRONT_CENTER;
+	case 2:		return dwFront;
+	case 3:		return dwFront | SPEAKER_FRONT_CENTER;
+	case 4:		return dwFront | dwBack;
+	case 5:		return dwFront | SPEAKER_FRONT_CENTER | dwBack;
+	case 6:		return dwFront | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | dwBack;
+	case 7:		return dwFront | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_CENTER | dwSide;
+	case 8:		return dwFront | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | dwBack | dwSide;
+	default:	break;
+	}
+	return dwChannels < MIX_SPEAKER_COUNT ? (1UL << dwChannels) - 1 : 0;
+}
+
+/*************************************************
+* GetLayoutChannelMask():
+* Mask from file if it matches channel count.
+* Extra speakers are cut, missing mask gets
+* default layout
+*************************************************/
+DWORD
+GetLayoutChannelMask(
+	_In_ DWORD dwChannelMask,
+	_In_ DWORD dwChannels
+)
+{
+	if (GetMaskChannels(dwChannelMask) < dwChannels) { return GetDefaultChannelMask(dwChannels); }
+
+	DWORD dwLayoutMask = 0;
+	for (DWORD i = 0; i < dwChannels; i++)
+	{
+		DWORD dwSpeaker = dwChannelMask & (~dwChannelMask + 1);
+		dwLayoutMask |= dwSpeaker;
+		dwChannelMask &= ~dwSpeaker;
+	}
+	return dwLayoutMask;
+}
+
+/*************************************************
+* BuildMixMatrix():
+* Gains of input channels for every output
+* channel, row per output. Rows with sum above
+* unity are normalized, so mix can't clip
+*************************************************/
+BOOL
+BuildMixMatrix(
+	_In_ DWORD dwSourceMask,
+	_In_ DWORD dwSourceChannels,
+	_In_ DWORD dwDestMask,
+	_In_ DWORD dwDestChannels,
+	_In_ CHANNEL_MIX_MODE eMode,
+	_Out_writes_(dwDestChannels * dwSourceChannels) FLOAT* lpMatrix
+)
+{
+	if (!dwSourceChannels || !dwDestChannels || dwSourceChannels > MIX_MAX_CHANNELS || dwDestChannels > MIX_MAX_CHANNELS) { return FALSE; }
+
+	dwSourceMask = GetLayoutChannelMask(dwSourceMask, dwSourceChannels);
+	dwDestMask = GetLayoutChannelMask(dwDestMask, dwDestChannels);
+	memset(lpMatrix, 0, dwDestChannels * dwSourceChannels * sizeof(FLOAT));
+
+	// channel of layout is n-th set bit of mask
+	DWORD dwSourceSpeakers[MIX_MAX_CHANNELS] = {};
+	DWORD dwDestSpeakers[MIX_MAX_CHANNELS] = {};
+	for (DWORD i = 0, dwMask = dwSourceMask; i < dwSourceChannels; i++, dwMask &= dwMask - 1) { dwSourceSpeakers[i] = dwMask & (~dwMask + 1); }
+	for (DWORD i = 0, dwMask = dwDestMask; i < dwDestChannels; i++, dwMask &= dwMask - 1) { dwDestSpeakers[i] = dwMask & (~dwMask + 1); }
+
+	for (DWORD i = 0; i < dwSourceChannels; i++)
+	{
+		FLOAT fGains[MIX_SPEAKER_COUNT] = {};
+		RouteSpeaker(dwSourceSpeakers[i], 1.0f, dwDestMask, 0, fGains);
+
+		// upmix fills center and surrounds which source hasn't got
+		if (eMode == CHANNEL_MIX_UPMIX && (dwSourceSpeakers[i] == SPEAKER_FRONT_LEFT || dwSourceSpeakers[i] == SPEAKER_FRONT_RIGHT))
+		{
+			BOOL isLeft = dwSourceSpeakers[i] == SPEAKER_FRONT_LEFT;
+			const DWORD dwFills[] =
+			{
+				SPEAKER_FRONT_CENTER,
+				isLeft ? (DWORD)SPEAKER_BACK_LEFT : (DWORD)SPEAKER_BACK_RIGHT,
+				isLeft ? (DWORD)SPEAKER_SIDE_LEFT : (DWORD)SPEAKER_SIDE_RIGHT
+			};
+
+			for (DWORD j = 0; j < sizeof(dwFills) / sizeof(DWORD); j++)
+			{
+				if ((dwDestMask & dwFills[j]) && !(dwSourceMask & dwFills[j])) { fGains[GetSpeakerIndex(dwFills[j])] += 0.5f; }
+			}
+		}
+
+		for (DWORD o = 0; o < dwDestChannels; o++)
+		{
+			lpMatrix[o * dwSourceChannels + i] = fGains[GetSpeakerIndex(dwDestSpeakers[o])];
+		}
+	}
+
+	for (DWORD o = 0; o < dwDestChannels; o++)
+	{
+		FLOAT* lpRow = lpMatrix + o * dwSourceChannels;
+		FLOAT fSum = 0.0f;
+		for (DWORD i = 0; i < dwSourceChannels; i++) { fSum += fabsf(lpRow[i]); }
+		if (fSum > 1.0f)
+		{
+			for (DWORD i = 0; i < dwSourceChannels; i++) { lpRow[i] /= fSum; }
+		}
+	}
+	return TRUE;
+}
+
+/*************************************************
+* GetCachedMixMatrix():
+* Matrix for layout pair, built once and kept
+* in small round-robin cache
+*************************************************/
+static BOOL
+GetCachedMixMatrix(
+	_In_ DWORD dwSourceMask,
+	_In_ DWORD dwSourceChannels,
+	_In_ DWORD dwDestMask,
+	_In_ DWORD dwDestChannels,
+	_In_ CHANNEL_MIX_MODE eMode,
+	_Out_writes_(dwDestChannels * dwSourceChannels) FLOAT* lpMatrix
+)
+{
+	for (DWORD i = 0; i < dwCacheCount; i++)
+	{
+		const MIX_CACHE_ENTRY& cacheEntry = mixCache[i];
+		if (cacheEntry.dwSourceMask == dwSourceMask && cacheEntry.dwSourceChannels == dwSourceChannels &&
+			cacheEntry.dwDestMask == dwDestMask && cacheEntry.dwDestChannels == dwDestChannels && cacheEntry.eMode == eMode)
+		{
+			memcpy(lpMatrix, cacheEntry.mixMatrix, dwDestChannels * dwSourceChannels * sizeof(FLOAT));
+			return TRUE;
+		}
+	}
+
+	if (!BuildMixMatrix(dwSourceMask, dwSourceChannels, dwDestMask, dwDestChannels, eMode, lpMatrix)) { return FALSE; }
+
+	MIX_CACHE_ENTRY& cacheEntry = mixCache[dwCacheNext];
+	cacheEntry.dwSourceMask = dwSourceMask;
+	cacheEntry.dwSourceChannels = dwSourceChannels;
+	cacheEntry.dwDestMask = dwDestMask;
+	cacheEntry.dwDestChannels = dwDestChannels;
+	cacheEntry.eMode = eMode;
+	memcpy(cacheEntry.mixMatrix, lpMatrix, dwDestChannels * dwSourceChannels * sizeof(FLOAT));
+
+	dwCacheNext = (dwCacheNext + 1) % MIX_CACHE_SIZE;
+	dwCacheCount = min(dwCacheCount + 1, (DWORD)MIX_CACHE_SIZE);
+	return TRUE;
+}
+
+/*************************************************
+* ParseMixMatrix():
+* Comma-separated gains, row per output channel.
+* Returns count of parsed gains
+*************************************************/
+DWORD
+ParseMixMatrix(
+	_In_ LPCSTR lpText,
+	_Out_writes_(MIX_MAX_CHANNELS * MIX_MAX_CHANNELS) FLOAT* lpMatrix
+)
+{
+	DWORD dwCount = 0;
+	while (lpText && *lpText && dwCount < MIX_MAX_CHANNELS * MIX_MAX_CHANNELS)
+	{
+		char* lpEnd = NULL;
+		FLOAT fGain = strtof(lpText, &lpEnd);
+		if (lpEnd == lpText) { break; }
+
+		lpMatrix[dwCount++] = fGain;
+		lpText = (*lpEnd == ',') ? lpEnd + 1 : lpEnd;
+	}
+	return dwCount;
+}
+
+/*************************************************
+* MixSource():
+* Constructor
+*************************************************/
+Player::MixSource::MixSource() :
+	lpSource(NULL),
+	eMode(CHANNEL_MIX_DOWNMIX),
+	dwCustomCount(0),
+	dwTapCount(0),
+	dwSourceChannels(0),
+	dwDestChannels(0),
+	dwSourceFrameBytes(0),
+	lpMixPlane(NULL),
+	lpDeinterleave(NULL),
+	lpInterleave(NULL)
+{
+	for (DWORD i = 0; i < MIX_MAX_CHANNELS; i++)
+	{
+		lpSourcePlanes[i] = planeData[i];
+		lpDestPlanes[i] = planeData[MIX_MAX_CHANNELS + i];
+	}
+}
+
+/*************************************************
+* SetMode():
+* Matrix mode for next SetSource, custom matrix
+* is used if its size fits layout pair
+*************************************************/
+VOID
+Player::MixSource::SetMode(
+	_In_ CHANNEL_MIX_MODE eNewMode,
+	_In_reads_opt_(dwCount) const FLOAT* lpCustomMatrix,
+	_In_ DWORD dwCount
+)
+{
+	eMode = eNewMode;
+	dwCustomCount = (lpCustomMatrix && eNewMode == CHANNEL_MIX_CUSTOM) ? min(dwCount, (DWORD)(MIX_MAX_CHANNELS * MIX_MAX_CHANNELS)) : 0;
+	if (dwCustomCount) { memcpy(customMatrix, lpCustomMatrix, dwCustomCount * sizeof(FLOAT)); }
+}
+
+/*************************************************
+* IsNeeded():
+* Mixer is skipped if layouts match and
+* matrix isn't forced
+*************************************************/
+BOOL
+Player::MixSource::IsNeeded(
+	_In_ DWORD dwSourceChannels,
+	_In_ DWORD dwDestChannels
+)
+{
+	return dwSourceChannels != dwDestChannels || dwCustomCount != 0;
+}
+
+/*************************************************
+* SetSource():
+* Attach upstream, output format is float
+* with channels of sink
+*************************************************/
+BOOL
+Player::MixSource::SetSource(
+	_In_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpSourceFormat,
+	_In_ DWORD dwSourceMask,
+	_In_ DWORD dwNewDestChannels,
+	_Out_ WAVEFORMATEX* lpMixFormat
+)
+{
+	lpSource = NULL;
+	dwTapCount = 0;
+
+	SAMPLE_FORMAT eSourceFormat = GetSampleFormat(lpSourceFormat);
+	dwSourceChannels = lpSourceFormat->nChannels;
+	dwDestChannels = dwNewDestChannels;
+	if (eSourceFormat == SAMPLE_FORMAT_UNKNOWN || !dwSourceChannels || !dwDestChannels ||
+		dwSourceChannels > MIX_MAX_CHANNELS || dwDestChannels > MIX_MAX_CHANNELS)
+	{
+		return FALSE;
+	}
+
+	if (dwCustomCount && dwCustomCount == dwSourceChannels * dwDestChannels)
+	{
+		memcpy(mixMatrix, customMatrix, dwCustomCount * sizeof(FLOAT));
+	}
+	else
+	{
+		if (dwCustomCount) { DEBUG_MESSAGE("Mix matrix doesn't fit channels, default downmix is used"); }
+		CHANNEL_MIX_MODE eMatrixMode = eMode == CHANNEL_MIX_UPMIX ? CHANNEL_MIX_UPMIX : CHANNEL_MIX_DOWNMIX;
+		if (!GetCachedMixMatrix(dwSourceMask, dwSourceChannels, 0, dwDestChannels, eMatrixMode, mixMatrix)) { return FALSE; }
+	}
+
+	// only non-zero gains are mixed
+	for (DWORD o = 0; o < dwDestChannels; o++)
+	{
+		for (DWORD i = 0; i < dwSourceChannels; i++)
+		{
+			FLOAT fGain = mixMatrix[o * dwSourceChannels + i];
+			if (fGain == 0.0f) { continue; }
+
+			MIX_TAP& mixTap = mixTaps[dwTapCount++];
+			mixTap.bDest = (BYTE)o;
+			mixTap.bSource = (BYTE)i;
+			mixTap.fGain = fGain;
+		}
+	}
+
+	lpMixPlane = GetMixPlaneKernel();
+	lpDeinterleave = GetDeinterleaveKernel(eSourceFormat, dwSourceChannels);
+	lpInterleave = GetInterleaveKernel(SAMPLE_FORMAT_F32, dwDestChannels);
+	dwSourceFrameBytes = GetSampleBytes(eSourceFormat) * dwSourceChannels;
+
+	*lpMixFormat = *lpSourceFormat;
+	lpMixFormat->nChannels = (WORD)dwDestChannels;
+	SetSampleFormat(lpMixFormat, SAMPLE_FORMAT_F32);
+
+	lpSource = lpUpstream;
+	return TRUE;
+}
+
+/*************************************************
+* ReadFrames():
+* Block of upstream frames to planes, taps of
+* matrix are added to output planes
+*************************************************/
+DWORD
+Player::MixSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpSource) { return 0; }
+
+	DWORD dwWritten = 0;
+	while (dwWritten < dwFrames)
+	{
+		DWORD dwBlock = min(dwFrames - dwWritten, (DWORD)MIX_BLOCK_FRAMES);
+		DWORD dwRead = lpSource->ReadFrames(scratch, dwBlock);
+		if (!dwRead) { break; }
+
+		lpDeinterleave(scratch, lpSourcePlanes, dwRead, dwSourceChannels);
+		for (DWORD o = 0; o < dwDestChannels; o++)
+		{
+			memset(lpDestPlanes[o], 0, dwRead * sizeof(FLOAT));
+		}
+		for (DWORD i = 0; i < dwTapCount; i++)
+		{
+			lpMixPlane(lpDestPlanes[mixTaps[i].bDest], lpSourcePlanes[mixTaps[i].bSource], mixTaps[i].fGain, dwRead);
+		}
+		lpInterleave(lpDestPlanes, lpDest + (size_t)dwWritten * dwDestChannels * sizeof(FLOAT), dwRead, dwDestChannels);
+
+		dwWritten += dwRead;
+		if (dwRead < dwBlock) { break; }
+	}
+	return dwWritten;
+}
+
+BOOL
+Player::MixSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	return lpSource ? lpSource->SeekFrame(uFrame) : FALSE;
+}
+
+const FLOAT* Player::MixSource::GetMatrix() { return mixMatrix; }
+
+/*************************************************
+* SetFormatStage():
+* Attach upstream to stages which make sink
+* format: mixer if channels differ, then
+* resampler if rate is changed, else converter.
+* Returns NULL if format isn't supported
+*************************************************/
+Player::AudioSource*
+Player::SetFormatStage(
+	_In_ MixSource* lpMix,
+	_In_ ConvertSource* lpConvert,
+	_In_ ResampleSource* lpResample,
+	_In_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpSourceFormat,
+	_In_ DWORD dwSourceMask,
+	_In_ const WAVEFORMATEX* lpDestFormat
+)
+{
+	WAVEFORMATEX mixFormat = *lpSourceFormat;
+	if (lpMix->IsNeeded(lpSourceFormat->nChannels, lpDestFormat->nChannels))
+	{
+		if (!lpMix->SetSource(lpUpstream, lpSourceFormat, dwSourceMask, lpDestFormat->nChannels, &mixFormat)) { return NULL; }
+		lpUpstream = lpMix;
+	}
+
+	if (mixFormat.nSamplesPerSec == lpDestFormat->nSamplesPerSec)
+	{
+		return lpConvert->SetSource(lpUpstream, &mixFormat, lpDestFormat) ? (AudioSource*)lpConvert : NULL;
+	}
+	return lpResample->SetSource(lpUpstream, &mixFormat, lpDestFormat) ? (AudioSource*)lpResample : NULL;
+}
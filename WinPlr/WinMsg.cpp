@@ -10,6 +10,51 @@
 *********************************************************/
 #include "WinAudio.h"
 
+static HWND hwndMessages = NULL;		// window which shows errors
+static DWORD dwMessageThreadId = 0;		// only this thread can show message boxes
+
+/*************************************************
+* SetMessageWindow():
+* Set window of UI thread. Errors from other
+* threads are posted to ring for this window
+*************************************************/
+VOID
+SetMessageWindow(
+	_In_ HWND hwnd
+)
+{
+	hwndMessages = hwnd;
+	dwMessageThreadId = hwnd ? GetWindowThreadProcessId(hwnd, NULL) : 0;
+}
+
+/*************************************************
+* PostAudioError():
+* Post error to ring and wake UI thread.
+* Never blocks, can be called from audio thread
+*************************************************/
+VOID
+PostAudioError(
+	_In_ DWORD dwCode,
+	_In_ LPCSTR lpMsgText
+)
+{
+	errorRing.Post(dwCode, lpMsgText);
+	if (hwndMessages)
+	{
+		PostMessageA(hwndMessages, WM_NULL, NULL, NULL);
+	}
+}
+
+/*************************************************
+* IsMessageThread():
+* Modal message can't stop other threads
+*************************************************/
+static BOOL
+IsMessageThread()
+{
+	return !dwMessageThreadId || dwMessageThreadId == GetCurrentThreadId();
+}
+
 /*************************************************
 * CreateWarningText():
 * Create message with warning and close process
@@ -19,6 +64,13 @@ CreateWarningText(
 	_In_ LPCSTR lpMsgText
 )
 {
+	// other thread goes on without closing process
+	if (!IsMessageThread())
+	{
+		PostAudioError(GetLastError(), lpMsgText);
+		return;
+	}
+
 	__debugbreak();
 	MessageBoxA(
 		NULL,
@@ -45,6 +97,12 @@ CreateErrorText(
 	LPCSTR lpCMessage = NULL;
 	std::string szString;
 
+	if (!IsMessageThread())
+	{
+		PostAudioError(dwError, lpMsgText);
+		return;
+	}
+
 	__debugbreak();
 
 	// if we got system error
@@ -114,6 +172,12 @@ CreateErrorText(
 	_In_ HRESULT hr
 )
 {
+	if (!IsMessageThread())
+	{
+		PostAudioError((DWORD)hr, lpMsgText);
+		return;
+	}
+
 	// get all our errors to display
 	DWORD dwError = GetLastError();
 	_com_error err(hr);
@@ -190,6 +254,12 @@ CreateInfoText(
 	_In_ LPCSTR lpMsgText
 )
 {
+	if (!IsMessageThread())
+	{
+		PostAudioError(NOERROR, lpMsgText);
+		return;
+	}
+
 	__debugbreak();
 	MessageBoxA(
 		NULL,
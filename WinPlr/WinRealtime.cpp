@@ -0,0 +1,487 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio real-time thread
+**********************************************************
+* WinRealtime.cpp
+* Render thread priority, deadline monitoring,
+* stream telemetry and error ring
+*********************************************************/
+#include "WinEngine.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+Player::ErrorRing errorRing;
+
+/*************************************************
+* SetRealtimeThreadPriority():
+* Raise priority of current render thread.
+* Without rights thread stays with normal priority
+*************************************************/
+VOID
+SetRealtimeThreadPriority()
+{
+#ifdef _WIN32
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+	{
+		DEBUG_MESSAGE("Can't set time-critical priority for render thread");
+	}
+#else
+	struct sched_param schedParam = {};
+	schedParam.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &schedParam))
+	{
+		DEBUG_MESSAGE("Can't set SCHED_FIFO priority for render thread");
+	}
+#endif
+}
+
+/*************************************************
+* Histogram():
+* Constructor
+*************************************************/
+Player::Histogram::Histogram(
+	_In_ BOOL isLinearBuckets
+) : isLinear(isLinearBuckets)
+{
+	Reset();
+}
+
+/*************************************************
+* Reset():
+* Clear all buckets
+*************************************************/
+VOID
+Player::Histogram::Reset()
+{
+	for (DWORD i = 0; i < TELEMETRY_BUCKETS; i++)
+	{
+		buckets[i] = 0;
+	}
+	uCount = 0;
+	uMax = 0;
+}
+
+/*************************************************
+* Add():
+* Count value in its bucket
+*************************************************/
+VOID
+Player::Histogram::Add(
+	_In_ UINT64 uValue
+)
+{
+	DWORD dwBucket = 0;
+	if (isLinear)
+	{
+		dwBucket = (DWORD)min(uValue, (UINT64)(TELEMETRY_BUCKETS - 1));
+	}
+	else
+	{
+		// bucket is count of significant bits
+		for (UINT64 uBits = uValue; uBits && dwBucket < TELEMETRY_BUCKETS - 1; uBits >>= 1)
+		{
+			dwBucket++;
+		}
+	}
+
+	buckets[dwBucket].fetch_add(1, std::memory_order_relaxed);
+	uCount.fetch_add(1, std::memory_order_relaxed);
+	if (uValue > uMax.load(std::memory_order_relaxed))
+	{
+		uMax.store(uValue, std::memory_order_relaxed);
+	}
+}
+
+/*************************************************
+* GetBucketMin():
+* Smallest value of bucket
+*************************************************/
+UINT64
+Player::Histogram::GetBucketMin(
+	_In_ DWORD dwBucket
+)
+{
+	if (isLinear || !dwBucket) { return dwBucket; }
+	return 1ULL << (dwBucket - 1);
+}
+
+/*************************************************
+* GetBucketMax():
+* Biggest value of bucket. Last bucket takes
+* all values bigger than others
+*************************************************/
+UINT64
+Player::Histogram::GetBucketMax(
+	_In_ DWORD dwBucket
+)
+{
+	if (dwBucket >= TELEMETRY_BUCKETS - 1) { return uMax.load(std::memory_order_relaxed); }
+	if (isLinear) { return dwBucket; }
+	return (1ULL << dwBucket) - 1;
+}
+
+/*************************************************
+* GetPercentile():
+* Upper bound of bucket where percentile is
+*************************************************/
+UINT64
+Player::Histogram::GetPercentile(
+	_In_ DWORD dwPercent
+)
+{
+	UINT64 uTotal = uCount.load(std::memory_order_relaxed);
+	if (!uTotal) { return 0; }
+
+	// at least one value must be counted to reach percentile
+	UINT64 uTarget = max((uTotal * min(dwPercent, 100UL) + 99) / 100, (UINT64)1);
+	UINT64 uSum = 0;
+	for (DWORD i = 0; i < TELEMETRY_BUCKETS; i++)
+	{
+		uSum += buckets[i].load(std::memory_order_relaxed);
+		if (uSum >= uTarget)
+		{
+			return min(GetBucketMax(i), uMax.load(std::memory_order_relaxed));
+		}
+	}
+	return uMax.load(std::memory_order_relaxed);
+}
+
+/*************************************************
+* StreamTelemetry():
+* Constructor
+*************************************************/
+Player::StreamTelemetry::StreamTelemetry()
+	: intervalUs(FALSE), jitterUs(FALSE), refillUs(FALSE), queuedBuffers(TRUE), uUnderruns(0), uLastStartNs(0), uLastIntervalNs(0)
+{
+}
+
+/*************************************************
+* Reset():
+* Clear telemetry before stream is started
+*************************************************/
+VOID
+Player::StreamTelemetry::Reset()
+{
+	intervalUs.Reset();
+	jitterUs.Reset();
+	refillUs.Reset();
+	queuedBuffers.Reset();
+	uUnderruns = 0;
+	uLastStartNs = 0;
+	uLastIntervalNs = 0;
+}
+
+/*************************************************
+* AddCallback():
+* Count callback interval, jitter and refill time
+*************************************************/
+VOID
+Player::StreamTelemetry::AddCallback(
+	_In_ UINT64 uStartNs,
+	_In_ UINT64 uDurationNs
+)
+{
+	refillUs.Add(uDurationNs / 1000);
+
+	// first callback has no interval
+	if (uLastStartNs)
+	{
+		UINT64 uIntervalNs = uStartNs - uLastStartNs;
+		intervalUs.Add(uIntervalNs / 1000);
+
+		if (uLastIntervalNs)
+		{
+			UINT64 uJitterNs = uIntervalNs > uLastIntervalNs ? uIntervalNs - uLastIntervalNs : uLastIntervalNs - uIntervalNs;
+			jitterUs.Add(uJitterNs / 1000);
+		}
+		uLastIntervalNs = uIntervalNs;
+	}
+	uLastStartNs = max(uStartNs, (UINT64)1);
+}
+
+VOID Player::StreamTelemetry::AddQueued(_In_ DWORD dwQueued) { queuedBuffers.Add(dwQueued); }
+VOID Player::StreamTelemetry::AddUnderrun() { uUnderruns.fetch_add(1, std::memory_order_relaxed); }
+
+/*************************************************
+* DeadlineMonitor():
+* Constructor
+*************************************************/
+Player::DeadlineMonitor::DeadlineMonitor() : uCallbacks(0), uMisses(0), uMaxDurationNs(0)
+{
+	Reset();
+}
+
+/*************************************************
+* Reset():
+* Clear counters. Call it before render thread
+* is started
+*************************************************/
+VOID
+Player::DeadlineMonitor::Reset()
+{
+	memset(history, 0, sizeof(history));
+	uCallbacks = 0;
+	uMisses = 0;
+	uMaxDurationNs = 0;
+	telemetry.Reset();
+	resetTime = std::chrono::steady_clock::now();
+}
+
+/*************************************************
+* BeginCallback():
+* Returns start time of callback
+*************************************************/
+UINT64
+Player::DeadlineMonitor::BeginCallback()
+{
+	return (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - resetTime).count();
+}
+
+/*************************************************
+* EndCallback():
+* Save callback to history ring and count miss
+* if callback took more time than it had
+*************************************************/
+VOID
+Player::DeadlineMonitor::EndCallback(
+	_In_ UINT64 uStartNs,
+	_In_ UINT64 uDeadlineNs
+)
+{
+	UINT64 uDurationNs = BeginCallback() - uStartNs;
+	telemetry.AddCallback(uStartNs, uDurationNs);
+	UINT64 uIndex = uCallbacks.load(std::memory_order_relaxed);
+
+	CALLBACK_RECORD* lpRecord = &history[uIndex % DEADLINE_HISTORY];
+	lpRecord->uStartNs = uStartNs;
+	lpRecord->uDurationNs = uDurationNs;
+	lpRecord->uDeadlineNs = uDeadlineNs;
+
+	if (uDurationNs > uDeadlineNs)
+	{
+		uMisses.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (uDurationNs > uMaxDurationNs.load(std::memory_order_relaxed))
+	{
+		uMaxDurationNs.store(uDurationNs, std::memory_order_relaxed);
+	}
+
+	// publish record after it is written
+	uCallbacks.store(uIndex + 1, std::memory_order_release);
+}
+
+/*************************************************
+* CopyHistory():
+* Copy last callbacks from oldest to newest.
+* Returns count of copied records
+*************************************************/
+DWORD
+Player::DeadlineMonitor::CopyHistory(
+	_Out_writes_(dwMaxRecords) CALLBACK_RECORD_P lpRecords,
+	_In_ DWORD dwMaxRecords
+)
+{
+	UINT64 uCount = uCallbacks.load(std::memory_order_acquire);
+	DWORD dwCopy = (DWORD)min(min(uCount, (UINT64)DEADLINE_HISTORY), (UINT64)dwMaxRecords);
+
+	for (DWORD i = 0; i < dwCopy; i++)
+	{
+		lpRecords[i] = history[(uCount - dwCopy + i) % DEADLINE_HISTORY];
+	}
+	return dwCopy;
+}
+
+/*************************************************
+* FormatTelemetry():
+* Print telemetry summary, one value per line
+*************************************************/
+VOID
+Player::DeadlineMonitor::FormatTelemetry(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	int iWritten = snprintf(lpText, dwSize, "Underruns: %llu", (unsigned long long)telemetry.uUnderruns.load());
+
+	// sinks without device queue don't count queued buffers
+	if (telemetry.queuedBuffers.uCount.load() && iWritten > 0 && (DWORD)iWritten < dwSize)
+	{
+		iWritten += snprintf(lpText + iWritten, dwSize - iWritten, "\nQueued buffers: p50 %llu, p1 %llu",
+			(unsigned long long)telemetry.queuedBuffers.GetPercentile(50),
+			(unsigned long long)telemetry.queuedBuffers.GetPercentile(1));
+	}
+
+	if (iWritten > 0 && (DWORD)iWritten < dwSize)
+	{
+		snprintf(
+			lpText + iWritten,
+			dwSize - iWritten,
+			"\nCallback interval: p50 %llu us"
+			"\nJitter: p99 %llu us, max %llu us"
+			"\nRefill: p99 %llu us, max %llu us",
+			(unsigned long long)telemetry.intervalUs.GetPercentile(50),
+			(unsigned long long)telemetry.jitterUs.GetPercentile(99),
+			(unsigned long long)telemetry.jitterUs.uMax.load(),
+			(unsigned long long)telemetry.refillUs.GetPercentile(99),
+			(unsigned long long)telemetry.refillUs.uMax.load()
+		);
+	}
+}
+
+/*************************************************
+* DumpHistogram():
+* Write non-empty buckets as CSV rows
+*************************************************/
+static VOID
+DumpHistogram(
+	_In_ FILE* lpFile,
+	_In_ LPCSTR lpName,
+	_In_ Player::Histogram* lpHistogram
+)
+{
+	for (DWORD i = 0; i < TELEMETRY_BUCKETS; i++)
+	{
+		UINT64 uCount = lpHistogram->buckets[i].load(std::memory_order_relaxed);
+		if (!uCount) { continue; }
+
+		fprintf(lpFile, "%s,%llu,%llu,%llu\n", lpName,
+			(unsigned long long)lpHistogram->GetBucketMin(i), (unsigned long long)lpHistogram->GetBucketMax(i), (unsigned long long)uCount);
+	}
+}
+
+/*************************************************
+* DumpTelemetry():
+* Write counters, histograms and last callbacks
+* to CSV file for offline analysis
+*************************************************/
+BOOL
+Player::DeadlineMonitor::DumpTelemetry(
+	_In_ LPCSTR lpPath
+)
+{
+	FILE* lpFile = fopen(lpPath, "w");
+	if (!lpFile)
+	{
+		DEBUG_MESSAGE("Can't create telemetry dump file");
+		return FALSE;
+	}
+
+	fprintf(lpFile, "callbacks,misses,max_callback_us,underruns\n%llu,%llu,%llu,%llu\n\n",
+		(unsigned long long)uCallbacks.load(), (unsigned long long)uMisses.load(),
+		(unsigned long long)(uMaxDurationNs.load() / 1000), (unsigned long long)telemetry.uUnderruns.load());
+
+	fputs("histogram,from,to,count\n", lpFile);
+	DumpHistogram(lpFile, "interval_us", &telemetry.intervalUs);
+	DumpHistogram(lpFile, "jitter_us", &telemetry.jitterUs);
+	DumpHistogram(lpFile, "refill_us", &telemetry.refillUs);
+	DumpHistogram(lpFile, "queued_buffers", &telemetry.queuedBuffers);
+
+	// history is copied, render thread can go on
+	CALLBACK_RECORD records[DEADLINE_HISTORY] = {};
+	DWORD dwRecords = CopyHistory(records, DEADLINE_HISTORY);
+
+	fputs("\nstart_us,duration_us,deadline_us\n", lpFile);
+	for (DWORD i = 0; i < dwRecords; i++)
+	{
+		fprintf(lpFile, "%llu,%llu,%llu\n", (unsigned long long)(records[i].uStartNs / 1000),
+			(unsigned long long)(records[i].uDurationNs / 1000), (unsigned long long)(records[i].uDeadlineNs / 1000));
+	}
+
+	fclose(lpFile);
+	return TRUE;
+}
+
+/*************************************************
+* ErrorRing():
+* Constructor
+*************************************************/
+Player::ErrorRing::ErrorRing() : dwPosted(0), dwDropped(0), dwHead(0), dwTail(0)
+{
+	for (DWORD i = 0; i < ERROR_RING_SIZE; i++)
+	{
+		slots[i].dwSequence.store(i, std::memory_order_relaxed);
+		memset(&slots[i].error, 0, sizeof(PLAYER_ERROR));
+	}
+}
+
+/*************************************************
+* Post():
+* Reserve slot by CAS on tail and publish it
+* by slot sequence. Returns FALSE if ring is full
+*************************************************/
+BOOL
+Player::ErrorRing::Post(
+	_In_ DWORD dwCode,
+	_In_ LPCSTR lpContext
+)
+{
+	dwPosted.fetch_add(1, std::memory_order_relaxed);
+
+	ERROR_SLOT* lpSlot = NULL;
+	DWORD dwPosition = dwTail.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		lpSlot = &slots[dwPosition & (ERROR_RING_SIZE - 1)];
+		LONG lDiff = (LONG)(lpSlot->dwSequence.load(std::memory_order_acquire) - dwPosition);
+
+		// slot is free, try to take it before other producers
+		if (!lDiff)
+		{
+			if (dwTail.compare_exchange_weak(dwPosition, dwPosition + 1, std::memory_order_relaxed)) { break; }
+		}
+		else if (lDiff < 0)
+		{
+			// consumer hasn't taken the oldest error yet
+			dwDropped.fetch_add(1, std::memory_order_relaxed);
+			return FALSE;
+		}
+		else
+		{
+			dwPosition = dwTail.load(std::memory_order_relaxed);
+		}
+	}
+
+	lpSlot->error.dwCode = dwCode;
+	lpSlot->error.uTimeNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	DWORD i = 0;
+	for (; lpContext && lpContext[i] && i < ERROR_CONTEXT_SIZE - 1; i++)
+	{
+		lpSlot->error.szContext[i] = lpContext[i];
+	}
+	lpSlot->error.szContext[i] = '\0';
+
+	lpSlot->dwSequence.store(dwPosition + 1, std::memory_order_release);
+	return TRUE;
+}
+
+/*************************************************
+* Pop():
+* Take oldest published error
+*************************************************/
+BOOL
+Player::ErrorRing::Pop(
+	_Out_ PLAYER_ERROR* lpError
+)
+{
+	DWORD dwPosition = dwHead.load(std::memory_order_relaxed);
+	ERROR_SLOT* lpSlot = &slots[dwPosition & (ERROR_RING_SIZE - 1)];
+
+	// slot is reserved but not published yet, or ring is empty
+	if (lpSlot->dwSequence.load(std::memory_order_acquire) != dwPosition + 1)
+	{
+		return FALSE;
+	}
+
+	*lpError = lpSlot->error;
+	lpSlot->dwSequence.store(dwPosition + ERROR_RING_SIZE, std::memory_order_release);
+	dwHead.store(dwPosition + 1, std::memory_order_relaxed);
+	return TRUE;
+}
@@ -0,0 +1,193 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio offline render
+**********************************************************
+* WinRender.cpp
+* Faster-than-realtime render and pipeline profiling
+*********************************************************/
+#include "WinEngine.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*************************************************
+* AddRenderStage():
+* Append stage time to render stats
+*************************************************/
+VOID
+AddRenderStage(
+	_Inout_ RENDER_STATS_P lpStats,
+	_In_ LPCSTR lpName,
+	_In_ double dSeconds
+)
+{
+	if (lpStats->dwStageCount >= MAX_RENDER_STAGES)
+	{
+		return;
+	}
+
+	RENDER_STAGE* lpStage = &lpStats->stages[lpStats->dwStageCount++];
+	snprintf(lpStage->szName, sizeof(lpStage->szName), "%s", lpName);
+	lpStage->dSeconds = dSeconds;
+}
+
+/*************************************************
+* GetPeakMemoryKB():
+* Peak resident memory of process
+*************************************************/
+UINT64
+GetPeakMemoryKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS memCounters = {};
+	memCounters.cb = sizeof(PROCESS_MEMORY_COUNTERS);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &memCounters, sizeof(PROCESS_MEMORY_COUNTERS)))
+	{
+		return 0;
+	}
+	return memCounters.PeakWorkingSetSize / 1024;
+#else
+	struct rusage resUsage = {};
+	if (getrusage(RUSAGE_SELF, &resUsage))
+	{
+		return 0;
+	}
+
+	// Linux reports ru_maxrss in kilobytes
+	return (UINT64)resUsage.ru_maxrss;
+#endif
+}
+
+/*************************************************
+* FormatRenderStats():
+* Print render stats to text
+*************************************************/
+VOID
+FormatRenderStats(
+	_In_ const RENDER_STATS* lpStats,
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	int iWritten = snprintf(
+		lpText,
+		dwSize,
+		"Rendered %.2f s in %.1f ms (realtime factor %.1fx), decode before render %.1f ms, peak memory %llu KB",
+		lpStats->dAudioSeconds,
+		lpStats->dWallSeconds * 1000.0,
+		lpStats->dRealtimeFactor,
+		lpStats->dDecodeSeconds * 1000.0,
+		(unsigned long long)lpStats->uPeakMemoryKB
+	);
+
+	// stages are parts of wall time, decode is printed above
+	double dStagesSeconds = 0.0;
+	for (DWORD i = 0; i < lpStats->dwStageCount; i++)
+	{
+		dStagesSeconds += lpStats->stages[i].dSeconds;
+	}
+
+	for (DWORD i = 0; i < lpStats->dwStageCount && iWritten > 0 && (DWORD)iWritten < dwSize; i++)
+	{
+		const RENDER_STAGE* lpStage = &lpStats->stages[i];
+		double dPercent = dStagesSeconds > 0.0 ? lpStage->dSeconds * 100.0 / dStagesSeconds : 0.0;
+		iWritten += snprintf(lpText + iWritten, dwSize - iWritten, "\n  %s: %.3f ms (%.1f%%)", lpStage->szName, lpStage->dSeconds * 1000.0, dPercent);
+	}
+}
+
+/*************************************************
+* TimedSource():
+* Constructor
+*************************************************/
+Player::TimedSource::TimedSource(
+	_In_ LPCSTR lpStageName,
+	_In_ AudioSource* lpUpstream,
+	_In_opt_ TimedSource* lpTimedUpstream
+) : lpSource(lpUpstream), lpTimedSource(lpTimedUpstream), dTotalSeconds(0.0)
+{
+	snprintf(szName, sizeof(szName), "%s", lpStageName);
+}
+
+/*************************************************
+* ReadFrames():
+* Pull frames from upstream and add spent time
+*************************************************/
+DWORD
+Player::TimedSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	DWORD dwRead = lpSource->ReadFrames(lpDest, dwFrames);
+	dTotalSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	return dwRead;
+}
+
+BOOL Player::TimedSource::SeekFrame(_In_ UINT64 uFrame) { return lpSource->SeekFrame(uFrame); }
+double Player::TimedSource::GetStageSeconds() { return dTotalSeconds - (lpTimedSource ? lpTimedSource->dTotalSeconds : 0.0); }
+
+/*************************************************
+* RenderOffline():
+* Run chain to sink and wait for end of stream.
+* Sink must not be paced to device clock.
+* Stages are added after stages already in stats
+*************************************************/
+BOOL
+Player::RenderOffline(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ TimedSource* lpChain,
+	_In_ AudioSink* lpSink,
+	_Inout_ RENDER_STATS_P lpStats
+)
+{
+	if (!lpFormat->nSamplesPerSec || !lpSink->Open(lpFormat, lpChain))
+	{
+		return FALSE;
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	if (!lpSink->Start())
+	{
+		lpSink->Close();
+		return FALSE;
+	}
+
+	// sleep granularity is bigger than render of short files, so just yield
+	while (!lpSink->IsFinished())
+	{
+		std::this_thread::yield();
+	}
+
+	// file sink writes header on close, it's part of render
+	UINT64 uFrames = lpSink->GetPosition();
+	lpSink->Close();
+	double dWallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	// chain is linked from output to input, stats are from input to output
+	TimedSource* lpStages[MAX_RENDER_STAGES] = {};
+	DWORD dwCount = 0;
+	for (TimedSource* lpStage = lpChain; lpStage && dwCount < MAX_RENDER_STAGES; lpStage = lpStage->lpTimedSource)
+	{
+		lpStages[dwCount++] = lpStage;
+	}
+	while (dwCount)
+	{
+		dwCount--;
+		AddRenderStage(lpStats, lpStages[dwCount]->szName, lpStages[dwCount]->GetStageSeconds());
+	}
+	AddRenderStage(lpStats, "sink", max(dWallSeconds - lpChain->dTotalSeconds, 0.0));
+
+	lpStats->uFrames = uFrames;
+	lpStats->dAudioSeconds = (double)uFrames / lpFormat->nSamplesPerSec;
+	lpStats->dWallSeconds = dWallSeconds;
+	lpStats->dRealtimeFactor = dWallSeconds > 0.0 ? lpStats->dAudioSeconds / dWallSeconds : 0.0;
+	lpStats->uPeakMemoryKB = GetPeakMemoryKB();
+	return TRUE;
+}
@@ -0,0 +1,665 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio resampler
+**********************************************************
+* WinResample.cpp
+* Polyphase windowed-sinc sample rate conversion
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+	DWORD dwTaps;				// taps of one phase without downsampling
+	WINDOW_TYPE eWindow;		// default window
+	double dRolloff;			// cutoff of input or output band, so transition ends at Nyquist
+} RESAMPLE_TIER;
+
+static const RESAMPLE_TIER resampleTiers[RESAMPLE_QUALITY_COUNT] =
+{
+	{ 16, HANN_WINDOW, 0.81 },
+	{ 32, HANN_WINDOW, 0.90 },
+	{ 64, BLACKMAN_WINDOW, 0.91 },
+	{ 128, BLACKMANHARRIS_WINDOW, 0.94 }
+};
+
+static const double dPi = 3.14159265358979323846;
+
+/*************************************************
+* GetWindowValue():
+* Cosine-sum window, x is 0..1 over filter
+*************************************************/
+static double
+GetWindowValue(
+	_In_ WINDOW_TYPE eWindow,
+	_In_ double x
+)
+{
+	double dCos1 = cos(2.0 * dPi * x);
+	double dCos2 = cos(4.0 * dPi * x);
+	double dCos3 = cos(6.0 * dPi * x);
+
+	switch (eWindow)
+	{
+	case HANN_WINDOW:			return 0.5 - 0.5 * dCos1;
+	case HAMMING_WINDOW:		return 0.54 - 0.46 * dCos1;
+	case BLACKMAN_WINDOW:		return 0.42 - 0.5 * dCos1 + 0.08 * dCos2;
+	default:					return 0.35875 - 0.48829 * dCos1 + 0.14128 * dCos2 - 0.01168 * dCos3;
+	}
+}
+
+/*************************************************
+* Inner products. Taps are multiple of 8,
+* so there is no tail
+*************************************************/
+static FLOAT
+DotScalar(
+	_In_reads_(dwTaps) const FLOAT* lpSamples,
+	_In_reads_(dwTaps) const FLOAT* lpCoefs,
+	_In_ DWORD dwTaps
+)
+{
+	FLOAT fSum[4] = {};
+	for (DWORD i = 0; i < dwTaps; i += 4)
+	{
+		fSum[0] += lpSamples[i] * lpCoefs[i];
+		fSum[1] += lpSamples[i + 1] * lpCoefs[i + 1];
+		fSum[2] += lpSamples[i + 2] * lpCoefs[i + 2];
+		fSum[3] += lpSamples[i + 3] * lpCoefs[i + 3];
+	}
+	return (fSum[0] + fSum[1]) + (fSum[2] + fSum[3]);
+}
+
+#ifdef CONVERT_X86
+static FLOAT
+DotSse(
+	_In_reads_(dwTaps) const FLOAT* lpSamples,
+	_In_reads_(dwTaps) const FLOAT* lpCoefs,
+	_In_ DWORD dwTaps
+)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	for (DWORD i = 0; i < dwTaps; i += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(lpSamples + i), _mm_loadu_ps(lpCoefs + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(lpSamples + i + 4), _mm_loadu_ps(lpCoefs + i + 4)));
+	}
+
+	sum0 = _mm_add_ps(sum0, sum1);
+	sum0 = _mm_add_ps(sum0, _mm_movehl_ps(sum0, sum0));
+	sum0 = _mm_add_ss(sum0, _mm_shuffle_ps(sum0, sum0, 1));
+	return _mm_cvtss_f32(sum0);
+}
+
+CONVERT_TARGET_AVX2
+static FLOAT
+DotAvx2(
+	_In_reads_(dwTaps) const FLOAT* lpSamples,
+	_In_reads_(dwTaps) const FLOAT* lpCoefs,
+	_In_ DWORD dwTaps
+)
+{
+	__m256 sum = _mm256_setzero_ps();
+	for (DWORD i = 0; i < dwTaps; i += 8)
+	{
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(lpSamples + i), _mm256_loadu_ps(lpCoefs + i)));
+	}
+
+	__m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+	sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, 1));
+	return _mm_cvtss_f32(sum4);
+}
+#endif
+
+static RESAMPLE_DOT
+GetDotKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return DotAvx2;
+	case CONVERT_ISA_SSE2:	return DotSse;
+	default:				break;
+	}
+#endif
+	return DotScalar;
+}
+
+static DWORD
+GetGcd(
+	_In_ DWORD a,
+	_In_ DWORD b
+)
+{
+	while (b)
+	{
+		DWORD c = a % b;
+		a = b;
+		b = c;
+	}
+	return a;
+}
+
+/*************************************************
+* GetResampleQualityByName():
+* Quality tier from launch param value,
+* high quality if name is unknown
+*************************************************/
+RESAMPLE_QUALITY
+GetResampleQualityByName(
+	_In_opt_ LPCSTR lpName
+)
+{
+	if (lpName && !strncmp(lpName, "low", 3)) { return RESAMPLE_QUALITY_LOW; }
+	if (lpName && !strncmp(lpName, "medium", 6)) { return RESAMPLE_QUALITY_MEDIUM; }
+	if (lpName && !strncmp(lpName, "best", 4)) { return RESAMPLE_QUALITY_BEST; }
+	return RESAMPLE_QUALITY_HIGH;
+}
+
+LPCSTR
+GetResampleQualityName(
+	_In_ RESAMPLE_QUALITY eQuality
+)
+{
+	switch (eQuality)
+	{
+	case RESAMPLE_QUALITY_LOW:		return "low";
+	case RESAMPLE_QUALITY_MEDIUM:	return "medium";
+	case RESAMPLE_QUALITY_BEST:		return "best";
+	default:						return "high";
+	}
+}
+
+/*************************************************
+* GetWindowTypeByName():
+* Window from launch param value, window
+* of quality tier if name is unknown
+*************************************************/
+WINDOW_TYPE
+GetWindowTypeByName(
+	_In_opt_ LPCSTR lpName,
+	_In_ RESAMPLE_QUALITY eQuality
+)
+{
+	// "blackmanharris" starts with "blackman", so it goes first
+	if (lpName && !strncmp(lpName, "blackmanharris", 14)) { return BLACKMANHARRIS_WINDOW; }
+	if (lpName && !strncmp(lpName, "blackman", 8)) { return BLACKMAN_WINDOW; }
+	if (lpName && !strncmp(lpName, "hamming", 7)) { return HAMMING_WINDOW; }
+	if (lpName && !strncmp(lpName, "hann", 4)) { return HANN_WINDOW; }
+	return resampleTiers[eQuality < RESAMPLE_QUALITY_COUNT ? eQuality : RESAMPLE_QUALITY_HIGH].eWindow;
+}
+
+LPCSTR
+GetWindowTypeName(
+	_In_ WINDOW_TYPE eWindow
+)
+{
+	switch (eWindow)
+	{
+	case HANN_WINDOW:			return "hann";
+	case HAMMING_WINDOW:		return "hamming";
+	case BLACKMAN_WINDOW:		return "blackman";
+	default:					return "blackmanharris";
+	}
+}
+
+/*************************************************
+* ResampleSource():
+* Constructor
+*************************************************/
+Player::ResampleSource::ResampleSource() :
+	lpSource(NULL),
+	eQuality(RESAMPLE_QUALITY_HIGH),
+	eWindow(BLACKMAN_WINDOW),
+	dwChannels(0),
+	dwUp(1),
+	dwDown(1),
+	dwPhases(0),
+	dwTaps(0),
+	lpCoefs(NULL),
+	lpDot(NULL),
+	lpDeinterleave(NULL),
+	lpInterleave(NULL),
+	lpScratch(NULL),
+	dwSourceFrameBytes(0),
+	dwDestFrameBytes(0),
+	lpInputData(NULL),
+	lpOutputData(NULL),
+	lpInputPlanes(NULL),
+	lpOutputPlanes(NULL),
+	lpFillPlanes(NULL),
+	dwInputCapacity(0),
+	dwInputValid(0),
+	dwInputPos(0),
+	dwInputEnd(0),
+	dwPhase(0),
+	isEndOfSource(FALSE)
+{
+}
+
+Player::ResampleSource::~ResampleSource()
+{
+	FreeBuffers();
+}
+
+VOID
+Player::ResampleSource::FreeBuffers()
+{
+	delete[] lpCoefs;
+	delete[] lpScratch;
+	delete[] lpInputData;
+	delete[] lpOutputData;
+	delete[] lpInputPlanes;
+	delete[] lpOutputPlanes;
+	delete[] lpFillPlanes;
+	lpCoefs = NULL;
+	lpScratch = NULL;
+	lpInputData = NULL;
+	lpOutputData = NULL;
+	lpInputPlanes = NULL;
+	lpOutputPlanes = NULL;
+	lpFillPlanes = NULL;
+}
+
+/*************************************************
+* SetQuality():
+* Quality for next SetSource
+*************************************************/
+VOID
+Player::ResampleSource::SetQuality(
+	_In_ RESAMPLE_QUALITY eNewQuality,
+	_In_ WINDOW_TYPE eNewWindow
+)
+{
+	eQuality = eNewQuality < RESAMPLE_QUALITY_COUNT ? eNewQuality : RESAMPLE_QUALITY_HIGH;
+	eWindow = eNewWindow;
+}
+
+/*************************************************
+* SetSource():
+* Attach upstream and design filter. All
+* buffers are allocated here and never
+* on audio thread
+*************************************************/
+BOOL
+Player::ResampleSource::SetSource(
+	_In_ AudioSource* lpUpstream,
+	_In_ const WAVEFORMATEX* lpSourceFormat,
+	_In_ const WAVEFORMATEX* lpDestFormat
+)
+{
+	FreeBuffers();
+	lpSource = NULL;
+
+	SAMPLE_FORMAT eSourceFormat = GetSampleFormat(lpSourceFormat);
+	SAMPLE_FORMAT eDestFormat = GetSampleFormat(lpDestFormat);
+	DWORD dwSourceRate = lpSourceFormat->nSamplesPerSec;
+	DWORD dwDestRate = lpDestFormat->nSamplesPerSec;
+	dwChannels = lpSourceFormat->nChannels;
+
+	if (eSourceFormat == SAMPLE_FORMAT_UNKNOWN || eDestFormat == SAMPLE_FORMAT_UNKNOWN ||
+		!dwChannels || dwChannels != lpDestFormat->nChannels || !dwSourceRate || !dwDestRate ||
+		dwSourceRate > dwDestRate * RESAMPLE_MAX_RATIO || dwDestRate > dwSourceRate * RESAMPLE_MAX_RATIO)
+	{
+		return FALSE;
+	}
+
+	DWORD dwGcd = GetGcd(dwSourceRate, dwDestRate);
+	dwUp = dwDestRate / dwGcd;
+	dwDown = dwSourceRate / dwGcd;
+	dwPhases = min(dwUp, (DWORD)RESAMPLE_MAX_PHASES);
+
+	// downsampling cuts output band, so filter is longer in input frames
+	const RESAMPLE_TIER& resampleTier = resampleTiers[eQuality];
+	double dScale = min(1.0, (double)dwUp / dwDown);
+	dwTaps = (DWORD)ceil(resampleTier.dwTaps / dScale);
+	dwTaps = min((dwTaps + 7) & ~7UL, (DWORD)RESAMPLE_MAX_TAPS);
+	DesignFilter();
+
+	lpDot = GetDotKernel();
+	lpDeinterleave = GetDeinterleaveKernel(eSourceFormat, dwChannels);
+	lpInterleave = GetInterleaveKernel(eDestFormat, dwChannels);
+	dwSourceFrameBytes = GetSampleBytes(eSourceFormat) * dwChannels;
+	dwDestFrameBytes = GetSampleBytes(eDestFormat) * dwChannels;
+
+	dwInputCapacity = dwTaps + RESAMPLE_CHUNK_FRAMES;
+	lpScratch = new BYTE[RESAMPLE_CHUNK_FRAMES * dwSourceFrameBytes];
+	lpInputData = new FLOAT[dwInputCapacity * dwChannels];
+	lpOutputData = new FLOAT[RESAMPLE_CHUNK_FRAMES * dwChannels];
+	lpInputPlanes = new FLOAT*[dwChannels];
+	lpOutputPlanes = new FLOAT*[dwChannels];
+	lpFillPlanes = new FLOAT*[dwChannels];
+	for (DWORD i = 0; i < dwChannels; i++)
+	{
+		lpInputPlanes[i] = lpInputData + i * dwInputCapacity;
+		lpOutputPlanes[i] = lpOutputData + i * RESAMPLE_CHUNK_FRAMES;
+	}
+
+	lpSource = lpUpstream;
+	ResetState(0);
+	return TRUE;
+}
+
+/*************************************************
+* DesignFilter():
+* Windowed sinc, one row per phase plus row
+* for next input frame. Row has unity DC gain
+*************************************************/
+VOID
+Player::ResampleSource::DesignFilter()
+{
+	const RESAMPLE_TIER& resampleTier = resampleTiers[eQuality];
+	WINDOW_TYPE eFilterWindow = (eWindow >= HANN_WINDOW && eWindow <= BLACKMANHARRIS_WINDOW) ? eWindow : resampleTier.eWindow;
+	double dCutoff = resampleTier.dRolloff * min(1.0, (double)dwUp / dwDown);
+	double dHalf = dwTaps / 2;
+
+	lpCoefs = new FLOAT[(dwPhases + 1) * dwTaps];
+	for (DWORD dwRow = 0; dwRow <= dwPhases; dwRow++)
+	{
+		FLOAT* lpRow = lpCoefs + dwRow * dwTaps;
+		double dOffset = (double)dwRow / dwPhases;
+		double dSum = 0.0;
+
+		for (DWORD k = 0; k < dwTaps; k++)
+		{
+			// distance from output position in input frames
+			double dDistance = (double)k - (dHalf - 1.0) - dOffset;
+			double x = dCutoff * dDistance;
+			double dSinc = fabs(x) < 1e-9 ? 1.0 : sin(dPi * x) / (dPi * x);
+			double dValue = dCutoff * dSinc * GetWindowValue(eFilterWindow, (dDistance + dHalf) / (2.0 * dHalf));
+			lpRow[k] = (FLOAT)dValue;
+			dSum += dValue;
+		}
+
+		for (DWORD k = 0; k < dwTaps; k++)
+		{
+			lpRow[k] = (FLOAT)(lpRow[k] / dSum);
+		}
+	}
+}
+
+/*************************************************
+* ResetState():
+* Clear history. Window starts with zeros,
+* so first output frame is on first input frame
+*************************************************/
+VOID
+Player::ResampleSource::ResetState(
+	_In_ DWORD dwStartPhase
+)
+{
+	DWORD dwHistory = dwTaps / 2 - 1;
+	for (DWORD i = 0; i < dwChannels; i++)
+	{
+		memset(lpInputPlanes[i], 0, dwHistory * sizeof(FLOAT));
+	}
+
+	dwInputValid = dwHistory;
+	dwInputPos = 0;
+	dwInputEnd = 0;
+	dwPhase = dwStartPhase;
+	isEndOfSource = FALSE;
+}
+
+/*************************************************
+* FillInput():
+* Move window to start of planes and read next
+* chunk. After end of upstream, planes are
+* filled with zeros to flush filter
+*************************************************/
+BOOL
+Player::ResampleSource::FillInput()
+{
+	DWORD dwKeep = dwInputValid - dwInputPos;
+	for (DWORD i = 0; i < dwChannels; i++)
+	{
+		memmove(lpInputPlanes[i], lpInputPlanes[i] + dwInputPos, dwKeep * sizeof(FLOAT));
+	}
+	dwInputEnd -= min(dwInputEnd, dwInputPos);
+	dwInputValid = dwKeep;
+	dwInputPos = 0;
+
+	DWORD dwFree = min(dwInputCapacity - dwInputValid, (DWORD)RESAMPLE_CHUNK_FRAMES);
+	if (!isEndOfSource && dwFree)
+	{
+		DWORD dwRead = lpSource->ReadFrames(lpScratch, dwFree);
+		for (DWORD i = 0; i < dwChannels; i++)
+		{
+			lpFillPlanes[i] = lpInputPlanes[i] + dwInputValid;
+		}
+		lpDeinterleave(lpScratch, lpFillPlanes, dwRead, dwChannels);
+		dwInputValid += dwRead;
+
+		if (dwRead < dwFree)
+		{
+			isEndOfSource = TRUE;
+			dwInputEnd = dwInputValid;
+		}
+	}
+
+	if (isEndOfSource)
+	{
+		for (DWORD i = 0; i < dwChannels; i++)
+		{
+			memset(lpInputPlanes[i] + dwInputValid, 0, (dwInputCapacity - dwInputValid) * sizeof(FLOAT));
+		}
+		dwInputValid = dwInputCapacity;
+	}
+	return dwInputPos + dwTaps <= dwInputValid;
+}
+
+/*************************************************
+* ReadFrames():
+* Filter input planes by chunks of output.
+* Output frame is between input frames
+* dwInputPos + taps / 2 - 1 and next one
+*************************************************/
+DWORD
+Player::ResampleSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!lpSource) { return 0; }
+
+	const DWORD dwCenter = dwTaps / 2 - 1;
+	const DWORD dwStep = dwDown / dwUp;
+	const DWORD dwStepPhase = dwDown % dwUp;
+	const BOOL isPhaseExact = dwPhases == dwUp;
+	DWORD dwWritten = 0;
+	BOOL isEnd = FALSE;
+
+	while (dwWritten < dwFrames && !isEnd)
+	{
+		DWORD dwChunk = min(dwFrames - dwWritten, (DWORD)RESAMPLE_CHUNK_FRAMES);
+		DWORD dwCount = 0;
+
+		while (dwCount < dwChunk)
+		{
+			// output frames after last input frame aren't played
+			if (isEndOfSource && dwInputPos + dwCenter >= dwInputEnd)
+			{
+				isEnd = TRUE;
+				break;
+			}
+			if (dwInputPos + dwTaps > dwInputValid && !FillInput())
+			{
+				isEnd = TRUE;
+				break;
+			}
+
+			if (isPhaseExact)
+			{
+				const FLOAT* lpRow = lpCoefs + dwPhase * dwTaps;
+				for (DWORD i = 0; i < dwChannels; i++)
+				{
+					lpOutputPlanes[i][dwCount] = lpDot(lpInputPlanes[i] + dwInputPos, lpRow, dwTaps);
+				}
+			}
+			else
+			{
+				// position between two phases of table
+				UINT64 uRow = (UINT64)dwPhase * dwPhases;
+				DWORD dwRow = (DWORD)(uRow / dwUp);
+				FLOAT fFraction = (FLOAT)(uRow % dwUp) / dwUp;
+				const FLOAT* lpRow = lpCoefs + dwRow * dwTaps;
+				for (DWORD i = 0; i < dwChannels; i++)
+				{
+					FLOAT fFirst = lpDot(lpInputPlanes[i] + dwInputPos, lpRow, dwTaps);
+					FLOAT fSecond = lpDot(lpInputPlanes[i] + dwInputPos, lpRow + dwTaps, dwTaps);
+					lpOutputPlanes[i][dwCount] = fFirst + (fSecond - fFirst) * fFraction;
+				}
+			}
+
+			dwCount++;
+			dwInputPos += dwStep;
+			dwPhase += dwStepPhase;
+			if (dwPhase >= dwUp)
+			{
+				dwPhase -= dwUp;
+				dwInputPos++;
+			}
+		}
+
+		lpInterleave(lpOutputPlanes, lpDest + dwWritten * dwDestFrameBytes, dwCount, dwChannels);
+		dwWritten += dwCount;
+	}
+	return dwWritten;
+}
+
+/*************************************************
+* SeekFrame():
+* Seek upstream to input frame of output frame,
+* filter history starts from zeros
+*************************************************/
+BOOL
+Player::ResampleSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	if (!lpSource) { return FALSE; }
+
+	UINT64 uPosition = uFrame * dwDown;
+	if (!lpSource->SeekFrame(uPosition / dwUp)) { return FALSE; }
+	ResetState((DWORD)(uPosition % dwUp));
+	return TRUE;
+}
+
+DWORD Player::ResampleSource::GetTaps() { return dwTaps; }
+
+/*************************************************
+* RunResampleBenchmark():
+* Speed and THD+N of every quality tier. THD+N
+* is residual of 1 kHz sine after removing
+* fitted 1 kHz sine, in dB of that sine
+*************************************************/
+VOID
+RunResampleBenchmark(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	const DWORD dwRates[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 48000, 96000 }, { 96000, 44100 } };
+	const DWORD dwChannels = 2;
+	const DWORD dwSeconds = 4;
+	const double dFrequency = 1000.0;
+
+	int iWritten = snprintf(lpText, dwSize, "Resampler, stereo float, x realtime and THD+N (%s)\n", GetConvertIsaName(GetConvertIsa()));
+	DWORD dwOffset = iWritten > 0 ? min((DWORD)iWritten, dwSize) : 0;
+
+	for (DWORD dwRatio = 0; dwRatio < sizeof(dwRates) / sizeof(dwRates[0]); dwRatio++)
+	{
+		DWORD dwSourceRate = dwRates[dwRatio][0];
+		DWORD dwDestRate = dwRates[dwRatio][1];
+		DWORD dwSourceFrames = dwSourceRate * dwSeconds;
+		DWORD dwDestFrames = dwDestRate * dwSeconds + 1;
+
+		FLOAT* lpInput = new FLOAT[dwSourceFrames * dwChannels];
+		FLOAT* lpOutput = new FLOAT[dwDestFrames * dwChannels];
+		for (DWORD i = 0; i < dwSourceFrames; i++)
+		{
+			FLOAT fValue = (FLOAT)(0.5 * sin(2.0 * dPi * dFrequency * i / dwSourceRate));
+			lpInput[i * dwChannels] = fValue;
+			lpInput[i * dwChannels + 1] = fValue;
+		}
+
+		WAVEFORMATEX sourceFormat = {};
+		sourceFormat.nChannels = (WORD)dwChannels;
+		sourceFormat.nSamplesPerSec = dwSourceRate;
+		SetSampleFormat(&sourceFormat, SAMPLE_FORMAT_F32);
+		WAVEFORMATEX destFormat = sourceFormat;
+		destFormat.nSamplesPerSec = dwDestRate;
+		SetSampleFormat(&destFormat, SAMPLE_FORMAT_F32);
+
+		for (DWORD dwQuality = 0; dwQuality < RESAMPLE_QUALITY_COUNT; dwQuality++)
+		{
+			Player::MemorySource memorySource(lpInput, dwSourceFrames, dwChannels);
+			Player::ResampleSource resampleSource;
+			resampleSource.SetQuality((RESAMPLE_QUALITY)dwQuality, (WINDOW_TYPE)0);
+			resampleSource.SetSource(&memorySource, &sourceFormat, &destFormat);
+
+			auto startTime = std::chrono::steady_clock::now();
+			DWORD dwOutput = resampleSource.ReadFrames((BYTE*)lpOutput, dwDestFrames);
+			double dTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+			// fit a*cos + b*sin + c on middle part, filter edges are skipped
+			DWORD dwFirst = dwOutput / 8;
+			DWORD dwLast = dwOutput - dwOutput / 8;
+			double dMatrix[3][3] = {};
+			double dVector[3] = {};
+			for (DWORD i = dwFirst; i < dwLast; i++)
+			{
+				double dBasis[3] = { cos(2.0 * dPi * dFrequency * i / dwDestRate), sin(2.0 * dPi * dFrequency * i / dwDestRate), 1.0 };
+				for (DWORD r = 0; r < 3; r++)
+				{
+					for (DWORD c = 0; c < 3; c++) { dMatrix[r][c] += dBasis[r] * dBasis[c]; }
+					dVector[r] += dBasis[r] * lpOutput[i * dwChannels];
+				}
+			}
+
+			// Cramer's rule for 3x3
+			double dDet = dMatrix[0][0] * (dMatrix[1][1] * dMatrix[2][2] - dMatrix[1][2] * dMatrix[2][1]) -
+				dMatrix[0][1] * (dMatrix[1][0] * dMatrix[2][2] - dMatrix[1][2] * dMatrix[2][0]) +
+				dMatrix[0][2] * (dMatrix[1][0] * dMatrix[2][1] - dMatrix[1][1] * dMatrix[2][0]);
+			double dFit[3] = {};
+			for (DWORD k = 0; k < 3 && dDet != 0.0; k++)
+			{
+				double dColumn[3][3] = {};
+				memcpy(dColumn, dMatrix, sizeof(dColumn));
+				for (DWORD r = 0; r < 3; r++) { dColumn[r][k] = dVector[r]; }
+				dFit[k] = (dColumn[0][0] * (dColumn[1][1] * dColumn[2][2] - dColumn[1][2] * dColumn[2][1]) -
+					dColumn[0][1] * (dColumn[1][0] * dColumn[2][2] - dColumn[1][2] * dColumn[2][0]) +
+					dColumn[0][2] * (dColumn[1][0] * dColumn[2][1] - dColumn[1][1] * dColumn[2][0])) / dDet;
+			}
+
+			double dSignal = 0.0;
+			double dNoise = 0.0;
+			for (DWORD i = dwFirst; i < dwLast; i++)
+			{
+				double dFitted = dFit[0] * cos(2.0 * dPi * dFrequency * i / dwDestRate) + dFit[1] * sin(2.0 * dPi * dFrequency * i / dwDestRate) + dFit[2];
+				double dResidual = lpOutput[i * dwChannels] - dFitted;
+				dSignal += dFitted * dFitted;
+				dNoise += dResidual * dResidual;
+			}
+
+			double dThdN = 10.0 * log10(max(dNoise, 1e-30) / max(dSignal, 1e-30));
+			iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%u->%u %s (%u taps, %s): %.1fx, THD+N %.1f dB\n",
+				dwSourceRate, dwDestRate, GetResampleQualityName((RESAMPLE_QUALITY)dwQuality), resampleSource.GetTaps(),
+				GetWindowTypeName(GetWindowTypeByName(NULL, (RESAMPLE_QUALITY)dwQuality)),
+				(double)dwOutput / dwDestRate / max(dTime, 1e-9), dThdN);
+			if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+		}
+
+		delete[] lpInput;
+		delete[] lpOutput;
+	}
+}
@@ -0,0 +1,318 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio portable sinks
+**********************************************************
+* WinSink.cpp
+* Null and WAV-file sinks for headless playback
+*********************************************************/
+#include "WinEngine.h"
+
+/*************************************************
+* NullSink():
+* Constructor
+*************************************************/
+Player::NullSink::NullSink(
+	_In_ BOOL bIsPaced
+) : bPaced(bIsPaced), lpSource(NULL), lpPeriod(NULL), dwPeriodFrames(0),
+	bStopRequested(FALSE), bFinished(FALSE), uFramesPlayed(0)
+{
+	memset(&waveFormat, 0, sizeof(WAVEFORMATEX));
+}
+
+/*************************************************
+* ~NullSink():
+* Destructor
+*************************************************/
+Player::NullSink::~NullSink()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Allocate period buffer for format.
+* Sink which is open is closed first
+*************************************************/
+BOOL
+Player::NullSink::Open(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpNewSource
+)
+{
+	Close();
+
+	if (!lpFormat->nBlockAlign || !lpFormat->nSamplesPerSec || !lpNewSource)
+	{
+		return FALSE;
+	}
+
+	waveFormat = *lpFormat;
+	lpSource = lpNewSource;
+	dwPeriodFrames = max(waveFormat.nSamplesPerSec * SINK_PERIOD_MS / 1000, 1u);
+	lpPeriod = new BYTE[dwPeriodFrames * waveFormat.nBlockAlign];
+	uFramesPlayed = 0;
+	bFinished = FALSE;
+	deadlineMonitor.Reset();
+	return TRUE;
+}
+
+/*************************************************
+* Start():
+* Begin render thread
+*************************************************/
+BOOL
+Player::NullSink::Start()
+{
+	if (!lpPeriod || renderThread.joinable())
+	{
+		return FALSE;
+	}
+
+	bStopRequested = FALSE;
+	renderThread = std::thread(&Player::NullSink::RenderLoop, this);
+	return TRUE;
+}
+
+/*************************************************
+* Stop():
+* Stop render thread, position is kept
+*************************************************/
+VOID
+Player::NullSink::Stop()
+{
+	bStopRequested = TRUE;
+	if (renderThread.joinable())
+	{
+		renderThread.join();
+	}
+}
+
+/*************************************************
+* Close():
+* Stop and free period buffer
+*************************************************/
+VOID
+Player::NullSink::Close()
+{
+	Stop();
+	delete[] lpPeriod;
+	lpPeriod = NULL;
+	lpSource = NULL;
+}
+
+/*************************************************
+* RenderLoop():
+* Pull periods from source. If sink is paced -
+* sleep till virtual clock reaches wall clock
+*************************************************/
+VOID
+Player::NullSink::RenderLoop()
+{
+	// virtual clock starts from current position
+	UINT64 uStartFrame = uFramesPlayed;
+	UINT64 uPeriodNs = (UINT64)dwPeriodFrames * 1000000000 / waveFormat.nSamplesPerSec;
+	auto startTime = std::chrono::steady_clock::now();
+
+	if (bPaced)
+	{
+		SetRealtimeThreadPriority();
+	}
+
+	while (!bStopRequested)
+	{
+		UINT64 uStartNs = deadlineMonitor.BeginCallback();
+		DWORD dwRead = lpSource->ReadFrames(lpPeriod, dwPeriodFrames);
+		uFramesPlayed += dwRead;
+		deadlineMonitor.EndCallback(uStartNs, uPeriodNs);
+
+		if (dwRead < dwPeriodFrames)
+		{
+			bFinished = TRUE;
+			break;
+		}
+
+		if (bPaced)
+		{
+			UINT64 uElapsed = uFramesPlayed - uStartFrame;
+			std::this_thread::sleep_until(startTime + std::chrono::microseconds(uElapsed * 1000000 / waveFormat.nSamplesPerSec));
+		}
+	}
+}
+
+UINT64 Player::NullSink::GetPosition() { return uFramesPlayed; }
+DWORD Player::NullSink::GetLatency() { return bPaced ? SINK_PERIOD_MS : 0; }
+DWORD Player::NullSink::GetUnderruns() { return 0; }
+BOOL Player::NullSink::IsFinished() { return bFinished; }
+Player::DeadlineMonitor* Player::NullSink::GetDeadlineMonitor() { return &deadlineMonitor; }
+
+/*************************************************
+* WaveFileSink():
+* Constructor
+*************************************************/
+Player::WaveFileSink::WaveFileSink(
+	_In_ LPCSTR lpFilePath,
+	_In_ BOOL bIsPaced
+) : bPaced(bIsPaced), lpFile(NULL), lpSource(NULL), lpPeriod(NULL), dwPeriodFrames(0), dwDataOffset(0),
+	bStopRequested(FALSE), bFinished(FALSE), uFramesWritten(0)
+{
+	memset(&waveFormat, 0, sizeof(WAVEFORMATEX));
+	snprintf(szPath, sizeof(szPath), "%s", lpFilePath);
+}
+
+/*************************************************
+* ~WaveFileSink():
+* Destructor
+*************************************************/
+Player::WaveFileSink::~WaveFileSink()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Create file and write RIFF header.
+* Sink which is open is closed first
+*************************************************/
+BOOL
+Player::WaveFileSink::Open(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpNewSource
+)
+{
+	Close();
+
+	if (!lpFormat->nBlockAlign || !lpFormat->nSamplesPerSec || !lpNewSource)
+	{
+		return FALSE;
+	}
+
+	lpFile = fopen(szPath, "wb");
+	if (!lpFile)
+	{
+		DEBUG_MESSAGE("Sink error! Can't create WAV file");
+		return FALSE;
+	}
+
+	waveFormat = *lpFormat;
+	waveFormat.cbSize = 0;
+	lpSource = lpNewSource;
+
+	// sizes are written on close
+	DWORD dwFormatSize = (waveFormat.wFormatTag == WAVE_FORMAT_PCM) ? sizeof(PCMWAVEFORMAT) : sizeof(WAVEFORMATEX);
+	RIFFChunkHeader riffHeader = { FOURCC_RIFF_TAG, 0, FOURCC_WAVE_FILE_TAG };
+	RIFFChunk fmtChunk = { FOURCC_FORMAT_TAG, dwFormatSize };
+	RIFFChunk dataChunk = { FOURCC_DATA_TAG, 0 };
+
+	fwrite(&riffHeader, sizeof(RIFFChunkHeader), 1, lpFile);
+	fwrite(&fmtChunk, sizeof(RIFFChunk), 1, lpFile);
+	fwrite(&waveFormat, dwFormatSize, 1, lpFile);
+	dwDataOffset = (DWORD)ftell(lpFile) + sizeof(uint32_t);
+	fwrite(&dataChunk, sizeof(RIFFChunk), 1, lpFile);
+
+	// write one second at time, or device period if paced
+	dwPeriodFrames = bPaced ? max(waveFormat.nSamplesPerSec * SINK_PERIOD_MS / 1000, 1u) : waveFormat.nSamplesPerSec;
+	lpPeriod = new BYTE[dwPeriodFrames * waveFormat.nBlockAlign];
+	uFramesWritten = 0;
+	bFinished = FALSE;
+	return TRUE;
+}
+
+/*************************************************
+* Start():
+* Begin writer thread
+*************************************************/
+BOOL
+Player::WaveFileSink::Start()
+{
+	if (!lpFile || renderThread.joinable())
+	{
+		return FALSE;
+	}
+
+	bStopRequested = FALSE;
+	renderThread = std::thread(&Player::WaveFileSink::RenderLoop, this);
+	return TRUE;
+}
+
+/*************************************************
+* Stop():
+* Stop writer thread
+*************************************************/
+VOID
+Player::WaveFileSink::Stop()
+{
+	bStopRequested = TRUE;
+	if (renderThread.joinable())
+	{
+		renderThread.join();
+	}
+}
+
+/*************************************************
+* Close():
+* Patch RIFF sizes and close file
+*************************************************/
+VOID
+Player::WaveFileSink::Close()
+{
+	Stop();
+
+	if (lpFile)
+	{
+		uint32_t uDataSize = (uint32_t)(uFramesWritten * waveFormat.nBlockAlign);
+		uint32_t uRiffSize = dwDataOffset + sizeof(uint32_t) + uDataSize - sizeof(RIFFChunk);
+
+		fseek(lpFile, sizeof(uint32_t), SEEK_SET);
+		fwrite(&uRiffSize, sizeof(uint32_t), 1, lpFile);
+		fseek(lpFile, dwDataOffset, SEEK_SET);
+		fwrite(&uDataSize, sizeof(uint32_t), 1, lpFile);
+		fclose(lpFile);
+		lpFile = NULL;
+	}
+
+	delete[] lpPeriod;
+	lpPeriod = NULL;
+	lpSource = NULL;
+}
+
+/*************************************************
+* RenderLoop():
+* Pull frames from source as fast as possible,
+* or at wall clock rate if sink is paced
+*************************************************/
+VOID
+Player::WaveFileSink::RenderLoop()
+{
+	UINT64 uStartFrame = uFramesWritten;
+	auto startTime = std::chrono::steady_clock::now();
+
+	while (!bStopRequested)
+	{
+		DWORD dwRead = lpSource->ReadFrames(lpPeriod, dwPeriodFrames);
+		if (dwRead)
+		{
+			fwrite(lpPeriod, waveFormat.nBlockAlign, dwRead, lpFile);
+			uFramesWritten += dwRead;
+		}
+
+		if (dwRead < dwPeriodFrames)
+		{
+			bFinished = TRUE;
+			break;
+		}
+
+		if (bPaced)
+		{
+			UINT64 uElapsed = uFramesWritten - uStartFrame;
+			std::this_thread::sleep_until(startTime + std::chrono::microseconds(uElapsed * 1000000 / waveFormat.nSamplesPerSec));
+		}
+	}
+}
+
+UINT64 Player::WaveFileSink::GetPosition() { return uFramesWritten; }
+DWORD Player::WaveFileSink::GetLatency() { return bPaced ? SINK_PERIOD_MS : 0; }
+DWORD Player::WaveFileSink::GetUnderruns() { return 0; }
+BOOL Player::WaveFileSink::IsFinished() { return bFinished; }
@@ -0,0 +1,671 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio source-system
+**********************************************************
+* WinSource.cpp
+* RIFF parser and PCM source for WinPlr engine
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*************************************************
+* FindSoundChunk():
+* Find current chunk and return header 
+* if data is presented. Odd-sized chunks
+* are followed by pad byte
+*************************************************/
+const RIFFChunk* FindSoundChunk(
+	_In_reads_bytes_(sizeBytes) const uint8_t* data,
+	_In_ size_t sizeBytes,
+	_In_ UINT tag
+)
+{
+	if (!data)
+		return NULL;
+
+	const uint8_t* ptr = data;
+	const uint8_t* end = data + sizeBytes;
+
+	while (end > (ptr + sizeof(RIFFChunk)))
+	{
+		const RIFFChunk* header = reinterpret_cast<const RIFFChunk*>(ptr);
+		if (header->tag == tag)
+			return header;
+
+		ptrdiff_t offset = (ptrdiff_t)header->size + (header->size & 1) + sizeof(RIFFChunk);
+		ptr += offset;
+	}
+
+	return NULL;
+}
+
+/*************************************************
+* MappedFile():
+* Constructor
+*************************************************/
+Player::MappedFile::MappedFile() : lpData(NULL), dwSize(0)
+{
+}
+
+/*************************************************
+* ~MappedFile():
+* Destructor
+*************************************************/
+Player::MappedFile::~MappedFile()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Map file for reading. Only first 4 GB are
+* mapped, chunk sizes of RIFF can't reach
+* any further
+*************************************************/
+BOOL
+Player::MappedFile::Open(
+	_In_ LPCSTR lpPath
+)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(lpPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+
+	LARGE_INTEGER fileSize = {};
+	HANDLE hMapping = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart ?
+		CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	DWORD dwMapSize = (DWORD)min((UINT64)fileSize.QuadPart, (UINT64)0xFFFFFFFF);
+	lpData = hMapping ? (BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, dwMapSize) : NULL;
+
+	// view keeps mapping and file open
+	if (hMapping) { CloseHandle(hMapping); }
+	CloseHandle(hFile);
+#else
+	int iFile = open(lpPath, O_RDONLY);
+	if (iFile < 0)
+	{
+		return FALSE;
+	}
+
+	struct stat fileStat = {};
+	DWORD dwMapSize = fstat(iFile, &fileStat) ? 0 : (DWORD)min((UINT64)fileStat.st_size, (UINT64)0xFFFFFFFF);
+	void* lpView = dwMapSize ? mmap(NULL, dwMapSize, PROT_READ, MAP_PRIVATE, iFile, 0) : MAP_FAILED;
+	lpData = lpView != MAP_FAILED ? (BYTE*)lpView : NULL;
+	close(iFile);
+#endif
+
+	dwSize = lpData ? dwMapSize : 0;
+	return lpData != NULL;
+}
+
+/*************************************************
+* Close():
+* Unmap file, data of it can't be read anymore
+*************************************************/
+VOID
+Player::MappedFile::Close()
+{
+	if (lpData)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(lpData);
+#else
+		munmap(lpData, dwSize);
+#endif
+	}
+	lpData = NULL;
+	dwSize = 0;
+}
+
+/*************************************************
+* Swap():
+* Exchange mapped files without remapping
+*************************************************/
+VOID
+Player::MappedFile::Swap(
+	_Inout_ MappedFile* lpOther
+)
+{
+	BYTE* lpOtherData = lpOther->lpData;
+	DWORD dwOtherSize = lpOther->dwSize;
+	lpOther->lpData = lpData;
+	lpOther->dwSize = dwSize;
+	lpData = lpOtherData;
+	dwSize = dwOtherSize;
+}
+
+/*************************************************
+* ParseWaveData():
+* Parse RIFF file from memory to PCM_DATA
+*************************************************/
+BOOL
+ParseWaveData(
+	_In_reads_bytes_(dwSize) BYTE* lpFile,
+	_In_ DWORD dwSize,
+	_Out_ PCM_DATA_P lpPCM
+)
+{
+	memset(lpPCM, 0, sizeof(PCM_DATA));
+
+	// need at least enough data to have a valid minimal WAV file
+	if (!lpFile || dwSize < (sizeof(RIFFChunk) * 2 + sizeof(DWORD) + sizeof(WAVEFORMAT)))
+	{
+		DEBUG_MESSAGE("Lowpart file is invalid");
+		return FALSE;
+	}
+
+	// check RIFF tag
+	const RIFFChunk* riffChunk = FindSoundChunk(lpFile, dwSize, FOURCC_RIFF_TAG);
+
+	// if chunk is empty or size smaller than 4 - take message
+	if (!riffChunk || riffChunk->size < 4)
+	{
+		DEBUG_MESSAGE("File is not a RIFF (riffChunk)");
+		return FALSE;
+	}
+
+	// get RIFF chunk header info
+	const uint8_t* wavEnd = lpFile + dwSize;
+	const RIFFChunkHeader* riffHeader = reinterpret_cast<const RIFFChunkHeader*>(riffChunk);
+
+	// if this file isn't RIFF - take message
+	if (riffHeader->riff != FOURCC_WAVE_FILE_TAG && riffHeader->riff != FOURCC_XWMA_FILE_TAG)
+	{
+		DEBUG_MESSAGE("File is not a RIFF (riffHeader)");
+		return FALSE;
+	}
+
+	// locate 'fmt ' at file
+	const uint8_t* ptr = reinterpret_cast<const uint8_t*>(riffHeader) + sizeof(RIFFChunkHeader);
+
+	if ((ptr + sizeof(RIFFChunk)) > wavEnd)
+	{
+		DEBUG_MESSAGE("File is not a RIFF (ptr)");
+		return FALSE;
+	}
+
+	// every chunk is searched in RIFF body, size of file limits broken RIFF size
+	const uint8_t* riffBody = ptr;
+	size_t riffBodySize = min((size_t)riffHeader->size - sizeof(DWORD), (size_t)(wavEnd - riffBody));
+
+	// find fmt chunk
+	const RIFFChunk* fmtChunk = FindSoundChunk(riffBody, riffBodySize, FOURCC_FORMAT_TAG);
+
+	// if chunk is empty or size smaller than size of PCMWAVEFORMAT - take message
+	if (!fmtChunk || fmtChunk->size < sizeof(PCMWAVEFORMAT))
+	{
+		DEBUG_MESSAGE("File is not a RIFF (fmtChunk)");
+		return FALSE;
+	}
+
+	// reinterpretate fmt chunk to pointer
+	ptr = reinterpret_cast<const uint8_t*>(fmtChunk) + sizeof(RIFFChunk);
+
+	if (ptr + fmtChunk->size > wavEnd)
+	{
+		DEBUG_MESSAGE("File is not a RIFF (fmtChunk->size)");
+		return FALSE;
+	}
+
+	////////////////////////////////////////////////////////
+
+	BOOL isDPDS = FALSE;
+
+	const WAVEFORMAT* wf = reinterpret_cast<const WAVEFORMAT*>(ptr);
+
+	// check formatTag
+	switch (wf->wFormatTag)
+	{
+	case WAVE_FORMAT_PCM:
+	case WAVE_FORMAT_IEEE_FLOAT:
+		// Can be a PCMWAVEFORMAT (8 bytes) or WAVEFORMATEX (10 bytes)
+		// We validiated chunk as at least sizeof(PCMWAVEFORMAT) above
+		break;
+	default:
+	{
+		if (fmtChunk->size < sizeof(WAVEFORMATEX))
+		{
+			DEBUG_MESSAGE("File is not a RIFF (fmtChunk->size < sizeof(WAVEFORMATEX))");
+		}
+		const WAVEFORMATEX* wfx = reinterpret_cast<const WAVEFORMATEX*>(ptr);
+
+		if (fmtChunk->size < (sizeof(WAVEFORMATEX) + wfx->cbSize))
+		{
+			DEBUG_MESSAGE("File is not a RIFF (fmtChunk->size < (sizeof(WAVEFORMATEX) + wfx->cbSize))");
+		}
+		switch (wfx->wFormatTag)
+		{
+		case WAVE_FORMAT_WMAUDIO2:
+		case WAVE_FORMAT_WMAUDIO3:
+			isDPDS = TRUE;
+			break;
+		case WAVE_FORMAT_ADPCM:
+			if ((fmtChunk->size < (sizeof(WAVEFORMATEX) + 32)) || (wfx->cbSize < 32))
+			{
+				DEBUG_MESSAGE("File is not a RIFF (fmtChunk->size < (sizeof(WAVEFORMATEX) + 32)) || (wfx->cbSize < 32)");
+			}
+			break;
+
+		case WAVE_FORMAT_EXTENSIBLE:
+			if ((fmtChunk->size < sizeof(WAVEFORMATEXTENSIBLE)) ||
+				(wfx->cbSize < (sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))))
+			{
+				DEBUG_MESSAGE("File is not a RIFF (fmtChunk->size < sizeof(WAVEFORMATEXTENSIBLE)) || (wfx->cbSize < (sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)))");
+			}
+			else
+			{
+				static const GUID s_wfexBase =
+				{ 0x00000000, 0x0000, 0x0010, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+
+				const WAVEFORMATEXTENSIBLE* wfex = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(ptr);
+
+				if (memcmp(
+					reinterpret_cast<const BYTE*>(&wfex->SubFormat) +
+					sizeof(DWORD),
+					reinterpret_cast<const BYTE*>(&s_wfexBase) + sizeof(DWORD),
+					sizeof(GUID) - sizeof(DWORD)
+				))
+				{
+					DEBUG_MESSAGE("File is not a RIFF (SubFormat)");
+					return FALSE;
+				}
+
+				switch (wfex->SubFormat.Data1)
+				{
+				case WAVE_FORMAT_PCM:
+				case WAVE_FORMAT_IEEE_FLOAT:
+					break;
+				case WAVE_FORMAT_WMAUDIO2:
+				case WAVE_FORMAT_WMAUDIO3:
+					isDPDS = TRUE;
+					break;
+
+				default:
+					DEBUG_MESSAGE("File is not a RIFF (default)");
+				}
+			}
+			break;
+
+		default:
+			DEBUG_MESSAGE("File is not a RIFF (default)");
+		}
+	}
+	}
+
+	// find 'data' chunk
+	const RIFFChunk* dataChunk = FindSoundChunk(riffBody, riffBodySize, FOURCC_DATA_TAG);
+	if (!dataChunk || !dataChunk->size)
+	{
+		DEBUG_MESSAGE("No data chunk or chunk size");
+		return FALSE;
+	}
+
+	// reinterpretate 'data' header to pointer
+	ptr = reinterpret_cast<const uint8_t*>(dataChunk) + sizeof(RIFFChunk);
+	if (ptr + dataChunk->size > wavEnd)
+	{
+		DEBUG_MESSAGE("size > wavEnd");
+		return FALSE;
+	}
+
+	// save 'data' position for streaming, loop chunks can be before or after it
+	BYTE* lpWaveData = lpFile + (ptr - lpFile);
+	DWORD dwWaveDataSize = dataChunk->size;
+
+	UINT pLoopStart = 0;
+	UINT pLoopLength = 0;
+
+	const RIFFChunk* dlsChunk = FindSoundChunk(riffBody, riffBodySize, FOURCC_DLS_SAMPLE);
+	if (dlsChunk)
+	{
+		ptr = reinterpret_cast<const uint8_t*>(dlsChunk) + sizeof(RIFFChunk);
+		ASSERT(!(ptr + dlsChunk->size > wavEnd), "(ptr + dlsChunk->size > wavEnd)");
+
+		if (dlsChunk->size >= sizeof(RIFFDLSSample))
+		{
+			const RIFFDLSSample* dlsSample = reinterpret_cast<const RIFFDLSSample*>(ptr);
+
+			if (dlsChunk->size >= (dlsSample->size + dlsSample->loopCount * sizeof(DLSLoop)))
+			{
+				const DLSLoop* loops = reinterpret_cast<const DLSLoop*>(ptr + dlsSample->size);
+				for (UINT j = 0; j < dlsSample->loopCount; ++j)
+				{
+					if ((loops[j].loopType == DLSLoop::LOOP_TYPE_FORWARD || loops[j].loopType == DLSLoop::LOOP_TYPE_RELEASE))
+					{
+						// Return 'forward' loop
+						pLoopStart = loops[j].loopStart;
+						pLoopLength = loops[j].loopLength;
+					}
+				}
+			}
+		} 
+	}
+
+	// Locate 'smpl' (Sample Chunk)
+	const RIFFChunk* midiChunk = FindSoundChunk(riffBody, riffBodySize, FOURCC_MIDI_SAMPLE);
+	if (midiChunk)
+	{
+		ptr = reinterpret_cast<const uint8_t*>(midiChunk) + sizeof(RIFFChunk);
+		ASSERT(!(ptr + midiChunk->size > wavEnd), "(ptr + midiChunk->size > wavEnd)");
+
+		if (midiChunk->size >= sizeof(RIFFMIDISample))
+		{
+			auto midiSample = reinterpret_cast<const RIFFMIDISample*>(ptr);
+
+			if (midiChunk->size >= (sizeof(RIFFMIDISample) + midiSample->loopCount * sizeof(MIDILoop)))
+			{
+				const MIDILoop* loops = reinterpret_cast<const MIDILoop*>(ptr + sizeof(RIFFMIDISample));
+				for (UINT j = 0; j < midiSample->loopCount; ++j)
+				{
+					if (loops[j].type == MIDILoop::LOOP_TYPE_FORWARD)
+					{
+						// Return 'forward' loop
+						pLoopStart = loops[j].start;
+						pLoopLength = loops[j].end - loops[j].start + 1;
+					}
+				}
+			}
+		}
+	}
+
+	// reinterpretate WAVEFORMAT to WAVEFORMATEX
+	const WAVEFORMATEX* wfexA = reinterpret_cast<const WAVEFORMATEX*>(wf);
+
+	lpPCM->waveFormat.cbSize = 0;
+	lpPCM->waveFormat.nAvgBytesPerSec = wfexA->nAvgBytesPerSec;
+	lpPCM->waveFormat.nBlockAlign = wfexA->nBlockAlign;
+	lpPCM->waveFormat.nChannels = wfexA->nChannels;
+	lpPCM->waveFormat.nSamplesPerSec = wfexA->nSamplesPerSec;
+	lpPCM->waveFormat.wBitsPerSample = wfexA->wBitsPerSample;
+	lpPCM->waveFormat.wFormatTag = wfexA->wFormatTag;
+
+	// extensible format is kept only as WAVEFORMATEX, so take its real tag and speakers
+	lpPCM->dwChannelMask = 0;
+	if (wfexA->wFormatTag == WAVE_FORMAT_EXTENSIBLE && wfexA->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))
+	{
+		lpPCM->waveFormat.wFormatTag = (WORD)reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(wfexA)->SubFormat.Data1;
+		lpPCM->dwChannelMask = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(wfexA)->dwChannelMask;
+	}
+	lpPCM->pLoopLength = pLoopLength;
+	lpPCM->pLoopStart = pLoopStart;
+	lpPCM->lpData = lpWaveData;
+	lpPCM->dwDataSize = dwWaveDataSize;
+
+	return TRUE;
+}
+
+/*************************************************
+* ReadSampleValue():
+* One sample of PCM data to float
+*************************************************/
+static FLOAT
+ReadSampleValue(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ const BYTE* lpSample
+)
+{
+	if (lpFormat->wFormatTag == WAVE_FORMAT_IEEE_FLOAT) { return *(const FLOAT*)lpSample; }
+
+	switch (lpFormat->wBitsPerSample)
+	{
+	case 8:		return (lpSample[0] - 128) / 128.0f;
+	case 16:	return *(const SHORT*)lpSample / 32768.0f;
+	case 24:	return (INT)((UINT)lpSample[0] << 8 | (UINT)lpSample[1] << 16 | (UINT)lpSample[2] << 24) / 2147483648.0f;
+	case 32:	return (FLOAT)(*(const INT*)lpSample / 2147483648.0);
+	default:	return 0.0f;
+	}
+}
+
+/*************************************************
+* WriteSampleValue():
+* Float to one sample of PCM data with clipping
+*************************************************/
+static VOID
+WriteSampleValue(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_Out_ BYTE* lpSample,
+	_In_ FLOAT fValue
+)
+{
+	if (lpFormat->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+	{
+		*(FLOAT*)lpSample = fValue;
+		return;
+	}
+
+	double dValue = max(min((double)fValue, 1.0), -1.0);
+	switch (lpFormat->wBitsPerSample)
+	{
+	case 8:
+		lpSample[0] = (BYTE)min(dValue * 128.0 + 128.5, 255.0);
+		break;
+	case 16:
+		*(SHORT*)lpSample = (SHORT)min(dValue * 32768.0, 32767.0);
+		break;
+	case 24:
+	{
+		INT iValue = (INT)min(dValue * 8388608.0, 8388607.0);
+		lpSample[0] = (BYTE)iValue;
+		lpSample[1] = (BYTE)(iValue >> 8);
+		lpSample[2] = (BYTE)(iValue >> 16);
+	}
+	break;
+	case 32:
+		*(INT*)lpSample = (INT)min(dValue * 2147483648.0, 2147483647.0);
+		break;
+	default:
+		break;
+	}
+}
+
+/*************************************************
+* PcmSource():
+* Constructor
+*************************************************/
+Player::PcmSource::PcmSource() : dwReadOffset(0), dwLoopsLeft(0), dwLoopStart(0), dwLoopEnd(0), dwCrossfadeBytes(0)
+{
+	memset(&dPCM, 0, sizeof(PCM_DATA));
+}
+
+/*************************************************
+* SetData():
+* Set new PCM data and rewind source
+*************************************************/
+VOID
+Player::PcmSource::SetData(
+	_In_ const PCM_DATA& dNewPCM
+)
+{
+	dPCM = dNewPCM;
+	dwReadOffset = 0;
+
+	// loop region from file is played one more time
+	SetLoop(dPCM.pLoopLength ? 1 : 0, 0);
+}
+
+/*************************************************
+* SetLoop():
+* Set count of loop repeats (LOOP_INFINITE for
+* endless loop) and crossfade at loop seam.
+* File without loop region is looped whole
+*************************************************/
+VOID
+Player::PcmSource::SetLoop(
+	_In_ DWORD dwLoopCount,
+	_In_ DWORD dwCrossfadeFrames
+)
+{
+	DWORD dwBlockAlign = dPCM.waveFormat.nBlockAlign;
+	dwLoopsLeft = 0;
+	dwLoopStart = 0;
+	dwLoopEnd = 0;
+	dwCrossfadeBytes = 0;
+
+	if (!dwBlockAlign || !dPCM.lpData)
+	{
+		return;
+	}
+
+	DWORD dwEndOffset = dPCM.dwDataSize - (dPCM.dwDataSize % dwBlockAlign);
+	UINT64 uLoopStart = (UINT64)dPCM.pLoopStart * dwBlockAlign;
+	UINT64 uLoopEnd = uLoopStart + (UINT64)dPCM.pLoopLength * dwBlockAlign;
+	if (!dPCM.pLoopLength)
+	{
+		uLoopStart = 0;
+		uLoopEnd = dwEndOffset;
+	}
+
+	// broken loop region can't be played
+	if (uLoopEnd > dwEndOffset || uLoopEnd <= uLoopStart)
+	{
+		return;
+	}
+
+	dwLoopsLeft = dwLoopCount;
+	dwLoopStart = (DWORD)uLoopStart;
+	dwLoopEnd = (DWORD)uLoopEnd;
+
+	// compressed data can't be mixed
+	BOOL isMixable = dPCM.waveFormat.wFormatTag == WAVE_FORMAT_PCM ||
+		(dPCM.waveFormat.wFormatTag == WAVE_FORMAT_IEEE_FLOAT && dPCM.waveFormat.wBitsPerSample == 32);
+	if (!isMixable)
+	{
+		return;
+	}
+
+	// crossfade takes data before loop start, so it can't be longer
+	DWORD dwCrossfade = min(min(dwCrossfadeFrames, dwLoopStart / dwBlockAlign), (dwLoopEnd - dwLoopStart) / dwBlockAlign);
+	dwCrossfadeBytes = dwCrossfade * dwBlockAlign;
+}
+
+/*************************************************
+* CrossfadeSeam():
+* Mix end of loop region with data before loop
+* start, so jump to loop start is continuous.
+* Equal-power curve, ambience is not correlated
+*************************************************/
+VOID
+Player::PcmSource::CrossfadeSeam(
+	_Inout_updates_bytes_(dwBytes) BYTE* lpDest,
+	_In_ DWORD dwOffset,
+	_In_ DWORD dwBytes
+)
+{
+	DWORD dwFadeStart = dwLoopEnd - dwCrossfadeBytes;
+	if (dwOffset + dwBytes <= dwFadeStart)
+	{
+		return;
+	}
+
+	DWORD dwBlockAlign = dPCM.waveFormat.nBlockAlign;
+	DWORD dwSampleBytes = dPCM.waveFormat.wBitsPerSample / 8;
+	DWORD dwLoopBytes = dwLoopEnd - dwLoopStart;
+	DWORD dwSkip = dwOffset < dwFadeStart ? dwFadeStart - dwOffset : 0;
+
+	for (DWORD dwByte = dwSkip; dwByte < dwBytes; dwByte += dwBlockAlign)
+	{
+		FLOAT fFadeIn = (FLOAT)(dwOffset + dwByte - dwFadeStart) / dwCrossfadeBytes;
+		FLOAT fGainIn = sqrtf(fFadeIn);
+		FLOAT fGainOut = sqrtf(1.0f - fFadeIn);
+		const BYTE* lpBefore = dPCM.lpData + dwOffset + dwByte - dwLoopBytes;
+
+		for (DWORD i = 0; i < dwBlockAlign; i += dwSampleBytes)
+		{
+			FLOAT fValue = ReadSampleValue(&dPCM.waveFormat, lpDest + dwByte + i) * fGainOut +
+				ReadSampleValue(&dPCM.waveFormat, lpBefore + i) * fGainIn;
+			WriteSampleValue(&dPCM.waveFormat, lpDest + dwByte + i, fValue);
+		}
+	}
+}
+
+/*************************************************
+* ReadFrames():
+* Copy next frames of PCM data to sink. Loop
+* wraps read cursor, data is never duplicated
+*************************************************/
+DWORD
+Player::PcmSource::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	DWORD dwBlockAlign = dPCM.waveFormat.nBlockAlign;
+	DWORD dwWritten = 0;
+
+	if (!dwBlockAlign || !dPCM.lpData)
+	{
+		return 0;
+	}
+
+	while (dwWritten < dwFrames)
+	{
+		DWORD dwEndOffset = dPCM.dwDataSize - (dPCM.dwDataSize % dwBlockAlign);
+		BOOL isLooping = dwLoopsLeft && dwLoopEnd;
+
+		// wrap cursor at the end of loop region
+		if (isLooping)
+		{
+			if (dwReadOffset >= dwLoopEnd)
+			{
+				dwReadOffset = dwLoopStart;
+				if (dwLoopsLeft != LOOP_INFINITE) { dwLoopsLeft--; }
+				continue;
+			}
+			dwEndOffset = dwLoopEnd;
+		}
+
+		if (dwReadOffset >= dwEndOffset)
+		{
+			break;
+		}
+
+		DWORD dwCopy = min((dwEndOffset - dwReadOffset) / dwBlockAlign, dwFrames - dwWritten);
+		BYTE* lpCopyDest = lpDest + dwWritten * dwBlockAlign;
+		memcpy(lpCopyDest, dPCM.lpData + dwReadOffset, dwCopy * dwBlockAlign);
+
+		// last pass goes on after loop end, it has no seam
+		if (isLooping && dwCrossfadeBytes)
+		{
+			CrossfadeSeam(lpCopyDest, dwReadOffset, dwCopy * dwBlockAlign);
+		}
+
+		dwReadOffset += dwCopy * dwBlockAlign;
+		dwWritten += dwCopy;
+	}
+
+	return dwWritten;
+}
+
+/*************************************************
+* SeekFrame():
+* Move read cursor to sample frame
+*************************************************/
+BOOL
+Player::PcmSource::SeekFrame(
+	_In_ UINT64 uFrame
+)
+{
+	DWORD dwBlockAlign = dPCM.waveFormat.nBlockAlign;
+	if (!dwBlockAlign || uFrame * dwBlockAlign > dPCM.dwDataSize)
+	{
+		return FALSE;
+	}
+
+	dwReadOffset = (DWORD)(uFrame * dwBlockAlign);
+	return TRUE;
+}
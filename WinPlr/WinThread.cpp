@@ -32,8 +32,8 @@ Player::ThreadSystem::ThSetNewThreadName(
 	// try to use SetThreadDescription function
 	if (lpSetThreadDescription)
 	{
-		// set thread name by Windows 10 function
-		R_ASSERT2(lpSetThreadDescription(GetCurrentThread(), GetUnicodeStringFromAnsi(lpName)), "Can't set thread name");
+		// set thread name by Windows 10 function, it's called by audio threads too
+		R_ASSERT3(lpSetThreadDescription(GetCurrentThread(), GetUnicodeStringFromAnsi(lpName)), "Can't set thread name");
 	}
 	else
 	{
@@ -0,0 +1,743 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio voice mixer
+**********************************************************
+* WinVoice.cpp
+* Pool of voices mixed to one float bus
+*********************************************************/
+#include "WinEngine.h"
+#include <math.h>
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/*************************************************
+* AccumulateVoiceScalar():
+* Bus channel c gets voice channel c, or the
+* only channel of mono voice, with gain
+* lpGains[c] + lpSteps[c] * n at frame n
+*************************************************/
+static VOID
+AccumulateVoiceScalar(
+	_Inout_updates_(dwFrames * dwBusChannels) FLOAT* lpBus,
+	_In_ const FLOAT* lpVoice,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwBusChannels,
+	_In_ DWORD dwVoiceChannels,
+	_In_reads_(dwBusChannels) const FLOAT* lpGains,
+	_In_reads_(dwBusChannels) const FLOAT* lpSteps
+)
+{
+	for (DWORD i = 0; i < dwFrames; i++)
+	{
+		for (DWORD c = 0; c < dwBusChannels; c++)
+		{
+			FLOAT fSample = dwVoiceChannels == 1 ? lpVoice[i] : lpVoice[i * dwVoiceChannels + c];
+			lpBus[i * dwBusChannels + c] += fSample * (lpGains[c] + lpSteps[c] * (FLOAT)i);
+		}
+	}
+}
+
+/*************************************************
+* SoftClipScalar():
+* Samples above knee go to 1.0 by x/(1+x)
+* curve, slope is 1 at knee so there is no edge
+*************************************************/
+static VOID
+SoftClipScalar(
+	_Inout_updates_(dwSamples) FLOAT* lpSamples,
+	_In_ DWORD dwSamples
+)
+{
+	const FLOAT fInvRange = 1.0f / (1.0f - VOICE_SOFT_CLIP_KNEE);
+	for (DWORD i = 0; i < dwSamples; i++)
+	{
+		FLOAT fAbs = fabsf(lpSamples[i]);
+		if (fAbs <= VOICE_SOFT_CLIP_KNEE) { continue; }
+
+		FLOAT fOver = fAbs - VOICE_SOFT_CLIP_KNEE;
+		lpSamples[i] = copysignf(VOICE_SOFT_CLIP_KNEE + fOver / (1.0f + fOver * fInvRange), lpSamples[i]);
+	}
+}
+
+#ifdef CONVERT_X86
+/*************************************************
+* GetLanePeriod():
+* Vectors after which channel pattern of lanes
+* repeats, it is lcm(channels, lanes) / lanes
+*************************************************/
+static DWORD
+GetLanePeriod(
+	_In_ DWORD dwChannels,
+	_In_ DWORD dwLanes
+)
+{
+	DWORD dwSamples = dwChannels;
+	while (dwSamples % dwLanes) { dwSamples += dwChannels; }
+	return dwSamples / dwLanes;
+}
+
+/*************************************************
+* AccumulateVoiceSse():
+* Mono voice to stereo bus duplicates samples
+* to lane pairs, voice with bus channels uses
+* lane pattern of gains. Other layouts are
+* scalar
+*************************************************/
+static VOID
+AccumulateVoiceSse(
+	_Inout_updates_(dwFrames * dwBusChannels) FLOAT* lpBus,
+	_In_ const FLOAT* lpVoice,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwBusChannels,
+	_In_ DWORD dwVoiceChannels,
+	_In_reads_(dwBusChannels) const FLOAT* lpGains,
+	_In_reads_(dwBusChannels) const FLOAT* lpSteps
+)
+{
+	DWORD dwDone = 0;
+	if (dwVoiceChannels == 1 && dwBusChannels == 2)
+	{
+		__m128 gains = _mm_setr_ps(lpGains[0], lpGains[1], lpGains[0], lpGains[1]);
+		__m128 steps = _mm_setr_ps(lpSteps[0], lpSteps[1], lpSteps[0], lpSteps[1]);
+		__m128 lowOffsets = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+		__m128 highOffsets = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f);
+		for (; dwDone + 4 <= dwFrames; dwDone += 4)
+		{
+			__m128 frameBase = _mm_set1_ps((FLOAT)dwDone);
+			__m128 samples = _mm_loadu_ps(lpVoice + dwDone);
+			__m128 lowGains = _mm_add_ps(gains, _mm_mul_ps(steps, _mm_add_ps(frameBase, lowOffsets)));
+			__m128 highGains = _mm_add_ps(gains, _mm_mul_ps(steps, _mm_add_ps(frameBase, highOffsets)));
+
+			FLOAT* lpOut = lpBus + dwDone * 2;
+			_mm_storeu_ps(lpOut, _mm_add_ps(_mm_loadu_ps(lpOut), _mm_mul_ps(_mm_unpacklo_ps(samples, samples), lowGains)));
+			_mm_storeu_ps(lpOut + 4, _mm_add_ps(_mm_loadu_ps(lpOut + 4), _mm_mul_ps(_mm_unpackhi_ps(samples, samples), highGains)));
+		}
+	}
+	else if (dwVoiceChannels == dwBusChannels && dwBusChannels <= MIX_MAX_CHANNELS)
+	{
+		// gain, step and frame of every lane inside period
+		DWORD dwVectors = GetLanePeriod(dwBusChannels, 4);
+		DWORD dwPeriodFrames = dwVectors * 4 / dwBusChannels;
+		__m128 laneGains[MIX_MAX_CHANNELS];
+		__m128 laneSteps[MIX_MAX_CHANNELS];
+		__m128 frameOffsets[MIX_MAX_CHANNELS];
+		for (DWORD v = 0; v < dwVectors; v++)
+		{
+			DWORD s = v * 4;
+			laneGains[v] = _mm_setr_ps(lpGains[s % dwBusChannels], lpGains[(s + 1) % dwBusChannels],
+				lpGains[(s + 2) % dwBusChannels], lpGains[(s + 3) % dwBusChannels]);
+			laneSteps[v] = _mm_setr_ps(lpSteps[s % dwBusChannels], lpSteps[(s + 1) % dwBusChannels],
+				lpSteps[(s + 2) % dwBusChannels], lpSteps[(s + 3) % dwBusChannels]);
+			frameOffsets[v] = _mm_setr_ps((FLOAT)(s / dwBusChannels), (FLOAT)((s + 1) / dwBusChannels),
+				(FLOAT)((s + 2) / dwBusChannels), (FLOAT)((s + 3) / dwBusChannels));
+		}
+
+		for (; dwDone + dwPeriodFrames <= dwFrames; dwDone += dwPeriodFrames)
+		{
+			__m128 frameBase = _mm_set1_ps((FLOAT)dwDone);
+			FLOAT* lpOut = lpBus + dwDone * dwBusChannels;
+			const FLOAT* lpIn = lpVoice + dwDone * dwBusChannels;
+			for (DWORD v = 0; v < dwVectors; v++, lpOut += 4, lpIn += 4)
+			{
+				__m128 gain = _mm_add_ps(laneGains[v], _mm_mul_ps(laneSteps[v], _mm_add_ps(frameBase, frameOffsets[v])));
+				_mm_storeu_ps(lpOut, _mm_add_ps(_mm_loadu_ps(lpOut), _mm_mul_ps(_mm_loadu_ps(lpIn), gain)));
+			}
+		}
+	}
+
+	// tail starts with gains of its first frame
+	FLOAT tailGains[MIX_MAX_CHANNELS];
+	for (DWORD c = 0; c < dwBusChannels && c < MIX_MAX_CHANNELS; c++) { tailGains[c] = lpGains[c] + lpSteps[c] * (FLOAT)dwDone; }
+	AccumulateVoiceScalar(lpBus + dwDone * dwBusChannels, lpVoice + dwDone * dwVoiceChannels, dwFrames - dwDone,
+		dwBusChannels, dwVoiceChannels, dwDone ? tailGains : lpGains, lpSteps);
+}
+
+CONVERT_TARGET_AVX2
+static VOID
+AccumulateVoiceAvx2(
+	_Inout_updates_(dwFrames * dwBusChannels) FLOAT* lpBus,
+	_In_ const FLOAT* lpVoice,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwBusChannels,
+	_In_ DWORD dwVoiceChannels,
+	_In_reads_(dwBusChannels) const FLOAT* lpGains,
+	_In_reads_(dwBusChannels) const FLOAT* lpSteps
+)
+{
+	DWORD dwDone = 0;
+	if (dwVoiceChannels == 1 && dwBusChannels == 2)
+	{
+		__m256 gains = _mm256_setr_ps(lpGains[0], lpGains[1], lpGains[0], lpGains[1], lpGains[0], lpGains[1], lpGains[0], lpGains[1]);
+		__m256 steps = _mm256_setr_ps(lpSteps[0], lpSteps[1], lpSteps[0], lpSteps[1], lpSteps[0], lpSteps[1], lpSteps[0], lpSteps[1]);
+		__m256 lowOffsets = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+		__m256 highOffsets = _mm256_setr_ps(4.0f, 4.0f, 5.0f, 5.0f, 6.0f, 6.0f, 7.0f, 7.0f);
+		__m256i lowPairs = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+		__m256i highPairs = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+		for (; dwDone + 8 <= dwFrames; dwDone += 8)
+		{
+			__m256 frameBase = _mm256_set1_ps((FLOAT)dwDone);
+			__m256 samples = _mm256_loadu_ps(lpVoice + dwDone);
+			__m256 lowGains = _mm256_add_ps(gains, _mm256_mul_ps(steps, _mm256_add_ps(frameBase, lowOffsets)));
+			__m256 highGains = _mm256_add_ps(gains, _mm256_mul_ps(steps, _mm256_add_ps(frameBase, highOffsets)));
+
+			FLOAT* lpOut = lpBus + dwDone * 2;
+			_mm256_storeu_ps(lpOut, _mm256_add_ps(_mm256_loadu_ps(lpOut),
+				_mm256_mul_ps(_mm256_permutevar8x32_ps(samples, lowPairs), lowGains)));
+			_mm256_storeu_ps(lpOut + 8, _mm256_add_ps(_mm256_loadu_ps(lpOut + 8),
+				_mm256_mul_ps(_mm256_permutevar8x32_ps(samples, highPairs), highGains)));
+		}
+	}
+	else if (dwVoiceChannels == dwBusChannels && dwBusChannels <= MIX_MAX_CHANNELS)
+	{
+		DWORD dwVectors = GetLanePeriod(dwBusChannels, 8);
+		DWORD dwPeriodFrames = dwVectors * 8 / dwBusChannels;
+		__m256 laneGains[MIX_MAX_CHANNELS];
+		__m256 laneSteps[MIX_MAX_CHANNELS];
+		__m256 frameOffsets[MIX_MAX_CHANNELS];
+		for (DWORD v = 0; v < dwVectors; v++)
+		{
+			FLOAT gainLanes[8];
+			FLOAT stepLanes[8];
+			FLOAT frameLanes[8];
+			for (DWORD k = 0; k < 8; k++)
+			{
+				DWORD s = v * 8 + k;
+				gainLanes[k] = lpGains[s % dwBusChannels];
+				stepLanes[k] = lpSteps[s % dwBusChannels];
+				frameLanes[k] = (FLOAT)(s / dwBusChannels);
+			}
+			laneGains[v] = _mm256_loadu_ps(gainLanes);
+			laneSteps[v] = _mm256_loadu_ps(stepLanes);
+			frameOffsets[v] = _mm256_loadu_ps(frameLanes);
+		}
+
+		for (; dwDone + dwPeriodFrames <= dwFrames; dwDone += dwPeriodFrames)
+		{
+			__m256 frameBase = _mm256_set1_ps((FLOAT)dwDone);
+			FLOAT* lpOut = lpBus + dwDone * dwBusChannels;
+			const FLOAT* lpIn = lpVoice + dwDone * dwBusChannels;
+			for (DWORD v = 0; v < dwVectors; v++, lpOut += 8, lpIn += 8)
+			{
+				__m256 gain = _mm256_add_ps(laneGains[v], _mm256_mul_ps(laneSteps[v], _mm256_add_ps(frameBase, frameOffsets[v])));
+				_mm256_storeu_ps(lpOut, _mm256_add_ps(_mm256_loadu_ps(lpOut), _mm256_mul_ps(_mm256_loadu_ps(lpIn), gain)));
+			}
+		}
+	}
+
+	// upper halves are cleared, so SSE code of libm after kernel has no transition stall
+	_mm256_zeroupper();
+	FLOAT tailGains[MIX_MAX_CHANNELS];
+	for (DWORD c = 0; c < dwBusChannels && c < MIX_MAX_CHANNELS; c++) { tailGains[c] = lpGains[c] + lpSteps[c] * (FLOAT)dwDone; }
+	AccumulateVoiceScalar(lpBus + dwDone * dwBusChannels, lpVoice + dwDone * dwVoiceChannels, dwFrames - dwDone,
+		dwBusChannels, dwVoiceChannels, dwDone ? tailGains : lpGains, lpSteps);
+}
+
+/*************************************************
+* SoftClipSse():
+* Branchless form of scalar curve:
+* min(|x|, knee) + over / (1 + over / range)
+*************************************************/
+static VOID
+SoftClipSse(
+	_Inout_updates_(dwSamples) FLOAT* lpSamples,
+	_In_ DWORD dwSamples
+)
+{
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 knee = _mm_set1_ps(VOICE_SOFT_CLIP_KNEE);
+	__m128 invRange = _mm_set1_ps(1.0f / (1.0f - VOICE_SOFT_CLIP_KNEE));
+	__m128 one = _mm_set1_ps(1.0f);
+	DWORD i = 0;
+	for (; i + 4 <= dwSamples; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(lpSamples + i);
+		__m128 absX = _mm_andnot_ps(signMask, x);
+		__m128 over = _mm_max_ps(_mm_sub_ps(absX, knee), _mm_setzero_ps());
+		__m128 y = _mm_add_ps(_mm_min_ps(absX, knee), _mm_div_ps(over, _mm_add_ps(one, _mm_mul_ps(over, invRange))));
+		_mm_storeu_ps(lpSamples + i, _mm_or_ps(y, _mm_and_ps(signMask, x)));
+	}
+	SoftClipScalar(lpSamples + i, dwSamples - i);
+}
+
+CONVERT_TARGET_AVX2
+static VOID
+SoftClipAvx2(
+	_Inout_updates_(dwSamples) FLOAT* lpSamples,
+	_In_ DWORD dwSamples
+)
+{
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	__m256 knee = _mm256_set1_ps(VOICE_SOFT_CLIP_KNEE);
+	__m256 invRange = _mm256_set1_ps(1.0f / (1.0f - VOICE_SOFT_CLIP_KNEE));
+	__m256 one = _mm256_set1_ps(1.0f);
+	DWORD i = 0;
+	for (; i + 8 <= dwSamples; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(lpSamples + i);
+		__m256 absX = _mm256_andnot_ps(signMask, x);
+		__m256 over = _mm256_max_ps(_mm256_sub_ps(absX, knee), _mm256_setzero_ps());
+		__m256 y = _mm256_add_ps(_mm256_min_ps(absX, knee), _mm256_div_ps(over, _mm256_add_ps(one, _mm256_mul_ps(over, invRange))));
+		_mm256_storeu_ps(lpSamples + i, _mm256_or_ps(y, _mm256_and_ps(signMask, x)));
+	}
+	_mm256_zeroupper();
+	SoftClipScalar(lpSamples + i, dwSamples - i);
+}
+#endif
+
+/*************************************************
+* GetAccumulateVoiceKernel():
+* Voice accumulate kernel for selected ISA
+*************************************************/
+ACCUMULATE_VOICE
+GetAccumulateVoiceKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return AccumulateVoiceAvx2;
+	case CONVERT_ISA_SSE2:	return AccumulateVoiceSse;
+	default:				break;
+	}
+#endif
+	return AccumulateVoiceScalar;
+}
+
+SOFT_CLIP
+GetSoftClipKernel()
+{
+#ifdef CONVERT_X86
+	switch (GetConvertIsa())
+	{
+	case CONVERT_ISA_AVX2:	return SoftClipAvx2;
+	case CONVERT_ISA_SSE2:	return SoftClipSse;
+	default:				break;
+	}
+#endif
+	return SoftClipScalar;
+}
+
+/*************************************************
+* VoiceMixer():
+* Constructor
+*************************************************/
+Player::VoiceMixer::VoiceMixer() :
+	dwChannels(0),
+	bEndWhenIdle(FALSE),
+	lpAccumulate(NULL),
+	lpSoftClip(NULL),
+	dwActiveVoices(0)
+{
+	for (DWORD i = 0; i < VOICE_POOL_SIZE; i++)
+	{
+		voicePool[i].lpStream = NULL;
+		voicePool[i].lpData = NULL;
+		voicePool[i].dwFrames = 0;
+		voicePool[i].dwPosition = 0;
+		voicePool[i].dwChannels = 0;
+		voicePool[i].isLooping = FALSE;
+		voicePool[i].fGain = 0.0f;
+		voicePool[i].fPan = 0.0f;
+		voicePool[i].bStopRequested = FALSE;
+		voicePool[i].dwState = VOICE_FREE;
+	}
+}
+
+/*************************************************
+* SetFormat():
+* Float format of bus. Call it only when no
+* voice plays and no sink is pulling frames.
+* Mixer with bNewEndWhenIdle ends stream when
+* last voice is over, other one plays silence
+*************************************************/
+BOOL
+Player::VoiceMixer::SetFormat(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ BOOL bNewEndWhenIdle
+)
+{
+	dwChannels = 0;
+	if (GetSampleFormat(lpFormat) != SAMPLE_FORMAT_F32 || !lpFormat->nChannels || lpFormat->nChannels > MIX_MAX_CHANNELS) { return FALSE; }
+
+	dwChannels = lpFormat->nChannels;
+	bEndWhenIdle = bNewEndWhenIdle;
+	lpAccumulate = GetAccumulateVoiceKernel();
+	lpSoftClip = GetSoftClipKernel();
+	return TRUE;
+}
+
+/*************************************************
+* StartVoice():
+* Take free voice of pool. Voice is set before
+* it is marked ready, render thread starts it
+* on next block
+*************************************************/
+DWORD
+Player::VoiceMixer::StartVoice(
+	_In_opt_ AudioSource* lpStream,
+	_In_opt_ const FLOAT* lpData,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwVoiceChannels,
+	_In_ BOOL isLooping,
+	_In_ FLOAT fGain,
+	_In_ FLOAT fPan
+)
+{
+	if (!dwChannels || (dwVoiceChannels != 1 && dwVoiceChannels != dwChannels)) { return VOICE_POOL_SIZE; }
+
+	for (DWORD i = 0; i < VOICE_POOL_SIZE; i++)
+	{
+		VOICE* lpVoice = &voicePool[i];
+		if (lpVoice->dwState.load(std::memory_order_acquire) != VOICE_FREE) { continue; }
+
+		lpVoice->lpStream = lpStream;
+		lpVoice->lpData = lpData;
+		lpVoice->dwFrames = dwFrames;
+		lpVoice->dwPosition = 0;
+		lpVoice->dwChannels = dwVoiceChannels;
+		lpVoice->isLooping = isLooping;
+		lpVoice->fGain.store(max(fGain, 0.0f), std::memory_order_relaxed);
+		lpVoice->fPan.store(min(max(fPan, -1.0f), 1.0f), std::memory_order_relaxed);
+		lpVoice->bStopRequested.store(FALSE, std::memory_order_relaxed);
+
+		dwActiveVoices.fetch_add(1, std::memory_order_relaxed);
+		lpVoice->dwState.store(VOICE_READY, std::memory_order_release);
+		return i;
+	}
+	return VOICE_POOL_SIZE;
+}
+
+/*************************************************
+* PlayMemory():
+* Voice of frames resident in memory, they
+* must live till voice is over
+*************************************************/
+DWORD
+Player::VoiceMixer::PlayMemory(
+	_In_reads_(dwFrames * dwChannels) const FLOAT* lpData,
+	_In_ DWORD dwFrames,
+	_In_ DWORD dwVoiceChannels,
+	_In_ BOOL isLooping,
+	_In_ FLOAT fGain,
+	_In_ FLOAT fPan
+)
+{
+	if (!lpData || !dwFrames) { return VOICE_POOL_SIZE; }
+	return StartVoice(NULL, lpData, dwFrames, dwVoiceChannels, isLooping, fGain, fPan);
+}
+
+/*************************************************
+* PlayStream():
+* Voice of float upstream at bus rate. It is
+* pulled on render thread, so it must not block
+*************************************************/
+DWORD
+Player::VoiceMixer::PlayStream(
+	_In_ AudioSource* lpStream,
+	_In_ DWORD dwVoiceChannels,
+	_In_ FLOAT fGain,
+	_In_ FLOAT fPan
+)
+{
+	if (!lpStream) { return VOICE_POOL_SIZE; }
+	return StartVoice(lpStream, NULL, 0, dwVoiceChannels, FALSE, fGain, fPan);
+}
+
+VOID
+Player::VoiceMixer::SetVoiceGain(
+	_In_ DWORD dwVoice,
+	_In_ FLOAT fGain
+)
+{
+	if (dwVoice < VOICE_POOL_SIZE) { voicePool[dwVoice].fGain.store(max(fGain, 0.0f), std::memory_order_relaxed); }
+}
+
+VOID
+Player::VoiceMixer::SetVoicePan(
+	_In_ DWORD dwVoice,
+	_In_ FLOAT fPan
+)
+{
+	if (dwVoice < VOICE_POOL_SIZE) { voicePool[dwVoice].fPan.store(min(max(fPan, -1.0f), 1.0f), std::memory_order_relaxed); }
+}
+
+/*************************************************
+* StopVoice():
+* Voice fades out over one block, then its
+* place in pool is free
+*************************************************/
+VOID
+Player::VoiceMixer::StopVoice(
+	_In_ DWORD dwVoice
+)
+{
+	if (dwVoice < VOICE_POOL_SIZE) { voicePool[dwVoice].bStopRequested.store(TRUE, std::memory_order_relaxed); }
+}
+
+BOOL
+Player::VoiceMixer::IsVoicePlaying(
+	_In_ DWORD dwVoice
+)
+{
+	return dwVoice < VOICE_POOL_SIZE && voicePool[dwVoice].dwState.load(std::memory_order_acquire) != VOICE_FREE;
+}
+
+DWORD Player::VoiceMixer::GetActiveVoices() { return dwActiveVoices.load(std::memory_order_relaxed); }
+
+/*************************************************
+* GetTargetGains():
+* Bus channel gains of voice. Mono voice is
+* panned to front pair by constant power law,
+* other voices are balanced between the pair
+*************************************************/
+VOID
+Player::VoiceMixer::GetTargetGains(
+	_In_ VOICE* lpVoice,
+	_Out_writes_(MIX_MAX_CHANNELS) FLOAT* lpGains
+)
+{
+	static const FLOAT fQuarterPi = 0.78539816339f;
+	FLOAT fGain = lpVoice->bStopRequested.load(std::memory_order_relaxed) ? 0.0f : lpVoice->fGain.load(std::memory_order_relaxed);
+	FLOAT fPan = lpVoice->fPan.load(std::memory_order_relaxed);
+
+	for (DWORD c = 0; c < MIX_MAX_CHANNELS; c++) { lpGains[c] = c < dwChannels ? fGain : 0.0f; }
+	if (dwChannels < 2) { return; }
+
+	if (lpVoice->dwChannels == 1)
+	{
+		for (DWORD c = 2; c < dwChannels; c++) { lpGains[c] = 0.0f; }
+		lpGains[0] = fGain * cosf((fPan + 1.0f) * fQuarterPi);
+		lpGains[1] = fGain * sinf((fPan + 1.0f) * fQuarterPi);
+	}
+	else
+	{
+		lpGains[0] *= min(1.0f, 1.0f - fPan);
+		lpGains[1] *= min(1.0f, 1.0f + fPan);
+	}
+}
+
+/*************************************************
+* FetchFrames():
+* Next frames of voice. Memory voice gives
+* pointer to its data, stream is read to
+* scratch. Returns 0 at end of voice
+*************************************************/
+DWORD
+Player::VoiceMixer::FetchFrames(
+	_In_ VOICE* lpVoice,
+	_In_ DWORD dwFrames,
+	_Out_ const FLOAT** lpFrames
+)
+{
+	if (lpVoice->lpStream)
+	{
+		*lpFrames = scratch;
+		return lpVoice->lpStream->ReadFrames((BYTE*)scratch, min(dwFrames, (DWORD)VOICE_BLOCK_FRAMES));
+	}
+
+	if (lpVoice->dwPosition >= lpVoice->dwFrames && lpVoice->isLooping) { lpVoice->dwPosition = 0; }
+
+	DWORD dwCount = min(dwFrames, lpVoice->dwFrames - lpVoice->dwPosition);
+	*lpFrames = lpVoice->lpData + (size_t)lpVoice->dwPosition * lpVoice->dwChannels;
+	lpVoice->dwPosition += dwCount;
+	return dwCount;
+}
+
+/*************************************************
+* MixVoice():
+* Accumulate block of voice with gains ramped
+* from last block. Voice is freed when it is
+* over or its stop ramp is done. Returns
+* frames of voice in block
+*************************************************/
+DWORD
+Player::VoiceMixer::MixVoice(
+	_In_ VOICE* lpVoice,
+	_Inout_updates_(dwFrames * dwChannels) FLOAT* lpBus,
+	_In_ DWORD dwFrames
+)
+{
+	FLOAT targetGains[MIX_MAX_CHANNELS];
+	FLOAT gains[MIX_MAX_CHANNELS];
+	FLOAT steps[MIX_MAX_CHANNELS];
+	GetTargetGains(lpVoice, targetGains);
+	for (DWORD c = 0; c < dwChannels; c++) { steps[c] = (targetGains[c] - lpVoice->fCurrent[c]) / (FLOAT)dwFrames; }
+
+	DWORD dwDone = 0;
+	BOOL isOver = FALSE;
+	while (dwDone < dwFrames)
+	{
+		const FLOAT* lpFrames = NULL;
+		DWORD dwCount = FetchFrames(lpVoice, dwFrames - dwDone, &lpFrames);
+		if (!dwCount)
+		{
+			isOver = TRUE;
+			break;
+		}
+
+		for (DWORD c = 0; c < dwChannels; c++) { gains[c] = lpVoice->fCurrent[c] + steps[c] * (FLOAT)dwDone; }
+		lpAccumulate(lpBus + (size_t)dwDone * dwChannels, lpFrames, dwCount, dwChannels, lpVoice->dwChannels, gains, steps);
+		dwDone += dwCount;
+	}
+
+	memcpy(lpVoice->fCurrent, targetGains, sizeof(targetGains));
+	if (isOver || lpVoice->bStopRequested.load(std::memory_order_relaxed))
+	{
+		dwActiveVoices.fetch_sub(1, std::memory_order_relaxed);
+		lpVoice->dwState.store(VOICE_FREE, std::memory_order_release);
+	}
+	return dwDone;
+}
+
+/*************************************************
+* ReadFrames():
+* Sum of all voices by blocks, bus is soft
+* clipped after every block. Mixer which ends
+* when idle stops after last frame of voices
+*************************************************/
+DWORD
+Player::VoiceMixer::ReadFrames(
+	_Out_writes_bytes_(dwFrames * nBlockAlign) BYTE* lpDest,
+	_In_ DWORD dwFrames
+)
+{
+	if (!dwChannels) { return 0; }
+
+	FLOAT* lpOutput = (FLOAT*)lpDest;
+	DWORD dwWritten = 0;
+	while (dwWritten < dwFrames)
+	{
+		if (bEndWhenIdle && !dwActiveVoices.load(std::memory_order_relaxed)) { break; }
+
+		DWORD dwBlock = min(dwFrames - dwWritten, (DWORD)VOICE_BLOCK_FRAMES);
+		FLOAT* lpBus = lpOutput + (size_t)dwWritten * dwChannels;
+		memset(lpBus, 0, (size_t)dwBlock * dwChannels * sizeof(FLOAT));
+		DWORD dwLongest = 0;
+
+		for (DWORD i = 0; i < VOICE_POOL_SIZE; i++)
+		{
+			VOICE* lpVoice = &voicePool[i];
+			DWORD dwState = lpVoice->dwState.load(std::memory_order_acquire);
+			if (dwState == VOICE_FREE) { continue; }
+
+			// new voice starts at its gains, stopped before start is dropped
+			if (dwState == VOICE_READY)
+			{
+				if (lpVoice->bStopRequested.load(std::memory_order_relaxed))
+				{
+					dwActiveVoices.fetch_sub(1, std::memory_order_relaxed);
+					lpVoice->dwState.store(VOICE_FREE, std::memory_order_release);
+					continue;
+				}
+
+				GetTargetGains(lpVoice, lpVoice->fCurrent);
+				lpVoice->dwState.store(VOICE_PLAYING, std::memory_order_relaxed);
+			}
+
+			dwLongest = max(dwLongest, MixVoice(lpVoice, lpBus, dwBlock));
+		}
+
+		lpSoftClip(lpBus, dwBlock * dwChannels);
+		if (bEndWhenIdle && !dwActiveVoices.load(std::memory_order_relaxed))
+		{
+			dwWritten += dwLongest;
+			break;
+		}
+		dwWritten += dwBlock;
+	}
+	return dwWritten;
+}
+
+/*************************************************
+* SeekFrame():
+* Bus has no position of its own
+*************************************************/
+BOOL
+Player::VoiceMixer::SeekFrame(
+	_In_ UINT64
+)
+{
+	return FALSE;
+}
+
+/*************************************************
+* RunVoiceBenchmark():
+* Full pool of memory voices at 48 kHz stereo.
+* Voices of sample bank end at different times
+* and are started again after every period,
+* so pool is full and voices start and stop
+* all the time
+*************************************************/
+VOID
+RunVoiceBenchmark(
+	_Out_writes_(dwSize) LPSTR lpText,
+	_In_ DWORD dwSize
+)
+{
+	const DWORD dwRate = 48000;
+	const DWORD dwBusChannels = 2;
+	const DWORD dwSeconds = 10;
+	const DWORD dwPeriodFrames = dwRate / 100;
+	const DWORD dwBankSize = 16;
+
+	int iWritten = snprintf(lpText, dwSize, "Voice mixer, %u voices at %u Hz stereo, x realtime and core load (%s)\n",
+		VOICE_POOL_SIZE, dwRate, GetConvertIsaName(GetConvertIsa()));
+	DWORD dwOffset = iWritten > 0 ? min((DWORD)iWritten, dwSize) : 0;
+
+	WAVEFORMATEX busFormat = {};
+	busFormat.nChannels = (WORD)dwBusChannels;
+	busFormat.nSamplesPerSec = dwRate;
+	SetSampleFormat(&busFormat, SAMPLE_FORMAT_F32);
+	FLOAT* lpPeriod = new FLOAT[dwPeriodFrames * dwBusChannels];
+
+	for (DWORD dwVoiceChannels = 1; dwVoiceChannels <= dwBusChannels; dwVoiceChannels++)
+	{
+		// bank of sines from 0.25 to 1 second
+		FLOAT* lpBank[dwBankSize];
+		DWORD dwBankFrames[dwBankSize];
+		for (DWORD b = 0; b < dwBankSize; b++)
+		{
+			dwBankFrames[b] = dwRate / 4 + b * dwRate / 20;
+			lpBank[b] = new FLOAT[(size_t)dwBankFrames[b] * dwVoiceChannels];
+			for (DWORD i = 0; i < dwBankFrames[b] * dwVoiceChannels; i++)
+			{
+				lpBank[b][i] = 0.01f * sinf(6.2831853f * (220.0f + 55.0f * b) * (FLOAT)(i / dwVoiceChannels) / (FLOAT)dwRate);
+			}
+		}
+
+		Player::VoiceMixer* lpMixer = new Player::VoiceMixer();
+		lpMixer->SetFormat(&busFormat, FALSE);
+
+		UINT64 uStarts = 0;
+		UINT64 uVoiceBlocks = 0;
+		double dTime = 0.0;
+		for (DWORD dwPeriod = 0; dwPeriod < dwSeconds * 100; dwPeriod++)
+		{
+			auto startTime = std::chrono::steady_clock::now();
+			for (DWORD n = lpMixer->GetActiveVoices(); n < VOICE_POOL_SIZE; n++, uStarts++)
+			{
+				DWORD b = (DWORD)(uStarts % dwBankSize);
+				lpMixer->PlayMemory(lpBank[b], dwBankFrames[b], dwVoiceChannels, FALSE, 1.0f, (FLOAT)(uStarts % 9) / 4.0f - 1.0f);
+			}
+
+			uVoiceBlocks += lpMixer->GetActiveVoices();
+			lpMixer->ReadFrames((BYTE*)lpPeriod, dwPeriodFrames);
+			dTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		}
+
+		double dRealtime = (double)dwSeconds / max(dTime, 1e-9);
+		iWritten = snprintf(lpText + dwOffset, dwSize - dwOffset, "%s voices: %.1fx, %.2f%% of core, %.1f voices avg, %llu starts\n",
+			dwVoiceChannels == 1 ? "mono" : "stereo", dRealtime, 100.0 / dRealtime,
+			(double)uVoiceBlocks / (dwSeconds * 100), (unsigned long long)uStarts);
+		if (iWritten > 0) { dwOffset = min(dwOffset + (DWORD)iWritten, dwSize - 1); }
+
+		delete lpMixer;
+		for (DWORD b = 0; b < dwBankSize; b++) { delete[] lpBank[b]; }
+	}
+
+	delete[] lpPeriod;
+}
@@ -12,18 +12,22 @@
 #include "WinXAudio.h"
 
 Player::ThreadSystem sysThread;
+XAUDIO_STREAM_CONFIG xStreamConfig = { STREAMING_BUFFER_SIZE, MAX_BUFFER_COUNT };
+XAUDIO_CONTROL xControl = { CreateEventA(NULL, FALSE, FALSE, NULL), XAUDIO_COMMAND_NONE };
+XAudioPlayer xAudioPlayer;
 
 /*************************************************
 * CreateXAudioDevice():
-* Checks buffer on validate
+* Take voice from device manager and
+* submit first buffers
 *************************************************/
 XAUDIO_DATA
 XAudioPlayer::CreateXAudioDevice(
-	_In_ FILE_DATA dData,
-	_In_ PCM_DATA dPCM
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ Player::AudioSource* lpSource,
+	_In_ XAUDIO_STREAM_CONFIG streamConfig
 )
 {
-	HRESULT hr = NULL;
 	XAUDIO_DATA audioStruct = {};
 	WAVEFORMATEX waveFormat = {};
 	XAUDIO_DATA xaudioData = {};
@@ -31,87 +35,122 @@ XAudioPlayer::CreateXAudioDevice(
 	ZeroMemory(&audioStruct, sizeof(XAUDIO_DATA));
 	ZeroMemory(&waveFormat, sizeof(WAVEFORMATEX));
 
-	if (dData.dwSize)
+	if (lpSource && lpFormat->nBlockAlign)
 	{
 		// set data to struct
 		waveFormat.cbSize = sizeof(WAVEFORMATEX);
-		waveFormat.nAvgBytesPerSec = dPCM.waveFormat.nAvgBytesPerSec;
-		waveFormat.nBlockAlign = dPCM.waveFormat.nBlockAlign;
-		waveFormat.nChannels = dPCM.waveFormat.nChannels;
-		waveFormat.nSamplesPerSec = dPCM.waveFormat.nSamplesPerSec;
-		waveFormat.wBitsPerSample = dPCM.waveFormat.wBitsPerSample;
-		waveFormat.wFormatTag = dPCM.waveFormat.wFormatTag;
-
-		// use default XAudio processor
-		hr = XAudio2Create(&audioStruct.lpXAudio);
-		R_ASSERT2(hr, "Can't create XAudio device. Please, use DirectSound method.");
-
-		// create default mastering voice
-		hr = audioStruct.lpXAudio->CreateMasteringVoice(&audioStruct.lpXAudioMasterVoice);
-		R_ASSERT2(hr, "Can't create XAudio Mastering voice.");
-
-		// create XAudio descriptor (pOutput is MasteringVoice)
-		XAUDIO2_SEND_DESCRIPTOR descAudio = {};
-		descAudio.Flags = NULL;
-		descAudio.pOutputVoice = audioStruct.lpXAudioMasterVoice;
-
-		audioStruct.voiceSends.SendCount = 1;
-		audioStruct.voiceSends.pSends = &descAudio;
-
-		// create default source voice
-		hr = audioStruct.lpXAudio->CreateSourceVoice(
-			&audioStruct.lpXAudioSourceVoice,
-			&waveFormat,
-			NULL,
-			2.0f,
-			NULL,
-			&audioStruct.voiceSends,
-			NULL
-		);
-		R_ASSERT2(hr, "Can't create XAudio Source voice.");
+		waveFormat.nAvgBytesPerSec = lpFormat->nAvgBytesPerSec;
+		waveFormat.nBlockAlign = lpFormat->nBlockAlign;
+		waveFormat.nChannels = lpFormat->nChannels;
+		waveFormat.nSamplesPerSec = lpFormat->nSamplesPerSec;
+		waveFormat.wBitsPerSample = lpFormat->wBitsPerSample;
+		waveFormat.wFormatTag = lpFormat->wFormatTag;
 
-		// create XAudio buffer
-		XAUDIO2_BUFFER audioXBuffer = {};
-		ZeroMemory(&audioXBuffer, sizeof(XAUDIO2_BUFFER));
-		audioXBuffer.AudioBytes = dData.dwSize;
-		audioXBuffer.pAudioData = dData.lpFile;
-		audioXBuffer.Flags = XAUDIO2_END_OF_STREAM; 
-
-		// if loop length bigger then 0 - set our pcm looplength
-		if (dPCM.pLoopLength > NULL)
+		// engine is opened at startup, voice is kept from last stream
+		audioStruct.lpXAudioSourceVoice = deviceManager.AcquireSourceVoice(&waveFormat, this);
+		if (!audioStruct.lpXAudioSourceVoice)
 		{
-			audioXBuffer.LoopLength = dPCM.pLoopLength;
-			audioXBuffer.LoopBegin = dPCM.pLoopStart;
-			audioXBuffer.LoopCount = 1;
+			return audioStruct;
 		}
+		audioStruct.lpXAudio = deviceManager.lpXAudio;
+		audioStruct.lpXAudioMasterVoice = deviceManager.lpMasterVoice;
+
+		// reused voice keeps counting samples
+		XAUDIO2_VOICE_STATE state;
+		audioStruct.lpXAudioSourceVoice->GetState(&state, NULL);
+		audioStruct.uSamplesBase = state.SamplesPlayed;
+
+		// events and counters can be left by last stream
+		ResetEvent(hBufferEndEvent);
+		ResetEvent(hStreamEndEvent);
+		dwUnderruns = 0;
+		dwBuffersSubmitted = 0;
 
-		// submit our buffer
-		hr = audioStruct.lpXAudioSourceVoice->SubmitSourceBuffer(&audioXBuffer);
-		R_ASSERT3(hr, "Can't submit buffer (buffer overflow");
-		if (!SUCCEEDED(hr))
+		// loop region is unrolled by source, so all data is streamed
+		audioStruct.lpSource = lpSource;
+		audioStruct.dwBlockAlign = waveFormat.nBlockAlign;
+
+		// buffer size must be aligned to sample frame
+		DWORD dwBufferSize = max(streamConfig.dwBufferSize, (DWORD)waveFormat.nBlockAlign);
+		audioStruct.dwBufferSize = dwBufferSize - (dwBufferSize % waveFormat.nBlockAlign);
+		audioStruct.dwBufferCount = min(max(streamConfig.dwBufferCount, 2UL), (DWORD)XAUDIO2_MAX_QUEUED_BUFFERS);
+		audioStruct.uBufferNs = (UINT64)audioStruct.dwBufferSize * 1000000000 / max(waveFormat.nAvgBytesPerSec, 1UL);
+
+		// allocate ring once, it doesn't depend on file size
+		audioStruct.lpStreamBuffers = (BYTE*)HeapAlloc(
+			GetProcessHeap(),
+			NULL,
+			audioStruct.dwBufferSize * audioStruct.dwBufferCount
+		);
+		DO_EXIT(audioStruct.lpStreamBuffers, "Can't allocate XAudio streaming buffers.");
+
+		// submit all ring before start
+		for (DWORD i = 0; i < audioStruct.dwBufferCount; i++)
 		{
-			_RELEASE(audioStruct.lpXAudio);
+			if (!SubmitStreamBuffer(&audioStruct)) { break; }
 		}
 	}
 	return audioStruct;
 }
 
+/*************************************************
+* SubmitStreamBuffer():
+* Copy next part of PCM data to ring 
+* and submit it to source voice
+*************************************************/
+BOOL
+XAudioPlayer::SubmitStreamBuffer(
+	_Inout_ XAUDIO_DATA_P lpAudioStruct
+)
+{
+	if (lpAudioStruct->bEndOfData || !lpAudioStruct->lpStreamBuffers)
+	{
+		return FALSE;
+	}
+
+	BYTE* lpBuffer = lpAudioStruct->lpStreamBuffers + lpAudioStruct->dwCurrentBuffer * lpAudioStruct->dwBufferSize;
+	DWORD dwFrames = lpAudioStruct->dwBufferSize / lpAudioStruct->dwBlockAlign;
+	DWORD dwRead = lpAudioStruct->lpSource->ReadFrames(lpBuffer, dwFrames);
+	lpAudioStruct->bEndOfData = (dwRead < dwFrames);
+
+	// source ended on buffer boundary - mark last queued buffer as end
+	if (!dwRead)
+	{
+		lpAudioStruct->lpXAudioSourceVoice->Discontinuity();
+		return FALSE;
+	}
+
+	XAUDIO2_BUFFER audioXBuffer = {};
+	ZeroMemory(&audioXBuffer, sizeof(XAUDIO2_BUFFER));
+	audioXBuffer.AudioBytes = dwRead * lpAudioStruct->dwBlockAlign;
+	audioXBuffer.pAudioData = lpBuffer;
+	audioXBuffer.Flags = lpAudioStruct->bEndOfData ? XAUDIO2_END_OF_STREAM : NULL;
+
+	HRESULT hr = lpAudioStruct->lpXAudioSourceVoice->SubmitSourceBuffer(&audioXBuffer);
+	R_ASSERT3(hr, "Can't submit streaming buffer");
+
+	lpAudioStruct->dwCurrentBuffer = (lpAudioStruct->dwCurrentBuffer + 1) % lpAudioStruct->dwBufferCount;
+	dwBuffersSubmitted++;
+	return SUCCEEDED(hr);
+}
+
 /*************************************************
 * CreateAudioState():
-* Create audio state with count of 
-* played samples
+* Play voice till end of stream or
+* stop command. Returns TRUE if stream is ended
 *************************************************/
-VOID
+BOOL
 XAudioPlayer::CreateXAudioState(
-	_In_ XAUDIO_DATA audioStruct
+	_Inout_ XAUDIO_DATA_P lpAudioStruct
 )
 {
 	HRESULT hr = NULL;
+	BOOL isEnded = FALSE;
 
-	if (audioStruct.lpXAudio)
+	if (lpAudioStruct->lpXAudio)
 	{
 		// get start playing
-		hr = audioStruct.lpXAudioSourceVoice->Start(NULL);
+		hr = lpAudioStruct->lpXAudioSourceVoice->Start(NULL);
 		R_ASSERT3(hr, "Can't start playing");
 
 		/*************************************************
@@ -122,48 +161,264 @@ XAudioPlayer::CreateXAudioState(
 		*************************************************/
 		XAUDIO2_VOICE_STATE state;
 
-		BOOL isRunning = TRUE;
-		while (SUCCEEDED(hr) && isRunning)
+		// command event must be first to have priority
+		HANDLE hEvents[3] = { xControl.hCommandEvent, hStreamEndEvent, hBufferEndEvent };
+
+		BOOL isRunning = SUCCEEDED(hr);
+		while (isRunning)
 		{
-			audioStruct.lpXAudioSourceVoice->GetState(&state);
-			if (!state.BuffersQueued)
+			// sleep till voice or UI has work for us
+			DWORD dwWait = WaitForMultipleObjects(3, hEvents, FALSE, INFINITE);
+
+			switch (dwWait)
+			{
+			case WAIT_OBJECT_0:
+				switch (InterlockedExchange(&xControl.lCommand, XAUDIO_COMMAND_NONE))
+				{
+				case XAUDIO_COMMAND_STOP:
+					isRunning = FALSE;
+					break;
+				default:
+					break;
+				}
+				break;
+			case WAIT_OBJECT_0 + 1:
+				isEnded = TRUE;
+				isRunning = FALSE;
 				break;
+			case WAIT_OBJECT_0 + 2:
+			{
+				UINT64 uStartNs = deadlineMonitor.BeginCallback();
+				lpAudioStruct->lpXAudioSourceVoice->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
 
-			isRunning = (state.BuffersQueued > 0) != 0;
+				// voice starves when all queued buffers are played
+				UINT64 uDeadlineNs = state.BuffersQueued * lpAudioStruct->uBufferNs;
+				deadlineMonitor.telemetry.AddQueued(state.BuffersQueued);
 
-			// wait till the escape key is pressed
-			if (GetAsyncKeyState(VK_ESCAPE))
-				break;
+				// refill every free buffer of ring 
+				while (state.BuffersQueued < lpAudioStruct->dwBufferCount && !lpAudioStruct->bEndOfData)
+				{
+					// voice has played everything before we had time to refill
+					if (!state.BuffersQueued)
+					{
+						dwUnderruns++;
+						deadlineMonitor.telemetry.AddUnderrun();
+					}
+					if (!SubmitStreamBuffer(lpAudioStruct)) { break; }
+					state.BuffersQueued++;
+				}
+
+				deadlineMonitor.EndCallback(uStartNs, uDeadlineNs);
 
-			Sleep(10);
+				// nothing to play and no end of stream to wait
+				isEnded = !state.BuffersQueued;
+				isRunning = !isEnded;
+				break;
+			}
+			default:
+				isRunning = FALSE;
+				break;
+			}
 		}
 
-		// wait till the escape key is released
-		while (GetAsyncKeyState(VK_ESCAPE))
-			Sleep(10);
+		// voice is paused, queued buffers are kept till next start
+		lpAudioStruct->lpXAudioSourceVoice->Stop(NULL);
+
+#ifdef DEBUG
+		CHAR szStats[128] = {};
+		StringCchPrintfA(szStats, 128, "XAudio stream: %u buffers submitted, %u underruns, %llu deadline misses", dwBuffersSubmitted, dwUnderruns, deadlineMonitor.uMisses.load());
+		DEBUG_MESSAGE(szStats);
+#endif
 	}
 
-	audioStruct.lpXAudioSourceVoice->Stop(NULL);
-	audioStruct.lpXAudioSourceVoice->DestroyVoice();
-	audioStruct.lpXAudioMasterVoice->DestroyVoice();
-	_RELEASE(audioStruct.lpXAudio);
+	return isEnded;
 }
 
 /*************************************************
-* CreateXAudioThread:
-* Method for create XAudio2 thread
+* ReleaseXAudioDevice():
+* Flush voice and free streaming ring.
+* Voices are kept by device manager
 *************************************************/
 VOID
-WINAPIV
+XAudioPlayer::ReleaseXAudioDevice(
+	_Inout_ XAUDIO_DATA_P lpAudioStruct
+)
+{
+	if (lpAudioStruct->lpXAudioSourceVoice)
+	{
+		XAUDIO2_VOICE_STATE state;
+		lpAudioStruct->lpXAudioSourceVoice->Stop(NULL);
+		lpAudioStruct->lpXAudioSourceVoice->FlushSourceBuffers();
+
+		// voice can't read ring after it's freed
+		lpAudioStruct->lpXAudioSourceVoice->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
+		while (state.BuffersQueued)
+		{
+			WaitForSingleObject(hBufferEndEvent, INFINITE);
+			lpAudioStruct->lpXAudioSourceVoice->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
+		}
+	}
+
+	if (lpAudioStruct->lpStreamBuffers)
+	{
+		HeapFree(GetProcessHeap(), NULL, lpAudioStruct->lpStreamBuffers);
+	}
+	ZeroMemory(lpAudioStruct, sizeof(XAUDIO_DATA));
+}
+
+/*************************************************
+* CreateXAudioThread:
+* Thread with XAudio2 state loop of sink
+*************************************************/
+DWORD
+WINAPI
 CreateXAudioThread(
-	_In_ LPVOID lpFile
+	_In_ LPVOID lpSink
+)
+{
+	Player::XAudioSink* lpXAudioSink = (Player::XAudioSink*)lpSink;
+	sysThread.ThSetNewThreadName("WINPLR XAUDIO2 THREAD");
+	SetRealtimeThreadPriority();
+
+	lpXAudioSink->bFinished = lpXAudioSink->xPlayer.CreateXAudioState(&lpXAudioSink->xData);
+	return 0;
+}
+
+/*************************************************
+* PostXAudioCommand:
+* Send command from UI to XAudio2 thread
+*************************************************/
+VOID
+PostXAudioCommand(
+	_In_ XAUDIO_COMMAND eCommand
 )
 {
-	XAudioPlayer xPlayer = {};
-	XAUDIO_DATA xData = {};
-	AUDIO_FILE* audioFile = (AUDIO_FILE*)lpFile;
+	InterlockedExchange(&xControl.lCommand, eCommand);
+	SetEvent(xControl.hCommandEvent);
+}
+
+/*************************************************
+* XAudioSink():
+* Constructor
+*************************************************/
+Player::XAudioSink::XAudioSink() : xPlayer(xAudioPlayer), hThread(NULL), dwLatency(0), bFinished(FALSE)
+{
 	ZeroMemory(&xData, sizeof(XAUDIO_DATA));
+}
+
+/*************************************************
+* ~XAudioSink():
+* Destructor
+*************************************************/
+Player::XAudioSink::~XAudioSink()
+{
+	Close();
+}
+
+/*************************************************
+* Open():
+* Acquire voice and submit first buffers
+*************************************************/
+BOOL
+Player::XAudioSink::Open(
+	_In_ const WAVEFORMATEX* lpFormat,
+	_In_ AudioSource* lpSource
+)
+{
+	xData = xPlayer.CreateXAudioDevice(lpFormat, lpSource, xStreamConfig);
+	if (!xData.lpXAudio)
+	{
+		return FALSE;
+	}
+
+	dwLatency = (DWORD)(((UINT64)xData.dwBufferSize * xData.dwBufferCount * 1000) / max(lpFormat->nAvgBytesPerSec, 1UL));
+	bFinished = FALSE;
+	xPlayer.deadlineMonitor.Reset();
+	return TRUE;
+}
+
+/*************************************************
+* Start():
+* Begin XAudio2 thread
+*************************************************/
+BOOL
+Player::XAudioSink::Start()
+{
+	if (!xData.lpXAudio || hThread)
+	{
+		return FALSE;
+	}
+
+	// command left by last stream must not stop new one
+	InterlockedExchange(&xControl.lCommand, XAUDIO_COMMAND_NONE);
+	ResetEvent(xControl.hCommandEvent);
 
-	xData = xPlayer.CreateXAudioDevice(audioFile->dData, audioFile->dPCM);
-	xPlayer.CreateXAudioState(xData);
+	hThread = CreateThread(NULL, NULL, CreateXAudioThread, (LPVOID)this, NULL, NULL);
+	return hThread != NULL;
+}
+
+/*************************************************
+* Stop():
+* Pause voice and wait for thread
+*************************************************/
+VOID
+Player::XAudioSink::Stop()
+{
+	if (hThread)
+	{
+		// thread which played to end takes no more commands
+		if (WaitForSingleObject(hThread, 0) == WAIT_TIMEOUT)
+		{
+			PostXAudioCommand(XAUDIO_COMMAND_STOP);
+		}
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+		hThread = NULL;
+	}
+}
+
+/*************************************************
+* Close():
+* Stop and release streaming ring
+*************************************************/
+VOID
+Player::XAudioSink::Close()
+{
+	Stop();
+	xPlayer.ReleaseXAudioDevice(&xData);
+}
+
+/*************************************************
+* GetPosition():
+* Samples played by source voice in this stream
+*************************************************/
+UINT64
+Player::XAudioSink::GetPosition()
+{
+	if (!xData.lpXAudioSourceVoice) { return 0; }
+
+	// end of stream resets counter of reused voice
+	XAUDIO2_VOICE_STATE state;
+	xData.lpXAudioSourceVoice->GetState(&state, NULL);
+	return state.SamplesPlayed >= xData.uSamplesBase ? state.SamplesPlayed - xData.uSamplesBase : state.SamplesPlayed;
+}
+
+DWORD Player::XAudioSink::GetLatency() { return dwLatency; }
+DWORD Player::XAudioSink::GetUnderruns() { return xPlayer.dwUnderruns; }
+BOOL Player::XAudioSink::IsFinished() { return bFinished; }
+
+/*************************************************
+* IsFormatSupported():
+* Source voice takes 8-bit and 16-bit PCM
+* and 32-bit float without extensible format
+*************************************************/
+BOOL
+Player::XAudioSink::IsFormatSupported(
+	_In_ const WAVEFORMATEX* lpFormat
+)
+{
+	if (lpFormat->nSamplesPerSec < XAUDIO2_MIN_SAMPLE_RATE || lpFormat->nSamplesPerSec > XAUDIO2_MAX_SAMPLE_RATE) { return FALSE; }
+	if (lpFormat->wFormatTag == WAVE_FORMAT_IEEE_FLOAT) { return lpFormat->wBitsPerSample == 32; }
+	return lpFormat->wFormatTag == WAVE_FORMAT_PCM && (lpFormat->wBitsPerSample == 8 || lpFormat->wBitsPerSample == 16);
 }
+Player::DeadlineMonitor* Player::XAudioSink::GetDeadlineMonitor() { return &xPlayer.deadlineMonitor; }
@@ -16,6 +16,24 @@
 #define STREAMING_BUFFER_SIZE 65536
 #define MAX_BUFFER_COUNT 3
 
+typedef struct
+{
+	DWORD dwBufferSize;			// size of one streaming buffer
+	DWORD dwBufferCount;		// count of buffers in ring
+} XAUDIO_STREAM_CONFIG, *XAUDIO_STREAM_CONFIG_P;
+
+typedef enum
+{
+	XAUDIO_COMMAND_NONE = 0,
+	XAUDIO_COMMAND_STOP = 1
+} XAUDIO_COMMAND;
+
+typedef struct
+{
+	HANDLE hCommandEvent;		// signaled by UI when command is posted
+	volatile LONG lCommand;		// XAUDIO_COMMAND to process
+} XAUDIO_CONTROL, *XAUDIO_CONTROL_P;
+
 typedef struct  
 {
 	IXAudio2* lpXAudio;
@@ -23,14 +41,31 @@ typedef struct
 	IXAudio2MasteringVoice* lpXAudioMasterVoice;
 	XAUDIO2_VOICE_STATE voiceState;
 	XAUDIO2_VOICE_SENDS voiceSends;
+	Player::AudioSource* lpSource;	// source of PCM frames
+	BOOL bEndOfData;			// source is drained
+	BYTE* lpStreamBuffers;		// ring of streaming buffers
+	DWORD dwBufferSize;			// size of one streaming buffer
+	DWORD dwBufferCount;		// count of buffers in ring
+	DWORD dwCurrentBuffer;		// next ring buffer to fill
+	DWORD dwBlockAlign;			// size of one sample frame
+	UINT64 uBufferNs;			// play time of one streaming buffer
+	UINT64 uSamplesBase;		// samples played by reused voice before stream
 } XAUDIO_DATA, *XAUDIO_DATA_P;
 
-VOID WINAPIV CreateXAudioThread(_In_ LPVOID lpFile);
+extern XAUDIO_STREAM_CONFIG xStreamConfig;
+extern XAUDIO_CONTROL xControl;
+
+DWORD WINAPI CreateXAudioThread(_In_ LPVOID lpSink);
+VOID PostXAudioCommand(_In_ XAUDIO_COMMAND eCommand);
 
 class XAudioPlayer : public IXAudio2VoiceCallback
 {
 public:
 	HANDLE hBufferEndEvent;
+	HANDLE hStreamEndEvent;
+	DWORD dwUnderruns;				// count of voice starvations
+	DWORD dwBuffersSubmitted;		// count of submitted buffers
+	Player::DeadlineMonitor deadlineMonitor;	// refills against starvation time
 
 	STDMETHOD_(void, OnVoiceProcessingPassStart)(UINT32) override
 	{
@@ -40,6 +75,7 @@ public:
 	}
 	STDMETHOD_(void, OnStreamEnd)() override
 	{
+		SetEvent(hStreamEndEvent);
 	}
 	STDMETHOD_(void, OnBufferStart)(void*) override
 	{
@@ -51,13 +87,49 @@ public:
 	STDMETHOD_(void, OnLoopEnd)(void*) override
 	{
 	}
-	STDMETHOD_(void, OnVoiceError)(void*, HRESULT) override
+	STDMETHOD_(void, OnVoiceError)(void*, HRESULT hr) override
 	{
+		PostAudioError((DWORD)hr, "XAudio voice error");
 	}
 
-	XAudioPlayer() : hBufferEndEvent(CreateEvent(NULL, FALSE, FALSE, NULL)) {}
-	~XAudioPlayer() { CloseHandle(hBufferEndEvent); }
+	XAudioPlayer() : 
+		hBufferEndEvent(CreateEvent(NULL, FALSE, FALSE, NULL)), 
+		hStreamEndEvent(CreateEvent(NULL, FALSE, FALSE, NULL)), 
+		dwUnderruns(0), 
+		dwBuffersSubmitted(0) {}
+	~XAudioPlayer() { CloseHandle(hBufferEndEvent); CloseHandle(hStreamEndEvent); }
 
-	XAUDIO_DATA CreateXAudioDevice(_In_ FILE_DATA dData, _In_ PCM_DATA dPCM);
-	VOID CreateXAudioState(_In_ XAUDIO_DATA audioStruct);
+	XAUDIO_DATA CreateXAudioDevice(_In_ const WAVEFORMATEX* lpFormat, _In_ Player::AudioSource* lpSource, _In_ XAUDIO_STREAM_CONFIG streamConfig);
+	BOOL SubmitStreamBuffer(_Inout_ XAUDIO_DATA_P lpAudioStruct);
+	BOOL CreateXAudioState(_Inout_ XAUDIO_DATA_P lpAudioStruct);
+	VOID ReleaseXAudioDevice(_Inout_ XAUDIO_DATA_P lpAudioStruct);
 };
+
+// voice callback lives as long as cached source voice
+extern XAudioPlayer xAudioPlayer;
+
+namespace Player
+{
+	class XAudioSink : public AudioSink
+	{
+	public:
+		XAudioSink();
+		~XAudioSink();
+		BOOL Open(_In_ const WAVEFORMATEX* lpFormat, _In_ AudioSource* lpSource) override;
+		BOOL Start() override;
+		VOID Stop() override;
+		VOID Close() override;
+		UINT64 GetPosition() override;
+		DWORD GetLatency() override;
+		DWORD GetUnderruns() override;
+		BOOL IsFinished() override;
+		DeadlineMonitor* GetDeadlineMonitor() override;
+		BOOL IsFormatSupported(_In_ const WAVEFORMATEX* lpFormat) override;
+
+		XAudioPlayer& xPlayer;		// shared callback of cached voice
+		XAUDIO_DATA xData;
+		HANDLE hThread;				// thread with XAudio state loop
+		DWORD dwLatency;			// latency of queued ring in milliseconds
+		volatile BOOL bFinished;	// end of stream is played
+	};
+}
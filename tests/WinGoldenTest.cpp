@@ -0,0 +1,140 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio golden output test
+**********************************************************
+* WinGoldenTest.cpp
+* Fixed input through EQ, gain, limiter and
+* dithered 16-bit output gives the same bytes
+* on every ISA
+*********************************************************/
+#include "WinEngine.h"
+#include <vector>
+
+static const DWORD dwTestRate = 48000;
+static const DWORD dwTestChannels = 2;
+static const DWORD dwTestFrames = 48000;
+static const DWORD dwTestPeriod = 441;		// odd period crosses every block size
+
+// FNV-1a of output for tpdf and shaped dither, recorded with x86-64 build
+static const DITHER_MODE eTestDithers[] = { DITHER_TPDF, DITHER_SHAPED };
+static const uint32_t uGoldenHashes[] = { 0xd8cc0023, 0x7461588b };
+
+/*************************************************
+* HashBytes():
+* FNV-1a, continued from previous hash
+*************************************************/
+static uint32_t
+HashBytes(
+	_In_ uint32_t uHash,
+	_In_reads_bytes_(dwSize) const BYTE* lpData,
+	_In_ DWORD dwSize
+)
+{
+	for (DWORD i = 0; i < dwSize; i++)
+	{
+		uHash = (uHash ^ lpData[i]) * 16777619u;
+	}
+	return uHash;
+}
+
+/*************************************************
+* RenderChain():
+* Kernels are taken when sources are set, so
+* chain is built again for every ISA
+*************************************************/
+static BOOL
+RenderChain(
+	_In_reads_(dwTestFrames * dwTestChannels) const FLOAT* lpInput,
+	_In_ DITHER_MODE eDither,
+	_Out_ uint32_t* lpHash
+)
+{
+	WAVEFORMATEX sinkFormat = {};
+	sinkFormat.wFormatTag = WAVE_FORMAT_PCM;
+	sinkFormat.nChannels = (WORD)dwTestChannels;
+	sinkFormat.nSamplesPerSec = dwTestRate;
+	SetSampleFormat(&sinkFormat, SAMPLE_FORMAT_S16);
+
+	WAVEFORMATEX busFormat = {};
+	if (!Player::GetBusFormat(&sinkFormat, eDither, TRUE, &busFormat)) { return FALSE; }
+
+	// boosts push noise into limiter, so every stage changes output
+	Player::MemorySource memorySource(lpInput, dwTestFrames, dwTestChannels);
+	Player::EqualizerSource eqSource;
+	const EQ_BAND eqBands[] =
+	{
+		{ EQ_BAND_LOW_SHELF, 120.0f, 4.0f, 0.7f },
+		{ EQ_BAND_PEAKING, 1000.0f, -3.0f, 1.4f },
+		{ EQ_BAND_HIGH_SHELF, 9000.0f, 6.0f, 0.7f },
+		{ EQ_BAND_HIGH_PASS, 30.0f, 0.0f, 0.7f }
+	};
+	for (DWORD i = 0; i < sizeof(eqBands) / sizeof(eqBands[0]); i++)
+	{
+		eqSource.SetBand(i, eqBands[i]);
+	}
+
+	Player::GainSource gainSource;
+	gainSource.SetGain(DecibelsToGain(6.0f));
+	Player::LimiterSource limiterSource;
+	limiterSource.SetParams(TRUE, LIMITER_LOOKAHEAD_MS, LIMITER_CEILING_DB);
+	Player::ConvertSource outputConvert;
+	outputConvert.SetDither(eDither, DITHER_SEED);
+
+	if (!eqSource.SetSource(&memorySource, &busFormat) || !gainSource.SetSource(&eqSource, &busFormat) ||
+		!limiterSource.SetSource(&gainSource, &busFormat) || !outputConvert.SetSource(&limiterSource, &busFormat, &sinkFormat))
+	{
+		return FALSE;
+	}
+
+	std::vector<BYTE> period(dwTestPeriod * sinkFormat.nBlockAlign);
+	uint32_t uHash = 2166136261u;
+	DWORD dwTotal = 0;
+	for (DWORD dwRead = 1; dwRead; dwTotal += dwRead)
+	{
+		dwRead = outputConvert.ReadFrames(period.data(), dwTestPeriod);
+		uHash = HashBytes(uHash, period.data(), dwRead * sinkFormat.nBlockAlign);
+	}
+
+	*lpHash = uHash;
+	return dwTotal >= dwTestFrames;
+}
+
+int
+main()
+{
+	std::vector<FLOAT> input(dwTestFrames * dwTestChannels);
+	FillBenchmarkNoise(input.data(), input.size(), 0.5f);
+
+	BOOL isPassed = TRUE;
+	for (DWORD d = 0; d < sizeof(eTestDithers) / sizeof(eTestDithers[0]); d++)
+	{
+		DITHER_MODE eDither = eTestDithers[d];
+		for (DWORD dwIsa = 0; dwIsa < CONVERT_ISA_COUNT; dwIsa++)
+		{
+			// CPU without this ISA has nothing to compare
+			if (InitConvertKernels((CONVERT_ISA)dwIsa) != (CONVERT_ISA)dwIsa)
+			{
+				printf("%s %s: not supported by CPU\n", GetDitherModeName(eDither), GetConvertIsaName((CONVERT_ISA)dwIsa));
+				continue;
+			}
+
+			uint32_t uHash = 0;
+			if (!RenderChain(input.data(), eDither, &uHash))
+			{
+				printf("%s %s: chain isn't rendered\n", GetDitherModeName(eDither), GetConvertIsaName((CONVERT_ISA)dwIsa));
+				isPassed = FALSE;
+				continue;
+			}
+
+			BOOL isSame = uHash == uGoldenHashes[d];
+			printf("%s %s: %08x, %s\n", GetDitherModeName(eDither), GetConvertIsaName((CONVERT_ISA)dwIsa), uHash,
+				isSame ? "ok" : "differs from golden");
+			isPassed &= isSame;
+		}
+	}
+
+	return isPassed ? 0 : 1;
+}
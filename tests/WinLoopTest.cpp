@@ -0,0 +1,139 @@
+/*********************************************************
+* Copyright (C) VERTVER, 2018. All rights reserved.
+* WinPlr - open-source WINAPI audio player.
+* MIT-License
+**********************************************************
+* Module Name: WinAudio loop test
+**********************************************************
+* WinLoopTest.cpp
+* WAV with smpl loop before and after 'data'
+* is parsed and played with loop region
+*********************************************************/
+#include "WinEngine.h"
+#include <vector>
+
+static const DWORD dwTestFrames = 4000;
+static const DWORD dwTestLoopStart = 1000;
+static const DWORD dwTestLoopEnd = 1999;	// last frame of loop, as in smpl
+
+/*************************************************
+* AppendChunk():
+* Chunk with pad byte after odd size
+*************************************************/
+static VOID
+AppendChunk(
+	_Inout_ std::vector<BYTE>* lpFile,
+	_In_ uint32_t uTag,
+	_In_reads_bytes_(uSize) const void* lpData,
+	_In_ uint32_t uSize
+)
+{
+	RIFFChunk chunk = { uTag, uSize };
+	lpFile->insert(lpFile->end(), (const BYTE*)&chunk, (const BYTE*)&chunk + sizeof(RIFFChunk));
+	lpFile->insert(lpFile->end(), (const BYTE*)lpData, (const BYTE*)lpData + uSize);
+	if (uSize & 1) { lpFile->push_back(0); }
+}
+
+/*************************************************
+* MakeWaveFile():
+* Mono 16-bit ramp, sample is its frame number
+*************************************************/
+static std::vector<BYTE>
+MakeWaveFile(
+	_In_ BOOL isLoop,
+	_In_ BOOL isLoopBeforeData
+)
+{
+	PCMWAVEFORMAT waveFormat = {};
+	waveFormat.wf.wFormatTag = WAVE_FORMAT_PCM;
+	waveFormat.wf.nChannels = 1;
+	waveFormat.wf.nSamplesPerSec = 48000;
+	waveFormat.wf.nBlockAlign = 2;
+	waveFormat.wf.nAvgBytesPerSec = 96000;
+	waveFormat.wBitsPerSample = 16;
+
+	std::vector<SHORT> samples(dwTestFrames);
+	for (DWORD i = 0; i < dwTestFrames; i++) { samples[i] = (SHORT)i; }
+
+	BYTE sampleChunk[sizeof(RIFFMIDISample) + sizeof(MIDILoop)] = {};
+	RIFFMIDISample* lpSample = (RIFFMIDISample*)sampleChunk;
+	MIDILoop* lpLoop = (MIDILoop*)(sampleChunk + sizeof(RIFFMIDISample));
+	lpSample->loopCount = 1;
+	lpLoop->type = MIDILoop::LOOP_TYPE_FORWARD;
+	lpLoop->start = dwTestLoopStart;
+	lpLoop->end = dwTestLoopEnd;
+
+	RIFFChunkHeader riffHeader = { FOURCC_RIFF_TAG, 0, FOURCC_WAVE_FILE_TAG };
+	std::vector<BYTE> waveFile((const BYTE*)&riffHeader, (const BYTE*)&riffHeader + sizeof(RIFFChunkHeader));
+	AppendChunk(&waveFile, FOURCC_FORMAT_TAG, &waveFormat, sizeof(PCMWAVEFORMAT));
+
+	// odd chunk before loop checks pad byte
+	AppendChunk(&waveFile, MAKEFOURCC('L', 'I', 'S', 'T'), "INFOx", 5);
+	if (isLoop && isLoopBeforeData) { AppendChunk(&waveFile, FOURCC_MIDI_SAMPLE, sampleChunk, sizeof(sampleChunk)); }
+	AppendChunk(&waveFile, FOURCC_DATA_TAG, samples.data(), dwTestFrames * sizeof(SHORT));
+	if (isLoop && !isLoopBeforeData) { AppendChunk(&waveFile, FOURCC_MIDI_SAMPLE, sampleChunk, sizeof(sampleChunk)); }
+
+	((RIFFChunkHeader*)waveFile.data())->size = (uint32_t)(waveFile.size() - sizeof(RIFFChunk));
+	return waveFile;
+}
+
+/*************************************************
+* CheckLoop():
+* Play file in odd periods and compare every
+* frame with ramp which jumps back once
+*************************************************/
+static BOOL
+CheckLoop(
+	_In_ LPCSTR lpName,
+	_In_ BOOL isLoop,
+	_In_ BOOL isLoopBeforeData
+)
+{
+	std::vector<BYTE> waveFile = MakeWaveFile(isLoop, isLoopBeforeData);
+	PCM_DATA dPCM = {};
+	if (!ParseWaveData(waveFile.data(), (DWORD)waveFile.size(), &dPCM))
+	{
+		printf("%s: file isn't parsed\n", lpName);
+		return FALSE;
+	}
+
+	// file loop is played one more time
+	Player::PcmSource pcmSource;
+	pcmSource.SetData(dPCM);
+	std::vector<SHORT> output;
+	SHORT period[333] = {};
+	for (DWORD dwRead = 1; dwRead; )
+	{
+		dwRead = pcmSource.ReadFrames((BYTE*)period, 333);
+		output.insert(output.end(), period, period + dwRead);
+	}
+
+	DWORD dwLoopFrames = isLoop ? dwTestLoopEnd - dwTestLoopStart + 1 : 0;
+	if (output.size() != dwTestFrames + dwLoopFrames)
+	{
+		printf("%s: %u frames, expected %u\n", lpName, (DWORD)output.size(), dwTestFrames + dwLoopFrames);
+		return FALSE;
+	}
+
+	for (DWORD i = 0; i < output.size(); i++)
+	{
+		DWORD dwExpected = (isLoop && i > dwTestLoopEnd) ? i - dwLoopFrames : i;
+		if (output[i] != (SHORT)dwExpected)
+		{
+			printf("%s: frame %u is %d, expected %u\n", lpName, i, output[i], dwExpected);
+			return FALSE;
+		}
+	}
+
+	printf("%s: %u frames, ok\n", lpName, (DWORD)output.size());
+	return TRUE;
+}
+
+int
+main()
+{
+	BOOL isPassed = CheckLoop("smpl after data", TRUE, FALSE);
+	isPassed &= CheckLoop("smpl before data", TRUE, TRUE);
+	isPassed &= CheckLoop("no loop", FALSE, FALSE);
+	return isPassed ? 0 : 1;
+}